@@ -30,11 +30,23 @@
 /* -- INCLUSIONS ----------------------------------------------------------- */
 /* ========================================================================= */
 
+#define _GNU_SOURCE                     /* sched_setaffinity(), CPU_SET() */
+
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <inttypes.h>
 #include <assert.h>
 #include <unistd.h>
+#include <time.h>
+#include <math.h>
+#include <sched.h>
+#include <sys/resource.h>
+#if defined(__linux__)
+# include <sys/ioctl.h>
+# include <sys/syscall.h>
+# include <linux/perf_event.h>
+#endif /* __linux__ */
 
 #ifdef USE_LIBUV_RWLOCK
 # include <uv.h>
@@ -43,6 +55,7 @@
 #endif /* USE_LIBUV_RWLOCK */
 
 #include "prwlock.h"
+#include "prwlock_inline.h"
 
 /* ========================================================================= */
 /* -- DEFINITIONS ---------------------------------------------------------- */
@@ -57,86 +70,167 @@
 #endif /* NUM_PARTITIONS */
 
 #ifndef NUM_ITERATIONS
-# define NUM_ITERATIONS         1E6
+# define NUM_ITERATIONS         1000000
 #endif /* NUM_ITERATIONS */
 
-#ifndef NUM_MICROSECONDS
-# define NUM_MICROSECONDS       1
-#endif /* NUM_MICROSECONDS */
+#ifndef NUM_KEYS
+# define NUM_KEYS               1000000
+#endif /* NUM_KEYS */
+
+#ifndef NUM_READ_PERCENT
+# define NUM_READ_PERCENT       50
+#endif /* NUM_READ_PERCENT */
+
+/* Busy-work loop iterations inside a read critical section; writes do 2x */
+#ifndef NUM_WORK_UNITS
+# define NUM_WORK_UNITS         100
+#endif /* NUM_WORK_UNITS */
+
+#if defined(USE_LIBUV_RWLOCK)
+# define BENCHMARK_BACKEND      "libuv"
+#elif defined(USE_FUTEX)
+# define BENCHMARK_BACKEND      "futex"
+#elif defined(USE_ATOMICS)
+# define BENCHMARK_BACKEND      "atomics"
+#else
+# define BENCHMARK_BACKEND      "pthread"
+#endif
+
+/* Log-linear latency histogram: 16 sub-buckets per power of two */
+#define LATENCY_SUB_BUCKET_BITS 4
+#define LATENCY_SUB_BUCKETS     (1 << LATENCY_SUB_BUCKET_BITS)
+#define LATENCY_BUCKETS         (64 * LATENCY_SUB_BUCKETS)
+
+/* Failed optimistic reads before a reader falls back to the read lock */
+#define OPTIMISTIC_ATTEMPTS     4
+
+/* Bytes of the stand-in old version an epoch writer retires per write */
+#define EPOCH_RETIRED_BYTES     64
+
+/* CPUs per NUMA node the benchmark will pin threads to */
+#define MAX_NODE_CPUS           1024
+
+#define ROLE_READER             0
+#define ROLE_WRITER             1
+#define ROLE_COUNT              2
+
+/*
+ * Per-thread event counters. The first four need a PMU; context switches
+ * and CPU time are software events, or getrusage() and the thread's CPU
+ * clock where perf_event_open(2) is refused altogether.
+ */
+#define COUNTER_CYCLES          0
+#define COUNTER_INSTRUCTIONS    1
+#define COUNTER_LLC_MISSES      2
+#define COUNTER_HITM            3
+#define COUNTER_CONTEXT_SWITCHES 4
+#define COUNTER_CPU_NS          5
+#define COUNTER_COUNT           6
+#define COUNTER_ALL             ((1u << COUNTER_COUNT) - 1)
+
+/*
+ * Loads that hit a line modified in another core's cache: Intel's
+ * MEM_LOAD_L3_HIT_RETIRED.XSNP_HITM (XSNP_FWD on recent cores). Other
+ * CPUs have no one event for it; -H names a raw event instead.
+ */
+#define HITM_INTEL_RAW_EVENT    UINT64_C(0x04d2)
 
 /* ========================================================================= */
 /* -- MACROS --------------------------------------------------------------- */
 /* ========================================================================= */
 
-#define HASH_JEN_MIX(a,b,c)                                                   \
-  do {                                                                        \
-    a -= b; a -= c; a ^= ( c >> 13 );                                         \
-    b -= c; b -= a; b ^= ( a << 8 );                                          \
-    c -= a; c -= b; c ^= ( b >> 13 );                                         \
-    a -= b; a -= c; a ^= ( c >> 12 );                                         \
-    b -= c; b -= a; b ^= ( a << 16 );                                         \
-    c -= a; c -= b; c ^= ( b >> 5 );                                          \
-    a -= b; a -= c; a ^= ( c >> 3 );                                          \
-    b -= c; b -= a; b ^= ( a << 10 );                                         \
-    c -= a; c -= b; c ^= ( b >> 15 );                                         \
-  } while (0)
-
-#define HASH_JEN(key,keylen,hashv)                                            \
-  do {                                                                        \
-    unsigned _hj_i,_hj_j,_hj_k;                                               \
-    unsigned const char *_hj_key=(unsigned const char *)(key);                \
-    hashv = 0xfeedbeefu;                                                      \
-    _hj_i = _hj_j = 0x9e3779b9u;                                              \
-    _hj_k = (unsigned)(keylen);                                               \
-    while (_hj_k >= 12U) {                                                    \
-      _hj_i += (_hj_key[0]                                                    \
-          + ((unsigned)_hj_key[1] << 8)                                       \
-          + ((unsigned)_hj_key[2] << 16)                                      \
-          + ((unsigned)_hj_key[3] << 24));                                    \
-      _hj_j += (_hj_key[4]                                                    \
-          + ((unsigned)_hj_key[5] << 8)                                       \
-          + ((unsigned)_hj_key[6] << 16)                                      \
-          + ((unsigned)_hj_key[7] << 24));                                    \
-      hashv += (_hj_key[8]                                                    \
-          + ((unsigned)_hj_key[9] << 8)                                       \
-          + ((unsigned)_hj_key[10] << 16)                                     \
-          + ((unsigned)_hj_key[11] << 24));                                   \
-                                                                              \
-       HASH_JEN_MIX(_hj_i, _hj_j, hashv);                                     \
-                                                                              \
-       _hj_key += 12;                                                         \
-       _hj_k -= 12U;                                                          \
-    }                                                                         \
-    hashv += (unsigned)(keylen);                                              \
-    switch (_hj_k) {                                                          \
-      case 11: hashv += ((unsigned)_hj_key[10] << 24); /* FALLTHROUGH */      \
-      case 10: hashv += ((unsigned)_hj_key[9] << 16);  /* FALLTHROUGH */      \
-      case 9:  hashv += ((unsigned)_hj_key[8] << 8);   /* FALLTHROUGH */      \
-      case 8:  _hj_j += ((unsigned)_hj_key[7] << 24);  /* FALLTHROUGH */      \
-      case 7:  _hj_j += ((unsigned)_hj_key[6] << 16);  /* FALLTHROUGH */      \
-      case 6:  _hj_j += ((unsigned)_hj_key[5] << 8);   /* FALLTHROUGH */      \
-      case 5:  _hj_j += _hj_key[4];                    /* FALLTHROUGH */      \
-      case 4:  _hj_i += ((unsigned)_hj_key[3] << 24);  /* FALLTHROUGH */      \
-      case 3:  _hj_i += ((unsigned)_hj_key[2] << 16);  /* FALLTHROUGH */      \
-      case 2:  _hj_i += ((unsigned)_hj_key[1] << 8);   /* FALLTHROUGH */      \
-      case 1:  _hj_i += _hj_key[0];                                           \
-    }                                                                         \
-    HASH_JEN_MIX(_hj_i, _hj_j, hashv);                                        \
-  } while (0)
-
 /* ========================================================================= */
 /* -- PRIVATE TYPES -------------------------------------------------------- */
 /* ========================================================================= */
 
+typedef enum {
+  DISTRIBUTION_UNIFORM = 0,
+  DISTRIBUTION_ZIPF,
+  DISTRIBUTION_HOTSPOT
+} key_distribution_t;
+
+typedef enum {
+  OUTPUT_TEXT = 0,
+  OUTPUT_CSV,
+  OUTPUT_JSON
+} output_format_t;
+
+/*
+ * Key generator shared read-only by every thread. Zipfian keys follow Gray
+ * et al., "Quickly Generating Billion-Record Synthetic Databases", as used
+ * by YCSB; rank 0 is the hottest key.
+ */
+typedef struct {
+  key_distribution_t            distribution;
+  uint64_t                      key_count;
+  double                        zipf_theta;
+  double                        zipf_zetan;
+  double                        zipf_alpha;
+  double                        zipf_eta;
+  double                        zipf_half_pow_theta;
+  double                        hot_fraction;
+  double                        hot_probability;
+} key_generator_t;
+
+typedef struct {
+  size_t                        thread_count;
+  size_t                        partition_count;
+  uint64_t                      iteration_count;
+  unsigned int                  read_percent;
+  uint64_t                      work_units;
+  key_generator_t               keys;
+  partitioned_rwlock_attr_t     attr;
+  output_format_t               output;
+  int                           sweep;
+  int                           print_stats;
+  int                           local_keys;
+  int                           optimistic;
+  int                           inline_paths;
+  int                           epoch;
+  int                           shared;
+  int                           combining;
+  int                           counters;
+  uint64_t                      hitm_event;     /* 0: the CPU's own */
+} benchmark_config_t;
+
+typedef struct {
+  uint64_t                        count[LATENCY_BUCKETS];
+  uint64_t                        total;
+  uint64_t                        max;
+} latency_histogram_t;
+
+typedef struct {
+  uint64_t                        operation_count;
+  uint64_t                        wait_count;
+  latency_histogram_t             acquire_latency;
+} prwlock_sample_role_output_t;
+
 typedef struct {
   partitioned_rwlock_t           *rwlock;
-  size_t                          iteration_count;
-  uint64_t                        sleep_in_microseconds;
-  uint64_t                        mcg64_seed;
+  const benchmark_config_t       *config;
+  uint64_t                        random_state;
+  int                             cpu;            /* -1: not pinned */
+  size_t                          local_first;
+  size_t                          local_count;    /* 0: every partition */
 } prwlock_sample_thread_input_t;
 
+/* One thread's open events, or -1 for each that could not be opened */
 typedef struct {
-  uint64_t                        wait_count;
+  int                             fd[COUNTER_COUNT];
+  uint64_t                        cpu_ns;         /* fallbacks, at start */
+  uint64_t                        context_switches;
+} counter_set_t;
+
+/* Event totals over operations; bit n of valid is set if n was counted */
+typedef struct {
+  uint64_t                        operations;
+  uint64_t                        value[COUNTER_COUNT];
+  unsigned int                    valid;
+} counter_values_t;
+
+typedef struct {
+  prwlock_sample_role_output_t    role[ROLE_COUNT];
+  counter_values_t                counters;
 } prwlock_sample_thread_output_t;
 
 typedef struct {
@@ -144,6 +238,17 @@ typedef struct {
   prwlock_sample_thread_output_t  output;
 } prwlock_sample_thread_context_t;
 
+typedef struct {
+  size_t                          thread_count;
+  size_t                          cell_stride;
+  double                          elapsed;
+  uint64_t                        whole_lock_acquire_ns;
+  uint64_t                        whole_lock_release_ns;
+  prwlock_sample_role_output_t    role[ROLE_COUNT];
+  counter_values_t                counters;
+  counter_values_t               *thread_counters;
+} benchmark_result_t;
+
 /* ========================================================================= */
 /* -- PRIVATE METHOD PROTOTYPES -------------------------------------------- */
 /* ========================================================================= */
@@ -152,6 +257,13 @@ typedef struct {
 /* -- PRIVATE DATA --------------------------------------------------------- */
 /* ========================================================================= */
 
+static const char *role_name[ROLE_COUNT] = { "reader", "writer" };
+
+static const char *counter_name[COUNTER_COUNT] = {
+  "cycles", "instructions", "llc_misses", "hitm", "context_switches",
+  "cpu_ns"
+};
+
 /* ========================================================================= */
 /* -- PUBLIC DATA ---------------------------------------------------------- */
 /* ========================================================================= */
@@ -172,50 +284,447 @@ typedef struct {
 /* -- PRIVATE METHODS ------------------------------------------------------ */
 /* ========================================================================= */
 
-#ifdef USE_LIBUV_RWLOCK
-void
-#else
-void *
-#endif /* USE_LIBUV_RWLOCK */
-random_reader_thread (
-  void                         *arg
+static uint64_t
+now_ns (
+  void
 ) {
-  prwlock_sample_thread_context_t *context =
-    (prwlock_sample_thread_context_t *) arg;
-  partitioned_rwlock_t *rwlock = context->input.rwlock;
-  size_t bucket_count = partitioned_rwlock_get_partition_count(rwlock);
-  uint64_t random_id = context->input.mcg64_seed;
-  uintptr_t wait_count = 0;
-  unsigned hash_value = 0;
-  unsigned hash_bucket = 0;
-
-  for (int ii = 0; ii < context->input.iteration_count; ++ii) {
-    random_id =
-      ((UINT64_C(164603309694725029) * random_id)
-        % UINT64_C(14738995463583502973));
-    HASH_JEN(&random_id, sizeof(random_id), hash_value);
-    hash_bucket = ((hash_value) & ((bucket_count) - 1U));
-    if (0 != partitioned_rwlock_tryrdlock(rwlock, hash_bucket)) {
-      ++wait_count;
-      if (0 != partitioned_rwlock_rdlock(rwlock, hash_bucket)) {
-        fprintf(stderr, "can't acquire read lock\n");
-        exit(-1);
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (((uint64_t) ts.tv_sec * UINT64_C(1000000000))
+    + (uint64_t) ts.tv_nsec);
+} /* now_ns() */
+
+/* ------------------------------------------------------------------------- */
+
+/* splitmix64: cheap, stateless enough to seed one stream per thread */
+static uint64_t
+random_next (
+  uint64_t                     *state
+) {
+  uint64_t z = (*state += UINT64_C(0x9e3779b97f4a7c15));
+  z = ((z ^ (z >> 30)) * UINT64_C(0xbf58476d1ce4e5b9));
+  z = ((z ^ (z >> 27)) * UINT64_C(0x94d049bb133111eb));
+  return (z ^ (z >> 31));
+} /* random_next() */
+
+/* ------------------------------------------------------------------------- */
+
+static double
+random_unit (
+  uint64_t                     *state
+) {
+  return ((double) (random_next(state) >> 11) * 0x1.0p-53);
+} /* random_unit() */
+
+/* ------------------------------------------------------------------------- */
+
+static int
+key_generator_init (
+  key_generator_t              *keys
+) {
+  if (0 == keys->key_count) {
+    fprintf(stderr, "key count must be positive\n");
+    return -1;
+  }
+
+  if (DISTRIBUTION_ZIPF == keys->distribution) {
+    double theta = keys->zipf_theta;
+    double zeta2 = 1.0 + pow(0.5, theta);
+
+    if (!(0.0 < theta && 1.0 > theta)) {
+      fprintf(stderr, "zipf theta must be in (0, 1)\n");
+      return -1;
+    }
+    keys->zipf_zetan = 0.0;
+    for (uint64_t ii = 1; ii <= keys->key_count; ++ii) {
+      keys->zipf_zetan += (1.0 / pow((double) ii, theta));
+    }
+    keys->zipf_alpha = (1.0 / (1.0 - theta));
+    keys->zipf_eta = ((1.0 - pow(2.0 / (double) keys->key_count, 1.0 - theta))
+      / (1.0 - (zeta2 / keys->zipf_zetan)));
+    keys->zipf_half_pow_theta = pow(0.5, theta);
+  } else if (DISTRIBUTION_HOTSPOT == keys->distribution) {
+    if (!(0.0 < keys->hot_fraction && 1.0 >= keys->hot_fraction)
+      || !(0.0 <= keys->hot_probability && 1.0 >= keys->hot_probability)) {
+      fprintf(stderr, "hot-spot percentages must be in (0, 100]\n");
+      return -1;
+    }
+  }
+  return 0;
+} /* key_generator_init() */
+
+/* ------------------------------------------------------------------------- */
+
+static uint64_t
+key_generator_next (
+  const key_generator_t        *keys,
+  uint64_t                     *state
+) {
+  switch (keys->distribution) {
+    case DISTRIBUTION_ZIPF: {
+      double uz = (random_unit(state) * keys->zipf_zetan);
+      if (1.0 > uz) {
+        return 0;
+      }
+      if ((1.0 + keys->zipf_half_pow_theta) > uz) {
+        return 1;
+      }
+      uint64_t rank = (uint64_t) ((double) keys->key_count
+        * pow((keys->zipf_eta * (uz / keys->zipf_zetan)) - keys->zipf_eta
+          + 1.0, keys->zipf_alpha));
+      return (rank < keys->key_count) ? rank : (keys->key_count - 1);
+    }
+    case DISTRIBUTION_HOTSPOT: {
+      uint64_t hot_count = (uint64_t) (keys->hot_fraction
+        * (double) keys->key_count);
+      if (0 == hot_count) {
+        hot_count = 1;
+      }
+      if (hot_count >= keys->key_count
+        || random_unit(state) < keys->hot_probability) {
+        return (random_next(state) % hot_count);
+      }
+      return (hot_count
+        + (random_next(state) % (keys->key_count - hot_count)));
+    }
+    default:
+      return (random_next(state) % keys->key_count);
+  }
+} /* key_generator_next() */
+
+/* ------------------------------------------------------------------------- */
+
+/* Stands in for real work under the lock without yielding the CPU */
+static void
+busy_work (
+  uint64_t                      units
+) {
+  for (uint64_t ii = 0; ii < units; ++ii) {
+    __asm__ __volatile__("" ::: "memory");
+  }
+} /* busy_work() */
+
+/* ------------------------------------------------------------------------- */
+
+static void
+latency_record (
+  latency_histogram_t          *histogram,
+  uint64_t                      nanoseconds
+) {
+  size_t bucket = nanoseconds;
+
+  if (nanoseconds >= LATENCY_SUB_BUCKETS) {
+    int msb = 63 - __builtin_clzll(nanoseconds);
+    bucket = ((size_t) (msb - LATENCY_SUB_BUCKET_BITS + 1)
+      << LATENCY_SUB_BUCKET_BITS)
+      + ((nanoseconds >> (msb - LATENCY_SUB_BUCKET_BITS))
+        & (LATENCY_SUB_BUCKETS - 1));
+  }
+  ++histogram->count[bucket];
+  ++histogram->total;
+  if (nanoseconds > histogram->max) {
+    histogram->max = nanoseconds;
+  }
+} /* latency_record() */
+
+/* ------------------------------------------------------------------------- */
+
+static void
+latency_merge (
+  latency_histogram_t          *into,
+  const latency_histogram_t    *from
+) {
+  for (size_t ii = 0; ii < LATENCY_BUCKETS; ++ii) {
+    into->count[ii] += from->count[ii];
+  }
+  into->total += from->total;
+  if (from->max > into->max) {
+    into->max = from->max;
+  }
+} /* latency_merge() */
+
+/* ------------------------------------------------------------------------- */
+
+/* Returns the upper bound of the bucket holding the given percentile */
+static uint64_t
+latency_percentile (
+  const latency_histogram_t    *histogram,
+  double                        percentile
+) {
+  uint64_t rank = (uint64_t) ((percentile / 100.0) * histogram->total);
+  uint64_t seen = 0;
+
+  for (size_t ii = 0; ii < LATENCY_BUCKETS; ++ii) {
+    seen += histogram->count[ii];
+    if (seen > rank) {
+      if (ii < LATENCY_SUB_BUCKETS) {
+        return ii;
       }
+      int shift = (int) (ii >> LATENCY_SUB_BUCKET_BITS) - 1;
+      uint64_t lower = (uint64_t) (LATENCY_SUB_BUCKETS
+        | (ii & (LATENCY_SUB_BUCKETS - 1))) << shift;
+      uint64_t upper = lower + (UINT64_C(1) << shift) - 1;
+      return (upper < histogram->max) ? upper : histogram->max;
     }
+  }
+  return histogram->max;
+} /* latency_percentile() */
+
+/* ------------------------------------------------------------------------- */
+
+static uint64_t
+thread_cpu_ns (
+  void
+) {
+  struct timespec ts;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return (((uint64_t) ts.tv_sec * UINT64_C(1000000000))
+    + (uint64_t) ts.tv_nsec);
+} /* thread_cpu_ns() */
+
+/* ------------------------------------------------------------------------- */
+
+static uint64_t
+thread_context_switches (
+  void
+) {
+#if defined(RUSAGE_THREAD)
+  struct rusage usage;
+  if (0 == getrusage(RUSAGE_THREAD, &usage)) {
+    return (uint64_t) (usage.ru_nvcsw + usage.ru_nivcsw);
+  }
+#endif /* RUSAGE_THREAD */
+  return 0;
+} /* thread_context_switches() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Opens a disabled counter of the calling thread. Kernel time counts where
+ * perf_event_paranoid allows, since that is where waiters sleep, and user
+ * time alone otherwise. Returns -1 if the event is not to be had.
+ */
+static int
+counter_open (
+  uint32_t                      type,
+  uint64_t                      event
+) {
+#if defined(__linux__)
+  struct perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = type;
+  attr.config = event;
+  attr.disabled = 1;
+  attr.exclude_hv = 1;
+  attr.read_format = (PERF_FORMAT_TOTAL_TIME_ENABLED
+    | PERF_FORMAT_TOTAL_TIME_RUNNING);
+
+  int fd = (int) syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+  if (0 > fd) {
+    attr.exclude_kernel = 1;
+    fd = (int) syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+  }
+  return fd;
+#else
+  (void) type;
+  (void) event;
+  return -1;
+#endif /* __linux__ */
+} /* counter_open() */
+
+/* ------------------------------------------------------------------------- */
+
+static void
+counters_start (
+  counter_set_t                *set,
+  const benchmark_config_t     *config
+) {
+  for (int counter = 0; counter < COUNTER_COUNT; ++counter) {
+    set->fd[counter] = -1;
+  }
+
+#if defined(__linux__)
+  uint64_t hitm_event = config->hitm_event;
+# if defined(__x86_64__) || defined(__i386__)
+  __builtin_cpu_init();
+  if (0 == hitm_event && __builtin_cpu_is("intel")) {
+    hitm_event = HITM_INTEL_RAW_EVENT;
+  }
+# endif /* __x86_64__ || __i386__ */
 
-    if (0 < context->input.sleep_in_microseconds) {
-      usleep(context->input.sleep_in_microseconds);
+  set->fd[COUNTER_CYCLES] = counter_open(PERF_TYPE_HARDWARE,
+    PERF_COUNT_HW_CPU_CYCLES);
+  set->fd[COUNTER_INSTRUCTIONS] = counter_open(PERF_TYPE_HARDWARE,
+    PERF_COUNT_HW_INSTRUCTIONS);
+  set->fd[COUNTER_LLC_MISSES] = counter_open(PERF_TYPE_HARDWARE,
+    PERF_COUNT_HW_CACHE_MISSES);
+  if (0 != hitm_event) {
+    set->fd[COUNTER_HITM] = counter_open(PERF_TYPE_RAW, hitm_event);
+  }
+  set->fd[COUNTER_CONTEXT_SWITCHES] = counter_open(PERF_TYPE_SOFTWARE,
+    PERF_COUNT_SW_CONTEXT_SWITCHES);
+  set->fd[COUNTER_CPU_NS] = counter_open(PERF_TYPE_SOFTWARE,
+    PERF_COUNT_SW_TASK_CLOCK);
+
+  for (int counter = 0; counter < COUNTER_COUNT; ++counter) {
+    if (0 <= set->fd[counter]) {
+      (void) ioctl(set->fd[counter], PERF_EVENT_IOC_RESET, 0);
+      (void) ioctl(set->fd[counter], PERF_EVENT_IOC_ENABLE, 0);
+    }
+  }
+#else
+  (void) config;
+#endif /* __linux__ */
+
+  set->cpu_ns = thread_cpu_ns();
+  set->context_switches = thread_context_switches();
+} /* counters_start() */
+
+/* ------------------------------------------------------------------------- */
+
+/* Counts multiplexed off the PMU part of the time are scaled to all of it */
+static void
+counters_stop (
+  counter_set_t                *set,
+  counter_values_t             *values
+) {
+  uint64_t cpu_ns = (thread_cpu_ns() - set->cpu_ns);
+  uint64_t context_switches = (thread_context_switches()
+    - set->context_switches);
+
+  for (int counter = 0; counter < COUNTER_COUNT; ++counter) {
+    uint64_t reading[3];
+
+    if (0 > set->fd[counter]) {
+      continue;
+    }
+#if defined(__linux__)
+    (void) ioctl(set->fd[counter], PERF_EVENT_IOC_DISABLE, 0);
+#endif /* __linux__ */
+    if (sizeof(reading) == read(set->fd[counter], reading, sizeof(reading))
+      && 0 < reading[2]) {
+      values->value[counter] = (uint64_t) ((double) reading[0]
+        * ((double) reading[1] / (double) reading[2]));
+      values->valid |= (1u << counter);
     }
+    close(set->fd[counter]);
+  }
 
-    partitioned_rwlock_unlock(rwlock, hash_bucket);
+  if (!(values->valid & (1u << COUNTER_CPU_NS))) {
+    values->value[COUNTER_CPU_NS] = cpu_ns;
+    values->valid |= (1u << COUNTER_CPU_NS);
+  }
+#if defined(RUSAGE_THREAD)
+  if (!(values->valid & (1u << COUNTER_CONTEXT_SWITCHES))) {
+    values->value[COUNTER_CONTEXT_SWITCHES] = context_switches;
+    values->valid |= (1u << COUNTER_CONTEXT_SWITCHES);
   }
+#else
+  (void) context_switches;
+#endif /* RUSAGE_THREAD */
+} /* counters_stop() */
 
-  context->output.wait_count = wait_count;
+/* ------------------------------------------------------------------------- */
 
-#ifndef USE_LIBUV_RWLOCK
-  return NULL;
-#endif /* !USE_LIBUV_RWLOCK */
-} /* random_reader_thread() */
+/* A counter is valid for the run only if every thread had it */
+static void
+counters_merge (
+  counter_values_t             *to,
+  const counter_values_t       *from
+) {
+  to->operations += from->operations;
+  for (int counter = 0; counter < COUNTER_COUNT; ++counter) {
+    to->value[counter] += from->value[counter];
+  }
+  to->valid &= from->valid;
+} /* counters_merge() */
+
+/* ------------------------------------------------------------------------- */
+
+/* Per-operation values: text name=value pairs, CSV fields or JSON members */
+static void
+counters_print (
+  const counter_values_t       *values,
+  output_format_t               output
+) {
+  for (int counter = 0; counter < COUNTER_COUNT; ++counter) {
+    int valid = (0 < values->operations
+      && (values->valid & (1u << counter)));
+    double per_operation = (valid) ? ((double) values->value[counter]
+      / (double) values->operations) : 0.0;
+
+    switch (output) {
+      case OUTPUT_CSV:
+        if (valid) {
+          printf(",%.6g", per_operation);
+        } else {
+          printf(",");
+        }
+        break;
+      case OUTPUT_JSON:
+        if (valid) {
+          printf(",\"%s\":%.6g", counter_name[counter], per_operation);
+        } else {
+          printf(",\"%s\":null", counter_name[counter]);
+        }
+        break;
+      default:
+        if (valid) {
+          printf(" %s=%.6g", counter_name[counter], per_operation);
+        } else {
+          printf(" %s=n/a", counter_name[counter]);
+        }
+        break;
+    }
+  }
+} /* counters_print() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * A read without the lock: the work stands in for copying the data out,
+ * and counts only if no writer got in meanwhile. Every failed attempt is
+ * a wait; after OPTIMISTIC_ATTEMPTS the caller takes the read lock.
+ */
+static int
+optimistic_read (
+  partitioned_rwlock_t         *rwlock,
+  size_t                        partition,
+  uint64_t                      work_units,
+  prwlock_sample_role_output_t *output,
+  uint64_t                      start
+) {
+  for (int attempt = 0; attempt < OPTIMISTIC_ATTEMPTS; ++attempt) {
+    uint64_t stamp;
+
+    if (0 == partitioned_rwlock_read_begin(rwlock, partition, &stamp)) {
+      uint64_t begun = now_ns();
+
+      busy_work(work_units);
+      if (0 == partitioned_rwlock_read_validate(rwlock, partition, stamp)) {
+        latency_record(&output->acquire_latency, (begun - start));
+        return 1;
+      }
+    }
+    ++output->wait_count;
+  }
+  return 0;
+} /* optimistic_read() */
+
+/* ------------------------------------------------------------------------- */
+
+/* A write handed to partitioned_rwlock_combine(); arg is its work units */
+static void
+combined_write (
+  partitioned_rwlock_t         *rwlock,
+  size_t                        partition,
+  void                         *arg
+) {
+  (void) rwlock;
+  (void) partition;
+  busy_work(*(const uint64_t *) arg);
+} /* combined_write() */
 
 /* ------------------------------------------------------------------------- */
 
@@ -224,110 +733,870 @@ void
 #else
 void *
 #endif /* USE_LIBUV_RWLOCK */
-random_writer_thread (
+random_mixed_thread (
   void                         *arg
 ) {
   prwlock_sample_thread_context_t *context =
     (prwlock_sample_thread_context_t *) arg;
   partitioned_rwlock_t *rwlock = context->input.rwlock;
-  size_t bucket_count = partitioned_rwlock_get_partition_count(rwlock);
-  uint64_t random_id = context->input.mcg64_seed;
-  uintptr_t wait_count = 0;
-  unsigned hash_value = 0;
-  unsigned hash_bucket = 0;
-
-  for (int ii = 0; ii < context->input.iteration_count; ++ii) {
-    random_id =
-      ((UINT64_C(164603309694725029) * random_id)
-        % UINT64_C(14738995463583502973));
-    HASH_JEN(&random_id, sizeof(random_id), hash_value);
-    hash_bucket = ((hash_value) & ((bucket_count) - 1U));
-    if (0 != partitioned_rwlock_trywrlock(rwlock, hash_bucket)) {
-      ++wait_count;
-      if (0 != partitioned_rwlock_wrlock(rwlock, hash_bucket)) {
-        fprintf(stderr, "can't acquire write lock\n");
+  const benchmark_config_t *config = context->input.config;
+  uint64_t random_state = context->input.random_state;
+  uint64_t write_units = (2 * config->work_units);
+
+  if (0 <= context->input.cpu) {
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(context->input.cpu, &cpus);
+    (void) sched_setaffinity(0, sizeof(cpus), &cpus);
+  }
+
+  counter_set_t counters;
+  memset(&counters, 0, sizeof(counters));
+  if (config->counters) {
+    counters_start(&counters, config);
+  }
+
+  for (uint64_t ii = 0; ii < config->iteration_count; ++ii) {
+    uint64_t key = key_generator_next(&config->keys, &random_state);
+    int role = ((random_next(&random_state) % 100) < config->read_percent)
+      ? ROLE_READER : ROLE_WRITER;
+    prwlock_sample_role_output_t *output = &context->output.role[role];
+    size_t hash_bucket = partitioned_rwlock_partition(rwlock, &key,
+      sizeof(key));
+    if (0 < context->input.local_count) {
+      hash_bucket = (context->input.local_first
+        + (hash_bucket % context->input.local_count));
+    }
+
+    uint64_t start = now_ns();
+    if (ROLE_READER == role && config->epoch) {
+      if (0 != partitioned_rwlock_epoch_enter(rwlock)) {
+        fprintf(stderr, "can't enter epoch\n");
         exit(-1);
       }
+      latency_record(&output->acquire_latency, (now_ns() - start));
+      busy_work(config->work_units);
+      (void) partitioned_rwlock_epoch_exit(rwlock);
+      ++output->operation_count;
+      continue;
     }
-
-    if (0 < context->input.sleep_in_microseconds) {
-      usleep(context->input.sleep_in_microseconds);
+    if (ROLE_READER == role && config->optimistic
+      && optimistic_read(rwlock, hash_bucket, config->work_units, output,
+        start)) {
+      ++output->operation_count;
+      continue;
+    }
+    /* The write may run on another thread; its latency includes the work */
+    if (ROLE_WRITER == role && config->combining) {
+      if (0 != partitioned_rwlock_combine(rwlock, hash_bucket,
+        combined_write, &write_units)) {
+        fprintf(stderr, "can't combine write\n");
+        exit(-1);
+      }
+      latency_record(&output->acquire_latency, (now_ns() - start));
+      if (config->epoch && 0 != partitioned_rwlock_defer(rwlock, free,
+        malloc(EPOCH_RETIRED_BYTES))) {
+        fprintf(stderr, "can't defer reclamation\n");
+        exit(-1);
+      }
+      ++output->operation_count;
+      continue;
     }
+    if (ROLE_READER == role && config->inline_paths) {
+      if (0 != partitioned_rwlock_inline_tryrdlock(rwlock, hash_bucket)) {
+        ++output->wait_count;
+        if (0 != partitioned_rwlock_inline_rdlock(rwlock, hash_bucket)) {
+          fprintf(stderr, "can't acquire read lock\n");
+          exit(-1);
+        }
+      }
+    } else if (ROLE_READER == role) {
+      if (0 != partitioned_rwlock_tryrdlock(rwlock, hash_bucket)) {
+        ++output->wait_count;
+        if (0 != partitioned_rwlock_rdlock(rwlock, hash_bucket)) {
+          fprintf(stderr, "can't acquire read lock\n");
+          exit(-1);
+        }
+      }
+    } else if (config->inline_paths) {
+      if (0 != partitioned_rwlock_inline_trywrlock(rwlock, hash_bucket)) {
+        ++output->wait_count;
+        if (0 != partitioned_rwlock_inline_wrlock(rwlock, hash_bucket)) {
+          fprintf(stderr, "can't acquire write lock\n");
+          exit(-1);
+        }
+      }
+    } else {
+      if (0 != partitioned_rwlock_trywrlock(rwlock, hash_bucket)) {
+        ++output->wait_count;
+        if (0 != partitioned_rwlock_wrlock(rwlock, hash_bucket)) {
+          fprintf(stderr, "can't acquire write lock\n");
+          exit(-1);
+        }
+      }
+    }
+    latency_record(&output->acquire_latency, (now_ns() - start));
+
+    /* We'll make writes take 2x */
+    busy_work((ROLE_READER == role) ? config->work_units
+      : (2 * config->work_units));
 
-    partitioned_rwlock_unlock(rwlock, hash_bucket);
+    if (ROLE_READER == role && config->inline_paths) {
+      partitioned_rwlock_inline_rdunlock(rwlock, hash_bucket);
+    } else if (ROLE_READER == role) {
+      partitioned_rwlock_rdunlock(rwlock, hash_bucket);
+    } else if (config->inline_paths) {
+      partitioned_rwlock_inline_wrunlock(rwlock, hash_bucket);
+    } else {
+      partitioned_rwlock_wrunlock(rwlock, hash_bucket);
+    }
+    /* The version the write replaced goes once its readers are gone */
+    if (ROLE_WRITER == role && config->epoch
+      && 0 != partitioned_rwlock_defer(rwlock, free,
+        malloc(EPOCH_RETIRED_BYTES))) {
+      fprintf(stderr, "can't defer reclamation\n");
+      exit(-1);
+    }
+    ++output->operation_count;
   }
 
-  context->output.wait_count = wait_count;
+  if (config->counters) {
+    counters_stop(&counters, &context->output.counters);
+    context->output.counters.operations = config->iteration_count;
+  }
 
 #ifndef USE_LIBUV_RWLOCK
   return NULL;
 #endif /* !USE_LIBUV_RWLOCK */
-} /* random_writer_thread() */
+} /* random_mixed_thread() */
 
-/* ========================================================================= */
-/* -- PUBLIC METHODS ------------------------------------------------------- */
-/* ========================================================================= */
+/* ------------------------------------------------------------------------- */
 
-int
-main (
-  int                           argc,
-  char                        **argv
+/* Reads a node's CPU list ("0-3,8-11") from sysfs; returns the CPU count */
+static int
+node_cpus (
+  int                           node,
+  int                          *cpus,
+  int                           capacity
 ) {
-  partitioned_rwlock_t *rwlock;
-  partitioned_rwlock_init(&rwlock, NUM_PARTITIONS);
+  char path[64];
+  int count = 0;
+  int first;
+  int last;
 
-  prwlock_sample_thread_context_t thread_context[NUM_THREADS];
-#ifdef USE_LIBUV_RWLOCK
-  uv_thread_t threads[NUM_THREADS];
-#else
-  pthread_t threads[NUM_THREADS];
-#endif /* USE_LIBUV_RWLOCK */
+  snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist",
+    node);
+  FILE *cpulist = fopen(path, "r");
+  if (NULL == cpulist) {
+    return 0;
+  }
+  while (1 == fscanf(cpulist, "%d", &first)) {
+    last = first;
+    int separator = fgetc(cpulist);
+    if ('-' == separator) {
+      if (1 != fscanf(cpulist, "%d", &last)) {
+        break;
+      }
+      separator = fgetc(cpulist);
+    }
+    for (int cpu = first; cpu <= last && count < capacity; ++cpu) {
+      cpus[count++] = cpu;
+    }
+    if (',' != separator) {
+      break;
+    }
+  }
+  fclose(cpulist);
+  return count;
+} /* node_cpus() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * With placement, thread t is pinned to node t % N (over nodes that have
+ * CPUs), one CPU after another within it, and with -N local it only touches
+ * the partitions whose cells live on that node.
+ */
+static void
+benchmark_place_threads (
+  const benchmark_config_t     *config,
+  partitioned_rwlock_t         *rwlock,
+  prwlock_sample_thread_context_t *thread_context,
+  size_t                        thread_count
+) {
+  static int cpus[MAX_NODE_CPUS];
+  static int cpu_nodes[MAX_NODE_CPUS];
+  size_t partition_count = partitioned_rwlock_get_partition_count(rwlock);
+  int node_count = partitioned_rwlock_numa_node_count();
+  size_t cpu_node_count = 0;
+
+  for (size_t ii = 0; ii < thread_count; ++ii) {
+    thread_context[ii].input.cpu = -1;
+  }
+  if (PRWLOCK_NUMA_NONE == config->attr.numa) {
+    return;
+  }
+
+  for (int node = 0; node < node_count && cpu_node_count < MAX_NODE_CPUS;
+    ++node) {
+    if (0 < node_cpus(node, cpus, MAX_NODE_CPUS)) {
+      cpu_nodes[cpu_node_count++] = node;
+    }
+  }
+
+  for (size_t ii = 0; 0 < cpu_node_count && ii < thread_count; ++ii) {
+    prwlock_sample_thread_input_t *input = &thread_context[ii].input;
+    int node = cpu_nodes[ii % cpu_node_count];
+    int cpu_count = node_cpus(node, cpus, MAX_NODE_CPUS);
+
+    input->cpu = cpus[(ii / cpu_node_count) % (size_t) cpu_count];
+    for (size_t pp = 0; config->local_keys && pp < partition_count; ++pp) {
+      if (node == partitioned_rwlock_partition_node(rwlock, pp)) {
+        if (0 == input->local_count) {
+          input->local_first = pp;
+        }
+        input->local_count = ((pp - input->local_first) + 1);
+      }
+    }
+  }
+} /* benchmark_place_threads() */
+
+/* ------------------------------------------------------------------------- */
 
-  for (int ii = 0; ii < NUM_THREADS; ++ii) {
+static int
+benchmark_run (
+  const benchmark_config_t     *config,
+  size_t                        thread_count,
+  benchmark_result_t           *result
+) {
+  partitioned_rwlock_t *rwlock;
+  prwlock_sample_thread_context_t *thread_context;
 #ifdef USE_LIBUV_RWLOCK
-    uv_thread_cb thread_callback = random_reader_thread;
+  uv_thread_t *threads;
 #else
-    void *(*thread_callback) (void *) = random_reader_thread;
+  pthread_t *threads;
 #endif /* USE_LIBUV_RWLOCK */
 
-    memset(&thread_context[ii], 0, sizeof(prwlock_sample_thread_context_t));
-    thread_context[ii].input.rwlock = rwlock;
-    thread_context[ii].input.iteration_count = NUM_ITERATIONS;
-    thread_context[ii].input.sleep_in_microseconds = NUM_MICROSECONDS;
-    thread_context[ii].input.mcg64_seed = (ii + 1);
+  if (0 != ((config->shared)
+    ? partitioned_rwlock_init_shared(&rwlock, NULL, 0,
+      config->partition_count, &config->attr)
+    : partitioned_rwlock_init_ex(&rwlock, config->partition_count,
+      &config->attr))) {
+    fprintf(stderr, "can't initialize lock\n");
+    return -1;
+  }
+
+  memset(result, 0, sizeof(*result));
+  thread_context = calloc(thread_count, sizeof(*thread_context));
+  threads = calloc(thread_count, sizeof(*threads));
+  if (config->counters) {
+    result->thread_counters = calloc(thread_count,
+      sizeof(*result->thread_counters));
+  }
+  if (NULL == thread_context || NULL == threads
+    || (config->counters && NULL == result->thread_counters)) {
+    fprintf(stderr, "can't allocate %zu threads\n", thread_count);
+    free(thread_context);
+    free(threads);
+    free(result->thread_counters);
+    partitioned_rwlock_destroy(rwlock);
+    return -1;
+  }
 
-    if (1 == (ii % 2)) {
-      thread_callback = random_writer_thread;
+  result->thread_count = thread_count;
+  result->counters.valid = COUNTER_ALL;
+  result->cell_stride = partitioned_rwlock_get_cell_stride(rwlock);
+  benchmark_place_threads(config, rwlock, thread_context, thread_count);
+  uint64_t start_time = now_ns();
 
-      /* We'll make writes take 2x */
-      thread_context[ii].input.sleep_in_microseconds *= 2;
-    }
+  for (size_t ii = 0; ii < thread_count; ++ii) {
+    thread_context[ii].input.rwlock = rwlock;
+    thread_context[ii].input.config = config;
+    thread_context[ii].input.random_state = (ii + 1);
 
 #ifdef USE_LIBUV_RWLOCK
-    uv_thread_create(&threads[ii], thread_callback,
-      &thread_context[ii]);
+    uv_thread_create(&threads[ii], random_mixed_thread, &thread_context[ii]);
 #else
-    (void) pthread_create(&threads[ii], NULL, thread_callback,
+    (void) pthread_create(&threads[ii], NULL, random_mixed_thread,
       &thread_context[ii]);
 #endif /* USE_LIBUV_RWLOCK */
   }
 
-  for (int ii = 0; ii < NUM_THREADS; ++ii) {
+  for (size_t ii = 0; ii < thread_count; ++ii) {
 #ifdef USE_LIBUV_RWLOCK
     (void) uv_thread_join(&threads[ii]);
 #else
     (void) pthread_join(threads[ii], NULL);
 #endif /* USE_LIBUV_RWLOCK */
-    printf("%s thread encountered %"PRIu64" waits\n",
-      (0 == (ii % 2)) ? "reader" : "writer",
-      thread_context[ii].output.wait_count);
+    for (int role = 0; role < ROLE_COUNT; ++role) {
+      prwlock_sample_role_output_t *from =
+        &thread_context[ii].output.role[role];
+
+      result->role[role].operation_count += from->operation_count;
+      result->role[role].wait_count += from->wait_count;
+      latency_merge(&result->role[role].acquire_latency,
+        &from->acquire_latency);
+    }
+    if (config->counters) {
+      result->thread_counters[ii] = thread_context[ii].output.counters;
+      counters_merge(&result->counters, &thread_context[ii].output.counters);
+    }
+  }
+
+  result->elapsed = ((double) (now_ns() - start_time) / 1E9);
+
+  uint64_t start = now_ns();
+  if (0 != partitioned_rwlock_wrlock_all(rwlock)) {
+    fprintf(stderr, "can't acquire whole lock\n");
+    exit(-1);
+  }
+  uint64_t locked = now_ns();
+  (void) partitioned_rwlock_unlock_all(rwlock);
+  result->whole_lock_acquire_ns = (locked - start);
+  result->whole_lock_release_ns = (now_ns() - locked);
+
+  if (config->print_stats) {
+    (void) partitioned_rwlock_stats_print(rwlock, stdout,
+      (2 == config->print_stats) ? PRWLOCK_STATS_FORMAT_JSON
+        : PRWLOCK_STATS_FORMAT_TEXT);
   }
 
+  free(thread_context);
+  free(threads);
   partitioned_rwlock_destroy(rwlock);
+  return 0;
+} /* benchmark_run() */
+
+/* ------------------------------------------------------------------------- */
+
+static const char *
+policy_name (
+  partitioned_rwlock_policy_t   policy
+) {
+  switch (policy) {
+    case PRWLOCK_POLICY_READER_PREFERRING:
+      return "reader";
+    case PRWLOCK_POLICY_WRITER_PREFERRING:
+      return "writer";
+    case PRWLOCK_POLICY_PHASE_FAIR:
+      return "phase-fair";
+    default:
+      return "default";
+  }
+} /* policy_name() */
+
+/* ------------------------------------------------------------------------- */
+
+static const char *
+placement_name (
+  const benchmark_config_t     *config
+) {
+  switch (config->attr.numa) {
+    case PRWLOCK_NUMA_INTERLEAVE:
+      return "interleave";
+    case PRWLOCK_NUMA_BLOCKED:
+      return (config->local_keys) ? "local" : "blocked";
+    default:
+      return "none";
+  }
+} /* placement_name() */
+
+/* ------------------------------------------------------------------------- */
+
+static void
+distribution_name (
+  const key_generator_t        *keys,
+  char                         *buffer,
+  size_t                        size
+) {
+  switch (keys->distribution) {
+    case DISTRIBUTION_ZIPF:
+      snprintf(buffer, size, "zipf:%g", keys->zipf_theta);
+      break;
+    case DISTRIBUTION_HOTSPOT:
+      snprintf(buffer, size, "hotspot:%g:%g", (keys->hot_fraction * 100.0),
+        (keys->hot_probability * 100.0));
+      break;
+    default:
+      snprintf(buffer, size, "uniform");
+      break;
+  }
+} /* distribution_name() */
+
+/* ------------------------------------------------------------------------- */
+
+static void
+benchmark_print (
+  const benchmark_config_t     *config,
+  const benchmark_result_t     *result,
+  int                           first
+) {
+  uint64_t operations = (result->role[ROLE_READER].operation_count
+    + result->role[ROLE_WRITER].operation_count);
+  double ops_per_second = ((double) operations / result->elapsed);
+  int bias = !!(config->attr.flags & PRWLOCK_FLAG_READER_BIAS);
+  int global = !!(config->attr.flags & PRWLOCK_FLAG_GLOBAL);
+  int cohort = !!(config->attr.flags & PRWLOCK_FLAG_COHORT);
+  int lease = !!(config->attr.flags & PRWLOCK_FLAG_READ_LEASE);
+  int combining = config->combining;
+  int optimistic = config->optimistic;
+  int inline_paths = config->inline_paths;
+  int epoch = config->epoch;
+  int shared = config->shared;
+  const char *counter_source = (!config->counters) ? ""
+    : (result->counters.valid & (1u << COUNTER_CYCLES)) ? "pmu"
+    : "software";
+  char distribution[64];
+
+  distribution_name(&config->keys, distribution, sizeof(distribution));
+
+  switch (config->output) {
+    case OUTPUT_CSV:
+      if (first) {
+        printf("backend,threads,partitions,keys,distribution,read_percent,"
+          "work_units,policy,bias,global,numa,cohort,optimistic,inline,"
+          "epoch,shared,lease,combining,cell_stride,table_bytes,"
+          "operations,seconds,ops_per_sec");
+        for (int role = 0; role < ROLE_COUNT; ++role) {
+          printf(",%1$s_ops,%1$s_waits,%1$s_p50_ns,%1$s_p99_ns,"
+            "%1$s_p999_ns,%1$s_max_ns", role_name[role]);
+        }
+        printf(",whole_lock_acquire_ns,whole_lock_release_ns,counter_source");
+        for (int counter = 0; counter < COUNTER_COUNT; ++counter) {
+          printf(",%s_per_op", counter_name[counter]);
+        }
+        printf("\n");
+      }
+      printf("%s,%zu,%zu,%"PRIu64",%s,%u,%"PRIu64",%s,%d,%d,%s,%d,%d,%d,%d,"
+        "%d,%d,%d,%zu,%zu,%"PRIu64",%.6f,%.0f", BENCHMARK_BACKEND,
+        result->thread_count, config->partition_count,
+        config->keys.key_count, distribution, config->read_percent,
+        config->work_units, policy_name(config->attr.policy), bias, global,
+        placement_name(config), cohort, optimistic, inline_paths, epoch,
+        shared, lease, combining, result->cell_stride,
+        (result->cell_stride * config->partition_count), operations,
+        result->elapsed, ops_per_second);
+      for (int role = 0; role < ROLE_COUNT; ++role) {
+        const prwlock_sample_role_output_t *output = &result->role[role];
+
+        printf(",%"PRIu64",%"PRIu64",%"PRIu64",%"PRIu64",%"PRIu64",%"PRIu64,
+          output->operation_count, output->wait_count,
+          latency_percentile(&output->acquire_latency, 50.0),
+          latency_percentile(&output->acquire_latency, 99.0),
+          latency_percentile(&output->acquire_latency, 99.9),
+          output->acquire_latency.max);
+      }
+      printf(",%"PRIu64",%"PRIu64",%s", result->whole_lock_acquire_ns,
+        result->whole_lock_release_ns, counter_source);
+      counters_print(&result->counters, OUTPUT_CSV);
+      printf("\n");
+      break;
+
+    case OUTPUT_JSON:
+      /* One object per line, so sweeps concatenate into JSON Lines */
+      printf("{\"backend\":\"%s\",\"threads\":%zu,\"partitions\":%zu,"
+        "\"keys\":%"PRIu64",\"distribution\":\"%s\",\"read_percent\":%u,"
+        "\"work_units\":%"PRIu64",\"policy\":\"%s\",\"bias\":%d,"
+        "\"global\":%d,\"numa\":\"%s\",\"cohort\":%d,\"optimistic\":%d,"
+        "\"inline\":%d,\"epoch\":%d,\"shared\":%d,\"lease\":%d,"
+        "\"combining\":%d,\"cell_stride\":%zu,\"table_bytes\":%zu,"
+        "\"operations\":%"PRIu64",\"seconds\":%.6f,\"ops_per_sec\":%.0f",
+        BENCHMARK_BACKEND,
+        result->thread_count, config->partition_count, config->keys.key_count,
+        distribution, config->read_percent, config->work_units,
+        policy_name(config->attr.policy), bias, global,
+        placement_name(config), cohort, optimistic, inline_paths, epoch,
+        shared, lease, combining, result->cell_stride,
+        (result->cell_stride * config->partition_count), operations,
+        result->elapsed, ops_per_second);
+      for (int role = 0; role < ROLE_COUNT; ++role) {
+        const prwlock_sample_role_output_t *output = &result->role[role];
+
+        printf(",\"%s\":{\"ops\":%"PRIu64",\"waits\":%"PRIu64
+          ",\"p50_ns\":%"PRIu64",\"p99_ns\":%"PRIu64",\"p999_ns\":%"PRIu64
+          ",\"max_ns\":%"PRIu64"}", role_name[role], output->operation_count,
+          output->wait_count,
+          latency_percentile(&output->acquire_latency, 50.0),
+          latency_percentile(&output->acquire_latency, 99.0),
+          latency_percentile(&output->acquire_latency, 99.9),
+          output->acquire_latency.max);
+      }
+      printf(",\"whole_lock_acquire_ns\":%"PRIu64
+        ",\"whole_lock_release_ns\":%"PRIu64,
+        result->whole_lock_acquire_ns, result->whole_lock_release_ns);
+      if (config->counters) {
+        printf(",\"counters\":{\"source\":\"%s\"", counter_source);
+        counters_print(&result->counters, OUTPUT_JSON);
+        printf(",\"threads\":[");
+        for (size_t ii = 0; ii < result->thread_count; ++ii) {
+          printf("%s{\"operations\":%"PRIu64, (0 < ii) ? "," : "",
+            result->thread_counters[ii].operations);
+          counters_print(&result->thread_counters[ii], OUTPUT_JSON);
+          printf("}");
+        }
+        printf("]}");
+      }
+      printf("}\n");
+      break;
+
+    default:
+      printf("%s: %zu threads, %zu partitions, %"PRIu64" keys (%s), "
+        "%u%% reads, %"PRIu64" work units, %s policy, %s placement"
+        "%s%s%s%s%s%s%s%s%s\n",
+        BENCHMARK_BACKEND, result->thread_count, config->partition_count,
+        config->keys.key_count, distribution, config->read_percent,
+        config->work_units, policy_name(config->attr.policy),
+        placement_name(config), (bias) ? ", reader-biased" : "",
+        (global) ? ", global" : "", (cohort) ? ", cohort" : "",
+        (optimistic) ? ", optimistic reads" : "",
+        (inline_paths) ? ", inline fast paths" : "",
+        (epoch) ? ", epoch reads" : "",
+        (shared) ? ", process-shared" : "",
+        (lease) ? ", read leases" : "",
+        (combining) ? ", combining writes" : "");
+      printf("cells: %zu bytes apart, %zu bytes in all\n", result->cell_stride,
+        (result->cell_stride * config->partition_count));
+      for (int role = 0; role < ROLE_COUNT; ++role) {
+        const prwlock_sample_role_output_t *output = &result->role[role];
+
+        printf("%s: %"PRIu64" ops, %"PRIu64" waits, acquire latency (ns): "
+          "p50=%"PRIu64" p99=%"PRIu64" p99.9=%"PRIu64" max=%"PRIu64"\n",
+          role_name[role], output->operation_count, output->wait_count,
+          latency_percentile(&output->acquire_latency, 50.0),
+          latency_percentile(&output->acquire_latency, 99.0),
+          latency_percentile(&output->acquire_latency, 99.9),
+          output->acquire_latency.max);
+      }
+      printf("%.3f seconds, %.0f ops/sec\n", result->elapsed, ops_per_second);
+      printf("whole-lock acquire: %"PRIu64" ns, release: %"PRIu64" ns\n",
+        result->whole_lock_acquire_ns, result->whole_lock_release_ns);
+      if (config->counters) {
+        printf("counters per op (%s):", counter_source);
+        counters_print(&result->counters, OUTPUT_TEXT);
+        printf("\n");
+        for (size_t ii = 0; ii < result->thread_count; ++ii) {
+          printf("  thread %zu:", ii);
+          counters_print(&result->thread_counters[ii], OUTPUT_TEXT);
+          printf("\n");
+        }
+      }
+      break;
+  }
+  fflush(stdout);
+} /* benchmark_print() */
+
+/* ------------------------------------------------------------------------- */
+
+static int
+parse_unsigned (
+  const char                   *arg,
+  char                          option,
+  uint64_t                      minimum,
+  uint64_t                     *value
+) {
+  char *end = NULL;
+  unsigned long long parsed = strtoull(arg, &end, 10);
+
+  if ('\0' == *arg || '\0' != *end || '-' == *arg || parsed < minimum) {
+    fprintf(stderr, "invalid value '%s' for -%c\n", arg, option);
+    return -1;
+  }
+  *value = (uint64_t) parsed;
+  return 0;
+} /* parse_unsigned() */
+
+/* ------------------------------------------------------------------------- */
+
+/* A raw PMU event as perf(1) spells it after the 'r': hex, umask first */
+static int
+parse_raw_event (
+  const char                   *arg,
+  char                          option,
+  uint64_t                     *value
+) {
+  char *end = NULL;
+  unsigned long long parsed = strtoull(arg, &end, 16);
+
+  if ('\0' == *arg || '\0' != *end || '-' == *arg || 0 == parsed) {
+    fprintf(stderr, "invalid raw event '%s' for -%c\n", arg, option);
+    return -1;
+  }
+  *value = (uint64_t) parsed;
+  return 0;
+} /* parse_raw_event() */
+
+/* ------------------------------------------------------------------------- */
+
+/* uniform | zipf[:theta] | hotspot[:hot-key-percent[:hot-op-percent]] */
+static int
+parse_distribution (
+  const char                   *arg,
+  key_generator_t              *keys
+) {
+  double first;
+  double second;
+
+  if (0 == strcmp(arg, "uniform")) {
+    keys->distribution = DISTRIBUTION_UNIFORM;
+  } else if (0 == strncmp(arg, "zipf", 4)
+    && ('\0' == arg[4] || ':' == arg[4])) {
+    keys->distribution = DISTRIBUTION_ZIPF;
+    keys->zipf_theta = 0.99;
+    if (':' == arg[4] && 1 != sscanf(&arg[5], "%lf", &keys->zipf_theta)) {
+      fprintf(stderr, "invalid zipf theta '%s'\n", &arg[5]);
+      return -1;
+    }
+  } else if (0 == strncmp(arg, "hotspot", 7)
+    && ('\0' == arg[7] || ':' == arg[7])) {
+    keys->distribution = DISTRIBUTION_HOTSPOT;
+    first = 10.0;
+    second = 90.0;
+    if (':' == arg[7] && 1 > sscanf(&arg[8], "%lf:%lf", &first, &second)) {
+      fprintf(stderr, "invalid hot-spot '%s'\n", &arg[8]);
+      return -1;
+    }
+    keys->hot_fraction = (first / 100.0);
+    keys->hot_probability = (second / 100.0);
+  } else {
+    fprintf(stderr, "unknown distribution '%s'\n", arg);
+    return -1;
+  }
+  return 0;
+} /* parse_distribution() */
+
+/* ------------------------------------------------------------------------- */
+
+static void
+usage (
+  const char                   *program
+) {
+  fprintf(stderr,
+    "usage: %s [options]\n"
+    "  -t threads       worker threads (default %d)\n"
+    "  -p partitions    lock partitions (default %d)\n"
+    "  -n iterations    operations per thread (default %d)\n"
+    "  -r percent       share of operations that read (default %d)\n"
+    "  -w units         busy-work loop iterations per read, 2x per write "
+      "(default %d)\n"
+    "  -k keys          key space size (default %d)\n"
+    "  -d distribution  uniform | zipf[:theta] | "
+      "hotspot[:key%%[:op%%]] (default uniform)\n"
+    "  -S               sweep thread counts 1, 2, 4, ... up to -t\n"
+    "  -o format        text | csv | json (default text)\n"
+    "  -b               reader-biased partitions\n"
+    "  -g               global (whole-lock) mode\n"
+    "  -s | -j          print partition statistics as text | JSON\n"
+    "  -P policy        default | reader | writer | phase-fair\n"
+    "  -N placement     none | interleave | local: NUMA cell placement; "
+      "pins\n"
+    "                   threads across nodes, and local keeps each "
+      "thread to\n"
+    "                   partitions on its own node\n"
+    "  -C               cohort handoff between writers of a node\n"
+    "  -L stride        line | packed | double: cell spacing (default line)\n"
+    "  -R               optimistic (sequence-checked) reads, falling back "
+      "to the\n"
+    "                   read lock\n"
+    "  -I               inline fast paths (prwlock_inline.h)\n"
+    "  -E               epoch reads; writers defer freeing what they "
+      "replace\n"
+    "  -X               process-shared lock in a shared mapping\n"
+    "  -l               read leases for partitions a thread keeps reading\n"
+    "  -F               combining writes (flat combining); write latency\n"
+    "                   includes the write\n"
+    "  -c               count cycles, instructions, LLC misses, HITM loads,\n"
+    "                   context switches and CPU time per operation\n"
+    "  -H event         raw PMU event (hex) to count as HITM loads\n",
+    program, NUM_THREADS, NUM_PARTITIONS, NUM_ITERATIONS, NUM_READ_PERCENT,
+    NUM_WORK_UNITS, NUM_KEYS);
+} /* usage() */
+
+/* ========================================================================= */
+/* -- PUBLIC METHODS ------------------------------------------------------- */
+/* ========================================================================= */
+
+int
+main (
+  int                           argc,
+  char                        **argv
+) {
+  benchmark_config_t config;
+  benchmark_result_t result;
+  uint64_t value;
+  int opt;
+
+  memset(&config, 0, sizeof(config));
+  config.thread_count = NUM_THREADS;
+  config.partition_count = NUM_PARTITIONS;
+  config.iteration_count = NUM_ITERATIONS;
+  config.read_percent = NUM_READ_PERCENT;
+  config.work_units = NUM_WORK_UNITS;
+  config.keys.distribution = DISTRIBUTION_UNIFORM;
+  config.keys.key_count = NUM_KEYS;
+  partitioned_rwlock_attr_init(&config.attr);
+
+  while (-1 != (opt = getopt(argc, argv,
+    "t:p:n:r:w:k:d:So:bgjsP:N:CL:RIEXlFcH:"))) {
+    switch (opt) {
+      case 't':
+        if (0 != parse_unsigned(optarg, opt, 1, &value)) {
+          return 1;
+        }
+        config.thread_count = (size_t) value;
+        break;
+      case 'p':
+        if (0 != parse_unsigned(optarg, opt, 1, &value)) {
+          return 1;
+        }
+        config.partition_count = (size_t) value;
+        break;
+      case 'n':
+        if (0 != parse_unsigned(optarg, opt, 0, &config.iteration_count)) {
+          return 1;
+        }
+        break;
+      case 'r':
+        if (0 != parse_unsigned(optarg, opt, 0, &value) || 100 < value) {
+          fprintf(stderr, "read percent must be 0-100\n");
+          return 1;
+        }
+        config.read_percent = (unsigned int) value;
+        break;
+      case 'w':
+        if (0 != parse_unsigned(optarg, opt, 0, &config.work_units)) {
+          return 1;
+        }
+        break;
+      case 'k':
+        if (0 != parse_unsigned(optarg, opt, 1, &config.keys.key_count)) {
+          return 1;
+        }
+        break;
+      case 'd':
+        if (0 != parse_distribution(optarg, &config.keys)) {
+          return 1;
+        }
+        break;
+      case 'S':
+        config.sweep = 1;
+        break;
+      case 'o':
+        if (0 == strcmp(optarg, "csv")) {
+          config.output = OUTPUT_CSV;
+        } else if (0 == strcmp(optarg, "json")) {
+          config.output = OUTPUT_JSON;
+        } else if (0 != strcmp(optarg, "text")) {
+          fprintf(stderr, "unknown output format '%s'\n", optarg);
+          return 1;
+        }
+        break;
+      case 'b':
+        config.attr.flags |= PRWLOCK_FLAG_READER_BIAS;
+        break;
+      case 'g':
+        config.attr.flags |= PRWLOCK_FLAG_GLOBAL;
+        break;
+      case 'j':
+        config.print_stats = 2;
+        config.attr.flags |= PRWLOCK_FLAG_STATS;
+        break;
+      case 's':
+        config.print_stats = (config.print_stats) ? config.print_stats : 1;
+        config.attr.flags |= PRWLOCK_FLAG_STATS;
+        break;
+      case 'P':
+        if (0 == strcmp(optarg, "reader")) {
+          config.attr.policy = PRWLOCK_POLICY_READER_PREFERRING;
+        } else if (0 == strcmp(optarg, "writer")) {
+          config.attr.policy = PRWLOCK_POLICY_WRITER_PREFERRING;
+        } else if (0 == strcmp(optarg, "phase-fair")) {
+          config.attr.policy = PRWLOCK_POLICY_PHASE_FAIR;
+        } else if (0 != strcmp(optarg, "default")) {
+          fprintf(stderr, "unknown policy '%s'\n", optarg);
+          return 1;
+        }
+        break;
+      case 'N':
+        if (0 == strcmp(optarg, "interleave")) {
+          config.attr.numa = PRWLOCK_NUMA_INTERLEAVE;
+        } else if (0 == strcmp(optarg, "local")) {
+          config.attr.numa = PRWLOCK_NUMA_BLOCKED;
+          config.local_keys = 1;
+        } else if (0 != strcmp(optarg, "none")) {
+          fprintf(stderr, "unknown placement '%s'\n", optarg);
+          return 1;
+        }
+        break;
+      case 'C':
+        config.attr.flags |= PRWLOCK_FLAG_COHORT;
+        break;
+      case 'L':
+        if (0 == strcmp(optarg, "packed")) {
+          config.attr.stride = PRWLOCK_STRIDE_PACKED;
+        } else if (0 == strcmp(optarg, "double")) {
+          config.attr.stride = PRWLOCK_STRIDE_DOUBLE_LINE;
+        } else if (0 != strcmp(optarg, "line")) {
+          fprintf(stderr, "unknown stride '%s'\n", optarg);
+          return 1;
+        }
+        break;
+      case 'R':
+        config.optimistic = 1;
+        config.attr.flags |= PRWLOCK_FLAG_OPTIMISTIC;
+        break;
+      case 'I':
+        config.inline_paths = 1;
+        break;
+      case 'E':
+        config.epoch = 1;
+        config.attr.flags |= PRWLOCK_FLAG_EPOCH;
+        break;
+      case 'X':
+        config.shared = 1;
+        break;
+      case 'l':
+        config.attr.flags |= PRWLOCK_FLAG_READ_LEASE;
+        break;
+      case 'F':
+        config.combining = 1;
+        config.attr.flags |= PRWLOCK_FLAG_COMBINING;
+        break;
+      case 'c':
+        config.counters = 1;
+        break;
+      case 'H':
+        if (0 != parse_raw_event(optarg, opt, &config.hitm_event)) {
+          return 1;
+        }
+        config.counters = 1;
+        break;
+      default:
+        usage(argv[0]);
+        return 1;
+    }
+  }
+
+  if (0 != key_generator_init(&config.keys)) {
+    return 1;
+  }
+
+  /* A sweep doubles the thread count from one, ending on -t exactly */
+  size_t thread_count = (config.sweep) ? 1 : config.thread_count;
+  for (int first = 1; ; first = 0) {
+    if (0 != benchmark_run(&config, thread_count, &result)) {
+      return 1;
+    }
+    benchmark_print(&config, &result, first);
+    free(result.thread_counters);
+    if (thread_count >= config.thread_count) {
+      break;
+    }
+    thread_count = (2 * thread_count < config.thread_count)
+      ? (2 * thread_count) : config.thread_count;
+  }
 
   return 0;
 
 } /* main() */
 
 /* :vi set ts=2 et sw=2: */
-
@@ -0,0 +1,192 @@
+/* ========================================================================= **
+**                                      __           __                      **
+**                       ______      __/ /___  _____/ /__                    **
+**                      / ___/ | /| / / / __ \/ ___/ //_/                    **
+**                     / /   | |/ |/ / / /_/ / /__/ ,<                       **
+**                    /_/    |__/|__/_/\____/\___/_/|_|                      **
+**                                                                           **
+** ========================================================================= **
+**                      PARTITIONED READER-WRITER LOCK                       **
+** ========================================================================= **
+**                                                                           **
+** Copyright (c) 2002-2018 Jonah H. Harris.                                  **
+**                                                                           **
+** This library is free software; you can redistribute it and/or modify it   **
+** under the terms of the GNU Lesser General Public License as published by  **
+** the Free Software Foundation; either version 3 of the License, or (at     **
+** your option) any later version.                                           **
+**                                                                           **
+** This library is distributed in the hope it will be useful, but WITHOUT    **
+** ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or     **
+** FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public       **
+** License for more details.                                                 **
+**                                                                           **
+** You should have received a copy of the GNU Lesser General Public License  **
+** along with this library; if not, write to the Free Software Foundation,   **
+** Inc., 675 Mass Ave, Cambridge, MA 02139, USA.                             **
+** ========================================================================= */
+
+/*
+ * Regression checks for lock interleavings that once deadlocked. Each
+ * check runs its threads in a fixed order and fails, rather than hangs,
+ * if they do not finish within CHECK_TIMEOUT seconds.
+ */
+
+/* ========================================================================= */
+/* -- INCLUSIONS ----------------------------------------------------------- */
+/* ========================================================================= */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <sched.h>
+#include <unistd.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#include "prwlock.h"
+
+/* ========================================================================= */
+/* -- DEFINITIONS ---------------------------------------------------------- */
+/* ========================================================================= */
+
+#if defined(USE_FUTEX)
+# define BENCHMARK_BACKEND      "futex"
+#elif defined(USE_ATOMICS)
+# define BENCHMARK_BACKEND      "atomics"
+#else
+# define BENCHMARK_BACKEND      "pthread"
+#endif
+
+#define CHECK_TIMEOUT           10
+
+/* Reads in a row that are sure to earn a thread a read lease */
+#define LEASE_EARNING_READS     4096
+
+/* ========================================================================= */
+/* -- PRIVATE TYPES -------------------------------------------------------- */
+/* ========================================================================= */
+
+typedef struct {
+  partitioned_rwlock_t         *rwlock;
+  _Atomic int                   step;
+} lease_check_t;
+
+/* ========================================================================= */
+/* -- PRIVATE METHODS ------------------------------------------------------ */
+/* ========================================================================= */
+
+static void
+check_timeout (
+  int                           signal_number
+) {
+  (void) signal_number;
+  static const char message[] = "FAIL: timed out\n";
+  (void) write(STDERR_FILENO, message, (sizeof(message) - 1));
+  _exit(1);
+} /* check_timeout() */
+
+/* ------------------------------------------------------------------------- */
+
+static void
+await_step (
+  lease_check_t                *check,
+  int                           step
+) {
+  while (step != atomic_load(&check->step)) {
+    sched_yield();
+  }
+} /* await_step() */
+
+/* ------------------------------------------------------------------------- */
+
+/* Owns the lease on partition 0 and reads it by lease, then wants 1 */
+static void *
+lease_owner_thread (
+  void                         *arg
+) {
+  lease_check_t *check = arg;
+
+  for (int ii = 0; ii < LEASE_EARNING_READS; ++ii) {
+    (void) partitioned_rwlock_rdlock(check->rwlock, 0);
+    (void) partitioned_rwlock_rdunlock(check->rwlock, 0);
+  }
+  (void) partitioned_rwlock_rdlock(check->rwlock, 0);
+  atomic_store(&check->step, 1);
+  await_step(check, 2);
+  (void) partitioned_rwlock_wrlock(check->rwlock, 1);
+  (void) partitioned_rwlock_wrunlock(check->rwlock, 1);
+  (void) partitioned_rwlock_rdunlock(check->rwlock, 0);
+  return NULL;
+} /* lease_owner_thread() */
+
+/* ------------------------------------------------------------------------- */
+
+/* Holds partition 1 while reading 0, so must not wait for the owner */
+static void *
+lease_reader_thread (
+  void                         *arg
+) {
+  lease_check_t *check = arg;
+
+  await_step(check, 1);
+  (void) partitioned_rwlock_rdlock(check->rwlock, 1);
+  atomic_store(&check->step, 2);
+  /* Give the owner time to block on partition 1 */
+  (void) usleep(100000);
+  (void) partitioned_rwlock_rdlock(check->rwlock, 0);
+  (void) partitioned_rwlock_rdunlock(check->rwlock, 0);
+  (void) partitioned_rwlock_rdunlock(check->rwlock, 1);
+  return NULL;
+} /* lease_reader_thread() */
+
+/* ------------------------------------------------------------------------- */
+
+/* A reader from another thread must not wait out the lease owner's reads */
+static int
+check_lease_foreign_reader (
+  void
+) {
+  partitioned_rwlock_attr_t attr;
+  lease_check_t check;
+  pthread_t owner;
+  pthread_t reader;
+
+  (void) partitioned_rwlock_attr_init(&attr);
+  attr.flags = PRWLOCK_FLAG_READ_LEASE;
+  /* The owner holds a read while wanting a write, so readers go first */
+  attr.policy = PRWLOCK_POLICY_READER_PREFERRING;
+  atomic_store(&check.step, 0);
+  if (0 != partitioned_rwlock_init_ex(&check.rwlock, 4, &attr)) {
+    return -1;
+  }
+  if (0 != pthread_create(&owner, NULL, lease_owner_thread, &check)
+    || 0 != pthread_create(&reader, NULL, lease_reader_thread, &check)) {
+    printf("Failed to create threads!\n");
+    return -1;
+  }
+  (void) pthread_join(owner, NULL);
+  (void) pthread_join(reader, NULL);
+  return partitioned_rwlock_destroy(check.rwlock);
+} /* check_lease_foreign_reader() */
+
+/* ========================================================================= */
+/* -- PUBLIC METHODS ------------------------------------------------------- */
+/* ========================================================================= */
+
+int
+main (
+  void
+) {
+  (void) signal(SIGALRM, check_timeout);
+  (void) alarm(CHECK_TIMEOUT);
+
+  if (0 != check_lease_foreign_reader()) {
+    printf("%s: FAIL: lease foreign reader\n", BENCHMARK_BACKEND);
+    return 1;
+  }
+  printf("%s: ok\n", BENCHMARK_BACKEND);
+  return 0;
+} /* main() */
+
+/* :vi set ts=2 et sw=2: */
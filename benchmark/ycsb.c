@@ -0,0 +1,815 @@
+/* ========================================================================= **
+**                                      __           __                      **
+**                       ______      __/ /___  _____/ /__                    **
+**                      / ___/ | /| / / / __ \/ ___/ //_/                    **
+**                     / /   | |/ |/ / / /_/ / /__/ ,<                       **
+**                    /_/    |__/|__/_/\____/\___/_/|_|                      **
+**                                                                           **
+** ========================================================================= **
+**                      PARTITIONED READER-WRITER LOCK                       **
+** ========================================================================= **
+**                                                                           **
+** Copyright (c) 2002-2018 Jonah H. Harris.                                  **
+**                                                                           **
+** This library is free software; you can redistribute it and/or modify it   **
+** under the terms of the GNU Lesser General Public License as published by  **
+** the Free Software Foundation; either version 3 of the License, or (at     **
+** your option) any later version.                                           **
+**                                                                           **
+** This library is distributed in the hope it will be useful, but WITHOUT    **
+** ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or     **
+** FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public       **
+** License for more details.                                                 **
+**                                                                           **
+** You should have received a copy of the GNU Lesser General Public License  **
+** along with this library; if not, write to the Free Software Foundation,   **
+** Inc., 675 Mass Ave, Cambridge, MA 02139, USA.                             **
+** ========================================================================= */
+
+/*
+ * YCSB-style core workloads against the partitioned hash map: a load phase
+ * inserts every record, then each thread runs the workload's operation mix
+ * with keys drawn as YCSB draws them. Unlike benchmark.c, the time under
+ * the lock is real table work, not a busy loop.
+ *
+ *   a  50% read, 50% update           (zipfian)
+ *   b  95% read,  5% update           (zipfian)
+ *   c  100% read                      (zipfian)
+ *   d  95% read,  5% insert           (latest)
+ *   f  50% read, 50% read-modify-write (zipfian)
+ *
+ * Workload e scans key ranges, which a hash map has no order for; -m reads
+ * in batches through partitioned_map_get_many() instead.
+ */
+
+/* ========================================================================= */
+/* -- INCLUSIONS ----------------------------------------------------------- */
+/* ========================================================================= */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <time.h>
+#include <math.h>
+#include <stdatomic.h>
+
+#ifdef USE_LIBUV_RWLOCK
+# include <uv.h>
+#else
+# include <pthread.h>
+#endif /* USE_LIBUV_RWLOCK */
+
+#include "prwlock.h"
+#include "prwlock_map.h"
+
+/* ========================================================================= */
+/* -- DEFINITIONS ---------------------------------------------------------- */
+/* ========================================================================= */
+
+#ifndef NUM_THREADS
+# define NUM_THREADS            6
+#endif /* NUM_THREADS */
+
+#ifndef NUM_PARTITIONS
+# define NUM_PARTITIONS         1024
+#endif /* NUM_PARTITIONS */
+
+#ifndef NUM_OPERATIONS
+# define NUM_OPERATIONS         1000000
+#endif /* NUM_OPERATIONS */
+
+#ifndef NUM_RECORDS
+# define NUM_RECORDS            1000000
+#endif /* NUM_RECORDS */
+
+#if defined(USE_LIBUV_RWLOCK)
+# define BENCHMARK_BACKEND      "libuv"
+#elif defined(USE_FUTEX)
+# define BENCHMARK_BACKEND      "futex"
+#elif defined(USE_ATOMICS)
+# define BENCHMARK_BACKEND      "atomics"
+#else
+# define BENCHMARK_BACKEND      "pthread"
+#endif
+
+/* Log-linear latency histogram: 16 sub-buckets per power of two */
+#define LATENCY_SUB_BUCKET_BITS 4
+#define LATENCY_SUB_BUCKETS     (1 << LATENCY_SUB_BUCKET_BITS)
+#define LATENCY_BUCKETS         (64 * LATENCY_SUB_BUCKETS)
+
+/* Largest -m batch */
+#define MAX_BATCH               1024
+
+#define OP_READ                 0
+#define OP_UPDATE               1
+#define OP_INSERT               2
+#define OP_RMW                  3
+#define OP_COUNT                4
+
+/* ========================================================================= */
+/* -- PRIVATE TYPES -------------------------------------------------------- */
+/* ========================================================================= */
+
+typedef enum {
+  OUTPUT_TEXT = 0,
+  OUTPUT_CSV
+} output_format_t;
+
+/* Percentages of each operation, and whether reads favour recent inserts */
+typedef struct {
+  char                          name;
+  unsigned int                  percent[OP_COUNT];
+  int                           latest;
+} workload_t;
+
+/*
+ * Zipfian ranks after Gray et al., as YCSB generates them, over the loaded
+ * records; theta 0 draws uniformly instead.
+ */
+typedef struct {
+  uint64_t                      record_count;
+  double                        theta;
+  double                        zetan;
+  double                        alpha;
+  double                        eta;
+  double                        half_pow_theta;
+} key_generator_t;
+
+typedef struct {
+  size_t                        thread_count;
+  size_t                        partition_count;
+  uint64_t                      operation_count;
+  size_t                        batch;
+  const workload_t             *workload;
+  key_generator_t               keys;
+  partitioned_rwlock_attr_t     attr;
+  output_format_t               output;
+} benchmark_config_t;
+
+typedef struct {
+  uint64_t                      count[LATENCY_BUCKETS];
+  uint64_t                      total;
+  uint64_t                      max;
+} latency_histogram_t;
+
+typedef struct {
+  uint64_t                      operation_count;
+  uint64_t                      miss_count;
+  latency_histogram_t           latency;
+} op_output_t;
+
+typedef struct {
+  partitioned_map_t            *map;
+  const benchmark_config_t     *config;
+  _Atomic uint64_t             *next_key;
+  uint64_t                      random_state;
+  op_output_t                   op[OP_COUNT];
+} thread_context_t;
+
+typedef struct {
+  size_t                        thread_count;
+  double                        load_elapsed;
+  double                        elapsed;
+  op_output_t                   op[OP_COUNT];
+} benchmark_result_t;
+
+/* ========================================================================= */
+/* -- PRIVATE DATA --------------------------------------------------------- */
+/* ========================================================================= */
+
+static const char *op_name[OP_COUNT] = { "read", "update", "insert", "rmw" };
+
+static const workload_t workloads[] = {
+  { 'a', { 50, 50, 0, 0 }, 0 },
+  { 'b', { 95, 5, 0, 0 }, 0 },
+  { 'c', { 100, 0, 0, 0 }, 0 },
+  { 'd', { 95, 0, 5, 0 }, 1 },
+  { 'f', { 50, 0, 0, 50 }, 0 }
+};
+
+/* ========================================================================= */
+/* -- PRIVATE METHODS ------------------------------------------------------ */
+/* ========================================================================= */
+
+static uint64_t
+now_ns (
+  void
+) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (((uint64_t) ts.tv_sec * UINT64_C(1000000000))
+    + (uint64_t) ts.tv_nsec);
+} /* now_ns() */
+
+/* ------------------------------------------------------------------------- */
+
+/* splitmix64: cheap, stateless enough to seed one stream per thread */
+static uint64_t
+random_next (
+  uint64_t                     *state
+) {
+  uint64_t z = (*state += UINT64_C(0x9e3779b97f4a7c15));
+  z = ((z ^ (z >> 30)) * UINT64_C(0xbf58476d1ce4e5b9));
+  z = ((z ^ (z >> 27)) * UINT64_C(0x94d049bb133111eb));
+  return (z ^ (z >> 31));
+} /* random_next() */
+
+/* ------------------------------------------------------------------------- */
+
+static double
+random_unit (
+  uint64_t                     *state
+) {
+  return ((double) (random_next(state) >> 11) * 0x1.0p-53);
+} /* random_unit() */
+
+/* ------------------------------------------------------------------------- */
+
+/* YCSB's scrambling of ranks, so the hot records are spread over the keys */
+static uint64_t
+fnv_hash (
+  uint64_t                      value
+) {
+  uint64_t hash = UINT64_C(0xcbf29ce484222325);
+
+  for (int ii = 0; ii < 8; ++ii) {
+    hash ^= (value & 0xff);
+    hash *= UINT64_C(0x100000001b3);
+    value >>= 8;
+  }
+  return hash;
+} /* fnv_hash() */
+
+/* ------------------------------------------------------------------------- */
+
+static int
+key_generator_init (
+  key_generator_t              *keys
+) {
+  if (0 == keys->record_count) {
+    fprintf(stderr, "record count must be positive\n");
+    return -1;
+  }
+  if (0.0 == keys->theta) {
+    return 0;
+  }
+
+  double theta = keys->theta;
+  double zeta2 = 1.0 + pow(0.5, theta);
+
+  if (!(0.0 < theta && 1.0 > theta)) {
+    fprintf(stderr, "zipf theta must be in (0, 1)\n");
+    return -1;
+  }
+  keys->zetan = 0.0;
+  for (uint64_t ii = 1; ii <= keys->record_count; ++ii) {
+    keys->zetan += (1.0 / pow((double) ii, theta));
+  }
+  keys->alpha = (1.0 / (1.0 - theta));
+  keys->eta = ((1.0 - pow(2.0 / (double) keys->record_count, 1.0 - theta))
+    / (1.0 - (zeta2 / keys->zetan)));
+  keys->half_pow_theta = pow(0.5, theta);
+  return 0;
+} /* key_generator_init() */
+
+/* ------------------------------------------------------------------------- */
+
+/* Rank 0 is the hottest */
+static uint64_t
+key_generator_rank (
+  const key_generator_t        *keys,
+  uint64_t                     *state
+) {
+  if (0.0 == keys->theta) {
+    return (random_next(state) % keys->record_count);
+  }
+
+  double uz = (random_unit(state) * keys->zetan);
+  if (1.0 > uz) {
+    return 0;
+  }
+  if ((1.0 + keys->half_pow_theta) > uz) {
+    return 1;
+  }
+  uint64_t rank = (uint64_t) ((double) keys->record_count
+    * pow((keys->eta * (uz / keys->zetan)) - keys->eta + 1.0, keys->alpha));
+  return (rank < keys->record_count) ? rank : (keys->record_count - 1);
+} /* key_generator_rank() */
+
+/* ------------------------------------------------------------------------- */
+
+/* The latest distribution counts back from the newest insert */
+static uint64_t
+key_generator_next (
+  const benchmark_config_t     *config,
+  _Atomic uint64_t             *next_key,
+  uint64_t                     *state
+) {
+  uint64_t rank = key_generator_rank(&config->keys, state);
+
+  if (config->workload->latest) {
+    uint64_t newest = atomic_load_explicit(next_key, memory_order_relaxed);
+    return (rank < newest) ? (newest - 1 - rank) : 0;
+  }
+  if (0.0 == config->keys.theta) {
+    return rank;
+  }
+  return (fnv_hash(rank) % config->keys.record_count);
+} /* key_generator_next() */
+
+/* ------------------------------------------------------------------------- */
+
+static void
+latency_record (
+  latency_histogram_t          *histogram,
+  uint64_t                      nanoseconds
+) {
+  size_t bucket = nanoseconds;
+
+  if (nanoseconds >= LATENCY_SUB_BUCKETS) {
+    int msb = 63 - __builtin_clzll(nanoseconds);
+    bucket = ((size_t) (msb - LATENCY_SUB_BUCKET_BITS + 1)
+      << LATENCY_SUB_BUCKET_BITS)
+      + ((nanoseconds >> (msb - LATENCY_SUB_BUCKET_BITS))
+        & (LATENCY_SUB_BUCKETS - 1));
+  }
+  ++histogram->count[bucket];
+  ++histogram->total;
+  if (nanoseconds > histogram->max) {
+    histogram->max = nanoseconds;
+  }
+} /* latency_record() */
+
+/* ------------------------------------------------------------------------- */
+
+static void
+latency_merge (
+  latency_histogram_t          *into,
+  const latency_histogram_t    *from
+) {
+  for (size_t ii = 0; ii < LATENCY_BUCKETS; ++ii) {
+    into->count[ii] += from->count[ii];
+  }
+  into->total += from->total;
+  if (from->max > into->max) {
+    into->max = from->max;
+  }
+} /* latency_merge() */
+
+/* ------------------------------------------------------------------------- */
+
+/* Returns the upper bound of the bucket holding the given percentile */
+static uint64_t
+latency_percentile (
+  const latency_histogram_t    *histogram,
+  double                        percentile
+) {
+  uint64_t rank = (uint64_t) ((percentile / 100.0) * histogram->total);
+  uint64_t seen = 0;
+
+  for (size_t ii = 0; ii < LATENCY_BUCKETS; ++ii) {
+    seen += histogram->count[ii];
+    if (seen > rank) {
+      if (ii < LATENCY_SUB_BUCKETS) {
+        return ii;
+      }
+      int shift = (int) (ii >> LATENCY_SUB_BUCKET_BITS) - 1;
+      uint64_t lower = (uint64_t) (LATENCY_SUB_BUCKETS
+        | (ii & (LATENCY_SUB_BUCKETS - 1))) << shift;
+      uint64_t upper = lower + (UINT64_C(1) << shift) - 1;
+      return (upper < histogram->max) ? upper : histogram->max;
+    }
+  }
+  return histogram->max;
+} /* latency_percentile() */
+
+/* ------------------------------------------------------------------------- */
+
+static int
+choose_op (
+  const workload_t             *workload,
+  uint64_t                     *state
+) {
+  unsigned int roll = (unsigned int) (random_next(state) % 100);
+
+  for (int op = 0; op < OP_COUNT; ++op) {
+    if (roll < workload->percent[op]) {
+      return op;
+    }
+    roll -= workload->percent[op];
+  }
+  return OP_READ;
+} /* choose_op() */
+
+/* ------------------------------------------------------------------------- */
+
+#ifdef USE_LIBUV_RWLOCK
+static void
+#else
+static void *
+#endif /* USE_LIBUV_RWLOCK */
+workload_thread (
+  void                         *arg
+) {
+  thread_context_t *context = (thread_context_t *) arg;
+  const benchmark_config_t *config = context->config;
+  partitioned_map_t *map = context->map;
+  uint64_t keys[MAX_BATCH];
+  uint64_t values[MAX_BATCH];
+  uint8_t found[MAX_BATCH];
+  uint64_t value;
+
+  for (uint64_t ii = 0; ii < config->operation_count; ++ii) {
+    int op = choose_op(config->workload, &context->random_state);
+    op_output_t *output = &context->op[op];
+    uint64_t key = key_generator_next(config, context->next_key,
+      &context->random_state);
+    uint64_t start = now_ns();
+    uint64_t misses = 0;
+
+    switch (op) {
+      case OP_READ:
+        if (1 == config->batch) {
+          misses = (0 != partitioned_map_get(map, key, &value));
+          break;
+        }
+        keys[0] = key;
+        for (size_t jj = 1; jj < config->batch; ++jj) {
+          keys[jj] = key_generator_next(config, context->next_key,
+            &context->random_state);
+        }
+        misses = (config->batch - partitioned_map_get_many(map, keys,
+          config->batch, values, found));
+        break;
+
+      case OP_UPDATE:
+        misses = (0 != partitioned_map_put(map, key,
+          random_next(&context->random_state)));
+        break;
+
+      case OP_INSERT:
+        key = atomic_fetch_add_explicit(context->next_key, 1,
+          memory_order_relaxed);
+        misses = (0 != partitioned_map_put(map, key, key));
+        break;
+
+      default:
+        misses = (0 != partitioned_map_get(map, key, &value)
+          || 0 != partitioned_map_put(map, key, (value + 1)));
+        break;
+    }
+
+    latency_record(&output->latency, (now_ns() - start));
+    output->operation_count += (OP_READ == op) ? config->batch : 1;
+    output->miss_count += misses;
+  }
+
+#ifndef USE_LIBUV_RWLOCK
+  return NULL;
+#endif /* USE_LIBUV_RWLOCK */
+} /* workload_thread() */
+
+/* ------------------------------------------------------------------------- */
+
+static int
+benchmark_run (
+  const benchmark_config_t     *config,
+  benchmark_result_t           *result
+) {
+  partitioned_map_t *map;
+  thread_context_t *contexts;
+  _Atomic uint64_t next_key;
+#ifdef USE_LIBUV_RWLOCK
+  uv_thread_t *threads;
+#else
+  pthread_t *threads;
+#endif /* USE_LIBUV_RWLOCK */
+
+  if (0 != partitioned_map_init(&map, config->partition_count,
+    config->keys.record_count, &config->attr)) {
+    fprintf(stderr, "can't initialize map\n");
+    return -1;
+  }
+
+  contexts = calloc(config->thread_count, sizeof(*contexts));
+  threads = calloc(config->thread_count, sizeof(*threads));
+  if (NULL == contexts || NULL == threads) {
+    fprintf(stderr, "can't allocate %zu threads\n", config->thread_count);
+    free(contexts);
+    free(threads);
+    partitioned_map_destroy(map);
+    return -1;
+  }
+
+  memset(result, 0, sizeof(*result));
+  result->thread_count = config->thread_count;
+
+  uint64_t start_time = now_ns();
+  for (uint64_t key = 0; key < config->keys.record_count; ++key) {
+    if (0 != partitioned_map_put(map, key, key)) {
+      fprintf(stderr, "can't load record %"PRIu64"\n", key);
+      exit(-1);
+    }
+  }
+  atomic_init(&next_key, config->keys.record_count);
+  result->load_elapsed = ((double) (now_ns() - start_time) / 1E9);
+
+  start_time = now_ns();
+  for (size_t ii = 0; ii < config->thread_count; ++ii) {
+    contexts[ii].map = map;
+    contexts[ii].config = config;
+    contexts[ii].next_key = &next_key;
+    contexts[ii].random_state = (ii + 1);
+
+#ifdef USE_LIBUV_RWLOCK
+    uv_thread_create(&threads[ii], workload_thread, &contexts[ii]);
+#else
+    (void) pthread_create(&threads[ii], NULL, workload_thread,
+      &contexts[ii]);
+#endif /* USE_LIBUV_RWLOCK */
+  }
+
+  for (size_t ii = 0; ii < config->thread_count; ++ii) {
+#ifdef USE_LIBUV_RWLOCK
+    (void) uv_thread_join(&threads[ii]);
+#else
+    (void) pthread_join(threads[ii], NULL);
+#endif /* USE_LIBUV_RWLOCK */
+    for (int op = 0; op < OP_COUNT; ++op) {
+      result->op[op].operation_count += contexts[ii].op[op].operation_count;
+      result->op[op].miss_count += contexts[ii].op[op].miss_count;
+      latency_merge(&result->op[op].latency, &contexts[ii].op[op].latency);
+    }
+  }
+  result->elapsed = ((double) (now_ns() - start_time) / 1E9);
+
+  free(contexts);
+  free(threads);
+  partitioned_map_destroy(map);
+  return 0;
+} /* benchmark_run() */
+
+/* ------------------------------------------------------------------------- */
+
+static const char *
+policy_name (
+  partitioned_rwlock_policy_t   policy
+) {
+  switch (policy) {
+    case PRWLOCK_POLICY_READER_PREFERRING:
+      return "reader";
+    case PRWLOCK_POLICY_WRITER_PREFERRING:
+      return "writer";
+    case PRWLOCK_POLICY_PHASE_FAIR:
+      return "phase-fair";
+    default:
+      return "default";
+  }
+} /* policy_name() */
+
+/* ------------------------------------------------------------------------- */
+
+static void
+benchmark_print (
+  const benchmark_config_t     *config,
+  const benchmark_result_t     *result
+) {
+  uint64_t operations = 0;
+  char distribution[32];
+
+  for (int op = 0; op < OP_COUNT; ++op) {
+    operations += result->op[op].operation_count;
+  }
+  if (0.0 == config->keys.theta) {
+    snprintf(distribution, sizeof(distribution), "uniform");
+  } else {
+    snprintf(distribution, sizeof(distribution), "%s:%g",
+      (config->workload->latest) ? "latest" : "zipf", config->keys.theta);
+  }
+
+  if (OUTPUT_CSV == config->output) {
+    printf("backend,workload,threads,partitions,records,distribution,batch,"
+      "policy,bias,load_seconds,operations,seconds,ops_per_sec");
+    for (int op = 0; op < OP_COUNT; ++op) {
+      printf(",%1$s_ops,%1$s_misses,%1$s_p50_ns,%1$s_p99_ns,%1$s_max_ns",
+        op_name[op]);
+    }
+    printf("\n%s,%c,%zu,%zu,%"PRIu64",%s,%zu,%s,%d,%.6f,%"PRIu64",%.6f,%.0f",
+      BENCHMARK_BACKEND, config->workload->name, result->thread_count,
+      config->partition_count, config->keys.record_count, distribution,
+      config->batch, policy_name(config->attr.policy),
+      !!(config->attr.flags & PRWLOCK_FLAG_READER_BIAS),
+      result->load_elapsed, operations, result->elapsed,
+      ((double) operations / result->elapsed));
+    for (int op = 0; op < OP_COUNT; ++op) {
+      const op_output_t *output = &result->op[op];
+
+      printf(",%"PRIu64",%"PRIu64",%"PRIu64",%"PRIu64",%"PRIu64,
+        output->operation_count, output->miss_count,
+        latency_percentile(&output->latency, 50.0),
+        latency_percentile(&output->latency, 99.0), output->latency.max);
+    }
+    printf("\n");
+    return;
+  }
+
+  printf("%s: workload %c, %zu threads, %zu partitions, %"PRIu64" records "
+    "(%s), read batch %zu, %s policy%s\n", BENCHMARK_BACKEND,
+    config->workload->name, result->thread_count, config->partition_count,
+    config->keys.record_count, distribution, config->batch,
+    policy_name(config->attr.policy),
+    (config->attr.flags & PRWLOCK_FLAG_READER_BIAS) ? ", reader-biased" : "");
+  printf("loaded in %.3f s; %"PRIu64" operations in %.3f s: %.0f ops/s\n",
+    result->load_elapsed, operations, result->elapsed,
+    ((double) operations / result->elapsed));
+  for (int op = 0; op < OP_COUNT; ++op) {
+    const op_output_t *output = &result->op[op];
+
+    if (0 == output->operation_count) {
+      continue;
+    }
+    printf("  %-6s %12"PRIu64" ops, %"PRIu64" misses, latency p50 %"PRIu64
+      " ns, p99 %"PRIu64" ns, max %"PRIu64" ns\n", op_name[op],
+      output->operation_count, output->miss_count,
+      latency_percentile(&output->latency, 50.0),
+      latency_percentile(&output->latency, 99.0), output->latency.max);
+  }
+} /* benchmark_print() */
+
+/* ------------------------------------------------------------------------- */
+
+static int
+parse_unsigned (
+  const char                   *arg,
+  char                          option,
+  uint64_t                      minimum,
+  uint64_t                     *value
+) {
+  char *end = NULL;
+  unsigned long long parsed = strtoull(arg, &end, 10);
+
+  if ('\0' == *arg || '\0' != *end || '-' == *arg || parsed < minimum) {
+    fprintf(stderr, "invalid value '%s' for -%c\n", arg, option);
+    return -1;
+  }
+  *value = (uint64_t) parsed;
+  return 0;
+} /* parse_unsigned() */
+
+/* ------------------------------------------------------------------------- */
+
+static void
+usage (
+  const char                   *program
+) {
+  fprintf(stderr,
+    "usage: %s [options]\n"
+    "  -W workload      a | b | c | d | f (default a)\n"
+    "  -t threads       worker threads (default %d)\n"
+    "  -p partitions    map partitions (default %d)\n"
+    "  -n operations    operations per thread (default %d)\n"
+    "  -k records       records loaded before the run (default %d)\n"
+    "  -d distribution  uniform | zipf[:theta] (default zipf:0.99; "
+      "workload d\n"
+    "                   counts back from the newest record)\n"
+    "  -m batch         keys per read, grouped by partition (default 1)\n"
+    "  -o format        text | csv (default text)\n"
+    "  -P policy        default | reader | writer | phase-fair\n"
+    "  -b               reader-biased partitions\n",
+    program, NUM_THREADS, NUM_PARTITIONS, NUM_OPERATIONS, NUM_RECORDS);
+} /* usage() */
+
+/* ========================================================================= */
+/* -- PUBLIC METHODS ------------------------------------------------------- */
+/* ========================================================================= */
+
+int
+main (
+  int                           argc,
+  char                        **argv
+) {
+  benchmark_config_t config;
+  benchmark_result_t result;
+  uint64_t value;
+  int opt;
+
+  memset(&config, 0, sizeof(config));
+  config.thread_count = NUM_THREADS;
+  config.partition_count = NUM_PARTITIONS;
+  config.operation_count = NUM_OPERATIONS;
+  config.batch = 1;
+  config.workload = &workloads[0];
+  config.keys.record_count = NUM_RECORDS;
+  config.keys.theta = 0.99;
+  partitioned_rwlock_attr_init(&config.attr);
+
+  while (-1 != (opt = getopt(argc, argv, "W:t:p:n:k:d:m:o:P:b"))) {
+    switch (opt) {
+      case 'W':
+        config.workload = NULL;
+        for (size_t ii = 0; ii < (sizeof(workloads) / sizeof(*workloads));
+          ++ii) {
+          if (optarg[0] == workloads[ii].name && '\0' == optarg[1]) {
+            config.workload = &workloads[ii];
+          }
+        }
+        if (NULL == config.workload) {
+          fprintf(stderr, "unknown workload '%s'\n", optarg);
+          return 1;
+        }
+        break;
+      case 't':
+        if (0 != parse_unsigned(optarg, opt, 1, &value)) {
+          return 1;
+        }
+        config.thread_count = (size_t) value;
+        break;
+      case 'p':
+        if (0 != parse_unsigned(optarg, opt, 1, &value)) {
+          return 1;
+        }
+        config.partition_count = (size_t) value;
+        break;
+      case 'n':
+        if (0 != parse_unsigned(optarg, opt, 1, &value)) {
+          return 1;
+        }
+        config.operation_count = value;
+        break;
+      case 'k':
+        if (0 != parse_unsigned(optarg, opt, 1, &value)) {
+          return 1;
+        }
+        config.keys.record_count = value;
+        break;
+      case 'd':
+        if (0 == strcmp(optarg, "uniform")) {
+          config.keys.theta = 0.0;
+        } else if (0 == strncmp(optarg, "zipf", 4)
+          && ('\0' == optarg[4] || ':' == optarg[4])) {
+          config.keys.theta = 0.99;
+          if (':' == optarg[4]
+            && 1 != sscanf(&optarg[5], "%lf", &config.keys.theta)) {
+            fprintf(stderr, "invalid zipf theta '%s'\n", &optarg[5]);
+            return 1;
+          }
+        } else {
+          fprintf(stderr, "unknown distribution '%s'\n", optarg);
+          return 1;
+        }
+        break;
+      case 'm':
+        if (0 != parse_unsigned(optarg, opt, 1, &value)) {
+          return 1;
+        }
+        if (MAX_BATCH < value) {
+          fprintf(stderr, "batches are at most %d keys\n", MAX_BATCH);
+          return 1;
+        }
+        config.batch = (size_t) value;
+        break;
+      case 'o':
+        if (0 == strcmp(optarg, "text")) {
+          config.output = OUTPUT_TEXT;
+        } else if (0 == strcmp(optarg, "csv")) {
+          config.output = OUTPUT_CSV;
+        } else {
+          fprintf(stderr, "unknown output format '%s'\n", optarg);
+          return 1;
+        }
+        break;
+      case 'P':
+        if (0 == strcmp(optarg, "default")) {
+          config.attr.policy = PRWLOCK_POLICY_DEFAULT;
+        } else if (0 == strcmp(optarg, "reader")) {
+          config.attr.policy = PRWLOCK_POLICY_READER_PREFERRING;
+        } else if (0 == strcmp(optarg, "writer")) {
+          config.attr.policy = PRWLOCK_POLICY_WRITER_PREFERRING;
+        } else if (0 == strcmp(optarg, "phase-fair")) {
+          config.attr.policy = PRWLOCK_POLICY_PHASE_FAIR;
+        } else {
+          fprintf(stderr, "unknown policy '%s'\n", optarg);
+          return 1;
+        }
+        break;
+      case 'b':
+        config.attr.flags |= PRWLOCK_FLAG_READER_BIAS;
+        break;
+      default:
+        usage(argv[0]);
+        return 1;
+    }
+  }
+
+  if (0 != key_generator_init(&config.keys)
+    || 0 != benchmark_run(&config, &result)) {
+    return 1;
+  }
+  benchmark_print(&config, &result);
+  return 0;
+
+} /* main() */
+
+/* :vi set ts=2 et sw=2: */
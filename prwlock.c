@@ -31,11 +31,34 @@
 /* ========================================================================= */
 
 #include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
 #include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <sched.h>
 #include <pthread.h>
+#include <stdatomic.h>
 #include <assert.h>
+#include <limits.h>
+#include <inttypes.h>
+#if defined(__linux__)
+# include <unistd.h>
+# include <sys/mman.h>
+# include <sys/syscall.h>
+#endif /* __linux__ */
+#if defined(USE_FUTEX)
+# include <linux/futex.h>
+#endif /* USE_FUTEX */
+#if defined(__linux__) && defined(SYS_membarrier)
+# include <linux/membarrier.h>
+#endif /* __linux__ && SYS_membarrier */
+#if defined(__GLIBC__)
+# include <execinfo.h>
+#endif /* __GLIBC__ */
 
 #include "prwlock.h"
+#include "prwlock_inline.h"
 
 /* ========================================================================= */
 /* -- DEFINITIONS ---------------------------------------------------------- */
@@ -43,52 +66,824 @@
 
 #define CACHE_LINE_SIZE         64
 
+/* Cells one adjacent-line prefetch pair apart */
+#define CACHE_LINE_PAIR_SIZE    (2 * CACHE_LINE_SIZE)
+
+/* Visible-reader slots per reader-biased lock (must be a power of two) */
+#define PRWLOCK_VISIBLE_READER_SLOTS    4096
+
+/* Bias stays off for this many times the duration of the last revocation */
+#define PRWLOCK_BIAS_INHIBIT_FACTOR     9
+
+/* Slot values pack (thread id + 1) above the partition index */
+#define PRWLOCK_BIAS_PARTITION_BITS     40
+#define PRWLOCK_BIAS_PARTITION_MASK                                           \
+  ((UINT64_C(1) << PRWLOCK_BIAS_PARTITION_BITS) - 1)
+
+/* Spins before a waiting thread starts yielding its timeslice */
+#define PRWLOCK_SPIN_LIMIT      128
+
+/* Exponential backoff rounds (1, 2, 4, ... pauses) before a waiter parks */
+#define PRWLOCK_SPIN_ROUNDS     8
+
+/*
+ * Acquisition deadlines are CLOCK_MONOTONIC nanoseconds. NOW asks for a
+ * single attempt (failing with EBUSY), NONE for a wait without a timeout.
+ */
+#define PRWLOCK_DEADLINE_NOW            UINT64_C(0)
+#define PRWLOCK_DEADLINE_NONE           UINT64_MAX
+
+/* An unlock that leaves the held mode for the cell to work out */
+#define PRWLOCK_UNLOCK_INFER            (-1)
+
+/* A release that may have let waiters of any partition in */
+#define PRWLOCK_PARTITION_ANY           SIZE_MAX
+
+/* Bounds of the doubling sleep of timed waiters on cells that cannot park */
+#define PRWLOCK_POLL_SLEEP_MIN_NS       1000
+#define PRWLOCK_POLL_SLEEP_MAX_NS       64000
+
+/* wyhash (final version 4) default secret */
+#define PRWLOCK_HASH_SECRET0    UINT64_C(0x2d358dccaa6c78a5)
+#define PRWLOCK_HASH_SECRET1    UINT64_C(0x8bb84b93962eacc9)
+#define PRWLOCK_HASH_SECRET2    UINT64_C(0x4b33a62ed433d4a3)
+#define PRWLOCK_HASH_SECRET3    UINT64_C(0x4d5a2da51de1aa47)
+
+/* Alignment of the caller data kept in each cell */
+#define PRWLOCK_CELL_DATA_ALIGN         16
+
+/* Partition sets up to this size are sorted on the stack by insertion */
+#define PRWLOCK_MANY_STACK_COUNT        16
+
+/* Per-thread ingress counters of a global lock (must be a power of two) */
+#define PRWLOCK_INGRESS_SLOTS           64
+
+/* Per-thread reader counters of a resizable lock (a power of two) */
+#define PRWLOCK_RESIZE_SLOTS            64
+
+/* Distinct global locks a thread can hold partitions of and still nest */
+#define PRWLOCK_GLOBAL_HOLD_SLOTS       8
+
+/* Statistics shards (must be a power of two), chosen by thread id */
+#define PRWLOCK_STATS_SHARDS            8
+
+/* Epoch reader slots come in chunks of this many, allocated on demand */
+#define PRWLOCK_EPOCH_CHUNK_SLOTS       64
+#define PRWLOCK_EPOCH_CHUNKS            64
+
+/* Deferred reclamations that make the deferring writer wait out a grace */
+#define PRWLOCK_EPOCH_DEFER_BATCH       64
+
+/* Shortest wait or hold a traced lock records, unless attr says */
+#define PRWLOCK_TRACE_THRESHOLD_NS      1000000
+
+/* Traced threads per lock, and records per thread (a power of two) */
+#define PRWLOCK_TRACE_RINGS             256
+#define PRWLOCK_TRACE_RING_RECORDS      128
+
+/* Held partitions per thread whose hold a trace can time */
+#define PRWLOCK_TRACE_HOLD_SLOTS        16
+
+/* How long the cycle counter is timed against the clock, once */
+#define PRWLOCK_TRACE_CALIBRATE_NS      2000000
+
+/*
+ * Read leases: consecutive reads of a partition by one thread that earn it
+ * a lease, doubled for each lease in a row revoked before it was used that
+ * often, and the number of such leases after which the partition is no
+ * longer leased. Streaks are kept per thread, in a small table by partition.
+ */
+#define PRWLOCK_LEASE_GRANT_READS       UINT32_C(64)
+#define PRWLOCK_LEASE_STRIKE_LIMIT      8
+#define PRWLOCK_LEASE_STREAKS           16
+
+/* Lease owner words hold the owning thread's id plus one, and this bit */
+#define PRWLOCK_LEASE_REVOKING          0x80000000u
+
+/* Operations a combiner runs before it hands combining on to a waiter */
+#define PRWLOCK_COMBINE_LIMIT           256
+
+/* States of a published operation, and a bit for a caller parked on it */
+#define PRWLOCK_COMBINE_WAITING         0x00000000u
+#define PRWLOCK_COMBINE_DONE            0x00000001u
+#define PRWLOCK_COMBINE_ELECTED         0x00000002u
+#define PRWLOCK_COMBINE_PARKED          0x80000000u
+
+/*
+ * Process-shared regions begin with this and the cell layout they were
+ * made for, so an incompatible build refuses to attach. Only flags whose
+ * state lives wholly in the cells are allowed there.
+ */
+#define PRWLOCK_SHARED_MAGIC            UINT64_C(0x70727772736801)
+#if defined(USE_LIBUV_RWLOCK)
+# define PRWLOCK_SHARED_BACKEND         0
+#elif defined(USE_FUTEX)
+# define PRWLOCK_SHARED_BACKEND         3
+#elif defined(USE_ATOMICS)
+# define PRWLOCK_SHARED_BACKEND         2
+#else
+# define PRWLOCK_SHARED_BACKEND         1
+#endif /* USE_LIBUV_RWLOCK */
+#define PRWLOCK_SHARED_FLAGS            PRWLOCK_FLAG_OPTIMISTIC
+
+/* Held partitions per thread whose hold time can be measured */
+#define PRWLOCK_STATS_HOLD_SLOTS        16
+
+/* Nodes a cohort tracks waiters on; higher node numbers fold onto these */
+#define PRWLOCK_COHORT_NODES            8
+
+/* Default limit on consecutive same-node handoffs of a partition */
+#define PRWLOCK_COHORT_BATCH            64
+
+/* Node lookups a thread serves from its cache before asking again */
+#define PRWLOCK_NUMA_NODE_REFRESH       256
+
+/* Highest NUMA node number cell placement can address, plus one */
+#define PRWLOCK_NUMA_MAX_NODES          1024
+
+/* mbind(2) policies and flags, as libnuma's <numaif.h> is not required */
+#define PRWLOCK_MPOL_PREFERRED          1
+#define PRWLOCK_MPOL_INTERLEAVE         3
+#define PRWLOCK_MPOL_MF_MOVE            (1 << 1)
+
+/*
+ * Intention word: an exclusive holder, or a count of shared holders. The
+ * first shared holder drains every partition holder, as an exclusive one
+ * would, while PENDING is set; once it clears, readers are let back in.
+ */
+#define PRWLOCK_GLOBAL_EXCLUSIVE        0x80000000u
+#define PRWLOCK_GLOBAL_PENDING          0x40000000u
+#define PRWLOCK_GLOBAL_SHARED           0x00000001u
+
+/* Flags under which a cell records whether it is write-held */
+#define PRWLOCK_WRITE_HELD_FLAGS                                              \
+  (PRWLOCK_FLAG_GLOBAL | PRWLOCK_FLAG_COHORT | PRWLOCK_FLAG_OPTIMISTIC        \
+    | PRWLOCK_FLAG_UPGRADABLE)
+
+/*
+ * Upgrader token: the owning thread's id plus one, a bit for threads parked
+ * waiting for it, and a bit for an upgrade waiting for readers to leave.
+ */
+#define PRWLOCK_UPGRADER_OWNER_MASK     0x3fffffffu
+#define PRWLOCK_UPGRADER_UPGRADING      0x40000000u
+#define PRWLOCK_UPGRADER_WAITING        0x80000000u
+
+/*
+ * Phase-fair ticket (PF-T) words, after Brandenburg and Anderson. Readers
+ * count in steps of PRWLOCK_PFT_RINC in rin/rout; the low byte of rin holds
+ * the writer-present and phase bits, plus a parked-readers bit. Writer
+ * tickets in win/wout step by two so bit 0 of wout can flag parked writers,
+ * and bit 0 of rout flags the writer parked waiting for readers to drain.
+ * The phase bit flips once per writer that actually enters (not per ticket,
+ * since a failed trywrlock consumes one), so a reader never mistakes the
+ * next writer for the one it queued behind.
+ */
+#define PRWLOCK_PFT_RINC                0x00000100u
+#define PRWLOCK_PFT_COUNT_MASK          0xffffff00u
+#define PRWLOCK_PFT_PHID                0x00000001u
+#define PRWLOCK_PFT_PRES                0x00000002u
+#define PRWLOCK_PFT_WBITS               (PRWLOCK_PFT_PRES | PRWLOCK_PFT_PHID)
+#define PRWLOCK_PFT_READERS_PARKED      0x00000004u
+#define PRWLOCK_PFT_WRITER_PARKED       0x00000001u
+#define PRWLOCK_PFT_TICKET              0x00000002u
+#define PRWLOCK_PFT_WRITERS_PARKED      0x00000001u
+
 /* ========================================================================= */
 /* -- MACROS --------------------------------------------------------------- */
 /* ========================================================================= */
 
+#if defined(__x86_64__) || defined(__i386__)
+# define PRWLOCK_CPU_RELAX()    __builtin_ia32_pause()
+#elif defined(__aarch64__)
+# define PRWLOCK_CPU_RELAX()    __asm__ __volatile__ ("yield" ::: "memory")
+#else
+# define PRWLOCK_CPU_RELAX()    __asm__ __volatile__ ("" ::: "memory")
+#endif
+
+#define PRWLOCK_CELL(rwlock, partition)                                       \
+  ((partitioned_rwlock_cell_t *) ((char *) (rwlock)->cells                    \
+    + ((partition) * (rwlock)->cell_stride)))
+
+#define PRWLOCK_TABLE_CELL(rwlock, table, partition)                          \
+  ((partitioned_rwlock_cell_t *) ((char *) (table)->cells                     \
+    + ((partition) * (rwlock)->cell_stride)))
+
+#define PRWLOCK_ROUND_UP(value, multiple)                                     \
+  ((((value) + (multiple) - 1) / (multiple)) * (multiple))
+
+/* Caller data follows the whole cell, whatever the stride */
+#define PRWLOCK_CELL_DATA_OFFSET                                              \
+  PRWLOCK_ROUND_UP(sizeof(partitioned_rwlock_cell_t), PRWLOCK_CELL_DATA_ALIGN)
+
+/* Public entry points note who called them, for PRWLOCK_FLAG_TRACE */
+#define PRWLOCK_TRACE_SITE(rwlock)                                            \
+  do {                                                                        \
+    if ((rwlock)->flags & PRWLOCK_FLAG_TRACE) {                               \
+      prwlock_trace_site = __builtin_return_address(0);                       \
+    }                                                                         \
+  } while (0)
+
+/* Process-shared cells are waited on by address, across processes */
+#if defined(USE_FUTEX)
+# define PRWLOCK_FUTEX_OP(rwlock, op)                                         \
+  ((NULL != (rwlock)->shared) ? (op) : ((op) | FUTEX_PRIVATE_FLAG))
+#endif /* USE_FUTEX */
+
+#define PRWLOCK_BIAS_SLOT_VALUE(thread_id, partition)                         \
+  ((((uint64_t) (thread_id) + 1) << PRWLOCK_BIAS_PARTITION_BITS)              \
+    | (uint64_t) (partition))
+
 /* ========================================================================= */
 /* -- PRIVATE TYPES -------------------------------------------------------- */
 /* ========================================================================= */
 
-#if defined(USE_LIBUV_RWLOCK) || defined(USE_ATOMICS)
+#if defined(USE_LIBUV_RWLOCK)
 typedef enum {
   PRWLOCK_TYPE_NONE,
-  PRWLOCK_TYPE_READ,
   PRWLOCK_TYPE_WRITE
 } prwlock_type_t;
 #endif /* USE_LIBUV_RWLOCK */
 
 typedef struct {
+  _Atomic uint32_t              rin;
+  _Atomic uint32_t              rout;
+  _Atomic uint32_t              win;
+  _Atomic uint32_t              wout;
+  _Atomic uint32_t              phase;
+  _Atomic uint32_t              writer_owned;
+} prwlock_pft_t;
+
+/* Cells are laid out cell_stride bytes apart, at least their own size */
+typedef struct {
+  union {
+    struct {
 #if defined(USE_LIBUV_RWLOCK)
-  uv_rwlock_t                   rwlock;
-  prwlock_type_t                lock_type_held;
-  char                          cache_line_padding[56
-                                  - sizeof(prwlock_type_t)];
+      uv_rwlock_t               rwlock;
+      prwlock_type_t            lock_type_held; /* set by writers only */
 #elif defined(USE_ATOMICS) 
-  _Atomic int32_t               rwlock;
-  prwlock_type_t                lock_type_held;
-  char                          cache_line_padding[CACHE_LINE_SIZE
-                                  - sizeof(int32_t) - sizeof(prwlock_type_t)];
+      _Atomic uint32_t          state;
+      _Atomic uint32_t          writer_notify;
 #else /* pthreads */
-  pthread_rwlock_t              rwlock;
-  char                          cache_line_padding[56];
+      pthread_rwlock_t          rwlock;
 #endif /* USE_LIBUV_RWLOCK */
+    };
+    prwlock_pft_t               pft;
+  };
+  _Atomic uint8_t               write_held;     /* WRITE_HELD_FLAGS only */
+  _Atomic uint32_t              sequence;       /* odd while write-held */
+  _Atomic uint32_t              upgrader;       /* UPGRADABLE only */
 } partitioned_rwlock_cell_t;
 
+typedef struct {
+  _Atomic uint64_t             *visible_readers;
+  _Atomic uint8_t              *enabled;
+  _Atomic uint64_t             *inhibit_until;
+} prwlock_bias_t;
+
+typedef struct {
+  _Atomic uint32_t              readers;
+  _Atomic uint32_t              writers;
+} __attribute__((aligned(CACHE_LINE_SIZE))) prwlock_ingress_t;
+
+typedef struct {
+  partitioned_rwlock_cell_t     cell __attribute__((aligned(CACHE_LINE_SIZE)));
+  _Atomic uint32_t              intent __attribute__((aligned(CACHE_LINE_SIZE)));
+  prwlock_ingress_t            *ingress;
+} prwlock_global_t;
+
+/* Partitions of one global lock held by the current thread */
+typedef struct {
+  const partitioned_rwlock_t   *rwlock;
+  uint32_t                      readers;
+  uint32_t                      writers;
+} prwlock_global_hold_t;
+
+/*
+ * Per-partition cohort state. A releasing writer that hands the partition
+ * over leaves the cell write-locked and publishes 1 + its node in handoff,
+ * for one waiting writer of that node to claim.
+ */
+typedef struct {
+  _Atomic uint32_t              handoff;
+  _Atomic uint32_t              sequence;       /* bumped on every release */
+  _Atomic uint32_t              batch;          /* handoffs in a row */
+  _Atomic uint32_t              waiters;        /* writers, any node */
+  _Atomic uint32_t              held_back;      /* readers */
+  _Atomic uint32_t              waiting[PRWLOCK_COHORT_NODES];
+} __attribute__((aligned(CACHE_LINE_SIZE))) prwlock_cohort_t;
+
+/*
+ * Per-partition read lease. Only the owner writes depth and uses, so while
+ * a lease stands the line stays in the owner's cache; a revoker marks
+ * owner, waits for depth to drain, and alone writes the rest.
+ */
+typedef struct {
+  _Atomic uint32_t              owner;
+  _Atomic uint32_t              depth;          /* reads held by lease */
+  _Atomic uint32_t              uses;           /* reads since the grant */
+  _Atomic uint32_t              strikes;        /* early revocations */
+  _Atomic uint64_t              inhibit_until;
+} __attribute__((aligned(CACHE_LINE_SIZE))) prwlock_lease_t;
+
+/* A partition's run of reads by the current thread */
+typedef struct {
+  const partitioned_rwlock_t   *rwlock;
+  size_t                        partition;
+  uint32_t                      reads;
+} prwlock_lease_streak_t;
+
+/* An operation published for a combiner; it lives on its caller's stack */
+typedef struct prwlock_combine_op_t {
+  struct prwlock_combine_op_t  *next;
+  partitioned_rwlock_combine_fn fn;
+  void                         *arg;
+  _Atomic uint32_t              state;
+} prwlock_combine_op_t;
+
+/*
+ * Per-partition publication list, newest first, and whether a combiner
+ * holds the partition. Only a combiner takes operations off the list.
+ */
+typedef struct {
+  prwlock_combine_op_t *_Atomic pending;
+  _Atomic uint32_t              active;
+} __attribute__((aligned(CACHE_LINE_SIZE))) prwlock_combine_t;
+
+/* Home node of each page of cells, or -1 where the kernel decides */
+typedef struct {
+  partitioned_rwlock_numa_t     placement;
+  size_t                        page_size;
+  size_t                        page_count;
+  int                          *page_nodes;
+} prwlock_numa_t;
+
+/*
+ * One generation of a resizable lock's cells. While a resize moves keys
+ * over, previous is the table being left and migrated marks its partitions
+ * whose keys now lock here instead.
+ */
+typedef struct prwlock_table_t {
+  size_t                        partition_count;
+  size_t                        partition_mask;
+  partitioned_rwlock_cell_t    *cells;
+  struct prwlock_table_t *_Atomic previous;
+  _Atomic uint8_t              *migrated;
+} prwlock_table_t;
+
+/* Key operations in flight, counted by phase so a resize can wait them out */
+typedef struct {
+  _Atomic uint32_t              readers[2];
+} __attribute__((aligned(CACHE_LINE_SIZE))) prwlock_resize_slot_t;
+
+typedef struct {
+  prwlock_table_t *_Atomic      table;
+  prwlock_resize_slot_t        *slots;
+  _Atomic uint32_t              phase;
+  pthread_rwlock_t              gate;           /* resize vs. *_all calls */
+} prwlock_resize_t;
+
+/* One partition's counters within one shard; a multiple of a cache line */
+typedef struct {
+  _Atomic uint64_t              read_acquires;
+  _Atomic uint64_t              write_acquires;
+  _Atomic uint64_t              try_failures;
+  _Atomic uint64_t              timeouts;
+  _Atomic uint64_t              contended;
+  _Atomic uint64_t              wait_ns;
+  _Atomic uint64_t              hold_ns;
+  _Atomic uint32_t              wait_histogram[PRWLOCK_STATS_BUCKETS];
+  _Atomic uint32_t              hold_histogram[PRWLOCK_STATS_BUCKETS];
+} __attribute__((aligned(CACHE_LINE_SIZE))) prwlock_stats_cell_t;
+
+/* A partition the current thread holds, and since when */
+typedef struct {
+  const partitioned_rwlock_t   *rwlock;
+  size_t                        partition;
+  uint64_t                      acquired_ns;
+} prwlock_stats_hold_t;
+
+#if defined(USE_LIBUV_RWLOCK)
+/* An asynchronous acquisition that found its partition busy */
+typedef struct prwlock_async_request_t {
+  struct prwlock_async_request_t *next;
+  size_t                        partition;
+  partitioned_rwlock_mode_t     mode;
+  partitioned_rwlock_async_cb   cb;
+  void                         *arg;
+} prwlock_async_request_t;
+
+/*
+ * One event loop's queue on one lock. Only the loop's thread touches the
+ * queue; a releasing thread raises signalled and sends the async handle,
+ * and further releases send nothing until the loop has drained. busy_pass
+ * records the last drain pass that found each partition busy.
+ */
+typedef struct prwlock_async_loop_t {
+  uv_async_t                    async;          /* first, for uv_close() */
+  uv_loop_t                    *loop;
+  partitioned_rwlock_t         *rwlock;
+  struct prwlock_async_loop_t  *next;
+  prwlock_async_request_t      *head;
+  prwlock_async_request_t      *tail;
+  uint32_t                     *busy_pass;
+  uint32_t                      pass;
+  _Atomic uint32_t              queued;
+  _Atomic uint32_t              signalled;
+} prwlock_async_loop_t;
+
+/* waiting (queued requests per partition) appears with the first loop */
+typedef struct {
+  pthread_mutex_t               mutex;          /* guards loops */
+  prwlock_async_loop_t         *loops;
+  _Atomic uint32_t *_Atomic     waiting;
+} prwlock_async_t;
+#endif /* USE_LIBUV_RWLOCK */
+
+/* One reader thread's slot: the epoch it entered in, or 0 while outside */
+typedef struct {
+  _Atomic uint64_t              value;
+  uint32_t                      nesting;        /* the owner's alone */
+} __attribute__((aligned(CACHE_LINE_SIZE))) prwlock_epoch_slot_t;
+
+/* A reclamation waiting for the readers of its epoch to leave */
+typedef struct prwlock_epoch_deferred_t {
+  struct prwlock_epoch_deferred_t *next;
+  void                        (*reclaim) (void *);
+  void                         *arg;
+} prwlock_epoch_deferred_t;
+
+/*
+ * Epoch readers announce themselves in slots of their own, found by thread
+ * id. membarrier is set when writers can fence every running reader with
+ * membarrier(2), which lets readers get by with a compiler barrier.
+ */
+typedef struct {
+  _Atomic uint64_t              epoch;
+  prwlock_epoch_slot_t *_Atomic chunks[PRWLOCK_EPOCH_CHUNKS];
+  pthread_mutex_t               mutex;          /* grace periods, deferred */
+  prwlock_epoch_deferred_t     *deferred;
+  size_t                        deferred_count;
+  int                           membarrier;
+} prwlock_epoch_t;
+
+/*
+ * One thread's trace records. The thread alone moves head, and a drainer
+ * (one at a time, under the lock's trace mutex) alone moves tail, so
+ * neither ever waits; records that find the ring full are dropped.
+ */
+typedef struct {
+  _Atomic uint32_t              head;
+  _Atomic uint32_t              tail __attribute__((aligned(CACHE_LINE_SIZE)));
+  _Atomic uint64_t              dropped;
+  partitioned_rwlock_trace_record_t records[PRWLOCK_TRACE_RING_RECORDS];
+} __attribute__((aligned(CACHE_LINE_SIZE))) prwlock_trace_ring_t;
+
+/* Rings are found by thread id, and allocated by their first record */
+typedef struct {
+  uint64_t                      threshold_ticks;
+  prwlock_trace_ring_t *_Atomic rings[PRWLOCK_TRACE_RINGS];
+  _Atomic uint64_t              dropped;        /* threads without a ring */
+  pthread_mutex_t               mutex;          /* drainers */
+} prwlock_trace_t;
+
+/* A partition the current thread holds under a trace, and since when */
+typedef struct {
+  const partitioned_rwlock_t   *rwlock;
+  size_t                        partition;
+  uint64_t                      acquired;       /* cycle counter */
+  const void                   *caller;
+  partitioned_rwlock_mode_t     mode;
+} prwlock_trace_hold_t;
+
+/*
+ * Head of a process-shared lock's region, with the cells cells_offset bytes
+ * in. It holds no pointers, since each process maps the region where it
+ * likes, and the creator stores magic last, so a process attaching that
+ * sees it sees the rest.
+ */
+typedef struct {
+  _Atomic uint64_t              magic;
+  uint32_t                      backend;
+  uint32_t                      cell_size;
+  size_t                        region_size;
+  size_t                        cells_offset;
+  size_t                        partition_count;
+  size_t                        cell_stride;
+  size_t                        cell_data;
+  uint64_t                      hash_seed;
+  unsigned int                  flags;
+  partitioned_rwlock_policy_t   policy;
+  pid_t                         creator;
+} prwlock_shared_t;
+
+/* Fields up to policy are read inline, as partitioned_rwlock_head_t */
 struct partitioned_rwlock_t {
   size_t                        partition_count;
+  size_t                        partition_mask;
+  uint64_t                      hash_seed;
   partitioned_rwlock_cell_t    *cells;
+  size_t                        cell_stride;
+  unsigned int                  flags;
+  partitioned_rwlock_policy_t   policy;
+  prwlock_bias_t                bias;
+  prwlock_global_t              global;
+  prwlock_stats_cell_t         *stats;
+  prwlock_numa_t                numa;
+  prwlock_cohort_t             *cohort;
+  uint32_t                      cohort_batch;
+  prwlock_resize_t              resize;
+  size_t                        cell_data;
+  prwlock_epoch_t               epoch;
+  prwlock_trace_t              *trace;
+  prwlock_lease_t              *lease;
+  int                           lease_membarrier;
+  prwlock_combine_t            *combine;
+  prwlock_shared_t             *shared;         /* process-shared only */
+  int                           shared_owner;   /* made by this handle */
+  int                           shared_mapped;  /* ours to unmap */
+#if defined(USE_LIBUV_RWLOCK)
+  prwlock_async_t               async;
+#endif /* USE_LIBUV_RWLOCK */
 };
 
 /* ========================================================================= */
 /* -- PRIVATE METHOD PROTOTYPES -------------------------------------------- */
 /* ========================================================================= */
 
+static void prwlock_thread_id_release (void *value);
+static void prwlock_thread_id_setup (void);
+static uint32_t prwlock_thread_id (void);
+static uint64_t prwlock_now_ns (void);
+static void prwlock_timespec (uint64_t nanoseconds, struct timespec *ts);
+static int prwlock_timespec_valid (const struct timespec *ts);
+static uint64_t prwlock_deadline (const struct timespec *abstime);
+static void prwlock_futex_wait (const partitioned_rwlock_t *rwlock,
+  _Atomic uint32_t *word, uint32_t expected);
+static int prwlock_futex_wait_until (const partitioned_rwlock_t *rwlock,
+  _Atomic uint32_t *word, uint32_t expected, uint64_t deadline);
+static int prwlock_futex_wake (const partitioned_rwlock_t *rwlock,
+  _Atomic uint32_t *word, int count);
+static uint32_t prwlock_pft_await (const partitioned_rwlock_t *rwlock,
+  _Atomic uint32_t *word, uint32_t mask, uint32_t value, int until_equal,
+  uint32_t parked_bit);
+static void prwlock_pft_release_ticket (const partitioned_rwlock_t *rwlock,
+  prwlock_pft_t *pft);
+static int prwlock_pft_rdlock (const partitioned_rwlock_t *rwlock,
+  prwlock_pft_t *pft);
+static int prwlock_pft_tryrdlock (const partitioned_rwlock_t *rwlock,
+  prwlock_pft_t *pft);
+static int prwlock_pft_wrlock (const partitioned_rwlock_t *rwlock,
+  prwlock_pft_t *pft);
+static int prwlock_pft_trywrlock (const partitioned_rwlock_t *rwlock,
+  prwlock_pft_t *pft);
+static int prwlock_pft_rdunlock (const partitioned_rwlock_t *rwlock,
+  prwlock_pft_t *pft);
+static int prwlock_pft_wrunlock (const partitioned_rwlock_t *rwlock,
+  prwlock_pft_t *pft);
+#if defined(USE_ATOMICS)
+static uint32_t prwlock_cell_spin (partitioned_rwlock_cell_t *cell,
+  int for_write);
+static int prwlock_cell_wake_writer (const partitioned_rwlock_t *rwlock,
+  partitioned_rwlock_cell_t *cell);
+static void prwlock_cell_wake_writer_or_readers (partitioned_rwlock_t *rwlock,
+  partitioned_rwlock_cell_t *cell, uint32_t state);
+static int prwlock_cell_rdlock_contended (partitioned_rwlock_t *rwlock,
+  partitioned_rwlock_cell_t *cell, uint64_t deadline);
+static int prwlock_cell_wrlock_contended (partitioned_rwlock_t *rwlock,
+  partitioned_rwlock_cell_t *cell, uint64_t deadline);
+static void prwlock_cell_abandon (const partitioned_rwlock_t *rwlock,
+  partitioned_rwlock_cell_t *cell);
+static int prwlock_cell_rdunlock (partitioned_rwlock_t *rwlock,
+  partitioned_rwlock_cell_t *cell);
+static int prwlock_cell_wrunlock (partitioned_rwlock_t *rwlock,
+  partitioned_rwlock_cell_t *cell);
+#endif /* USE_ATOMICS */
+static int prwlock_cell_init (partitioned_rwlock_t *rwlock,
+  partitioned_rwlock_cell_t *cell);
+static void prwlock_cell_destroy (partitioned_rwlock_t *rwlock,
+  partitioned_rwlock_cell_t *cell);
+static int prwlock_cell_rdlock (partitioned_rwlock_t *rwlock,
+  partitioned_rwlock_cell_t *cell);
+static int prwlock_cell_tryrdlock (partitioned_rwlock_t *rwlock,
+  partitioned_rwlock_cell_t *cell);
+static int prwlock_cell_wrlock (partitioned_rwlock_t *rwlock,
+  partitioned_rwlock_cell_t *cell);
+static int prwlock_cell_trywrlock (partitioned_rwlock_t *rwlock,
+  partitioned_rwlock_cell_t *cell);
+static int prwlock_cell_release (partitioned_rwlock_t *rwlock,
+  partitioned_rwlock_cell_t *cell, int for_write);
+static int prwlock_cell_unlock (partitioned_rwlock_t *rwlock,
+  partitioned_rwlock_cell_t *cell);
+static int prwlock_cell_poll (partitioned_rwlock_t *rwlock,
+  partitioned_rwlock_cell_t *cell, int for_write, uint64_t deadline);
+static int prwlock_cell_timedlock (partitioned_rwlock_t *rwlock,
+  partitioned_rwlock_cell_t *cell, int for_write, uint64_t deadline);
+static int prwlock_cell_acquire (partitioned_rwlock_t *rwlock,
+  partitioned_rwlock_cell_t *cell, int for_write, uint64_t deadline);
+static int prwlock_upgrader_emulated (const partitioned_rwlock_t *rwlock);
+static int prwlock_upgrader_acquire (const partitioned_rwlock_t *rwlock,
+  partitioned_rwlock_cell_t *cell, uint64_t deadline);
+static void prwlock_upgrader_release (const partitioned_rwlock_t *rwlock,
+  partitioned_rwlock_cell_t *cell);
+static int prwlock_upgrader_owned (partitioned_rwlock_cell_t *cell);
+static int prwlock_cell_upgrade (partitioned_rwlock_t *rwlock,
+  partitioned_rwlock_cell_t *cell, uint64_t deadline);
+static int prwlock_cell_downgrade (partitioned_rwlock_t *rwlock,
+  partitioned_rwlock_cell_t *cell);
+static int prwlock_bias_init (partitioned_rwlock_t *rwlock);
+static void prwlock_bias_destroy (partitioned_rwlock_t *rwlock);
+static _Atomic uint64_t *prwlock_bias_slot (partitioned_rwlock_t *rwlock,
+  uint32_t thread_id, size_t partition);
+static int prwlock_bias_rdlock (partitioned_rwlock_t *rwlock,
+  size_t partition, uint64_t deadline);
+static int prwlock_bias_revoke (partitioned_rwlock_t *rwlock,
+  size_t partition, uint64_t deadline);
+static int prwlock_bias_rdunlock (partitioned_rwlock_t *rwlock,
+  size_t partition, int for_write);
+static uint64_t prwlock_hash_mix (uint64_t lhs, uint64_t rhs);
+static uint64_t prwlock_hash_read8 (const uint8_t *bytes);
+static uint64_t prwlock_hash_read4 (const uint8_t *bytes);
+static uint64_t prwlock_hash_bytes (const void *key, size_t length,
+  uint64_t seed);
+static uint64_t prwlock_hash_u64 (uint64_t key, uint64_t seed);
+static size_t prwlock_hash_reduce (const partitioned_rwlock_t *rwlock,
+  uint64_t hash);
+static int prwlock_global_init (partitioned_rwlock_t *rwlock);
+static void prwlock_global_destroy (partitioned_rwlock_t *rwlock);
+static prwlock_global_hold_t *prwlock_global_hold (
+  partitioned_rwlock_t *rwlock);
+static int prwlock_global_blocks (uint32_t intent,
+  partitioned_rwlock_mode_t mode, const prwlock_global_hold_t *hold);
+static int prwlock_global_enter (partitioned_rwlock_t *rwlock,
+  partitioned_rwlock_mode_t mode, uint64_t deadline);
+static void prwlock_global_exit (partitioned_rwlock_t *rwlock,
+  partitioned_rwlock_mode_t mode);
+static void prwlock_global_drain (partitioned_rwlock_t *rwlock);
+static int prwlock_stats_init (partitioned_rwlock_t *rwlock);
+static void prwlock_stats_destroy (partitioned_rwlock_t *rwlock);
+static size_t prwlock_stats_bucket (uint64_t nanoseconds);
+static prwlock_stats_cell_t *prwlock_stats_cell (partitioned_rwlock_t *rwlock,
+  size_t partition);
+static void prwlock_stats_hold_push (partitioned_rwlock_t *rwlock,
+  size_t partition, uint64_t now);
+static int prwlock_stats_hold_pop (partitioned_rwlock_t *rwlock,
+  size_t partition, uint64_t *acquired_ns);
+static void prwlock_configure (partitioned_rwlock_t *rwlock,
+  size_t partition_count, const partitioned_rwlock_attr_t *attr);
+static size_t prwlock_cell_stride (const partitioned_rwlock_t *rwlock,
+  partitioned_rwlock_stride_t stride);
+static void prwlock_cells_init (partitioned_rwlock_t *rwlock);
+static int prwlock_numa_node_count (void);
+static int prwlock_numa_current_node (void);
+static int prwlock_numa_mbind (void *address, size_t length, int mode,
+  int node);
+static int prwlock_numa_init (partitioned_rwlock_t *rwlock);
+static void prwlock_numa_destroy (partitioned_rwlock_t *rwlock);
+static int prwlock_cohort_init (partitioned_rwlock_t *rwlock);
+static void prwlock_cohort_destroy (partitioned_rwlock_t *rwlock);
+static uint32_t prwlock_cohort_node (void);
+static int prwlock_cohort_hold_back (partitioned_rwlock_t *rwlock,
+  size_t partition, uint64_t deadline);
+static int prwlock_cohort_wrlock (partitioned_rwlock_t *rwlock,
+  size_t partition);
+static int prwlock_cohort_wrunlock (partitioned_rwlock_t *rwlock,
+  size_t partition);
+static void prwlock_cohort_rdunlock (partitioned_rwlock_t *rwlock,
+  size_t partition);
+static int prwlock_lease_init (partitioned_rwlock_t *rwlock);
+static void prwlock_lease_destroy (partitioned_rwlock_t *rwlock);
+static int prwlock_lease_rdlock (partitioned_rwlock_t *rwlock,
+  size_t partition, uint64_t deadline);
+static void prwlock_lease_grant (partitioned_rwlock_t *rwlock,
+  size_t partition);
+static int prwlock_lease_revoke (partitioned_rwlock_t *rwlock,
+  size_t partition, uint64_t deadline);
+static int prwlock_lease_rdunlock (partitioned_rwlock_t *rwlock,
+  size_t partition, int for_write);
+static int prwlock_combine_init (partitioned_rwlock_t *rwlock);
+static void prwlock_combine_destroy (partitioned_rwlock_t *rwlock);
+static void prwlock_combine_run (partitioned_rwlock_t *rwlock,
+  size_t partition, partitioned_rwlock_combine_fn fn, void *arg);
+static void prwlock_sequence_begin (_Atomic uint32_t *sequence);
+static void prwlock_sequence_end (_Atomic uint32_t *sequence);
+static uint64_t prwlock_sequence_stamp (partitioned_rwlock_t *rwlock,
+  size_t partition);
+static size_t prwlock_table_reduce (const prwlock_table_t *table,
+  uint64_t hash);
+static prwlock_table_t *prwlock_table_create (partitioned_rwlock_t *rwlock,
+  size_t partition_count, prwlock_table_t *previous);
+static void prwlock_table_free (partitioned_rwlock_t *rwlock,
+  prwlock_table_t *table);
+static int prwlock_resize_init (partitioned_rwlock_t *rwlock);
+static void prwlock_resize_destroy (partitioned_rwlock_t *rwlock);
+static uint32_t prwlock_resize_enter (partitioned_rwlock_t *rwlock);
+static void prwlock_resize_exit (partitioned_rwlock_t *rwlock,
+  uint32_t phase);
+static void prwlock_resize_synchronize (partitioned_rwlock_t *rwlock);
+static partitioned_rwlock_cell_t *prwlock_resize_route (
+  partitioned_rwlock_t *rwlock, uint64_t hash, size_t *partition);
+static int prwlock_resize_acquire (partitioned_rwlock_t *rwlock,
+  partitioned_rwlock_cell_t *cell, partitioned_rwlock_mode_t mode,
+  uint64_t deadline);
+static int prwlock_resize_release (partitioned_rwlock_t *rwlock,
+  partitioned_rwlock_cell_t *cell);
+static int prwlock_resize_lock (partitioned_rwlock_t *rwlock, uint64_t hash,
+  partitioned_rwlock_mode_t mode, uint64_t deadline, size_t *partition);
+static int prwlock_resize_unlock (partitioned_rwlock_t *rwlock,
+  uint64_t hash);
+static int prwlock_resize_hold (partitioned_rwlock_t *rwlock);
+static void prwlock_resize_unhold (partitioned_rwlock_t *rwlock);
+static uint64_t prwlock_trace_ticks (void);
+static void prwlock_trace_calibrate (void);
+static int prwlock_trace_init (partitioned_rwlock_t *rwlock,
+  const partitioned_rwlock_attr_t *attr);
+static void prwlock_trace_destroy (partitioned_rwlock_t *rwlock);
+static void prwlock_trace_record (partitioned_rwlock_t *rwlock,
+  partitioned_rwlock_trace_kind_t kind, size_t partition,
+  partitioned_rwlock_mode_t mode, uint64_t ticks, const void *caller);
+static void prwlock_trace_acquired (partitioned_rwlock_t *rwlock,
+  size_t partition, partitioned_rwlock_mode_t mode, uint64_t start);
+static void prwlock_trace_released (partitioned_rwlock_t *rwlock,
+  size_t partition);
+static size_t prwlock_shared_cells_offset (
+  const partitioned_rwlock_t *rwlock);
+static void prwlock_shared_detach (partitioned_rwlock_t *rwlock);
+static int prwlock_membarrier_register (void);
+static void prwlock_membarrier_fence (int registered);
+static int prwlock_epoch_init (partitioned_rwlock_t *rwlock);
+static void prwlock_epoch_destroy (partitioned_rwlock_t *rwlock);
+static prwlock_epoch_slot_t *prwlock_epoch_slot (partitioned_rwlock_t *rwlock,
+  int create);
+static void prwlock_epoch_fence (partitioned_rwlock_t *rwlock);
+static void prwlock_epoch_synchronize (partitioned_rwlock_t *rwlock);
+static void prwlock_epoch_run (prwlock_epoch_deferred_t *deferred);
+static int prwlock_partition_acquire (partitioned_rwlock_t *rwlock,
+  size_t partition, partitioned_rwlock_mode_t mode, uint64_t deadline);
+static int prwlock_partition_lock_stats (partitioned_rwlock_t *rwlock,
+  size_t partition, partitioned_rwlock_mode_t mode, uint64_t deadline);
+static int prwlock_partition_lock (partitioned_rwlock_t *rwlock,
+  size_t partition, partitioned_rwlock_mode_t mode, uint64_t deadline);
+static int prwlock_partition_unlock (partitioned_rwlock_t *rwlock,
+  size_t partition, int for_write);
+static int prwlock_partition_upgrade (partitioned_rwlock_t *rwlock,
+  size_t partition, uint64_t deadline);
+static partitioned_rwlock_request_t prwlock_many_request (
+  const size_t *partitions, const partitioned_rwlock_request_t *requests,
+  partitioned_rwlock_mode_t mode, size_t index);
+static partitioned_rwlock_mode_t prwlock_many_mode (
+  partitioned_rwlock_mode_t lhs, partitioned_rwlock_mode_t rhs);
+static int prwlock_many_compare (const void *lhs, const void *rhs);
+static size_t prwlock_many_normalize (partitioned_rwlock_request_t *set,
+  size_t count);
+static int prwlock_many_acquire (partitioned_rwlock_t *rwlock,
+  const partitioned_rwlock_request_t *request, uint64_t deadline);
+static int prwlock_many_lock (partitioned_rwlock_t *rwlock,
+  const size_t *partitions, const partitioned_rwlock_request_t *requests,
+  partitioned_rwlock_mode_t mode, size_t count, uint64_t deadline);
+static void prwlock_async_notify (partitioned_rwlock_t *rwlock,
+  size_t partition);
+#if defined(USE_LIBUV_RWLOCK)
+static prwlock_async_loop_t *prwlock_async_loop (uv_loop_t *loop,
+  partitioned_rwlock_t *rwlock);
+static void prwlock_async_drain (uv_async_t *handle);
+static void prwlock_async_closed (uv_handle_t *handle);
+static int prwlock_async_lock (uv_loop_t *loop, partitioned_rwlock_t *rwlock,
+  size_t partition, partitioned_rwlock_mode_t mode,
+  partitioned_rwlock_async_cb cb, void *arg);
+#endif /* USE_LIBUV_RWLOCK */
+static int prwlock_key_lock (partitioned_rwlock_t *rwlock, const void *key,
+  size_t length, partitioned_rwlock_mode_t mode, uint64_t deadline,
+  size_t *partition);
+
 /* ========================================================================= */
 /* -- PRIVATE DATA --------------------------------------------------------- */
 /* ========================================================================= */
 
+static pthread_once_t prwlock_thread_once = PTHREAD_ONCE_INIT;
+static pthread_key_t prwlock_thread_key;
+static pthread_mutex_t prwlock_thread_mutex = PTHREAD_MUTEX_INITIALIZER;
+static uint32_t prwlock_thread_id_next = 0;
+static uint32_t *prwlock_thread_id_free = NULL;
+static size_t prwlock_thread_id_free_count = 0;
+static size_t prwlock_thread_id_free_capacity = 0;
+static _Thread_local uint32_t prwlock_thread_id_cached = 0;
+static _Thread_local prwlock_global_hold_t
+  prwlock_global_holds[PRWLOCK_GLOBAL_HOLD_SLOTS];
+static _Thread_local prwlock_stats_hold_t
+  prwlock_stats_holds[PRWLOCK_STATS_HOLD_SLOTS];
+static _Thread_local size_t prwlock_stats_hold_count = 0;
+static _Atomic int prwlock_numa_nodes = 0;
+static _Thread_local uint32_t prwlock_numa_cached_node = 0;
+static _Thread_local uint32_t prwlock_numa_cached_uses = 0;
+static pthread_once_t prwlock_trace_once = PTHREAD_ONCE_INIT;
+static double prwlock_trace_ns_per_tick = 1.0;
+static _Thread_local prwlock_trace_hold_t
+  prwlock_trace_holds[PRWLOCK_TRACE_HOLD_SLOTS];
+static _Thread_local size_t prwlock_trace_hold_count = 0;
+static _Thread_local const void *prwlock_trace_site = NULL;
+static _Thread_local prwlock_lease_streak_t
+  prwlock_lease_streaks[PRWLOCK_LEASE_STREAKS];
+
 /* ========================================================================= */
 /* -- PUBLIC DATA ---------------------------------------------------------- */
 /* ========================================================================= */
@@ -105,242 +900,6235 @@ struct partitioned_rwlock_t {
 /* -- STATIC ASSERTIONS ---------------------------------------------------- */
 /* ========================================================================= */
 
+_Static_assert(0 == (PRWLOCK_VISIBLE_READER_SLOTS
+  & (PRWLOCK_VISIBLE_READER_SLOTS - 1)),
+  "PRWLOCK_VISIBLE_READER_SLOTS must be a power of two");
+_Static_assert(0 == (PRWLOCK_INGRESS_SLOTS & (PRWLOCK_INGRESS_SLOTS - 1)),
+  "PRWLOCK_INGRESS_SLOTS must be a power of two");
+_Static_assert(0 == (PRWLOCK_STATS_SHARDS & (PRWLOCK_STATS_SHARDS - 1)),
+  "PRWLOCK_STATS_SHARDS must be a power of two");
+_Static_assert(PRWLOCK_LEASE_STRIKE_LIMIT < 26,
+  "PRWLOCK_LEASE_GRANT_READS << PRWLOCK_LEASE_STRIKE_LIMIT must fit 32 bits");
+#if defined(USE_ATOMICS)
+_Static_assert(0 == offsetof(partitioned_rwlock_cell_t, state),
+  "prwlock_inline.h expects a cell to begin with its state word");
+_Static_assert(offsetof(partitioned_rwlock_t, partition_count)
+  == offsetof(partitioned_rwlock_head_t, partition_count)
+  && offsetof(partitioned_rwlock_t, cells)
+    == offsetof(partitioned_rwlock_head_t, cells)
+  && offsetof(partitioned_rwlock_t, cell_stride)
+    == offsetof(partitioned_rwlock_head_t, cell_stride)
+  && offsetof(partitioned_rwlock_t, flags)
+    == offsetof(partitioned_rwlock_head_t, flags)
+  && offsetof(partitioned_rwlock_t, policy)
+    == offsetof(partitioned_rwlock_head_t, policy),
+  "partitioned_rwlock_head_t must match partitioned_rwlock_t");
+#endif /* USE_ATOMICS */
+
 /* ========================================================================= */
 /* -- PRIVATE METHODS ------------------------------------------------------ */
 /* ========================================================================= */
 
-/* ========================================================================= */
-/* -- PUBLIC METHODS ------------------------------------------------------- */
-/* ========================================================================= */
+static void
+prwlock_thread_id_release (
+  void                         *value
+) {
+  uint32_t thread_id = (uint32_t) ((uintptr_t) value - 1);
 
-int
-partitioned_rwlock_init (
-  partitioned_rwlock_t        **rwlock,
-  size_t                        partition_count
+  pthread_mutex_lock(&prwlock_thread_mutex);
+  if (prwlock_thread_id_free_count == prwlock_thread_id_free_capacity) {
+    size_t capacity = (0 == prwlock_thread_id_free_capacity) ? 64
+      : (prwlock_thread_id_free_capacity * 2);
+    uint32_t *ids = realloc(prwlock_thread_id_free,
+      (capacity * sizeof(*ids)));
+    if (NULL == ids) {
+      /* Leak the id rather than fail thread exit */
+      pthread_mutex_unlock(&prwlock_thread_mutex);
+      return;
+    }
+    prwlock_thread_id_free = ids;
+    prwlock_thread_id_free_capacity = capacity;
+  }
+  prwlock_thread_id_free[prwlock_thread_id_free_count++] = thread_id;
+  pthread_mutex_unlock(&prwlock_thread_mutex);
+} /* prwlock_thread_id_release() */
+
+/* ------------------------------------------------------------------------- */
+
+static void
+prwlock_thread_id_setup (
+  void
 ) {
-  partitioned_rwlock_t *newlock = NULL;
-  if (posix_memalign((void *) &newlock, CACHE_LINE_SIZE, sizeof(*newlock))) {
-    printf("Failed to allocate new lock structure!\n");
-    return -1;
+  (void) pthread_key_create(&prwlock_thread_key, prwlock_thread_id_release);
+} /* prwlock_thread_id_setup() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Small, dense per-thread identifiers. Ids of exited threads are recycled so
+ * that tables indexed by thread id stay bounded by the number of live threads.
+ */
+static uint32_t
+prwlock_thread_id (
+  void
+) {
+  if (0 != prwlock_thread_id_cached) {
+    return (prwlock_thread_id_cached - 1);
   }
 
-  newlock->partition_count = partition_count;
-  if (posix_memalign((void **) &newlock->cells, CACHE_LINE_SIZE,
-    (partition_count * sizeof(*newlock->cells)))) {
-    printf("Failed to allocate %zd cells!\n", partition_count);
+  (void) pthread_once(&prwlock_thread_once, prwlock_thread_id_setup);
+
+  uint32_t thread_id;
+  pthread_mutex_lock(&prwlock_thread_mutex);
+  if (0 < prwlock_thread_id_free_count) {
+    thread_id = prwlock_thread_id_free[--prwlock_thread_id_free_count];
+  } else {
+    thread_id = prwlock_thread_id_next++;
   }
+  pthread_mutex_unlock(&prwlock_thread_mutex);
 
-  for (size_t ii = 0; ii < partition_count; ++ii) {
-    int rc = 0;
-#if defined(USE_LIBUV_RWLOCK)
-    newlock->cells[ii].lock_type_held = PRWLOCK_TYPE_NONE;
-    rc = uv_rwlock_init(&(newlock->cells[ii].rwlock));
-#elif defined(USE_ATOMICS) 
-    newlock->cells[ii].lock_type_held = PRWLOCK_TYPE_NONE;
-    newlock->cells[ii].rwlock = 0;
+  prwlock_thread_id_cached = (thread_id + 1);
+  (void) pthread_setspecific(prwlock_thread_key,
+    (void *) (uintptr_t) prwlock_thread_id_cached);
+
+  return thread_id;
+} /* prwlock_thread_id() */
+
+/* ------------------------------------------------------------------------- */
+
+static uint64_t
+prwlock_now_ns (
+  void
+) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (((uint64_t) ts.tv_sec * UINT64_C(1000000000))
+    + (uint64_t) ts.tv_nsec);
+} /* prwlock_now_ns() */
+
+/* ------------------------------------------------------------------------- */
+
+static void
+prwlock_timespec (
+  uint64_t                      nanoseconds,
+  struct timespec              *ts
+) {
+  ts->tv_sec = (time_t) (nanoseconds / UINT64_C(1000000000));
+  ts->tv_nsec = (long) (nanoseconds % UINT64_C(1000000000));
+} /* prwlock_timespec() */
+
+/* ------------------------------------------------------------------------- */
+
+static int
+prwlock_timespec_valid (
+  const struct timespec        *ts
+) {
+  return (NULL != ts && 0 <= ts->tv_sec && 0 <= ts->tv_nsec
+    && 1000000000 > ts->tv_nsec);
+} /* prwlock_timespec_valid() */
+
+/* ------------------------------------------------------------------------- */
+
+/* Nanoseconds since boot never reach NOW, which would mean a trylock */
+static uint64_t
+prwlock_deadline (
+  const struct timespec        *abstime
+) {
+  uint64_t deadline = ((uint64_t) abstime->tv_sec * UINT64_C(1000000000))
+    + (uint64_t) abstime->tv_nsec;
+
+  return (PRWLOCK_DEADLINE_NOW == deadline) ? 1 : deadline;
+} /* prwlock_deadline() */
+
+/* ------------------------------------------------------------------------- */
+
+static void
+prwlock_futex_wait (
+  const partitioned_rwlock_t   *rwlock,
+  _Atomic uint32_t             *word,
+  uint32_t                      expected
+) {
+#if defined(USE_FUTEX)
+  (void) syscall(SYS_futex, (uint32_t *) word,
+    PRWLOCK_FUTEX_OP(rwlock, FUTEX_WAIT), expected, NULL, NULL, 0);
 #else
-    rc = pthread_rwlock_init(&(newlock->cells[ii].rwlock), NULL);
-#endif /* USE_LIBUV_RWLOCK */
-    if (0 != rc) {
-      printf("init = %d\n", rc);
-    }
+  (void) rwlock;
+  if (expected == atomic_load_explicit(word, memory_order_relaxed)) {
+    sched_yield();
   }
-  *rwlock = newlock;
-  return 0;
-} /* partitioned_rwlock_init() */
+#endif /* USE_FUTEX */
+} /* prwlock_futex_wait() */
 
 /* ------------------------------------------------------------------------- */
 
-int
-partitioned_rwlock_destroy (
-  partitioned_rwlock_t         *rwlock
+/*
+ * As prwlock_futex_wait(), but not past deadline. Returns ETIMEDOUT, without
+ * waiting, once the deadline has come, so callers retry before giving up
+ * and a wake-up received just in time is not lost.
+ */
+static int
+prwlock_futex_wait_until (
+  const partitioned_rwlock_t   *rwlock,
+  _Atomic uint32_t             *word,
+  uint32_t                      expected,
+  uint64_t                      deadline
 ) {
-  for (size_t ii = 0; ii < rwlock->partition_count; ++ii) {
-#if defined(USE_LIBUV_RWLOCK)
-    uv_rwlock_destroy(&(rwlock->cells[ii].rwlock));
-#elif defined(USE_ATOMICS) 
-    rwlock->cells[ii].rwlock = 0;
+  if (PRWLOCK_DEADLINE_NONE == deadline) {
+    prwlock_futex_wait(rwlock, word, expected);
+    return 0;
+  }
+
+  uint64_t now = prwlock_now_ns();
+  if (now >= deadline) {
+    return ETIMEDOUT;
+  }
+#if defined(USE_FUTEX)
+  struct timespec timeout;
+  prwlock_timespec((deadline - now), &timeout);
+  (void) syscall(SYS_futex, (uint32_t *) word,
+    PRWLOCK_FUTEX_OP(rwlock, FUTEX_WAIT), expected, &timeout, NULL, 0);
 #else
-    int rc = pthread_rwlock_destroy(&(rwlock->cells[ii].rwlock));
-    if (0 != rc) {
-      printf("init = %d\n", rc);
-    }
-#endif /* USE_LIBUV_RWLOCK */
+  if (expected == atomic_load_explicit(word, memory_order_relaxed)) {
+    sched_yield();
   }
-  free(rwlock->cells);
-  free(rwlock);
+#endif /* USE_FUTEX */
   return 0;
-} /* partitioned_rwlock_destroy() */
+} /* prwlock_futex_wait_until() */
 
 /* ------------------------------------------------------------------------- */
 
-size_t
-partitioned_rwlock_get_partition_count (
-  partitioned_rwlock_t         *rwlock
+/*
+ * Returns the number of threads woken. Without futex support waiters poll,
+ * so there is never anyone to wake.
+ */
+static int
+prwlock_futex_wake (
+  const partitioned_rwlock_t   *rwlock,
+  _Atomic uint32_t             *word,
+  int                           count
 ) {
-  return rwlock->partition_count;
-} /* partitioned_rwlock_get_partition_count() */
+#if defined(USE_FUTEX)
+  long rc = syscall(SYS_futex, (uint32_t *) word,
+    PRWLOCK_FUTEX_OP(rwlock, FUTEX_WAKE), count, NULL, NULL, 0);
+  return (0 < rc) ? (int) rc : 0;
+#else
+  (void) rwlock;
+  (void) word;
+  (void) count;
+  return 0;
+#endif /* USE_FUTEX */
+} /* prwlock_futex_wake() */
 
 /* ------------------------------------------------------------------------- */
 
-int
-partitioned_rwlock_rdlock (
-  partitioned_rwlock_t         *rwlock,
-  const size_t                  partition
+/*
+ * Waits until (*word & mask) becomes equal to value, or stops being equal
+ * to it, first spinning with backoff and then parking with parked_bit set in
+ * the word so the thread that changes it knows to issue a wake-up. Returns
+ * the last value read.
+ */
+static uint32_t
+prwlock_pft_await (
+  const partitioned_rwlock_t   *rwlock,
+  _Atomic uint32_t             *word,
+  uint32_t                      mask,
+  uint32_t                      value,
+  int                           until_equal,
+  uint32_t                      parked_bit
 ) {
-  assert(NULL != rwlock);
-  assert(partition < rwlock->partition_count);
+  uint32_t current;
+
+  for (int round = 0; round < PRWLOCK_SPIN_ROUNDS; ++round) {
+    current = atomic_load_explicit(word, memory_order_acquire);
+    if (((current & mask) == value) == until_equal) {
+      return current;
+    }
+    for (int ii = 0; ii < (1 << round); ++ii) {
+      PRWLOCK_CPU_RELAX();
+    }
+  }
 
-#if defined(USE_LIBUV_RWLOCK)
-  uv_rwlock_rdlock(&(rwlock->cells[partition].rwlock));
-  rwlock->cells[partition].lock_type_held = PRWLOCK_TYPE_READ;
-  return 0;
-#elif defined(USE_ATOMICS) 
   while (1) {
-    int32_t val; 
-    do {
-      val = atomic_load_explicit(&rwlock->cells[partition].rwlock,
-        memory_order_relaxed);
-      if (0 > val) {
+    current = atomic_load_explicit(word, memory_order_acquire);
+    if (((current & mask) == value) == until_equal) {
+      return current;
+    }
+    if (0 == (current & parked_bit)) {
+      if (!atomic_compare_exchange_weak_explicit(word, &current,
+        (current | parked_bit), memory_order_relaxed, memory_order_relaxed)) {
         continue;
       }
-    } while (!atomic_compare_exchange_weak_explicit(
-      &rwlock->cells[partition].rwlock, &val, (val + 1), memory_order_acquire,
-      memory_order_relaxed));
-    break;
+      current |= parked_bit;
+    }
+    prwlock_futex_wait(rwlock, word, current);
   }
-  rwlock->cells[partition].lock_type_held = PRWLOCK_TYPE_READ;
-  return 0;
-#else
-  return pthread_rwlock_rdlock(&(rwlock->cells[partition].rwlock));
-#endif /* USE_LIBUV_RWLOCK */
-} /* partitioned_rwlock_rdlock() */
+} /* prwlock_pft_await() */
 
 /* ------------------------------------------------------------------------- */
 
-int
-partitioned_rwlock_tryrdlock (
-  partitioned_rwlock_t         *rwlock,
-  const size_t                  partition
+static void
+prwlock_pft_release_ticket (
+  const partitioned_rwlock_t   *rwlock,
+  prwlock_pft_t                *pft
 ) {
-  assert(NULL != rwlock);
-  assert(partition < rwlock->partition_count);
+  uint32_t wout = atomic_load_explicit(&pft->wout, memory_order_relaxed);
 
-#if defined(USE_LIBUV_RWLOCK)
-  int rc = uv_rwlock_tryrdlock(&(rwlock->cells[partition].rwlock));
-  if (0 == rc) {
-    rwlock->cells[partition].lock_type_held = PRWLOCK_TYPE_READ;
-  }
-  return rc;
-#elif defined(USE_ATOMICS) 
-  int32_t val = atomic_load_explicit(&rwlock->cells[partition].rwlock,
-    memory_order_relaxed);
-  if (0 > val) {
-    return 1;
-  } else {
-    return partitioned_rwlock_rdlock(rwlock, partition);
+  while (!atomic_compare_exchange_weak_explicit(&pft->wout, &wout,
+    ((wout & ~PRWLOCK_PFT_WRITERS_PARKED) + PRWLOCK_PFT_TICKET),
+    memory_order_release, memory_order_relaxed));
+  if (wout & PRWLOCK_PFT_WRITERS_PARKED) {
+    (void) prwlock_futex_wake(rwlock, &pft->wout, INT_MAX);
   }
-#else
-  return pthread_rwlock_tryrdlock(&(rwlock->cells[partition].rwlock));
-#endif /* USE_LIBUV_RWLOCK */
-} /* partitioned_rwlock_tryrdlock() */
+} /* prwlock_pft_release_ticket() */
 
 /* ------------------------------------------------------------------------- */
 
-int
-partitioned_rwlock_trywrlock (
-  partitioned_rwlock_t         *rwlock,
-  const size_t                  partition
+/*
+ * A reader that arrives while a writer is present waits only for that
+ * writer's phase to end, never behind a second writer, and writers are
+ * served in ticket order; both roles therefore see bounded waits.
+ */
+static int
+prwlock_pft_rdlock (
+  const partitioned_rwlock_t   *rwlock,
+  prwlock_pft_t                *pft
 ) {
-  assert(NULL != rwlock);
-  assert(partition < rwlock->partition_count);
+  uint32_t w = atomic_fetch_add_explicit(&pft->rin, PRWLOCK_PFT_RINC,
+    memory_order_acquire) & PRWLOCK_PFT_WBITS;
 
-#if defined(USE_LIBUV_RWLOCK)
-  int rc = uv_rwlock_trywrlock(&(rwlock->cells[partition].rwlock));
-  if (0 == rc) {
-    rwlock->cells[partition].lock_type_held = PRWLOCK_TYPE_WRITE;
-  }
-  return rc;
-#elif defined(USE_ATOMICS) 
-  int32_t val = atomic_load_explicit(&rwlock->cells[partition].rwlock,
-    memory_order_relaxed);
-  if (0 == val) {
-    return partitioned_rwlock_wrlock(rwlock, partition);
-  } else {
-    return 1;
+  if (0 != w) {
+    (void) prwlock_pft_await(rwlock, &pft->rin, PRWLOCK_PFT_WBITS, w, 0,
+      PRWLOCK_PFT_READERS_PARKED);
   }
-#else
-  return pthread_rwlock_trywrlock(&rwlock->cells[partition].rwlock);
-#endif /* USE_LIBUV_RWLOCK */
-} /* partitioned_rwlock_trywrlock() */
+  return 0;
+} /* prwlock_pft_rdlock() */
 
 /* ------------------------------------------------------------------------- */
 
-int
-partitioned_rwlock_wrlock (
-  partitioned_rwlock_t         *rwlock,
-  const size_t                  partition
+static int
+prwlock_pft_tryrdlock (
+  const partitioned_rwlock_t   *rwlock,
+  prwlock_pft_t                *pft
 ) {
-  assert(NULL != rwlock);
-  assert(partition < rwlock->partition_count);
+  (void) rwlock;
+  uint32_t rin = atomic_load_explicit(&pft->rin, memory_order_relaxed);
 
-#if defined(USE_LIBUV_RWLOCK)
-  uv_rwlock_wrlock(&(rwlock->cells[partition].rwlock));
-  rwlock->cells[partition].lock_type_held = PRWLOCK_TYPE_WRITE;
-  return 0;
-#elif defined(USE_ATOMICS) 
-  while (1) {
-    int32_t val = atomic_load_explicit(&rwlock->cells[partition].rwlock,
-      memory_order_relaxed);
-    while (!atomic_compare_exchange_weak_explicit(
-      &rwlock->cells[partition].rwlock, &val, (val | (1<<31)),
-      memory_order_acq_rel, memory_order_relaxed));
-    val = INT32_MIN;
-    while (atomic_compare_exchange_strong_explicit(
-      &rwlock->cells[partition].rwlock, &val, -1, memory_order_acquire,
-      memory_order_relaxed)) {
-      val = INT32_MIN;
-      asm("nop");
+  while (0 == (rin & PRWLOCK_PFT_WBITS)) {
+    if (atomic_compare_exchange_weak_explicit(&pft->rin, &rin,
+      (rin + PRWLOCK_PFT_RINC), memory_order_acquire, memory_order_relaxed)) {
+      return 0;
     }
-    break;
   }
-  rwlock->cells[partition].lock_type_held = PRWLOCK_TYPE_WRITE;
-  return 0;
+  return EBUSY;
+} /* prwlock_pft_tryrdlock() */
+
+/* ------------------------------------------------------------------------- */
+
+static int
+prwlock_pft_wrlock (
+  const partitioned_rwlock_t   *rwlock,
+  prwlock_pft_t                *pft
+) {
+  uint32_t ticket = atomic_fetch_add_explicit(&pft->win, PRWLOCK_PFT_TICKET,
+    memory_order_relaxed);
+
+  (void) prwlock_pft_await(rwlock, &pft->wout, ~PRWLOCK_PFT_WRITERS_PARKED,
+    ticket, 1, PRWLOCK_PFT_WRITERS_PARKED);
+
+  uint32_t phase = atomic_load_explicit(&pft->phase, memory_order_relaxed)
+    ^ PRWLOCK_PFT_PHID;
+  atomic_store_explicit(&pft->phase, phase, memory_order_relaxed);
+
+  uint32_t w = PRWLOCK_PFT_PRES | phase;
+  uint32_t readers = atomic_fetch_add_explicit(&pft->rin, w,
+    memory_order_acquire) & PRWLOCK_PFT_COUNT_MASK;
+
+  if (PRWLOCK_PFT_WRITER_PARKED & prwlock_pft_await(rwlock, &pft->rout,
+    PRWLOCK_PFT_COUNT_MASK, readers, 1, PRWLOCK_PFT_WRITER_PARKED)) {
+    atomic_fetch_and_explicit(&pft->rout, ~PRWLOCK_PFT_WRITER_PARKED,
+      memory_order_relaxed);
+  }
+
+  atomic_store_explicit(&pft->writer_owned, 1, memory_order_relaxed);
+  return 0;
+} /* prwlock_pft_wrlock() */
+
+/* ------------------------------------------------------------------------- */
+
+static int
+prwlock_pft_trywrlock (
+  const partitioned_rwlock_t   *rwlock,
+  prwlock_pft_t                *pft
+) {
+  uint32_t ticket = atomic_load_explicit(&pft->wout, memory_order_acquire)
+    & ~PRWLOCK_PFT_WRITERS_PARKED;
+  uint32_t expected = ticket;
+
+  if (!atomic_compare_exchange_strong_explicit(&pft->win, &expected,
+    (ticket + PRWLOCK_PFT_TICKET), memory_order_relaxed,
+    memory_order_relaxed)) {
+    return EBUSY;
+  }
+
+  /* We own the next phase; enter only if no reader is inside or queued */
+  uint32_t phase = atomic_load_explicit(&pft->phase, memory_order_relaxed)
+    ^ PRWLOCK_PFT_PHID;
+  uint32_t rin = atomic_load_explicit(&pft->rin, memory_order_relaxed);
+  uint32_t rout = atomic_load_explicit(&pft->rout, memory_order_acquire);
+
+  if ((rin & PRWLOCK_PFT_COUNT_MASK) == (rout & PRWLOCK_PFT_COUNT_MASK)
+    && atomic_compare_exchange_strong_explicit(&pft->rin, &rin,
+      (rin | PRWLOCK_PFT_PRES | phase), memory_order_acquire,
+      memory_order_relaxed)) {
+    atomic_store_explicit(&pft->phase, phase, memory_order_relaxed);
+    atomic_store_explicit(&pft->writer_owned, 1, memory_order_relaxed);
+    return 0;
+  }
+
+  prwlock_pft_release_ticket(rwlock, pft);
+  return EBUSY;
+} /* prwlock_pft_trywrlock() */
+
+/* ------------------------------------------------------------------------- */
+
+static int
+prwlock_pft_rdunlock (
+  const partitioned_rwlock_t   *rwlock,
+  prwlock_pft_t                *pft
+) {
+  if (PRWLOCK_PFT_WRITER_PARKED & atomic_fetch_add_explicit(&pft->rout,
+    PRWLOCK_PFT_RINC, memory_order_release)) {
+    (void) prwlock_futex_wake(rwlock, &pft->rout, 1);
+  }
+  return 0;
+} /* prwlock_pft_rdunlock() */
+
+/* ------------------------------------------------------------------------- */
+
+static int
+prwlock_pft_wrunlock (
+  const partitioned_rwlock_t   *rwlock,
+  prwlock_pft_t                *pft
+) {
+  atomic_store_explicit(&pft->writer_owned, 0, memory_order_relaxed);
+  if (PRWLOCK_PFT_READERS_PARKED & atomic_fetch_and_explicit(&pft->rin,
+    PRWLOCK_PFT_COUNT_MASK, memory_order_release)) {
+    (void) prwlock_futex_wake(rwlock, &pft->rin, INT_MAX);
+  }
+  prwlock_pft_release_ticket(rwlock, pft);
+  return 0;
+} /* prwlock_pft_wrunlock() */
+
+/* ------------------------------------------------------------------------- */
+
+#if defined(USE_ATOMICS)
+
+/*
+ * Bounded spin with exponential backoff. Stops early once the cell looks
+ * acquirable, or once another thread has already started parking, in which
+ * case spinning longer would only let us barge ahead of it.
+ */
+static uint32_t
+prwlock_cell_spin (
+  partitioned_rwlock_cell_t    *cell,
+  int                           for_write
+) {
+  uint32_t state = atomic_load_explicit(&cell->state, memory_order_relaxed);
+
+  for (int round = 0; round < PRWLOCK_SPIN_ROUNDS; ++round) {
+    if (for_write) {
+      if (PRWLOCK_STATE_IS_UNLOCKED(state)
+        || (state & PRWLOCK_STATE_WRITERS_WAITING)) {
+        break;
+      }
+    } else if (!PRWLOCK_STATE_IS_WRITE_LOCKED(state)
+      || (state & (PRWLOCK_STATE_READERS_WAITING
+        | PRWLOCK_STATE_WRITERS_WAITING))) {
+      break;
+    }
+
+    for (int ii = 0; ii < (1 << round); ++ii) {
+      PRWLOCK_CPU_RELAX();
+    }
+    state = atomic_load_explicit(&cell->state, memory_order_relaxed);
+  }
+
+  return state;
+} /* prwlock_cell_spin() */
+
+/* ------------------------------------------------------------------------- */
+
+static int
+prwlock_cell_wake_writer (
+  const partitioned_rwlock_t   *rwlock,
+  partitioned_rwlock_cell_t    *cell
+) {
+  atomic_fetch_add_explicit(&cell->writer_notify, 1, memory_order_release);
+  return prwlock_futex_wake(rwlock, &cell->writer_notify, 1);
+} /* prwlock_cell_wake_writer() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Called by the releasing thread once the cell is unlocked and a waiting bit
+ * is set. Unless readers are preferred, with both kinds parked only one
+ * writer is woken and readers stay parked, unless no writer was actually
+ * asleep. If the cell is locked again meanwhile, the new owner inherits the
+ * wake-up duty.
+ */
+static void
+prwlock_cell_wake_writer_or_readers (
+  partitioned_rwlock_t         *rwlock,
+  partitioned_rwlock_cell_t    *cell,
+  uint32_t                      state
+) {
+  assert(PRWLOCK_STATE_IS_UNLOCKED(state));
+
+  /* Reader preference: release every parked reader, writers keep waiting */
+  if (PRWLOCK_POLICY_READER_PREFERRING == rwlock->policy
+    && (state & PRWLOCK_STATE_READERS_WAITING)) {
+    if (atomic_compare_exchange_strong_explicit(&cell->state, &state,
+      (state & ~PRWLOCK_STATE_READERS_WAITING), memory_order_relaxed,
+      memory_order_relaxed)) {
+      (void) prwlock_futex_wake(rwlock, &cell->state, INT_MAX);
+    }
+    return;
+  }
+
+  if (PRWLOCK_STATE_WRITERS_WAITING == state) {
+    if (atomic_compare_exchange_strong_explicit(&cell->state, &state, 0,
+      memory_order_relaxed, memory_order_relaxed)) {
+      (void) prwlock_cell_wake_writer(rwlock, cell);
+      return;
+    }
+  }
+
+  if ((PRWLOCK_STATE_READERS_WAITING | PRWLOCK_STATE_WRITERS_WAITING)
+    == state) {
+    if (!atomic_compare_exchange_strong_explicit(&cell->state, &state,
+      PRWLOCK_STATE_READERS_WAITING, memory_order_relaxed,
+      memory_order_relaxed)) {
+      return;
+    }
+    if (prwlock_cell_wake_writer(rwlock, cell)) {
+      return;
+    }
+    state = PRWLOCK_STATE_READERS_WAITING;
+  }
+
+  if (PRWLOCK_STATE_READERS_WAITING == state) {
+    if (atomic_compare_exchange_strong_explicit(&cell->state, &state, 0,
+      memory_order_relaxed, memory_order_relaxed)) {
+      (void) prwlock_futex_wake(rwlock, &cell->state, INT_MAX);
+    }
+  }
+} /* prwlock_cell_wake_writer_or_readers() */
+
+/* ------------------------------------------------------------------------- */
+
+static int
+prwlock_cell_rdlock_contended (
+  partitioned_rwlock_t         *rwlock,
+  partitioned_rwlock_cell_t    *cell,
+  uint64_t                      deadline
+) {
+  uint32_t state = prwlock_cell_spin(cell, 0);
+
+  while (1) {
+    if (PRWLOCK_STATE_IS_READ_LOCKABLE(state, rwlock->policy)) {
+      if (atomic_compare_exchange_weak_explicit(&cell->state, &state,
+        (state + PRWLOCK_STATE_READ_LOCKED), memory_order_acquire,
+        memory_order_relaxed)) {
+        return 0;
+      }
+      continue;
+    }
+
+    if (PRWLOCK_STATE_MAX_READERS == (state & PRWLOCK_STATE_MASK)) {
+      if (prwlock_now_ns() >= deadline) {
+        return ETIMEDOUT;
+      }
+      sched_yield();
+      state = atomic_load_explicit(&cell->state, memory_order_relaxed);
+      continue;
+    }
+
+    if (0 == (state & PRWLOCK_STATE_READERS_WAITING)) {
+      if (!atomic_compare_exchange_weak_explicit(&cell->state, &state,
+        (state | PRWLOCK_STATE_READERS_WAITING), memory_order_relaxed,
+        memory_order_relaxed)) {
+        continue;
+      }
+    }
+
+    if (0 != prwlock_futex_wait_until(rwlock, &cell->state,
+      (state | PRWLOCK_STATE_READERS_WAITING), deadline)) {
+      prwlock_cell_abandon(rwlock, cell);
+      return ETIMEDOUT;
+    }
+    state = prwlock_cell_spin(cell, 0);
+  }
+} /* prwlock_cell_rdlock_contended() */
+
+/* ------------------------------------------------------------------------- */
+
+static int
+prwlock_cell_wrlock_contended (
+  partitioned_rwlock_t         *rwlock,
+  partitioned_rwlock_cell_t    *cell,
+  uint64_t                      deadline
+) {
+  uint32_t state = prwlock_cell_spin(cell, 1);
+  uint32_t other_writers_waiting = 0;
+
+  while (1) {
+    if (PRWLOCK_STATE_IS_UNLOCKED(state)) {
+      /* Keep the waiting bit: other writers may still be parked */
+      if (atomic_compare_exchange_weak_explicit(&cell->state, &state,
+        (state | PRWLOCK_STATE_WRITE_LOCKED | other_writers_waiting),
+        memory_order_acquire, memory_order_relaxed)) {
+        return 0;
+      }
+      continue;
+    }
+
+    if (0 == (state & PRWLOCK_STATE_WRITERS_WAITING)) {
+      if (!atomic_compare_exchange_weak_explicit(&cell->state, &state,
+        (state | PRWLOCK_STATE_WRITERS_WAITING), memory_order_relaxed,
+        memory_order_relaxed)) {
+        continue;
+      }
+    }
+    other_writers_waiting = PRWLOCK_STATE_WRITERS_WAITING;
+
+    /* Sample the sequence before re-checking so no wake-up is missed */
+    uint32_t seq = atomic_load_explicit(&cell->writer_notify,
+      memory_order_acquire);
+    state = atomic_load_explicit(&cell->state, memory_order_relaxed);
+    if (PRWLOCK_STATE_IS_UNLOCKED(state)
+      || 0 == (state & PRWLOCK_STATE_WRITERS_WAITING)) {
+      continue;
+    }
+
+    if (0 != prwlock_futex_wait_until(rwlock, &cell->writer_notify, seq,
+      deadline)) {
+      prwlock_cell_abandon(rwlock, cell);
+      return ETIMEDOUT;
+    }
+    state = prwlock_cell_spin(cell, 1);
+  }
+} /* prwlock_cell_wrlock_contended() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Called by a waiter that timed out. The waiting bits are shared by every
+ * waiter of a kind, so it cannot tell whether its own was the last one: it
+ * clears both and wakes everyone parked, and those still waiting set them
+ * again. A stale writers-waiting bit would otherwise hold new readers back
+ * until the next release.
+ */
+static void
+prwlock_cell_abandon (
+  const partitioned_rwlock_t   *rwlock,
+  partitioned_rwlock_cell_t    *cell
+) {
+  uint32_t state = atomic_fetch_and_explicit(&cell->state,
+    PRWLOCK_STATE_MASK, memory_order_relaxed);
+
+  if (state & PRWLOCK_STATE_WRITERS_WAITING) {
+    atomic_fetch_add_explicit(&cell->writer_notify, 1, memory_order_release);
+    (void) prwlock_futex_wake(rwlock, &cell->writer_notify, INT_MAX);
+  }
+  if (state & PRWLOCK_STATE_READERS_WAITING) {
+    (void) prwlock_futex_wake(rwlock, &cell->state, INT_MAX);
+  }
+} /* prwlock_cell_abandon() */
+
+/* ------------------------------------------------------------------------- */
+
+static int
+prwlock_cell_rdunlock (
+  partitioned_rwlock_t         *rwlock,
+  partitioned_rwlock_cell_t    *cell
+) {
+  uint32_t state = atomic_fetch_sub_explicit(&cell->state,
+    PRWLOCK_STATE_READ_LOCKED, memory_order_release)
+    - PRWLOCK_STATE_READ_LOCKED;
+
+  /* Readers only park behind a writer, so only the last reader has work */
+  if (PRWLOCK_STATE_IS_UNLOCKED(state)
+    && (state & PRWLOCK_STATE_WRITERS_WAITING)) {
+    prwlock_cell_wake_writer_or_readers(rwlock, cell, state);
+  }
+
+  /*
+   * ...or the last but one, when the one left is upgrading. The fence
+   * pairs with the upgrader's between flagging itself and reading state.
+   */
+  if ((rwlock->flags & PRWLOCK_FLAG_UPGRADABLE)
+    && PRWLOCK_STATE_READ_LOCKED == (state & PRWLOCK_STATE_MASK)) {
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&cell->upgrader, memory_order_relaxed)
+      & PRWLOCK_UPGRADER_UPGRADING) {
+      atomic_fetch_add_explicit(&cell->writer_notify, 1,
+        memory_order_release);
+      (void) prwlock_futex_wake(rwlock, &cell->writer_notify, INT_MAX);
+    }
+  }
+  return 0;
+} /* prwlock_cell_rdunlock() */
+
+/* ------------------------------------------------------------------------- */
+
+static int
+prwlock_cell_wrunlock (
+  partitioned_rwlock_t         *rwlock,
+  partitioned_rwlock_cell_t    *cell
+) {
+  uint32_t state = atomic_fetch_sub_explicit(&cell->state,
+    PRWLOCK_STATE_WRITE_LOCKED, memory_order_release)
+    - PRWLOCK_STATE_WRITE_LOCKED;
+
+  if (state & (PRWLOCK_STATE_READERS_WAITING
+    | PRWLOCK_STATE_WRITERS_WAITING)) {
+    prwlock_cell_wake_writer_or_readers(rwlock, cell, state);
+  }
+  return 0;
+} /* prwlock_cell_wrunlock() */
+#endif /* USE_ATOMICS */
+
+/* ------------------------------------------------------------------------- */
+
+static int
+prwlock_cell_init (
+  partitioned_rwlock_t         *rwlock,
+  partitioned_rwlock_cell_t    *cell
+) {
+  /* Packed cells end before write_held unless the flags need it */
+  if (rwlock->flags & PRWLOCK_WRITE_HELD_FLAGS) {
+    atomic_init(&cell->write_held, 0);
+    atomic_init(&cell->sequence, 0);
+    atomic_init(&cell->upgrader, 0);
+  }
+  if (PRWLOCK_POLICY_PHASE_FAIR == rwlock->policy) {
+    memset(&cell->pft, 0, sizeof(cell->pft));
+    return 0;
+  }
+
+#if defined(USE_LIBUV_RWLOCK)
+  cell->lock_type_held = PRWLOCK_TYPE_NONE;
+  return uv_rwlock_init(&(cell->rwlock));
+#elif defined(USE_ATOMICS) 
+  atomic_init(&cell->state, 0);
+  atomic_init(&cell->writer_notify, 0);
+  return 0;
 #else
-  return pthread_rwlock_wrlock(&rwlock->cells[partition].rwlock);
+  pthread_rwlockattr_t attr;
+  int rc = pthread_rwlockattr_init(&attr);
+  if (0 != rc) {
+    return rc;
+  }
+#if defined(__GLIBC__)
+  if (PRWLOCK_POLICY_WRITER_PREFERRING == rwlock->policy) {
+    rc = pthread_rwlockattr_setkind_np(&attr,
+      PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+  }
+#endif /* __GLIBC__ */
+  if (0 == rc && NULL != rwlock->shared) {
+    rc = pthread_rwlockattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+  }
+  if (0 == rc) {
+    rc = pthread_rwlock_init(&(cell->rwlock), &attr);
+  }
+  (void) pthread_rwlockattr_destroy(&attr);
+  return rc;
 #endif /* USE_LIBUV_RWLOCK */
-} /* partitioned_rwlock_wrlock() */
+} /* prwlock_cell_init() */
 
 /* ------------------------------------------------------------------------- */
 
-int
-partitioned_rwlock_unlock (
+static void
+prwlock_cell_destroy (
   partitioned_rwlock_t         *rwlock,
-  const size_t                  partition
+  partitioned_rwlock_cell_t    *cell
 ) {
-  assert(NULL != rwlock);
-  assert(partition < rwlock->partition_count);
+  if (PRWLOCK_POLICY_PHASE_FAIR == rwlock->policy) {
+    return;
+  }
 
 #if defined(USE_LIBUV_RWLOCK)
-  if (PRWLOCK_TYPE_READ == rwlock->cells[partition].lock_type_held) {
-    uv_rwlock_rdunlock(&rwlock->cells[partition].rwlock);
-  } else if (PRWLOCK_TYPE_WRITE == rwlock->cells[partition].lock_type_held) {
-    uv_rwlock_wrunlock(&rwlock->cells[partition].rwlock);
+  uv_rwlock_destroy(&(cell->rwlock));
+#elif defined(USE_ATOMICS) 
+  atomic_store(&cell->state, 0);
+#else
+  int rc = pthread_rwlock_destroy(&(cell->rwlock));
+  if (0 != rc) {
+    printf("init = %d\n", rc);
+  }
+#endif /* USE_LIBUV_RWLOCK */
+} /* prwlock_cell_destroy() */
+
+/* ------------------------------------------------------------------------- */
+
+static int
+prwlock_cell_rdlock (
+  partitioned_rwlock_t         *rwlock,
+  partitioned_rwlock_cell_t    *cell
+) {
+  if (PRWLOCK_POLICY_PHASE_FAIR == rwlock->policy) {
+    return prwlock_pft_rdlock(rwlock, &cell->pft);
   }
+
+#if defined(USE_LIBUV_RWLOCK)
+  uv_rwlock_rdlock(&(cell->rwlock));
   return 0;
 #elif defined(USE_ATOMICS) 
-  if (PRWLOCK_TYPE_READ == rwlock->cells[partition].lock_type_held) {
-    atomic_fetch_sub_explicit(&rwlock->cells[partition].rwlock, 1,
-      memory_order_release);
-  } else if (PRWLOCK_TYPE_WRITE == rwlock->cells[partition].lock_type_held) {
-    atomic_store_explicit(&rwlock->cells[partition].rwlock, 0,
-      memory_order_release);
+  uint32_t state = atomic_load_explicit(&cell->state, memory_order_relaxed);
+  if (!PRWLOCK_STATE_IS_READ_LOCKABLE(state, rwlock->policy)
+    || !atomic_compare_exchange_weak_explicit(&cell->state, &state,
+      (state + PRWLOCK_STATE_READ_LOCKED), memory_order_acquire,
+      memory_order_relaxed)) {
+    (void) prwlock_cell_rdlock_contended(rwlock, cell,
+      PRWLOCK_DEADLINE_NONE);
   }
   return 0;
 #else
-  return pthread_rwlock_unlock(&rwlock->cells[partition].rwlock);
+  return pthread_rwlock_rdlock(&(cell->rwlock));
 #endif /* USE_LIBUV_RWLOCK */
-} /* partitioned_rwlock_unlock() */
+} /* prwlock_cell_rdlock() */
 
-/* :vi set ts=2 et sw=2: */
+/* ------------------------------------------------------------------------- */
+
+static int
+prwlock_cell_tryrdlock (
+  partitioned_rwlock_t         *rwlock,
+  partitioned_rwlock_cell_t    *cell
+) {
+  if (PRWLOCK_POLICY_PHASE_FAIR == rwlock->policy) {
+    return prwlock_pft_tryrdlock(rwlock, &cell->pft);
+  }
+
+#if defined(USE_LIBUV_RWLOCK)
+  int rc = uv_rwlock_tryrdlock(&(cell->rwlock));
+  return (UV_EBUSY == rc) ? EBUSY : rc;
+#elif defined(USE_ATOMICS) 
+  uint32_t state = atomic_load_explicit(&cell->state, memory_order_relaxed);
+  while (PRWLOCK_STATE_IS_READ_LOCKABLE(state, rwlock->policy)) {
+    if (atomic_compare_exchange_weak_explicit(&cell->state, &state,
+      (state + PRWLOCK_STATE_READ_LOCKED), memory_order_acquire,
+      memory_order_relaxed)) {
+      return 0;
+    }
+  }
+  return EBUSY;
+#else
+  return pthread_rwlock_tryrdlock(&(cell->rwlock));
+#endif /* USE_LIBUV_RWLOCK */
+} /* prwlock_cell_tryrdlock() */
+
+/* ------------------------------------------------------------------------- */
+
+static int
+prwlock_cell_wrlock (
+  partitioned_rwlock_t         *rwlock,
+  partitioned_rwlock_cell_t    *cell
+) {
+  if (PRWLOCK_POLICY_PHASE_FAIR == rwlock->policy) {
+    return prwlock_pft_wrlock(rwlock, &cell->pft);
+  }
+
+#if defined(USE_LIBUV_RWLOCK)
+  uv_rwlock_wrlock(&(cell->rwlock));
+  cell->lock_type_held = PRWLOCK_TYPE_WRITE;
+  return 0;
+#elif defined(USE_ATOMICS) 
+  uint32_t state = 0;
+  if (!atomic_compare_exchange_strong_explicit(&cell->state, &state,
+    PRWLOCK_STATE_WRITE_LOCKED, memory_order_acquire, memory_order_relaxed)) {
+    (void) prwlock_cell_wrlock_contended(rwlock, cell,
+      PRWLOCK_DEADLINE_NONE);
+  }
+  return 0;
+#else
+  return pthread_rwlock_wrlock(&(cell->rwlock));
+#endif /* USE_LIBUV_RWLOCK */
+} /* prwlock_cell_wrlock() */
+
+/* ------------------------------------------------------------------------- */
+
+static int
+prwlock_cell_trywrlock (
+  partitioned_rwlock_t         *rwlock,
+  partitioned_rwlock_cell_t    *cell
+) {
+  if (PRWLOCK_POLICY_PHASE_FAIR == rwlock->policy) {
+    return prwlock_pft_trywrlock(rwlock, &cell->pft);
+  }
+
+#if defined(USE_LIBUV_RWLOCK)
+  int rc = uv_rwlock_trywrlock(&(cell->rwlock));
+  if (0 == rc) {
+    cell->lock_type_held = PRWLOCK_TYPE_WRITE;
+  }
+  return (UV_EBUSY == rc) ? EBUSY : rc;
+#elif defined(USE_ATOMICS) 
+  uint32_t state = atomic_load_explicit(&cell->state, memory_order_relaxed);
+  while (PRWLOCK_STATE_IS_UNLOCKED(state)) {
+    if (atomic_compare_exchange_weak_explicit(&cell->state, &state,
+      (state | PRWLOCK_STATE_WRITE_LOCKED), memory_order_acquire,
+      memory_order_relaxed)) {
+      return 0;
+    }
+  }
+  return EBUSY;
+#else
+  return pthread_rwlock_trywrlock(&(cell->rwlock));
+#endif /* USE_LIBUV_RWLOCK */
+} /* prwlock_cell_trywrlock() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Releases the cell in the mode the caller says it holds, or with
+ * PRWLOCK_UNLOCK_INFER works the mode out first. Only writers ever store
+ * anything to tell by, so readers leave the cell line shared.
+ */
+static int
+prwlock_cell_release (
+  partitioned_rwlock_t         *rwlock,
+  partitioned_rwlock_cell_t    *cell,
+  int                           for_write
+) {
+  if (PRWLOCK_POLICY_PHASE_FAIR == rwlock->policy) {
+    if (PRWLOCK_UNLOCK_INFER == for_write) {
+      for_write = atomic_load_explicit(&cell->pft.writer_owned,
+        memory_order_relaxed);
+    }
+    return (for_write) ? prwlock_pft_wrunlock(rwlock, &cell->pft)
+      : prwlock_pft_rdunlock(rwlock, &cell->pft);
+  }
+
+#if defined(USE_LIBUV_RWLOCK)
+  if (PRWLOCK_UNLOCK_INFER == for_write) {
+    for_write = (PRWLOCK_TYPE_WRITE == cell->lock_type_held);
+  }
+  if (for_write) {
+    cell->lock_type_held = PRWLOCK_TYPE_NONE;
+    uv_rwlock_wrunlock(&(cell->rwlock));
+  } else {
+    uv_rwlock_rdunlock(&(cell->rwlock));
+  }
+  return 0;
+#elif defined(USE_ATOMICS) 
+  /* The caller holds the cell, so the reader count tells us which mode */
+  if (PRWLOCK_UNLOCK_INFER == for_write) {
+    for_write = PRWLOCK_STATE_IS_WRITE_LOCKED(atomic_load_explicit(
+      &cell->state, memory_order_relaxed));
+  }
+  return (for_write) ? prwlock_cell_wrunlock(rwlock, cell)
+    : prwlock_cell_rdunlock(rwlock, cell);
+#else
+  (void) for_write;
+  return pthread_rwlock_unlock(&(cell->rwlock));
+#endif /* USE_LIBUV_RWLOCK */
+} /* prwlock_cell_release() */
+
+/* ------------------------------------------------------------------------- */
+
+static int
+prwlock_cell_unlock (
+  partitioned_rwlock_t         *rwlock,
+  partitioned_rwlock_cell_t    *cell
+) {
+  return prwlock_cell_release(rwlock, cell, PRWLOCK_UNLOCK_INFER);
+} /* prwlock_cell_unlock() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Timed acquisition of cells that cannot wait with a timeout: libuv's, and
+ * phase-fair ones, whose tickets cannot be handed back once queued. Retries
+ * the trylock with backoff, then sleeps between attempts, doubling the nap
+ * up to a bound so a release is noticed soon after it happens.
+ */
+static int
+prwlock_cell_poll (
+  partitioned_rwlock_t         *rwlock,
+  partitioned_rwlock_cell_t    *cell,
+  int                           for_write,
+  uint64_t                      deadline
+) {
+  uint64_t nap = PRWLOCK_POLL_SLEEP_MIN_NS;
+
+  for (int round = 0; ; ++round) {
+    int rc = (for_write) ? prwlock_cell_trywrlock(rwlock, cell)
+      : prwlock_cell_tryrdlock(rwlock, cell);
+    if (EBUSY != rc) {
+      return rc;
+    }
 
+    uint64_t now = prwlock_now_ns();
+    if (now >= deadline) {
+      return ETIMEDOUT;
+    }
+    if (PRWLOCK_SPIN_ROUNDS > round) {
+      for (int ii = 0; ii < (1 << round); ++ii) {
+        PRWLOCK_CPU_RELAX();
+      }
+      continue;
+    }
+
+    struct timespec pause;
+    prwlock_timespec(((deadline - now) < nap) ? (deadline - now) : nap,
+      &pause);
+    (void) nanosleep(&pause, NULL);
+    if (PRWLOCK_POLL_SLEEP_MAX_NS > nap) {
+      nap *= 2;
+    }
+  }
+} /* prwlock_cell_poll() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * The atomics backend spins, then parks with a timeout, and on giving up
+ * takes back the waiting bit it set. pthreads only time out against the
+ * realtime clock, so the deadline is carried over to it, as of now.
+ */
+static int
+prwlock_cell_timedlock (
+  partitioned_rwlock_t         *rwlock,
+  partitioned_rwlock_cell_t    *cell,
+  int                           for_write,
+  uint64_t                      deadline
+) {
+  if (PRWLOCK_POLICY_PHASE_FAIR == rwlock->policy) {
+    return prwlock_cell_poll(rwlock, cell, for_write, deadline);
+  }
+
+#if defined(USE_LIBUV_RWLOCK)
+  return prwlock_cell_poll(rwlock, cell, for_write, deadline);
+#elif defined(USE_ATOMICS) 
+  if (for_write) {
+    uint32_t state = 0;
+    if (atomic_compare_exchange_strong_explicit(&cell->state, &state,
+      PRWLOCK_STATE_WRITE_LOCKED, memory_order_acquire,
+      memory_order_relaxed)) {
+      return 0;
+    }
+    return prwlock_cell_wrlock_contended(rwlock, cell, deadline);
+  }
+
+  uint32_t state = atomic_load_explicit(&cell->state, memory_order_relaxed);
+  if (PRWLOCK_STATE_IS_READ_LOCKABLE(state, rwlock->policy)
+    && atomic_compare_exchange_weak_explicit(&cell->state, &state,
+      (state + PRWLOCK_STATE_READ_LOCKED), memory_order_acquire,
+      memory_order_relaxed)) {
+    return 0;
+  }
+  return prwlock_cell_rdlock_contended(rwlock, cell, deadline);
+#else
+  struct timespec realtime;
+  uint64_t now = prwlock_now_ns();
+
+  clock_gettime(CLOCK_REALTIME, &realtime);
+  prwlock_timespec(((uint64_t) realtime.tv_sec * UINT64_C(1000000000))
+    + (uint64_t) realtime.tv_nsec + ((deadline > now) ? (deadline - now) : 0),
+    &realtime);
+  return (for_write) ? pthread_rwlock_timedwrlock(&(cell->rwlock), &realtime)
+    : pthread_rwlock_timedrdlock(&(cell->rwlock), &realtime);
+#endif /* USE_LIBUV_RWLOCK */
+} /* prwlock_cell_timedlock() */
+
+/* ------------------------------------------------------------------------- */
+
+/* Takes the cell by deadline: a trylock, a plain lock or a timed one */
+static int
+prwlock_cell_acquire (
+  partitioned_rwlock_t         *rwlock,
+  partitioned_rwlock_cell_t    *cell,
+  int                           for_write,
+  uint64_t                      deadline
+) {
+  if (PRWLOCK_DEADLINE_NOW == deadline) {
+    return (for_write) ? prwlock_cell_trywrlock(rwlock, cell)
+      : prwlock_cell_tryrdlock(rwlock, cell);
+  }
+  if (PRWLOCK_DEADLINE_NONE == deadline) {
+    return (for_write) ? prwlock_cell_wrlock(rwlock, cell)
+      : prwlock_cell_rdlock(rwlock, cell);
+  }
+  return prwlock_cell_timedlock(rwlock, cell, for_write, deadline);
+} /* prwlock_cell_acquire() */
+
+/* ------------------------------------------------------------------------- */
+
+/* Whether conversions go through the token rather than the cell itself */
+static int
+prwlock_upgrader_emulated (
+  const partitioned_rwlock_t   *rwlock
+) {
+  if (!(rwlock->flags & PRWLOCK_FLAG_UPGRADABLE)) {
+    return 0;
+  }
+#if defined(USE_ATOMICS)
+  return (PRWLOCK_POLICY_PHASE_FAIR == rwlock->policy);
+#else
+  return 1;
+#endif /* USE_ATOMICS */
+} /* prwlock_upgrader_emulated() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Takes the partition's upgrader token. A thread that has parked keeps the
+ * waiting bit set when it gets the token, as others may still be parked.
+ */
+static int
+prwlock_upgrader_acquire (
+  const partitioned_rwlock_t   *rwlock,
+  partitioned_rwlock_cell_t    *cell,
+  uint64_t                      deadline
+) {
+  uint32_t self = (prwlock_thread_id() + 1);
+  uint32_t token = atomic_load_explicit(&cell->upgrader, memory_order_relaxed);
+  uint32_t waiting = 0;
+
+  for (;;) {
+    if (0 == (token & PRWLOCK_UPGRADER_OWNER_MASK)) {
+      if (atomic_compare_exchange_weak_explicit(&cell->upgrader, &token,
+        (self | (token & PRWLOCK_UPGRADER_WAITING) | waiting),
+        memory_order_acquire, memory_order_relaxed)) {
+        return 0;
+      }
+      continue;
+    }
+    if (PRWLOCK_DEADLINE_NOW == deadline) {
+      return EBUSY;
+    }
+    if (0 == (token & PRWLOCK_UPGRADER_WAITING)) {
+      if (!atomic_compare_exchange_weak_explicit(&cell->upgrader, &token,
+        (token | PRWLOCK_UPGRADER_WAITING), memory_order_relaxed,
+        memory_order_relaxed)) {
+        continue;
+      }
+      token |= PRWLOCK_UPGRADER_WAITING;
+    }
+    waiting = PRWLOCK_UPGRADER_WAITING;
+    if (0 != prwlock_futex_wait_until(rwlock, &cell->upgrader, token,
+      deadline)) {
+      return ETIMEDOUT;
+    }
+    token = atomic_load_explicit(&cell->upgrader, memory_order_relaxed);
+  }
+} /* prwlock_upgrader_acquire() */
+
+/* ------------------------------------------------------------------------- */
+
+static void
+prwlock_upgrader_release (
+  const partitioned_rwlock_t   *rwlock,
+  partitioned_rwlock_cell_t    *cell
+) {
+  uint32_t token = atomic_exchange_explicit(&cell->upgrader, 0,
+    memory_order_release);
+
+  if (token & PRWLOCK_UPGRADER_WAITING) {
+    (void) prwlock_futex_wake(rwlock, &cell->upgrader, 1);
+  }
+} /* prwlock_upgrader_release() */
+
+/* ------------------------------------------------------------------------- */
+
+static int
+prwlock_upgrader_owned (
+  partitioned_rwlock_cell_t    *cell
+) {
+  return ((prwlock_thread_id() + 1) == (atomic_load_explicit(&cell->upgrader,
+    memory_order_relaxed) & PRWLOCK_UPGRADER_OWNER_MASK));
+} /* prwlock_upgrader_owned() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Turns the caller's read hold into a write hold. Natively, the upgrader
+ * flags its wait on the state word so new readers queue, and the reader
+ * that leaves it alone wakes it. Emulated, it lets go of the cell and
+ * write-locks it; it holds the token, so no writer comes in between.
+ */
+static int
+prwlock_cell_upgrade (
+  partitioned_rwlock_t         *rwlock,
+  partitioned_rwlock_cell_t    *cell,
+  uint64_t                      deadline
+) {
+  int rc;
+
+  if (prwlock_upgrader_emulated(rwlock)) {
+    (void) prwlock_cell_unlock(rwlock, cell);
+    if (0 != (rc = prwlock_cell_acquire(rwlock, cell, 1, deadline))) {
+      (void) prwlock_cell_rdlock(rwlock, cell);
+    }
+    return rc;
+  }
+
+#if defined(USE_ATOMICS)
+  uint32_t state = atomic_load_explicit(&cell->state, memory_order_relaxed);
+  rc = 0;
+
+  for (;;) {
+    if (PRWLOCK_STATE_READ_LOCKED == (state & PRWLOCK_STATE_MASK)) {
+      if (atomic_compare_exchange_weak_explicit(&cell->state, &state,
+        ((state & ~PRWLOCK_STATE_MASK) | PRWLOCK_STATE_WRITE_LOCKED),
+        memory_order_acquire, memory_order_relaxed)) {
+        break;
+      }
+      continue;
+    }
+    if (PRWLOCK_DEADLINE_NOW == deadline) {
+      rc = EBUSY;
+      break;
+    }
+    if (0 == (state & PRWLOCK_STATE_WRITERS_WAITING)) {
+      if (!atomic_compare_exchange_weak_explicit(&cell->state, &state,
+        (state | PRWLOCK_STATE_WRITERS_WAITING), memory_order_relaxed,
+        memory_order_relaxed)) {
+        continue;
+      }
+    }
+    atomic_fetch_or(&cell->upgrader, PRWLOCK_UPGRADER_UPGRADING);
+
+    uint32_t seq = atomic_load_explicit(&cell->writer_notify,
+      memory_order_acquire);
+    state = atomic_load(&cell->state);
+    if (PRWLOCK_STATE_READ_LOCKED != (state & PRWLOCK_STATE_MASK)) {
+      if (0 != prwlock_futex_wait_until(rwlock, &cell->writer_notify, seq,
+        deadline)) {
+        rc = ETIMEDOUT;
+        break;
+      }
+      state = atomic_load_explicit(&cell->state, memory_order_relaxed);
+    }
+  }
+
+  atomic_fetch_and_explicit(&cell->upgrader, ~PRWLOCK_UPGRADER_UPGRADING,
+    memory_order_relaxed);
+  if (ETIMEDOUT == rc) {
+    prwlock_cell_abandon(rwlock, cell);
+  }
+  return rc;
+#else
+  return EINVAL;
+#endif /* USE_ATOMICS */
+} /* prwlock_cell_upgrade() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Turns the caller's write hold into a read hold. Parked readers are let in
+ * along with us unless writers are waiting and readers are not preferred.
+ */
+static int
+prwlock_cell_downgrade (
+  partitioned_rwlock_t         *rwlock,
+  partitioned_rwlock_cell_t    *cell
+) {
+  if (prwlock_upgrader_emulated(rwlock)) {
+    (void) prwlock_cell_unlock(rwlock, cell);
+    return prwlock_cell_rdlock(rwlock, cell);
+  }
+
+#if defined(USE_ATOMICS)
+  uint32_t state = atomic_load_explicit(&cell->state, memory_order_relaxed);
+  uint32_t next;
+
+  do {
+    next = ((state & ~PRWLOCK_STATE_MASK) | PRWLOCK_STATE_READ_LOCKED);
+    if ((next & PRWLOCK_STATE_READERS_WAITING)
+      && (PRWLOCK_POLICY_READER_PREFERRING == rwlock->policy
+        || 0 == (next & PRWLOCK_STATE_WRITERS_WAITING))) {
+      next &= ~PRWLOCK_STATE_READERS_WAITING;
+    }
+  } while (!atomic_compare_exchange_weak_explicit(&cell->state, &state, next,
+    memory_order_release, memory_order_relaxed));
+
+  if ((state & PRWLOCK_STATE_READERS_WAITING)
+    && 0 == (next & PRWLOCK_STATE_READERS_WAITING)) {
+    (void) prwlock_futex_wake(rwlock, &cell->state, INT_MAX);
+  }
+  return 0;
+#else
+  return EINVAL;
+#endif /* USE_ATOMICS */
+} /* prwlock_cell_downgrade() */
+
+/* ------------------------------------------------------------------------- */
+
+static int
+prwlock_bias_init (
+  partitioned_rwlock_t         *rwlock
+) {
+  size_t partition_count = rwlock->partition_count;
+
+  if (partition_count > PRWLOCK_BIAS_PARTITION_MASK) {
+    printf("Too many partitions for a reader-biased lock!\n");
+    return -1;
+  }
+
+  if (posix_memalign((void **) &rwlock->bias.visible_readers, CACHE_LINE_SIZE,
+    (PRWLOCK_VISIBLE_READER_SLOTS * sizeof(*rwlock->bias.visible_readers)))) {
+    printf("Failed to allocate visible reader table!\n");
+    return -1;
+  }
+  rwlock->bias.enabled = malloc(partition_count
+    * sizeof(*rwlock->bias.enabled));
+  rwlock->bias.inhibit_until = malloc(partition_count
+    * sizeof(*rwlock->bias.inhibit_until));
+  if (NULL == rwlock->bias.enabled || NULL == rwlock->bias.inhibit_until) {
+    printf("Failed to allocate reader bias state!\n");
+    prwlock_bias_destroy(rwlock);
+    return -1;
+  }
+
+  for (size_t ii = 0; ii < PRWLOCK_VISIBLE_READER_SLOTS; ++ii) {
+    atomic_init(&rwlock->bias.visible_readers[ii], 0);
+  }
+  for (size_t ii = 0; ii < partition_count; ++ii) {
+    atomic_init(&rwlock->bias.enabled[ii], 1);
+    atomic_init(&rwlock->bias.inhibit_until[ii], 0);
+  }
+  return 0;
+} /* prwlock_bias_init() */
+
+/* ------------------------------------------------------------------------- */
+
+static void
+prwlock_bias_destroy (
+  partitioned_rwlock_t         *rwlock
+) {
+  free(rwlock->bias.visible_readers);
+  free(rwlock->bias.enabled);
+  free(rwlock->bias.inhibit_until);
+  memset(&rwlock->bias, 0, sizeof(rwlock->bias));
+} /* prwlock_bias_destroy() */
+
+/* ------------------------------------------------------------------------- */
+
+static _Atomic uint64_t *
+prwlock_bias_slot (
+  partitioned_rwlock_t         *rwlock,
+  uint32_t                      thread_id,
+  size_t                        partition
+) {
+  uint64_t hash = ((uint64_t) thread_id * UINT64_C(0x9e3779b97f4a7c15))
+    ^ ((uint64_t) partition * UINT64_C(0xc2b2ae3d27d4eb4f));
+  hash ^= (hash >> 29);
+  return &rwlock->bias.visible_readers[hash
+    & (PRWLOCK_VISIBLE_READER_SLOTS - 1)];
+} /* prwlock_bias_slot() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * While a partition is biased, a reader only publishes itself in a slot of
+ * the visible-reader table and re-checks the bias; the cell, and therefore
+ * the cache line every other reader of the partition is using, is untouched.
+ * Readers that lose the race with a revoking writer, or collide on a slot,
+ * take the cell's own read lock instead.
+ */
+static int
+prwlock_bias_rdlock (
+  partitioned_rwlock_t         *rwlock,
+  size_t                        partition,
+  uint64_t                      deadline
+) {
+  if (atomic_load_explicit(&rwlock->bias.enabled[partition],
+    memory_order_relaxed)) {
+    uint32_t thread_id = prwlock_thread_id();
+    _Atomic uint64_t *slot = prwlock_bias_slot(rwlock, thread_id, partition);
+    uint64_t expected = 0;
+
+    if (atomic_compare_exchange_strong(slot, &expected,
+      PRWLOCK_BIAS_SLOT_VALUE(thread_id, partition))) {
+      if (atomic_load(&rwlock->bias.enabled[partition])) {
+        return 0;
+      }
+      atomic_store_explicit(slot, 0, memory_order_release);
+    }
+  }
+
+  partitioned_rwlock_cell_t *cell = PRWLOCK_CELL(rwlock, partition);
+  int rc = prwlock_cell_acquire(rwlock, cell, 0, deadline);
+
+  /* Writers are excluded while we hold the cell, so re-arming is safe here */
+  if (0 == rc
+    && !atomic_load_explicit(&rwlock->bias.enabled[partition],
+      memory_order_relaxed)
+    && prwlock_now_ns() >= atomic_load_explicit(
+      &rwlock->bias.inhibit_until[partition], memory_order_relaxed)) {
+    atomic_store_explicit(&rwlock->bias.enabled[partition], 1,
+      memory_order_relaxed);
+  }
+
+  return rc;
+} /* prwlock_bias_rdlock() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Called with the cell write-locked. Turns the bias off and waits for every
+ * reader that entered through the visible-reader table to leave. The bias
+ * then stays off for a multiple of the time the drain took, which bounds the
+ * fraction of time writers spend scanning the table. A trylock that finds a
+ * reader still inside, or a timed lock that runs out of time waiting for
+ * one, re-arms the bias before backing out, since the next writer relies on
+ * it to know the table must be drained.
+ */
+static int
+prwlock_bias_revoke (
+  partitioned_rwlock_t         *rwlock,
+  size_t                        partition,
+  uint64_t                      deadline
+) {
+  atomic_store(&rwlock->bias.enabled[partition], 0);
+
+  uint64_t start = prwlock_now_ns();
+  for (size_t ii = 0; ii < PRWLOCK_VISIBLE_READER_SLOTS; ++ii) {
+    _Atomic uint64_t *slot = &rwlock->bias.visible_readers[ii];
+    size_t spins = 0;
+    uint64_t value;
+
+    while (0 != (value = atomic_load_explicit(slot, memory_order_acquire))
+      && partition == (value & PRWLOCK_BIAS_PARTITION_MASK)) {
+      if (PRWLOCK_DEADLINE_NOW == deadline || (PRWLOCK_SPIN_LIMIT <= spins
+        && prwlock_now_ns() >= deadline)) {
+        atomic_store(&rwlock->bias.enabled[partition], 1);
+        return (PRWLOCK_DEADLINE_NOW == deadline) ? EBUSY : ETIMEDOUT;
+      }
+      if (PRWLOCK_SPIN_LIMIT > ++spins) {
+        PRWLOCK_CPU_RELAX();
+      } else {
+        sched_yield();
+      }
+    }
+  }
+  uint64_t end = prwlock_now_ns();
+
+  atomic_store_explicit(&rwlock->bias.inhibit_until[partition],
+    (end + ((end - start) * PRWLOCK_BIAS_INHIBIT_FACTOR)),
+    memory_order_relaxed);
+
+  return 0;
+} /* prwlock_bias_revoke() */
+
+/* ------------------------------------------------------------------------- */
+
+static int
+prwlock_bias_rdunlock (
+  partitioned_rwlock_t         *rwlock,
+  size_t                        partition,
+  int                           for_write
+) {
+  uint32_t thread_id = prwlock_thread_id();
+  _Atomic uint64_t *slot = prwlock_bias_slot(rwlock, thread_id, partition);
+
+  /* Only this thread ever stores this value, so a match means we own it */
+  if (PRWLOCK_BIAS_SLOT_VALUE(thread_id, partition)
+    == atomic_load_explicit(slot, memory_order_relaxed)) {
+    atomic_store_explicit(slot, 0, memory_order_release);
+    return 0;
+  }
+
+  return prwlock_cell_release(rwlock, PRWLOCK_CELL(rwlock, partition),
+    for_write);
+} /* prwlock_bias_rdunlock() */
+
+/* ------------------------------------------------------------------------- */
+
+/* 64x64->128 multiply, folded back to 64 bits */
+static uint64_t
+prwlock_hash_mix (
+  uint64_t                      lhs,
+  uint64_t                      rhs
+) {
+  __uint128_t product = (__uint128_t) lhs * rhs;
+  return ((uint64_t) product ^ (uint64_t) (product >> 64));
+} /* prwlock_hash_mix() */
+
+/* ------------------------------------------------------------------------- */
+
+static uint64_t
+prwlock_hash_read8 (
+  const uint8_t                *bytes
+) {
+  uint64_t value;
+  memcpy(&value, bytes, sizeof(value));
+  return value;
+} /* prwlock_hash_read8() */
+
+/* ------------------------------------------------------------------------- */
+
+static uint64_t
+prwlock_hash_read4 (
+  const uint8_t                *bytes
+) {
+  uint32_t value;
+  memcpy(&value, bytes, sizeof(value));
+  return value;
+} /* prwlock_hash_read4() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * wyhash (final version 4): keys are consumed eight bytes at a time, 48 at
+ * a time over three independent lanes for long keys, and short keys need
+ * no loop at all. Far faster than a byte-at-a-time hash on the short keys
+ * partitions are usually chosen by, with good avalanche in both halves.
+ */
+static uint64_t
+prwlock_hash_bytes (
+  const void                   *key,
+  size_t                        length,
+  uint64_t                      seed
+) {
+  const uint8_t *bytes = (const uint8_t *) key;
+  uint64_t lhs, rhs;
+
+  seed ^= prwlock_hash_mix(seed ^ PRWLOCK_HASH_SECRET0, PRWLOCK_HASH_SECRET1);
+  if (16 >= length) {
+    if (4 <= length) {
+      size_t offset = ((length >> 3) << 2);
+      lhs = (prwlock_hash_read4(bytes) << 32)
+        | prwlock_hash_read4(bytes + offset);
+      rhs = (prwlock_hash_read4(bytes + length - 4) << 32)
+        | prwlock_hash_read4(bytes + length - 4 - offset);
+    } else if (0 < length) {
+      lhs = (((uint64_t) bytes[0]) << 16)
+        | (((uint64_t) bytes[length >> 1]) << 8) | bytes[length - 1];
+      rhs = 0;
+    } else {
+      lhs = rhs = 0;
+    }
+  } else {
+    size_t remaining = length;
+    if (48 < remaining) {
+      uint64_t seed1 = seed;
+      uint64_t seed2 = seed;
+      do {
+        seed = prwlock_hash_mix(prwlock_hash_read8(bytes) ^ PRWLOCK_HASH_SECRET1,
+          prwlock_hash_read8(bytes + 8) ^ seed);
+        seed1 = prwlock_hash_mix(
+          prwlock_hash_read8(bytes + 16) ^ PRWLOCK_HASH_SECRET2,
+          prwlock_hash_read8(bytes + 24) ^ seed1);
+        seed2 = prwlock_hash_mix(
+          prwlock_hash_read8(bytes + 32) ^ PRWLOCK_HASH_SECRET3,
+          prwlock_hash_read8(bytes + 40) ^ seed2);
+        bytes += 48;
+        remaining -= 48;
+      } while (48 < remaining);
+      seed ^= (seed1 ^ seed2);
+    }
+    while (16 < remaining) {
+      seed = prwlock_hash_mix(prwlock_hash_read8(bytes) ^ PRWLOCK_HASH_SECRET1,
+        prwlock_hash_read8(bytes + 8) ^ seed);
+      bytes += 16;
+      remaining -= 16;
+    }
+    lhs = prwlock_hash_read8(bytes + remaining - 16);
+    rhs = prwlock_hash_read8(bytes + remaining - 8);
+  }
+
+  __uint128_t product = (__uint128_t) (lhs ^ PRWLOCK_HASH_SECRET1)
+    * (rhs ^ seed);
+  lhs = (uint64_t) product;
+  rhs = (uint64_t) (product >> 64);
+  return prwlock_hash_mix(lhs ^ PRWLOCK_HASH_SECRET0 ^ length,
+    rhs ^ PRWLOCK_HASH_SECRET1);
+} /* prwlock_hash_bytes() */
+
+/* ------------------------------------------------------------------------- */
+
+/* wyhash64: integer keys, two multiplies and no memory traffic */
+static uint64_t
+prwlock_hash_u64 (
+  uint64_t                      key,
+  uint64_t                      seed
+) {
+  __uint128_t product = (__uint128_t) (key ^ PRWLOCK_HASH_SECRET0)
+    * (seed ^ PRWLOCK_HASH_SECRET1);
+  return prwlock_hash_mix((uint64_t) product ^ PRWLOCK_HASH_SECRET0,
+    (uint64_t) (product >> 64) ^ PRWLOCK_HASH_SECRET1);
+} /* prwlock_hash_u64() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Power-of-two counts take the low bits; anything else uses Lemire's
+ * multiply-shift range reduction, which needs no division and is unbiased
+ * enough for any count far below 2^64.
+ */
+static size_t
+prwlock_hash_reduce (
+  const partitioned_rwlock_t   *rwlock,
+  uint64_t                      hash
+) {
+  if (0 != rwlock->partition_mask) {
+    return (size_t) (hash & rwlock->partition_mask);
+  }
+  return (size_t) (((__uint128_t) hash * rwlock->partition_count) >> 64);
+} /* prwlock_hash_reduce() */
+
+/* ------------------------------------------------------------------------- */
+
+static int
+prwlock_global_init (
+  partitioned_rwlock_t         *rwlock
+) {
+  if (posix_memalign((void **) &rwlock->global.ingress, CACHE_LINE_SIZE,
+    (PRWLOCK_INGRESS_SLOTS * sizeof(*rwlock->global.ingress)))) {
+    printf("Failed to allocate ingress counters!\n");
+    return -1;
+  }
+  for (size_t ii = 0; ii < PRWLOCK_INGRESS_SLOTS; ++ii) {
+    atomic_init(&rwlock->global.ingress[ii].readers, 0);
+    atomic_init(&rwlock->global.ingress[ii].writers, 0);
+  }
+  atomic_init(&rwlock->global.intent, 0);
+
+  int rc = prwlock_cell_init(rwlock, &rwlock->global.cell);
+  if (0 != rc) {
+    printf("init = %d\n", rc);
+    free(rwlock->global.ingress);
+    rwlock->global.ingress = NULL;
+    return -1;
+  }
+  return 0;
+} /* prwlock_global_init() */
+
+/* ------------------------------------------------------------------------- */
+
+static void
+prwlock_global_destroy (
+  partitioned_rwlock_t         *rwlock
+) {
+  if (NULL == rwlock->global.ingress) {
+    return;
+  }
+  prwlock_cell_destroy(rwlock, &rwlock->global.cell);
+  free(rwlock->global.ingress);
+  rwlock->global.ingress = NULL;
+} /* prwlock_global_destroy() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Finds, or claims, the calling thread's record of the partitions it holds
+ * in this lock. An entry holding nothing is free for reuse by any lock.
+ * Returns NULL if the thread already holds partitions of too many locks.
+ */
+static prwlock_global_hold_t *
+prwlock_global_hold (
+  partitioned_rwlock_t         *rwlock
+) {
+  prwlock_global_hold_t *unused = NULL;
+
+  for (size_t ii = 0; ii < PRWLOCK_GLOBAL_HOLD_SLOTS; ++ii) {
+    prwlock_global_hold_t *hold = &prwlock_global_holds[ii];
+
+    if (0 == hold->readers && 0 == hold->writers) {
+      if (NULL == unused) {
+        unused = hold;
+      }
+    } else if (rwlock == hold->rwlock) {
+      return hold;
+    }
+  }
+  if (NULL != unused) {
+    unused->rwlock = rwlock;
+  }
+  return unused;
+} /* prwlock_global_hold() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Whether a partition operation must wait for the global holders recorded in
+ * the intention word. While a global holder is draining, everyone new waits;
+ * a thread that already holds partitions is one of those being drained, so
+ * the global holder is in fact waiting on it, and it goes ahead rather than
+ * deadlock. Once a shared holder is in, only writers are kept out.
+ */
+static int
+prwlock_global_blocks (
+  uint32_t                      intent,
+  partitioned_rwlock_mode_t     mode,
+  const prwlock_global_hold_t  *hold
+) {
+  if (intent & (PRWLOCK_GLOBAL_EXCLUSIVE | PRWLOCK_GLOBAL_PENDING)) {
+    return (NULL == hold) || (0 == hold->readers && 0 == hold->writers);
+  }
+  return (PRWLOCK_MODE_WRITE == mode) && (0 != intent);
+} /* prwlock_global_blocks() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Partition-side half of the global protocol: count ourselves in the
+ * thread's ingress slot, then check the intention word. The global side
+ * publishes its intention before reading the counters, so with both sides
+ * sequentially consistent at least one of them sees the other. A thread
+ * holding nothing sleeps on the global cell until the conflicting holders
+ * are out, then tries again. One holding partitions must not queue there
+ * behind a global holder that may be draining it, and watches the
+ * intention word instead, as does anyone waiting out a drain.
+ */
+static int
+prwlock_global_enter (
+  partitioned_rwlock_t         *rwlock,
+  partitioned_rwlock_mode_t     mode,
+  uint64_t                      deadline
+) {
+  prwlock_ingress_t *ingress = &rwlock->global.ingress[prwlock_thread_id()
+    & (PRWLOCK_INGRESS_SLOTS - 1)];
+  _Atomic uint32_t *count = (PRWLOCK_MODE_WRITE == mode) ? &ingress->writers
+    : &ingress->readers;
+  prwlock_global_hold_t *hold = prwlock_global_hold(rwlock);
+
+  for (;;) {
+    atomic_fetch_add(count, 1);
+    uint32_t intent = atomic_load(&rwlock->global.intent);
+    if (!prwlock_global_blocks(intent, mode, hold)) {
+      break;
+    }
+    atomic_fetch_sub_explicit(count, 1, memory_order_release);
+
+    if (PRWLOCK_DEADLINE_NOW == deadline) {
+      return EBUSY;
+    }
+    if (!(intent & PRWLOCK_GLOBAL_PENDING)
+      && (NULL == hold || (0 == hold->readers && 0 == hold->writers))) {
+      int rc = prwlock_cell_acquire(rwlock, &rwlock->global.cell,
+        (PRWLOCK_MODE_WRITE == mode), deadline);
+      if (0 != rc) {
+        return rc;
+      }
+      (void) prwlock_cell_unlock(rwlock, &rwlock->global.cell);
+    } else if (0 != prwlock_futex_wait_until(rwlock, &rwlock->global.intent,
+      intent, deadline)) {
+      return ETIMEDOUT;
+    }
+  }
+
+  if (NULL != hold) {
+    if (PRWLOCK_MODE_WRITE == mode) {
+      ++hold->writers;
+    } else {
+      ++hold->readers;
+    }
+  }
+  return 0;
+} /* prwlock_global_enter() */
+
+/* ------------------------------------------------------------------------- */
+
+static void
+prwlock_global_exit (
+  partitioned_rwlock_t         *rwlock,
+  partitioned_rwlock_mode_t     mode
+) {
+  prwlock_ingress_t *ingress = &rwlock->global.ingress[prwlock_thread_id()
+    & (PRWLOCK_INGRESS_SLOTS - 1)];
+  prwlock_global_hold_t *hold = prwlock_global_hold(rwlock);
+
+  if (PRWLOCK_MODE_WRITE == mode) {
+    atomic_fetch_sub_explicit(&ingress->writers, 1, memory_order_release);
+    if (NULL != hold && 0 < hold->writers) {
+      --hold->writers;
+    }
+  } else {
+    atomic_fetch_sub_explicit(&ingress->readers, 1, memory_order_release);
+    if (NULL != hold && 0 < hold->readers) {
+      --hold->readers;
+    }
+  }
+} /* prwlock_global_exit() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Called with the intention published; waits out partition holders. A slot
+ * seen empty stays empty, as anyone counting into it afresh now backs off.
+ */
+static void
+prwlock_global_drain (
+  partitioned_rwlock_t         *rwlock
+) {
+  for (size_t ii = 0; ii < PRWLOCK_INGRESS_SLOTS; ++ii) {
+    prwlock_ingress_t *ingress = &rwlock->global.ingress[ii];
+    size_t spins = 0;
+
+    while (0 != atomic_load(&ingress->writers)
+      || 0 != atomic_load(&ingress->readers)) {
+      if (PRWLOCK_SPIN_LIMIT > ++spins) {
+        PRWLOCK_CPU_RELAX();
+      } else {
+        sched_yield();
+      }
+    }
+  }
+} /* prwlock_global_drain() */
+
+/* ------------------------------------------------------------------------- */
+
+static int
+prwlock_stats_init (
+  partitioned_rwlock_t         *rwlock
+) {
+  size_t count = (PRWLOCK_STATS_SHARDS * rwlock->partition_count);
+
+  if (posix_memalign((void **) &rwlock->stats, CACHE_LINE_SIZE,
+    (count * sizeof(*rwlock->stats)))) {
+    printf("Failed to allocate partition statistics!\n");
+    return -1;
+  }
+  memset(rwlock->stats, 0, (count * sizeof(*rwlock->stats)));
+  return 0;
+} /* prwlock_stats_init() */
+
+/* ------------------------------------------------------------------------- */
+
+static void
+prwlock_stats_destroy (
+  partitioned_rwlock_t         *rwlock
+) {
+  free(rwlock->stats);
+  rwlock->stats = NULL;
+} /* prwlock_stats_destroy() */
+
+/* ------------------------------------------------------------------------- */
+
+static size_t
+prwlock_stats_bucket (
+  uint64_t                      nanoseconds
+) {
+  if (nanoseconds < (UINT64_C(1) << PRWLOCK_STATS_BUCKET_SHIFT)) {
+    return 0;
+  }
+  size_t bucket = (size_t) (64 - __builtin_clzll(nanoseconds))
+    - PRWLOCK_STATS_BUCKET_SHIFT;
+  return (bucket < PRWLOCK_STATS_BUCKETS) ? bucket
+    : (PRWLOCK_STATS_BUCKETS - 1);
+} /* prwlock_stats_bucket() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Shards are laid out one after another, each a full array of partitions,
+ * so threads in different shards never write to the same cache line.
+ */
+static prwlock_stats_cell_t *
+prwlock_stats_cell (
+  partitioned_rwlock_t         *rwlock,
+  size_t                        partition
+) {
+  size_t shard = (prwlock_thread_id() & (PRWLOCK_STATS_SHARDS - 1));
+  return &rwlock->stats[(shard * rwlock->partition_count) + partition];
+} /* prwlock_stats_cell() */
+
+/* ------------------------------------------------------------------------- */
+
+/* Holds beyond the per-thread limit go unmeasured rather than allocate */
+static void
+prwlock_stats_hold_push (
+  partitioned_rwlock_t         *rwlock,
+  size_t                        partition,
+  uint64_t                      now
+) {
+  if (PRWLOCK_STATS_HOLD_SLOTS > prwlock_stats_hold_count) {
+    prwlock_stats_hold_t *hold =
+      &prwlock_stats_holds[prwlock_stats_hold_count++];
+    hold->rwlock = rwlock;
+    hold->partition = partition;
+    hold->acquired_ns = now;
+  }
+} /* prwlock_stats_hold_push() */
+
+/* ------------------------------------------------------------------------- */
+
+static int
+prwlock_stats_hold_pop (
+  partitioned_rwlock_t         *rwlock,
+  size_t                        partition,
+  uint64_t                     *acquired_ns
+) {
+  for (size_t ii = prwlock_stats_hold_count; 0 < ii--; ) {
+    prwlock_stats_hold_t *hold = &prwlock_stats_holds[ii];
+
+    if (rwlock == hold->rwlock && partition == hold->partition) {
+      *acquired_ns = hold->acquired_ns;
+      *hold = prwlock_stats_holds[--prwlock_stats_hold_count];
+      return 1;
+    }
+  }
+  return 0;
+} /* prwlock_stats_hold_pop() */
+
+/* ------------------------------------------------------------------------- */
+
+/* What a lock takes from its attributes, wherever its cells live */
+static void
+prwlock_configure (
+  partitioned_rwlock_t         *rwlock,
+  size_t                        partition_count,
+  const partitioned_rwlock_attr_t *attr
+) {
+  rwlock->partition_count = partition_count;
+  rwlock->partition_mask = (0 < partition_count
+    && 0 == (partition_count & (partition_count - 1)))
+    ? (partition_count - 1) : 0;
+  rwlock->hash_seed = (NULL != attr) ? attr->hash_seed : 0;
+  rwlock->flags = (NULL != attr) ? attr->flags : 0;
+  rwlock->policy = (NULL != attr) ? attr->policy : PRWLOCK_POLICY_DEFAULT;
+  if (PRWLOCK_POLICY_DEFAULT == rwlock->policy) {
+#if defined(USE_ATOMICS)
+    rwlock->policy = PRWLOCK_POLICY_WRITER_PREFERRING;
+#else
+    rwlock->policy = PRWLOCK_POLICY_READER_PREFERRING;
+#endif /* USE_ATOMICS */
+  }
+  rwlock->numa.placement = (NULL != attr) ? attr->numa : PRWLOCK_NUMA_NONE;
+  rwlock->cell_data = (NULL != attr) ? attr->cell_data : 0;
+} /* prwlock_configure() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * A packed cell only needs the lock words its policy uses, unless the flags
+ * want write_held, which sits after them, or there is caller data, which
+ * sits after the whole cell. The other strides pad whole cells out to one
+ * or two cache lines.
+ */
+static size_t
+prwlock_cell_stride (
+  const partitioned_rwlock_t   *rwlock,
+  partitioned_rwlock_stride_t   stride
+) {
+  size_t size = sizeof(partitioned_rwlock_cell_t);
+
+  if (0 < rwlock->cell_data) {
+    size = (PRWLOCK_CELL_DATA_OFFSET + rwlock->cell_data);
+  }
+  if (PRWLOCK_STRIDE_DOUBLE_LINE == stride) {
+    return PRWLOCK_ROUND_UP(size, CACHE_LINE_PAIR_SIZE);
+  }
+  if (PRWLOCK_STRIDE_PACKED != stride) {
+    return PRWLOCK_ROUND_UP(size, CACHE_LINE_SIZE);
+  }
+
+  if (0 < rwlock->cell_data) {
+    return PRWLOCK_ROUND_UP(size, PRWLOCK_CELL_DATA_ALIGN);
+  }
+  if (!(rwlock->flags & PRWLOCK_WRITE_HELD_FLAGS)) {
+    if (PRWLOCK_POLICY_PHASE_FAIR == rwlock->policy) {
+      size = sizeof(prwlock_pft_t);
+    } else {
+#if defined(USE_LIBUV_RWLOCK)
+      size = (offsetof(partitioned_rwlock_cell_t, lock_type_held)
+        + sizeof(prwlock_type_t));
+#elif defined(USE_ATOMICS)
+      size = (offsetof(partitioned_rwlock_cell_t, writer_notify)
+        + sizeof(uint32_t));
+#else
+      size = sizeof(pthread_rwlock_t);
+#endif /* USE_LIBUV_RWLOCK */
+    }
+  }
+  return PRWLOCK_ROUND_UP(size, _Alignof(partitioned_rwlock_cell_t));
+} /* prwlock_cell_stride() */
+
+/* ------------------------------------------------------------------------- */
+
+static void
+prwlock_cells_init (
+  partitioned_rwlock_t         *rwlock
+) {
+  for (size_t ii = 0; ii < rwlock->partition_count; ++ii) {
+    int rc = prwlock_cell_init(rwlock, PRWLOCK_CELL(rwlock, ii));
+    if (0 != rc) {
+      printf("init = %d\n", rc);
+    }
+    if (0 < rwlock->cell_data) {
+      memset(partitioned_rwlock_cell_data(rwlock, ii), 0, rwlock->cell_data);
+    }
+  }
+} /* prwlock_cells_init() */
+
+/* ------------------------------------------------------------------------- */
+
+/* Highest online node plus one, read once from sysfs; 1 without NUMA */
+static int
+prwlock_numa_node_count (
+  void
+) {
+  int count = atomic_load_explicit(&prwlock_numa_nodes, memory_order_relaxed);
+
+  if (0 == count) {
+    count = 1;
+#if defined(__linux__)
+    FILE *online = fopen("/sys/devices/system/node/online", "r");
+    if (NULL != online) {
+      int node;
+      while (1 == fscanf(online, "%d", &node)) {
+        if (node >= count) {
+          count = (node + 1);
+        }
+        if (EOF == fgetc(online)) {
+          break;
+        }
+      }
+      fclose(online);
+    }
+#endif /* __linux__ */
+    if (count > PRWLOCK_NUMA_MAX_NODES) {
+      count = PRWLOCK_NUMA_MAX_NODES;
+    }
+    atomic_store_explicit(&prwlock_numa_nodes, count, memory_order_relaxed);
+  }
+  return count;
+} /* prwlock_numa_node_count() */
+
+/* ------------------------------------------------------------------------- */
+
+static int
+prwlock_numa_current_node (
+  void
+) {
+#if defined(__linux__) && defined(SYS_getcpu)
+  unsigned int node = 0;
+  if (0 == syscall(SYS_getcpu, NULL, &node, NULL)) {
+    return (int) node;
+  }
+#endif /* __linux__ && SYS_getcpu */
+  return 0;
+} /* prwlock_numa_current_node() */
+
+/* ------------------------------------------------------------------------- */
+
+/* Binds whole pages to one node, or interleaves them over all when node < 0 */
+static int
+prwlock_numa_mbind (
+  void                         *address,
+  size_t                        length,
+  int                           mode,
+  int                           node
+) {
+#if defined(__linux__) && defined(SYS_mbind)
+  unsigned long mask[PRWLOCK_NUMA_MAX_NODES / (8 * sizeof(unsigned long))];
+  int node_count = prwlock_numa_node_count();
+
+  memset(mask, 0, sizeof(mask));
+  for (int ii = 0; ii < node_count; ++ii) {
+    if (0 > node || ii == node) {
+      mask[ii / (8 * sizeof(unsigned long))] |=
+        (1UL << (ii % (8 * sizeof(unsigned long))));
+    }
+  }
+
+  /* The kernel reads one bit fewer than maxnode says */
+  if (0 != syscall(SYS_mbind, address, length, mode, mask,
+    (unsigned long) (PRWLOCK_NUMA_MAX_NODES + 1), PRWLOCK_MPOL_MF_MOVE)) {
+    return errno;
+  }
+  return 0;
+#else
+  (void) address;
+  (void) length;
+  (void) mode;
+  (void) node;
+  return ENOSYS;
+#endif /* __linux__ && SYS_mbind */
+} /* prwlock_numa_mbind() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Blocked placement gives node n the n-th of node_count equal runs of cell
+ * pages. Machines with a single node record the placement but skip the
+ * system calls.
+ */
+static int
+prwlock_numa_init (
+  partitioned_rwlock_t         *rwlock
+) {
+  prwlock_numa_t *numa = &rwlock->numa;
+  int node_count = prwlock_numa_node_count();
+  size_t cell_bytes = (rwlock->partition_count * rwlock->cell_stride);
+
+  numa->page_count = ((cell_bytes + numa->page_size - 1) / numa->page_size);
+  numa->page_nodes = malloc((0 < numa->page_count ? numa->page_count : 1)
+    * sizeof(*numa->page_nodes));
+  if (NULL == numa->page_nodes) {
+    printf("Failed to allocate NUMA page map!\n");
+    return -1;
+  }
+
+  for (size_t ii = 0; ii < numa->page_count; ++ii) {
+    if (PRWLOCK_NUMA_BLOCKED == numa->placement) {
+      numa->page_nodes[ii] = (int) ((ii * (size_t) node_count)
+        / numa->page_count);
+    } else {
+      numa->page_nodes[ii] = (1 < node_count) ? -1 : 0;
+    }
+  }
+
+  if (1 < node_count && 0 < numa->page_count) {
+    int rc = 0;
+
+    if (PRWLOCK_NUMA_INTERLEAVE == numa->placement) {
+      rc = prwlock_numa_mbind(rwlock->cells,
+        (numa->page_count * numa->page_size), PRWLOCK_MPOL_INTERLEAVE, -1);
+    } else {
+      for (size_t first = 0; 0 == rc && first < numa->page_count; ) {
+        size_t last = first;
+        while (last < numa->page_count
+          && numa->page_nodes[last] == numa->page_nodes[first]) {
+          ++last;
+        }
+        rc = prwlock_numa_mbind(
+          ((char *) rwlock->cells + (first * numa->page_size)),
+          ((last - first) * numa->page_size), PRWLOCK_MPOL_PREFERRED,
+          numa->page_nodes[first]);
+        first = last;
+      }
+    }
+    if (0 != rc) {
+      printf("Failed to place cells on NUMA nodes: %s!\n", strerror(rc));
+      prwlock_numa_destroy(rwlock);
+      return -1;
+    }
+  }
+  return 0;
+} /* prwlock_numa_init() */
+
+/* ------------------------------------------------------------------------- */
+
+static void
+prwlock_numa_destroy (
+  partitioned_rwlock_t         *rwlock
+) {
+  free(rwlock->numa.page_nodes);
+  rwlock->numa.page_nodes = NULL;
+} /* prwlock_numa_destroy() */
+
+/* ------------------------------------------------------------------------- */
+
+static int
+prwlock_cohort_init (
+  partitioned_rwlock_t         *rwlock
+) {
+  if (posix_memalign((void **) &rwlock->cohort, CACHE_LINE_SIZE,
+    (rwlock->partition_count * sizeof(*rwlock->cohort)))) {
+    printf("Failed to allocate cohort state!\n");
+    return -1;
+  }
+  memset(rwlock->cohort, 0,
+    (rwlock->partition_count * sizeof(*rwlock->cohort)));
+  return 0;
+} /* prwlock_cohort_init() */
+
+/* ------------------------------------------------------------------------- */
+
+static void
+prwlock_cohort_destroy (
+  partitioned_rwlock_t         *rwlock
+) {
+  free(rwlock->cohort);
+  rwlock->cohort = NULL;
+} /* prwlock_cohort_destroy() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * The calling thread's node, folded onto the tracked range. Threads rarely
+ * migrate between nodes, so the answer is cached for a while; a stale one
+ * only costs locality, never correctness.
+ */
+static uint32_t
+prwlock_cohort_node (
+  void
+) {
+  if (0 == prwlock_numa_cached_uses) {
+    prwlock_numa_cached_node = ((uint32_t) prwlock_numa_current_node()
+      % PRWLOCK_COHORT_NODES);
+    prwlock_numa_cached_uses = PRWLOCK_NUMA_NODE_REFRESH;
+  }
+  --prwlock_numa_cached_uses;
+  return prwlock_numa_cached_node;
+} /* prwlock_cohort_node() */
+
+/* ------------------------------------------------------------------------- */
+
+/* Writers queue outside the cell, so readers defer to them by hand */
+static int
+prwlock_cohort_hold_back (
+  partitioned_rwlock_t         *rwlock,
+  size_t                        partition,
+  uint64_t                      deadline
+) {
+  prwlock_cohort_t *cohort = &rwlock->cohort[partition];
+  int rc = 0;
+
+  if (PRWLOCK_POLICY_READER_PREFERRING == rwlock->policy
+    || 0 == atomic_load(&cohort->waiters)) {
+    return 0;
+  }
+
+  atomic_fetch_add(&cohort->held_back, 1);
+  for (;;) {
+    uint32_t sequence = atomic_load(&cohort->sequence);
+    if (0 == atomic_load(&cohort->waiters)) {
+      break;
+    }
+    if (0 != (rc = prwlock_futex_wait_until(rwlock, &cohort->sequence,
+      sequence, deadline))) {
+      break;
+    }
+  }
+  atomic_fetch_sub(&cohort->held_back, 1);
+  return rc;
+} /* prwlock_cohort_hold_back() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * A waiting writer registers under its node, then repeatedly either claims
+ * a handoff addressed to that node or takes the cell outright once nothing
+ * is being handed over. The sequence is read before either check, so a
+ * release between the checks and the wait keeps the waiter awake.
+ */
+static int
+prwlock_cohort_wrlock (
+  partitioned_rwlock_t         *rwlock,
+  size_t                        partition
+) {
+  partitioned_rwlock_cell_t *cell = PRWLOCK_CELL(rwlock, partition);
+  prwlock_cohort_t *cohort = &rwlock->cohort[partition];
+
+  if (0 == prwlock_cell_trywrlock(rwlock, cell)) {
+    return 0;
+  }
+
+  uint32_t node = prwlock_cohort_node();
+  atomic_fetch_add(&cohort->waiting[node], 1);
+  atomic_fetch_add(&cohort->waiters, 1);
+  /* Pairs with the fence in prwlock_cohort_rdunlock() */
+  atomic_thread_fence(memory_order_seq_cst);
+  for (size_t spins = 0; ; ++spins) {
+    uint32_t sequence = atomic_load(&cohort->sequence);
+    uint32_t handoff = (node + 1);
+
+    if (atomic_compare_exchange_strong(&cohort->handoff, &handoff, 0)) {
+      break;
+    }
+    if (0 == handoff && 0 == prwlock_cell_trywrlock(rwlock, cell)) {
+      break;
+    }
+    if (PRWLOCK_SPIN_LIMIT > spins) {
+      PRWLOCK_CPU_RELAX();
+    } else {
+      prwlock_futex_wait(rwlock, &cohort->sequence, sequence);
+    }
+  }
+  atomic_fetch_sub(&cohort->waiters, 1);
+  atomic_fetch_sub(&cohort->waiting[node], 1);
+  return 0;
+} /* prwlock_cohort_wrlock() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Every registered waiter stays registered until it owns the partition, so
+ * a handoff addressed to a node with waiters is always claimed. Waking all
+ * of them is cheap next to a cross-node miss; those from other nodes just
+ * go back to sleep.
+ */
+static int
+prwlock_cohort_wrunlock (
+  partitioned_rwlock_t         *rwlock,
+  size_t                        partition
+) {
+  partitioned_rwlock_cell_t *cell = PRWLOCK_CELL(rwlock, partition);
+  prwlock_cohort_t *cohort = &rwlock->cohort[partition];
+  uint32_t batch = atomic_load_explicit(&cohort->batch, memory_order_relaxed);
+  int rc = 0;
+
+  if (0 != atomic_load(&cohort->waiters) && batch < rwlock->cohort_batch) {
+    uint32_t node = prwlock_cohort_node();
+
+    if (0 != atomic_load(&cohort->waiting[node])) {
+      atomic_store_explicit(&cohort->batch, (batch + 1), memory_order_relaxed);
+      atomic_store(&cohort->handoff, (node + 1));
+      atomic_fetch_add(&cohort->sequence, 1);
+      (void) prwlock_futex_wake(rwlock, &cohort->sequence, INT_MAX);
+      return 0;
+    }
+  }
+
+  atomic_store_explicit(&cohort->batch, 0, memory_order_relaxed);
+  rc = prwlock_cell_unlock(rwlock, cell);
+  atomic_fetch_add(&cohort->sequence, 1);
+  if (0 != atomic_load(&cohort->waiters)
+    || 0 != atomic_load(&cohort->held_back)) {
+    (void) prwlock_futex_wake(rwlock, &cohort->sequence, INT_MAX);
+  }
+  return rc;
+} /* prwlock_cohort_wrunlock() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Writers wait on the cohort rather than the cell, so a reader leaving must
+ * wake them itself. The fence orders the cell release before the check for
+ * waiters, against a waiter registering before it tries the cell.
+ */
+static void
+prwlock_cohort_rdunlock (
+  partitioned_rwlock_t         *rwlock,
+  size_t                        partition
+) {
+  prwlock_cohort_t *cohort = &rwlock->cohort[partition];
+
+  atomic_thread_fence(memory_order_seq_cst);
+  if (0 != atomic_load_explicit(&cohort->waiters, memory_order_relaxed)) {
+    atomic_fetch_add(&cohort->sequence, 1);
+    (void) prwlock_futex_wake(rwlock, &cohort->sequence, INT_MAX);
+  }
+} /* prwlock_cohort_rdunlock() */
+
+/* ------------------------------------------------------------------------- */
+
+static int
+prwlock_lease_init (
+  partitioned_rwlock_t         *rwlock
+) {
+  if (posix_memalign((void **) &rwlock->lease, CACHE_LINE_SIZE,
+    (rwlock->partition_count * sizeof(*rwlock->lease)))) {
+    printf("Failed to allocate read lease state!\n");
+    return -1;
+  }
+  memset(rwlock->lease, 0,
+    (rwlock->partition_count * sizeof(*rwlock->lease)));
+  rwlock->lease_membarrier = prwlock_membarrier_register();
+  return 0;
+} /* prwlock_lease_init() */
+
+/* ------------------------------------------------------------------------- */
+
+static void
+prwlock_lease_destroy (
+  partitioned_rwlock_t         *rwlock
+) {
+  free(rwlock->lease);
+  rwlock->lease = NULL;
+} /* prwlock_lease_destroy() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * The owner of a lease reads by counting itself in and checking the lease
+ * is still its own; the count and the check are ordered by a compiler
+ * barrier where revokers fence with membarrier(2), and by a full fence
+ * otherwise. A revocation seen here is backed out of, as the revoker may
+ * be waiting for this very count, unless the owner already reads by
+ * lease: the revoker cannot finish before those reads end, and sending a
+ * nested read to a cell the revoking writer holds would deadlock. Everyone
+ * else reads through the cell, revoking another thread's lease on the way.
+ */
+static int
+prwlock_lease_rdlock (
+  partitioned_rwlock_t         *rwlock,
+  size_t                        partition,
+  uint64_t                      deadline
+) {
+  prwlock_lease_t *lease = &rwlock->lease[partition];
+  uint32_t self = (prwlock_thread_id() + 1);
+  uint32_t owner = atomic_load_explicit(&lease->owner, memory_order_relaxed);
+
+  if (self == (owner & ~PRWLOCK_LEASE_REVOKING)) {
+    uint32_t depth = atomic_load_explicit(&lease->depth, memory_order_relaxed);
+
+    atomic_store_explicit(&lease->depth, (depth + 1), memory_order_relaxed);
+    if (0 == depth) {
+      if (rwlock->lease_membarrier) {
+        atomic_signal_fence(memory_order_seq_cst);
+      } else {
+        atomic_thread_fence(memory_order_seq_cst);
+      }
+      owner = atomic_load_explicit(&lease->owner, memory_order_relaxed);
+    }
+    if (0 < depth || self == owner) {
+      atomic_store_explicit(&lease->uses, (atomic_load_explicit(&lease->uses,
+        memory_order_relaxed) + 1), memory_order_relaxed);
+      return 0;
+    }
+    atomic_store_explicit(&lease->depth, depth, memory_order_release);
+  }
+
+  int rc = prwlock_cell_acquire(rwlock, PRWLOCK_CELL(rwlock, partition), 0,
+    deadline);
+  if (0 != rc) {
+    return rc;
+  }
+
+  /*
+   * Readers share the partition anyway, so one never waits for the owner's
+   * reads: it may itself be held up by a lock the owner is waiting for
+   */
+  owner = atomic_load_explicit(&lease->owner, memory_order_relaxed);
+  if (0 == owner) {
+    prwlock_lease_grant(rwlock, partition);
+  } else if (self != (owner & ~PRWLOCK_LEASE_REVOKING)) {
+    (void) prwlock_lease_revoke(rwlock, partition, PRWLOCK_DEADLINE_NOW);
+  }
+  return 0;
+} /* prwlock_lease_rdlock() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Called by a reader holding the cell of an unleased partition. Runs of
+ * reads are counted in the thread's own table, so tracking them writes
+ * nothing shared; the lease is taken with a compare-and-swap, as another
+ * reader may be taking it alongside. Every early revocation so far doubles
+ * the run a lease takes, and past the limit none is granted at all.
+ */
+static void
+prwlock_lease_grant (
+  partitioned_rwlock_t         *rwlock,
+  size_t                        partition
+) {
+  prwlock_lease_t *lease = &rwlock->lease[partition];
+  prwlock_lease_streak_t *streak =
+    &prwlock_lease_streaks[partition & (PRWLOCK_LEASE_STREAKS - 1)];
+  uint32_t strikes = atomic_load_explicit(&lease->strikes,
+    memory_order_relaxed);
+
+  if (PRWLOCK_LEASE_STRIKE_LIMIT <= strikes) {
+    return;
+  }
+  if (rwlock != streak->rwlock || partition != streak->partition) {
+    streak->rwlock = rwlock;
+    streak->partition = partition;
+    streak->reads = 0;
+  }
+  /* Below the limit here, so the shift is in range */
+  if ((PRWLOCK_LEASE_GRANT_READS << strikes) > ++streak->reads) {
+    return;
+  }
+
+  streak->reads = 0;
+  if (prwlock_now_ns() >= atomic_load_explicit(&lease->inhibit_until,
+    memory_order_relaxed)) {
+    uint32_t expected = 0;
+
+    atomic_store_explicit(&lease->uses, 0, memory_order_relaxed);
+    (void) atomic_compare_exchange_strong(&lease->owner, &expected,
+      (prwlock_thread_id() + 1));
+  }
+} /* prwlock_lease_grant() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Called with the cell held: write-locked by writers, read-locked by
+ * readers of other threads, of whom the first to mark the lease revokes
+ * it and the rest carry on. After the mark and a fence, the owner either
+ * sees the mark or shows its reads. A writer waits those reads out; a
+ * reader, like a trylock, hands the lease back if the owner is still
+ * reading, as does a timed lock that runs out of time waiting. The lease
+ * is not granted again for a multiple of the time revoking it took, and
+ * one revoked before it was used as often as it took to earn is a strike
+ * against the partition.
+ */
+static int
+prwlock_lease_revoke (
+  partitioned_rwlock_t         *rwlock,
+  size_t                        partition,
+  uint64_t                      deadline
+) {
+  prwlock_lease_t *lease = &rwlock->lease[partition];
+  uint32_t owner = atomic_load(&lease->owner);
+
+  if (0 == owner || (owner & PRWLOCK_LEASE_REVOKING)
+    || !atomic_compare_exchange_strong(&lease->owner, &owner,
+      (owner | PRWLOCK_LEASE_REVOKING))) {
+    return 0;
+  }
+
+  uint64_t start = prwlock_now_ns();
+  size_t spins = 0;
+
+  prwlock_membarrier_fence(rwlock->lease_membarrier);
+  while (0 != atomic_load_explicit(&lease->depth, memory_order_acquire)) {
+    if (PRWLOCK_DEADLINE_NOW == deadline || (PRWLOCK_SPIN_LIMIT <= spins
+      && prwlock_now_ns() >= deadline)) {
+      atomic_store_explicit(&lease->owner, owner, memory_order_release);
+      return (PRWLOCK_DEADLINE_NOW == deadline) ? EBUSY : ETIMEDOUT;
+    }
+    if (PRWLOCK_SPIN_LIMIT > ++spins) {
+      PRWLOCK_CPU_RELAX();
+    } else {
+      sched_yield();
+    }
+  }
+  uint64_t end = prwlock_now_ns();
+
+  /* Strikes stop at the limit, which keeps the shift below the word size */
+  uint32_t strikes = atomic_load_explicit(&lease->strikes,
+    memory_order_relaxed);
+  if (PRWLOCK_LEASE_STRIKE_LIMIT <= strikes) {
+    strikes = PRWLOCK_LEASE_STRIKE_LIMIT;
+  } else if (atomic_load_explicit(&lease->uses, memory_order_relaxed)
+    < (PRWLOCK_LEASE_GRANT_READS << strikes)) {
+    ++strikes;
+  } else {
+    strikes = 0;
+  }
+  atomic_store_explicit(&lease->strikes, strikes, memory_order_relaxed);
+  atomic_store_explicit(&lease->inhibit_until,
+    (end + ((end - start) * PRWLOCK_BIAS_INHIBIT_FACTOR)),
+    memory_order_relaxed);
+  atomic_store_explicit(&lease->owner, 0, memory_order_release);
+  return 0;
+} /* prwlock_lease_revoke() */
+
+/* ------------------------------------------------------------------------- */
+
+/* Only the owner counts reads held by lease, so a count of its own is one */
+static int
+prwlock_lease_rdunlock (
+  partitioned_rwlock_t         *rwlock,
+  size_t                        partition,
+  int                           for_write
+) {
+  prwlock_lease_t *lease = &rwlock->lease[partition];
+  uint32_t depth = atomic_load_explicit(&lease->depth, memory_order_relaxed);
+
+  if (0 < depth && (prwlock_thread_id() + 1)
+    == (atomic_load_explicit(&lease->owner, memory_order_relaxed)
+      & ~PRWLOCK_LEASE_REVOKING)) {
+    atomic_store_explicit(&lease->depth, (depth - 1), memory_order_release);
+    return 0;
+  }
+
+  return prwlock_cell_release(rwlock, PRWLOCK_CELL(rwlock, partition),
+    for_write);
+} /* prwlock_lease_rdunlock() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Write side of an optimistic read: the sequence goes odd before the writer
+ * touches the data, and even again once it is done. Only the holder writes
+ * it, so a plain increment will do.
+ */
+static void
+prwlock_sequence_begin (
+  _Atomic uint32_t             *sequence
+) {
+  atomic_store_explicit(sequence,
+    (atomic_load_explicit(sequence, memory_order_relaxed) + 1),
+    memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+} /* prwlock_sequence_begin() */
+
+/* ------------------------------------------------------------------------- */
+
+static void
+prwlock_sequence_end (
+  _Atomic uint32_t             *sequence
+) {
+  atomic_store_explicit(sequence,
+    (atomic_load_explicit(sequence, memory_order_relaxed) + 1),
+    memory_order_release);
+} /* prwlock_sequence_end() */
+
+/* ------------------------------------------------------------------------- */
+
+/* The cell's sequence, with the global one above it when there is one */
+static uint64_t
+prwlock_sequence_stamp (
+  partitioned_rwlock_t         *rwlock,
+  size_t                        partition
+) {
+  uint64_t stamp = atomic_load_explicit(
+    &PRWLOCK_CELL(rwlock, partition)->sequence, memory_order_acquire);
+
+  if (rwlock->flags & PRWLOCK_FLAG_GLOBAL) {
+    stamp |= ((uint64_t) atomic_load_explicit(&rwlock->global.cell.sequence,
+      memory_order_acquire) << 32);
+  }
+  return stamp;
+} /* prwlock_sequence_stamp() */
+
+/* ------------------------------------------------------------------------- */
+
+static size_t
+prwlock_table_reduce (
+  const prwlock_table_t        *table,
+  uint64_t                      hash
+) {
+  if (0 != table->partition_mask) {
+    return (size_t) (hash & table->partition_mask);
+  }
+  return (size_t) (((__uint128_t) hash * table->partition_count) >> 64);
+} /* prwlock_table_reduce() */
+
+/* ------------------------------------------------------------------------- */
+
+static prwlock_table_t *
+prwlock_table_create (
+  partitioned_rwlock_t         *rwlock,
+  size_t                        partition_count,
+  prwlock_table_t              *previous
+) {
+  prwlock_table_t *table = calloc(1, sizeof(*table));
+  if (NULL == table) {
+    return NULL;
+  }
+
+  size_t cell_alignment = (CACHE_LINE_PAIR_SIZE == rwlock->cell_stride)
+    ? CACHE_LINE_PAIR_SIZE : CACHE_LINE_SIZE;
+  if (posix_memalign((void **) &table->cells, cell_alignment,
+    (partition_count * rwlock->cell_stride))) {
+    free(table);
+    return NULL;
+  }
+  if (NULL != previous && NULL == (table->migrated = calloc(
+    previous->partition_count, sizeof(*table->migrated)))) {
+    free(table->cells);
+    free(table);
+    return NULL;
+  }
+
+  table->partition_count = partition_count;
+  table->partition_mask = (0 == (partition_count & (partition_count - 1)))
+    ? (partition_count - 1) : 0;
+  atomic_init(&table->previous, previous);
+  for (size_t ii = 0; ii < partition_count; ++ii) {
+    int rc = prwlock_cell_init(rwlock, PRWLOCK_TABLE_CELL(rwlock, table, ii));
+    if (0 != rc) {
+      printf("init = %d\n", rc);
+    }
+  }
+  return table;
+} /* prwlock_table_create() */
+
+/* ------------------------------------------------------------------------- */
+
+static void
+prwlock_table_free (
+  partitioned_rwlock_t         *rwlock,
+  prwlock_table_t              *table
+) {
+  for (size_t ii = 0; ii < table->partition_count; ++ii) {
+    prwlock_cell_destroy(rwlock, PRWLOCK_TABLE_CELL(rwlock, table, ii));
+  }
+  free(table->cells);
+  free(table->migrated);
+  free(table);
+} /* prwlock_table_free() */
+
+/* ------------------------------------------------------------------------- */
+
+/* The first table wraps the cells init_ex() allocated; the lock frees them */
+static int
+prwlock_resize_init (
+  partitioned_rwlock_t         *rwlock
+) {
+  prwlock_table_t *table = calloc(1, sizeof(*table));
+  if (NULL == table) {
+    printf("Failed to allocate partition table!\n");
+    return -1;
+  }
+  table->partition_count = rwlock->partition_count;
+  table->partition_mask = rwlock->partition_mask;
+  table->cells = rwlock->cells;
+  atomic_init(&table->previous, NULL);
+
+  if (posix_memalign((void **) &rwlock->resize.slots, CACHE_LINE_SIZE,
+    (PRWLOCK_RESIZE_SLOTS * sizeof(*rwlock->resize.slots)))) {
+    printf("Failed to allocate resize counters!\n");
+    free(table);
+    return -1;
+  }
+  for (size_t ii = 0; ii < PRWLOCK_RESIZE_SLOTS; ++ii) {
+    atomic_init(&rwlock->resize.slots[ii].readers[0], 0);
+    atomic_init(&rwlock->resize.slots[ii].readers[1], 0);
+  }
+  atomic_init(&rwlock->resize.phase, 0);
+
+  int rc = pthread_rwlock_init(&rwlock->resize.gate, NULL);
+  if (0 != rc) {
+    printf("init = %d\n", rc);
+    free(rwlock->resize.slots);
+    rwlock->resize.slots = NULL;
+    free(table);
+    return -1;
+  }
+  atomic_init(&rwlock->resize.table, table);
+  return 0;
+} /* prwlock_resize_init() */
+
+/* ------------------------------------------------------------------------- */
+
+static void
+prwlock_resize_destroy (
+  partitioned_rwlock_t         *rwlock
+) {
+  if (NULL == rwlock->resize.slots) {
+    return;
+  }
+  free(atomic_load(&rwlock->resize.table));
+  (void) pthread_rwlock_destroy(&rwlock->resize.gate);
+  free(rwlock->resize.slots);
+  rwlock->resize.slots = NULL;
+} /* prwlock_resize_destroy() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Counts a key operation in for the current phase. Everything it reads of
+ * the tables comes after the increment, so a resize that has published a
+ * new table and then seen the counter empty is sure it is not being read.
+ */
+static uint32_t
+prwlock_resize_enter (
+  partitioned_rwlock_t         *rwlock
+) {
+  prwlock_resize_slot_t *slot = &rwlock->resize.slots[prwlock_thread_id()
+    & (PRWLOCK_RESIZE_SLOTS - 1)];
+  uint32_t phase = (atomic_load(&rwlock->resize.phase) & 1);
+
+  atomic_fetch_add(&slot->readers[phase], 1);
+  return phase;
+} /* prwlock_resize_enter() */
+
+/* ------------------------------------------------------------------------- */
+
+static void
+prwlock_resize_exit (
+  partitioned_rwlock_t         *rwlock,
+  uint32_t                      phase
+) {
+  prwlock_resize_slot_t *slot = &rwlock->resize.slots[prwlock_thread_id()
+    & (PRWLOCK_RESIZE_SLOTS - 1)];
+
+  atomic_fetch_sub_explicit(&slot->readers[phase], 1, memory_order_release);
+} /* prwlock_resize_exit() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Waits until no key operation that could have seen a retired table is in
+ * flight. New operations count into the other phase, so the old one drains
+ * however busy the lock is. Flipping twice catches an operation that read
+ * the phase just before the first flip but counted itself in after the
+ * wait had already passed its slot.
+ */
+static void
+prwlock_resize_synchronize (
+  partitioned_rwlock_t         *rwlock
+) {
+  for (int round = 0; round < 2; ++round) {
+    uint32_t phase = (atomic_fetch_add(&rwlock->resize.phase, 1) & 1);
+
+    for (size_t ii = 0; ii < PRWLOCK_RESIZE_SLOTS; ++ii) {
+      _Atomic uint32_t *readers = &rwlock->resize.slots[ii].readers[phase];
+      size_t spins = 0;
+
+      while (0 != atomic_load(readers)) {
+        if (PRWLOCK_SPIN_LIMIT > ++spins) {
+          PRWLOCK_CPU_RELAX();
+        } else {
+          sched_yield();
+        }
+      }
+    }
+  }
+} /* prwlock_resize_synchronize() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * The cell a key locks right now: its partition of the previous table
+ * until a resize has moved that partition, its partition of the current
+ * table after. A resize moves a partition only once it has it write-locked,
+ * so the answer cannot change under a holder of the cell.
+ */
+static partitioned_rwlock_cell_t *
+prwlock_resize_route (
+  partitioned_rwlock_t         *rwlock,
+  uint64_t                      hash,
+  size_t                       *partition
+) {
+  prwlock_table_t *table = atomic_load(&rwlock->resize.table);
+  prwlock_table_t *previous = atomic_load(&table->previous);
+
+  if (NULL != previous) {
+    size_t mapped = prwlock_table_reduce(previous, hash);
+    if (!atomic_load(&table->migrated[mapped])) {
+      *partition = mapped;
+      return PRWLOCK_TABLE_CELL(rwlock, previous, mapped);
+    }
+  }
+  *partition = prwlock_table_reduce(table, hash);
+  return PRWLOCK_TABLE_CELL(rwlock, table, *partition);
+} /* prwlock_resize_route() */
+
+/* ------------------------------------------------------------------------- */
+
+static int
+prwlock_resize_acquire (
+  partitioned_rwlock_t         *rwlock,
+  partitioned_rwlock_cell_t    *cell,
+  partitioned_rwlock_mode_t     mode,
+  uint64_t                      deadline
+) {
+  int rc;
+
+  if (rwlock->flags & PRWLOCK_FLAG_GLOBAL) {
+    if (0 != (rc = prwlock_global_enter(rwlock, mode, deadline))) {
+      return rc;
+    }
+  }
+
+  if (PRWLOCK_MODE_READ == mode) {
+    rc = prwlock_cell_acquire(rwlock, cell, 0, deadline);
+  } else {
+    rc = prwlock_cell_acquire(rwlock, cell, 1, deadline);
+  }
+
+  if (0 != rc) {
+    if (rwlock->flags & PRWLOCK_FLAG_GLOBAL) {
+      prwlock_global_exit(rwlock, mode);
+    }
+  } else if (PRWLOCK_MODE_WRITE == mode
+    && (rwlock->flags & PRWLOCK_WRITE_HELD_FLAGS)) {
+    atomic_store_explicit(&cell->write_held, 1, memory_order_relaxed);
+    if (rwlock->flags & PRWLOCK_FLAG_OPTIMISTIC) {
+      prwlock_sequence_begin(&cell->sequence);
+    }
+  }
+  return rc;
+} /* prwlock_resize_acquire() */
+
+/* ------------------------------------------------------------------------- */
+
+static int
+prwlock_resize_release (
+  partitioned_rwlock_t         *rwlock,
+  partitioned_rwlock_cell_t    *cell
+) {
+  partitioned_rwlock_mode_t mode = PRWLOCK_MODE_READ;
+
+  if ((rwlock->flags & PRWLOCK_WRITE_HELD_FLAGS)
+    && atomic_load_explicit(&cell->write_held, memory_order_relaxed)) {
+    atomic_store_explicit(&cell->write_held, 0, memory_order_relaxed);
+    mode = PRWLOCK_MODE_WRITE;
+    if (rwlock->flags & PRWLOCK_FLAG_OPTIMISTIC) {
+      prwlock_sequence_end(&cell->sequence);
+    }
+  }
+
+  int rc = prwlock_cell_unlock(rwlock, cell);
+
+  if (rwlock->flags & PRWLOCK_FLAG_GLOBAL) {
+    prwlock_global_exit(rwlock, mode);
+  }
+  return rc;
+} /* prwlock_resize_release() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Locks the cell the key routes to, then checks the route still leads
+ * there: a waiter woken on a partition that a resize has just moved lets
+ * it go and follows the key to the new table.
+ */
+static int
+prwlock_resize_lock (
+  partitioned_rwlock_t         *rwlock,
+  uint64_t                      hash,
+  partitioned_rwlock_mode_t     mode,
+  uint64_t                      deadline,
+  size_t                       *partition
+) {
+  uint32_t phase = prwlock_resize_enter(rwlock);
+  size_t mapped;
+  int rc;
+
+  for (;;) {
+    partitioned_rwlock_cell_t *cell = prwlock_resize_route(rwlock, hash,
+      &mapped);
+
+    if (0 != (rc = prwlock_resize_acquire(rwlock, cell, mode, deadline))) {
+      break;
+    }
+    if (cell == prwlock_resize_route(rwlock, hash, &mapped)) {
+      break;
+    }
+    (void) prwlock_resize_release(rwlock, cell);
+  }
+
+  prwlock_resize_exit(rwlock, phase);
+  if (NULL != partition) {
+    *partition = mapped;
+  }
+  return rc;
+} /* prwlock_resize_lock() */
+
+/* ------------------------------------------------------------------------- */
+
+static int
+prwlock_resize_unlock (
+  partitioned_rwlock_t         *rwlock,
+  uint64_t                      hash
+) {
+  uint32_t phase = prwlock_resize_enter(rwlock);
+  size_t mapped;
+  int rc = prwlock_resize_release(rwlock,
+    prwlock_resize_route(rwlock, hash, &mapped));
+
+  prwlock_resize_exit(rwlock, phase);
+  return rc;
+} /* prwlock_resize_unlock() */
+
+/* ------------------------------------------------------------------------- */
+
+/* The *_all calls keep a resize out for as long as they hold the lock */
+static int
+prwlock_resize_hold (
+  partitioned_rwlock_t         *rwlock
+) {
+  if (!(rwlock->flags & PRWLOCK_FLAG_RESIZABLE)) {
+    return 0;
+  }
+  return pthread_rwlock_rdlock(&rwlock->resize.gate);
+} /* prwlock_resize_hold() */
+
+/* ------------------------------------------------------------------------- */
+
+static void
+prwlock_resize_unhold (
+  partitioned_rwlock_t         *rwlock
+) {
+  if (rwlock->flags & PRWLOCK_FLAG_RESIZABLE) {
+    (void) pthread_rwlock_unlock(&rwlock->resize.gate);
+  }
+} /* prwlock_resize_unhold() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * The cycle counter: the TSC on x86 (invariant on anything recent), the
+ * virtual counter on ARMv8, and the monotonic clock anywhere else.
+ */
+static uint64_t
+prwlock_trace_ticks (
+  void
+) {
+#if defined(__x86_64__) || defined(__i386__)
+  return __builtin_ia32_rdtsc();
+#elif defined(__aarch64__)
+  uint64_t ticks;
+  __asm__ __volatile__ ("mrs %0, cntvct_el0" : "=r" (ticks));
+  return ticks;
+#else
+  return prwlock_now_ns();
+#endif
+} /* prwlock_trace_ticks() */
+
+/* ------------------------------------------------------------------------- */
+
+/* Times the cycle counter against the monotonic clock, once per process */
+static void
+prwlock_trace_calibrate (
+  void
+) {
+#if defined(__x86_64__) || defined(__i386__) || defined(__aarch64__)
+  uint64_t start_ns = prwlock_now_ns();
+  uint64_t start = prwlock_trace_ticks();
+  uint64_t end_ns;
+
+  while (PRWLOCK_TRACE_CALIBRATE_NS > ((end_ns = prwlock_now_ns())
+    - start_ns)) {
+    PRWLOCK_CPU_RELAX();
+  }
+  uint64_t ticks = (prwlock_trace_ticks() - start);
+  if (0 < ticks) {
+    prwlock_trace_ns_per_tick = ((double) (end_ns - start_ns)
+      / (double) ticks);
+  }
+#endif /* __x86_64__ || __i386__ || __aarch64__ */
+} /* prwlock_trace_calibrate() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * The threshold is kept in cycles so the lock paths never convert. A first
+ * backtrace() here loads what it needs, rather than in some lock path.
+ */
+static int
+prwlock_trace_init (
+  partitioned_rwlock_t         *rwlock,
+  const partitioned_rwlock_attr_t *attr
+) {
+  uint64_t threshold_ns = (0 < attr->trace_threshold_ns)
+    ? attr->trace_threshold_ns : PRWLOCK_TRACE_THRESHOLD_NS;
+
+  (void) pthread_once(&prwlock_trace_once, prwlock_trace_calibrate);
+
+  if (posix_memalign((void **) &rwlock->trace, CACHE_LINE_SIZE,
+    sizeof(*rwlock->trace))) {
+    printf("Failed to allocate trace rings!\n");
+    return -1;
+  }
+  memset(rwlock->trace, 0, sizeof(*rwlock->trace));
+  if (0 != pthread_mutex_init(&rwlock->trace->mutex, NULL)) {
+    printf("Failed to initialize trace mutex!\n");
+    free(rwlock->trace);
+    rwlock->trace = NULL;
+    return -1;
+  }
+  rwlock->trace->threshold_ticks = (uint64_t) ((double) threshold_ns
+    / prwlock_trace_ns_per_tick);
+
+#if defined(__GLIBC__)
+  void *frame;
+  (void) backtrace(&frame, 1);
+#endif /* __GLIBC__ */
+  return 0;
+} /* prwlock_trace_init() */
+
+/* ------------------------------------------------------------------------- */
+
+static void
+prwlock_trace_destroy (
+  partitioned_rwlock_t         *rwlock
+) {
+  if (NULL == rwlock->trace) {
+    return;
+  }
+  for (size_t ii = 0; ii < PRWLOCK_TRACE_RINGS; ++ii) {
+    free(atomic_load(&rwlock->trace->rings[ii]));
+  }
+  (void) pthread_mutex_destroy(&rwlock->trace->mutex);
+  free(rwlock->trace);
+  rwlock->trace = NULL;
+} /* prwlock_trace_destroy() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Only ever reached by waits and holds past the threshold, so it can
+ * afford the clock, the backtrace and, once per thread, the ring.
+ */
+static void
+prwlock_trace_record (
+  partitioned_rwlock_t         *rwlock,
+  partitioned_rwlock_trace_kind_t kind,
+  size_t                        partition,
+  partitioned_rwlock_mode_t     mode,
+  uint64_t                      ticks,
+  const void                   *caller
+) {
+  uint32_t thread_id = prwlock_thread_id();
+  prwlock_trace_ring_t *ring = NULL;
+
+  if (PRWLOCK_TRACE_RINGS > thread_id) {
+    ring = atomic_load_explicit(&rwlock->trace->rings[thread_id],
+      memory_order_relaxed);
+    if (NULL == ring
+      && 0 == posix_memalign((void **) &ring, CACHE_LINE_SIZE,
+        sizeof(*ring))) {
+      memset(ring, 0, sizeof(*ring));
+      atomic_store_explicit(&rwlock->trace->rings[thread_id], ring,
+        memory_order_release);
+    }
+  }
+  if (NULL == ring) {
+    atomic_fetch_add_explicit(&rwlock->trace->dropped, 1,
+      memory_order_relaxed);
+    return;
+  }
+
+  uint32_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+  if (PRWLOCK_TRACE_RING_RECORDS <= (head - atomic_load_explicit(&ring->tail,
+    memory_order_acquire))) {
+    atomic_fetch_add_explicit(&ring->dropped, 1, memory_order_relaxed);
+    return;
+  }
+
+  partitioned_rwlock_trace_record_t *record =
+    &ring->records[head & (PRWLOCK_TRACE_RING_RECORDS - 1)];
+  record->kind = kind;
+  record->mode = mode;
+  record->partition = partition;
+  record->thread_id = thread_id;
+  record->duration_ns = (uint64_t) ((double) ticks
+    * prwlock_trace_ns_per_tick);
+  record->timestamp_ns = prwlock_now_ns();
+  record->caller = caller;
+  record->frame_count = 0;
+#if defined(__GLIBC__)
+  /* Our own frame is of no interest */
+  void *frames[PRWLOCK_TRACE_FRAMES + 1];
+  int depth = backtrace(frames, (PRWLOCK_TRACE_FRAMES + 1));
+  for (int ii = 1; ii < depth; ++ii) {
+    record->frames[record->frame_count++] = frames[ii];
+  }
+#endif /* __GLIBC__ */
+  atomic_store_explicit(&ring->head, (head + 1), memory_order_release);
+} /* prwlock_trace_record() */
+
+/* ------------------------------------------------------------------------- */
+
+/* Holds beyond the per-thread limit are timed for their wait only */
+static void
+prwlock_trace_acquired (
+  partitioned_rwlock_t         *rwlock,
+  size_t                        partition,
+  partitioned_rwlock_mode_t     mode,
+  uint64_t                      start
+) {
+  uint64_t now = prwlock_trace_ticks();
+
+  if ((now - start) >= rwlock->trace->threshold_ticks) {
+    prwlock_trace_record(rwlock, PRWLOCK_TRACE_WAIT, partition, mode,
+      (now - start), prwlock_trace_site);
+  }
+  if (PRWLOCK_TRACE_HOLD_SLOTS > prwlock_trace_hold_count) {
+    prwlock_trace_hold_t *hold =
+      &prwlock_trace_holds[prwlock_trace_hold_count++];
+    hold->rwlock = rwlock;
+    hold->partition = partition;
+    hold->acquired = now;
+    hold->caller = prwlock_trace_site;
+    hold->mode = mode;
+  }
+} /* prwlock_trace_acquired() */
+
+/* ------------------------------------------------------------------------- */
+
+static void
+prwlock_trace_released (
+  partitioned_rwlock_t         *rwlock,
+  size_t                        partition
+) {
+  for (size_t ii = prwlock_trace_hold_count; 0 < ii--; ) {
+    prwlock_trace_hold_t *hold = &prwlock_trace_holds[ii];
+
+    if (rwlock == hold->rwlock && partition == hold->partition) {
+      uint64_t ticks = (prwlock_trace_ticks() - hold->acquired);
+      const void *caller = hold->caller;
+      partitioned_rwlock_mode_t mode = hold->mode;
+
+      *hold = prwlock_trace_holds[--prwlock_trace_hold_count];
+      if (ticks >= rwlock->trace->threshold_ticks) {
+        prwlock_trace_record(rwlock, PRWLOCK_TRACE_HOLD, partition, mode,
+          ticks, caller);
+      }
+      return;
+    }
+  }
+} /* prwlock_trace_released() */
+
+/* ------------------------------------------------------------------------- */
+
+/* Cells start as aligned in a shared region as they would on the heap */
+static size_t
+prwlock_shared_cells_offset (
+  const partitioned_rwlock_t   *rwlock
+) {
+  size_t cell_alignment = (CACHE_LINE_PAIR_SIZE == rwlock->cell_stride)
+    ? CACHE_LINE_PAIR_SIZE : CACHE_LINE_SIZE;
+
+  return PRWLOCK_ROUND_UP(sizeof(prwlock_shared_t), cell_alignment);
+} /* prwlock_shared_cells_offset() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Lets go of a shared region. Only the creator's own handle, in the
+ * creating process (not in a child that inherited it), tears the cells
+ * down; everyone else just stops using them.
+ */
+static void
+prwlock_shared_detach (
+  partitioned_rwlock_t         *rwlock
+) {
+  prwlock_shared_t *shared = rwlock->shared;
+
+  if (rwlock->shared_owner && getpid() == shared->creator) {
+    atomic_store_explicit(&shared->magic, 0, memory_order_relaxed);
+    for (size_t ii = 0; ii < rwlock->partition_count; ++ii) {
+      prwlock_cell_destroy(rwlock, PRWLOCK_CELL(rwlock, ii));
+    }
+  }
+  if (rwlock->shared_mapped) {
+    (void) munmap(shared, shared->region_size);
+  }
+} /* prwlock_shared_detach() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Registering for expedited membarrier(2) is per process and idempotent.
+ * Where it succeeds, a thread that fences through prwlock_membarrier_fence()
+ * orders its stores before its loads on every running thread of the
+ * process, which may then get by with a compiler barrier.
+ */
+static int
+prwlock_membarrier_register (
+  void
+) {
+#if defined(__linux__) && defined(SYS_membarrier)                            \
+  && defined(MEMBARRIER_CMD_PRIVATE_EXPEDITED)
+  long commands = syscall(SYS_membarrier, MEMBARRIER_CMD_QUERY, 0, 0);
+  return (0 <= commands
+    && (commands & MEMBARRIER_CMD_PRIVATE_EXPEDITED)
+    && 0 == syscall(SYS_membarrier,
+      MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED, 0, 0));
+#else
+  return 0;
+#endif /* __linux__ && SYS_membarrier && MEMBARRIER_CMD_PRIVATE_EXPEDITED */
+} /* prwlock_membarrier_register() */
+
+/* ------------------------------------------------------------------------- */
+
+static void
+prwlock_membarrier_fence (
+  int                           registered
+) {
+#if defined(__linux__) && defined(SYS_membarrier)                            \
+  && defined(MEMBARRIER_CMD_PRIVATE_EXPEDITED)
+  if (registered
+    && 0 == syscall(SYS_membarrier, MEMBARRIER_CMD_PRIVATE_EXPEDITED, 0, 0)) {
+    return;
+  }
+#else
+  (void) registered;
+#endif /* __linux__ && SYS_membarrier && MEMBARRIER_CMD_PRIVATE_EXPEDITED */
+  atomic_thread_fence(memory_order_seq_cst);
+} /* prwlock_membarrier_fence() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Epochs start at 1, so that 0 can mark a slot whose thread is outside.
+ * Where the kernel offers no expedited membarrier(2), readers fence for
+ * themselves instead.
+ */
+static int
+prwlock_epoch_init (
+  partitioned_rwlock_t         *rwlock
+) {
+  atomic_init(&rwlock->epoch.epoch, 1);
+  for (size_t ii = 0; ii < PRWLOCK_EPOCH_CHUNKS; ++ii) {
+    atomic_init(&rwlock->epoch.chunks[ii], NULL);
+  }
+  if (0 != pthread_mutex_init(&rwlock->epoch.mutex, NULL)) {
+    printf("Failed to initialize epoch mutex!\n");
+    return -1;
+  }
+  rwlock->epoch.membarrier = prwlock_membarrier_register();
+  return 0;
+} /* prwlock_epoch_init() */
+
+/* ------------------------------------------------------------------------- */
+
+/* Nobody can be reading by now, so what was deferred is reclaimed at once */
+static void
+prwlock_epoch_destroy (
+  partitioned_rwlock_t         *rwlock
+) {
+  if (!(rwlock->flags & PRWLOCK_FLAG_EPOCH)) {
+    return;
+  }
+
+  prwlock_epoch_run(rwlock->epoch.deferred);
+  rwlock->epoch.deferred = NULL;
+  for (size_t ii = 0; ii < PRWLOCK_EPOCH_CHUNKS; ++ii) {
+    free(atomic_load(&rwlock->epoch.chunks[ii]));
+  }
+  (void) pthread_mutex_destroy(&rwlock->epoch.mutex);
+} /* prwlock_epoch_destroy() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * The calling thread's slot. A chunk is allocated by the first of its
+ * threads to enter; when two race, the loser frees its copy. NULL if the
+ * thread id is past the last chunk, or there was no memory.
+ */
+static prwlock_epoch_slot_t *
+prwlock_epoch_slot (
+  partitioned_rwlock_t         *rwlock,
+  int                           create
+) {
+  uint32_t thread_id = prwlock_thread_id();
+  size_t chunk_index = (thread_id / PRWLOCK_EPOCH_CHUNK_SLOTS);
+
+  if (PRWLOCK_EPOCH_CHUNKS <= chunk_index) {
+    return NULL;
+  }
+
+  prwlock_epoch_slot_t *chunk = atomic_load_explicit(
+    &rwlock->epoch.chunks[chunk_index], memory_order_acquire);
+  if (NULL == chunk) {
+    prwlock_epoch_slot_t *fresh = NULL;
+
+    if (!create || posix_memalign((void **) &fresh, CACHE_LINE_SIZE,
+      (PRWLOCK_EPOCH_CHUNK_SLOTS * sizeof(*fresh)))) {
+      return NULL;
+    }
+    memset(fresh, 0, (PRWLOCK_EPOCH_CHUNK_SLOTS * sizeof(*fresh)));
+    if (atomic_compare_exchange_strong_explicit(
+      &rwlock->epoch.chunks[chunk_index], &chunk, fresh,
+      memory_order_acq_rel, memory_order_acquire)) {
+      chunk = fresh;
+    } else {
+      free(fresh);
+    }
+  }
+  return &chunk[thread_id % PRWLOCK_EPOCH_CHUNK_SLOTS];
+} /* prwlock_epoch_slot() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * The writer's half of the reader's barrier: after this, every reader has
+ * either made its slot visible, or will see whatever was published before.
+ */
+static void
+prwlock_epoch_fence (
+  partitioned_rwlock_t         *rwlock
+) {
+  prwlock_membarrier_fence(rwlock->epoch.membarrier);
+} /* prwlock_epoch_fence() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * One grace period. Readers that entered after the epoch moved on loaded
+ * the new epoch with acquire, so they see all that came before; only slots
+ * still showing an older epoch are waited for.
+ */
+static void
+prwlock_epoch_synchronize (
+  partitioned_rwlock_t         *rwlock
+) {
+  pthread_mutex_lock(&rwlock->epoch.mutex);
+  prwlock_epoch_fence(rwlock);
+  uint64_t current = (atomic_fetch_add(&rwlock->epoch.epoch, 1) + 1);
+
+  for (size_t ii = 0; ii < PRWLOCK_EPOCH_CHUNKS; ++ii) {
+    prwlock_epoch_slot_t *chunk = atomic_load_explicit(
+      &rwlock->epoch.chunks[ii], memory_order_acquire);
+    if (NULL == chunk) {
+      continue;
+    }
+    for (size_t jj = 0; jj < PRWLOCK_EPOCH_CHUNK_SLOTS; ++jj) {
+      size_t spins = 0;
+      uint64_t value;
+
+      while (0 != (value = atomic_load_explicit(&chunk[jj].value,
+        memory_order_acquire)) && current > value) {
+        if (PRWLOCK_SPIN_LIMIT > ++spins) {
+          PRWLOCK_CPU_RELAX();
+        } else {
+          sched_yield();
+        }
+      }
+    }
+  }
+  pthread_mutex_unlock(&rwlock->epoch.mutex);
+} /* prwlock_epoch_synchronize() */
+
+/* ------------------------------------------------------------------------- */
+
+static void
+prwlock_epoch_run (
+  prwlock_epoch_deferred_t     *deferred
+) {
+  while (NULL != deferred) {
+    prwlock_epoch_deferred_t *next = deferred->next;
+
+    deferred->reclaim(deferred->arg);
+    free(deferred);
+    deferred = next;
+  }
+} /* prwlock_epoch_run() */
+
+/* ------------------------------------------------------------------------- */
+
+static int
+prwlock_partition_acquire (
+  partitioned_rwlock_t         *rwlock,
+  size_t                        partition,
+  partitioned_rwlock_mode_t     mode,
+  uint64_t                      deadline
+) {
+  partitioned_rwlock_cell_t *cell = PRWLOCK_CELL(rwlock, partition);
+  int rc;
+
+  if (rwlock->flags & PRWLOCK_FLAG_GLOBAL) {
+    if (0 != (rc = prwlock_global_enter(rwlock, mode, deadline))) {
+      return rc;
+    }
+  }
+
+  if (PRWLOCK_MODE_WRITE != mode) {
+    rc = ((rwlock->flags & PRWLOCK_FLAG_COHORT)
+      && PRWLOCK_DEADLINE_NOW != deadline)
+      ? prwlock_cohort_hold_back(rwlock, partition, deadline) : 0;
+
+    if (0 == rc) {
+      if (PRWLOCK_MODE_UPGRADABLE == mode) {
+        /* Upgraders read through the cell, which upgrade() converts */
+        if (0 == (rc = prwlock_upgrader_acquire(rwlock, cell, deadline))
+          && 0 != (rc = prwlock_cell_acquire(rwlock, cell, 0, deadline))) {
+          prwlock_upgrader_release(rwlock, cell);
+        }
+      } else if (rwlock->flags & PRWLOCK_FLAG_READER_BIAS) {
+        rc = prwlock_bias_rdlock(rwlock, partition, deadline);
+      } else if (rwlock->flags & PRWLOCK_FLAG_READ_LEASE) {
+        rc = prwlock_lease_rdlock(rwlock, partition, deadline);
+      } else {
+        rc = prwlock_cell_acquire(rwlock, cell, 0, deadline);
+      }
+    }
+  } else {
+    /* Emulated upgrades rely on writers queueing for the token first */
+    int emulated = prwlock_upgrader_emulated(rwlock);
+    rc = (emulated) ? prwlock_upgrader_acquire(rwlock, cell, deadline) : 0;
+
+    /* Cohort queues cannot be left, so timed writers wait on the cell */
+    if (0 == rc) {
+      if ((rwlock->flags & PRWLOCK_FLAG_COHORT)
+        && PRWLOCK_DEADLINE_NONE == deadline) {
+        rc = prwlock_cohort_wrlock(rwlock, partition);
+      } else {
+        rc = prwlock_cell_acquire(rwlock, cell, 1, deadline);
+      }
+    }
+    /* A handed-over partition was revoked by the writer that passed it on */
+    if (0 == rc && (rwlock->flags & PRWLOCK_FLAG_READER_BIAS)
+      && atomic_load_explicit(&rwlock->bias.enabled[partition],
+        memory_order_relaxed)
+      && 0 != (rc = prwlock_bias_revoke(rwlock, partition, deadline))) {
+      (void) prwlock_cell_unlock(rwlock, cell);
+      prwlock_async_notify(rwlock, partition);
+    }
+    /* Only readers holding the cell take leases, so none appears after this */
+    if (0 == rc && (rwlock->flags & PRWLOCK_FLAG_READ_LEASE)
+      && 0 != (rc = prwlock_lease_revoke(rwlock, partition, deadline))) {
+      (void) prwlock_cell_unlock(rwlock, cell);
+      prwlock_async_notify(rwlock, partition);
+    }
+    if (0 != rc && emulated && prwlock_upgrader_owned(cell)) {
+      prwlock_upgrader_release(rwlock, cell);
+    }
+  }
+
+  if (0 != rc) {
+    if (rwlock->flags & PRWLOCK_FLAG_GLOBAL) {
+      prwlock_global_exit(rwlock, mode);
+    }
+  } else if (PRWLOCK_MODE_WRITE == mode
+    && (rwlock->flags & PRWLOCK_WRITE_HELD_FLAGS)) {
+    atomic_store_explicit(&cell->write_held, 1, memory_order_relaxed);
+    if (rwlock->flags & PRWLOCK_FLAG_OPTIMISTIC) {
+      prwlock_sequence_begin(&cell->sequence);
+    }
+  }
+  return rc;
+} /* prwlock_partition_acquire() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * With statistics on, a blocking acquisition first tries its luck, so that
+ * only acquisitions that really wait pay for timing the wait.
+ */
+static int
+prwlock_partition_lock_stats (
+  partitioned_rwlock_t         *rwlock,
+  size_t                        partition,
+  partitioned_rwlock_mode_t     mode,
+  uint64_t                      deadline
+) {
+  if (!(rwlock->flags & PRWLOCK_FLAG_STATS)) {
+    return prwlock_partition_acquire(rwlock, partition, mode, deadline);
+  }
+
+  prwlock_stats_cell_t *stats = prwlock_stats_cell(rwlock, partition);
+  uint64_t wait_ns = 0;
+  int rc = prwlock_partition_acquire(rwlock, partition, mode,
+    PRWLOCK_DEADLINE_NOW);
+
+  if (EBUSY == rc) {
+    if (PRWLOCK_DEADLINE_NOW == deadline) {
+      atomic_fetch_add_explicit(&stats->try_failures, 1,
+        memory_order_relaxed);
+      return rc;
+    }
+    uint64_t start = prwlock_now_ns();
+    rc = prwlock_partition_acquire(rwlock, partition, mode, deadline);
+    wait_ns = (prwlock_now_ns() - start);
+    atomic_fetch_add_explicit(&stats->contended, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&stats->wait_ns, wait_ns, memory_order_relaxed);
+    if (ETIMEDOUT == rc) {
+      atomic_fetch_add_explicit(&stats->timeouts, 1, memory_order_relaxed);
+    }
+  }
+  if (0 != rc) {
+    return rc;
+  }
+
+  atomic_fetch_add_explicit((PRWLOCK_MODE_WRITE == mode)
+    ? &stats->write_acquires : &stats->read_acquires, 1, memory_order_relaxed);
+  atomic_fetch_add_explicit(
+    &stats->wait_histogram[prwlock_stats_bucket(wait_ns)], 1,
+    memory_order_relaxed);
+  prwlock_stats_hold_push(rwlock, partition, prwlock_now_ns());
+  return 0;
+} /* prwlock_partition_lock_stats() */
+
+/* ------------------------------------------------------------------------- */
+
+static int
+prwlock_partition_lock (
+  partitioned_rwlock_t         *rwlock,
+  size_t                        partition,
+  partitioned_rwlock_mode_t     mode,
+  uint64_t                      deadline
+) {
+  if (!(rwlock->flags & PRWLOCK_FLAG_TRACE)) {
+    return prwlock_partition_lock_stats(rwlock, partition, mode, deadline);
+  }
+
+  uint64_t start = prwlock_trace_ticks();
+  int rc = prwlock_partition_lock_stats(rwlock, partition, mode, deadline);
+  if (0 == rc) {
+    prwlock_trace_acquired(rwlock, partition, mode, start);
+  }
+  return rc;
+} /* prwlock_partition_lock() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * for_write is the mode the caller holds the partition in, when it says;
+ * with PRWLOCK_UNLOCK_INFER the write_held flag, or failing that the cell,
+ * tells.
+ */
+static int
+prwlock_partition_unlock (
+  partitioned_rwlock_t         *rwlock,
+  size_t                        partition,
+  int                           for_write
+) {
+  partitioned_rwlock_cell_t *cell = PRWLOCK_CELL(rwlock, partition);
+  partitioned_rwlock_mode_t mode;
+  uint64_t acquired_ns;
+  int rc;
+
+  if (rwlock->flags & PRWLOCK_FLAG_TRACE) {
+    prwlock_trace_released(rwlock, partition);
+  }
+  if ((rwlock->flags & PRWLOCK_FLAG_STATS)
+    && prwlock_stats_hold_pop(rwlock, partition, &acquired_ns)) {
+    prwlock_stats_cell_t *stats = prwlock_stats_cell(rwlock, partition);
+    uint64_t hold_ns = (prwlock_now_ns() - acquired_ns);
+
+    atomic_fetch_add_explicit(&stats->hold_ns, hold_ns, memory_order_relaxed);
+    atomic_fetch_add_explicit(
+      &stats->hold_histogram[prwlock_stats_bucket(hold_ns)], 1,
+      memory_order_relaxed);
+  }
+
+  /* Only a writer sets the flag, and it is cleared before anyone else gets in */
+  if (PRWLOCK_UNLOCK_INFER == for_write
+    && (rwlock->flags & PRWLOCK_WRITE_HELD_FLAGS)) {
+    for_write = atomic_load_explicit(&cell->write_held, memory_order_relaxed);
+  }
+  mode = (1 == for_write) ? PRWLOCK_MODE_WRITE : PRWLOCK_MODE_READ;
+  if (PRWLOCK_MODE_WRITE == mode
+    && (rwlock->flags & PRWLOCK_WRITE_HELD_FLAGS)) {
+    atomic_store_explicit(&cell->write_held, 0, memory_order_relaxed);
+    if (rwlock->flags & PRWLOCK_FLAG_OPTIMISTIC) {
+      prwlock_sequence_end(&cell->sequence);
+    }
+  }
+
+  if (PRWLOCK_MODE_WRITE == mode && (rwlock->flags & PRWLOCK_FLAG_COHORT)) {
+    rc = prwlock_cohort_wrunlock(rwlock, partition);
+  } else if (PRWLOCK_MODE_WRITE != mode
+    && (rwlock->flags & PRWLOCK_FLAG_READER_BIAS)) {
+    rc = prwlock_bias_rdunlock(rwlock, partition, for_write);
+  } else if (PRWLOCK_MODE_WRITE != mode
+    && (rwlock->flags & PRWLOCK_FLAG_READ_LEASE)) {
+    rc = prwlock_lease_rdunlock(rwlock, partition, for_write);
+  } else {
+    rc = prwlock_cell_release(rwlock, cell, for_write);
+  }
+
+  if (PRWLOCK_MODE_READ == mode && (rwlock->flags & PRWLOCK_FLAG_COHORT)) {
+    prwlock_cohort_rdunlock(rwlock, partition);
+  }
+
+  /* Held by upgradable readers, and by every writer when emulated */
+  if ((rwlock->flags & PRWLOCK_FLAG_UPGRADABLE)
+    && prwlock_upgrader_owned(cell)) {
+    prwlock_upgrader_release(rwlock, cell);
+  }
+
+  if (rwlock->flags & PRWLOCK_FLAG_GLOBAL) {
+    prwlock_global_exit(rwlock, mode);
+  }
+  prwlock_async_notify(rwlock, partition);
+  return rc;
+} /* prwlock_partition_unlock() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Upgrades the caller's upgradable hold. Under the global flag the ingress
+ * count moves from readers to writers first; a thread holding partitions
+ * is never kept out by a drain, but a shared whole-lock holder does keep
+ * it waiting. Reader-biased partitions then have their bias revoked, and
+ * leased ones their lease.
+ */
+static int
+prwlock_partition_upgrade (
+  partitioned_rwlock_t         *rwlock,
+  size_t                        partition,
+  uint64_t                      deadline
+) {
+  partitioned_rwlock_cell_t *cell = PRWLOCK_CELL(rwlock, partition);
+  int rc;
+
+  if (!prwlock_upgrader_owned(cell)) {
+    return EPERM;
+  }
+
+  if (rwlock->flags & PRWLOCK_FLAG_GLOBAL) {
+    if (0 != (rc = prwlock_global_enter(rwlock, PRWLOCK_MODE_WRITE,
+      deadline))) {
+      return rc;
+    }
+  }
+
+  if (0 == (rc = prwlock_cell_upgrade(rwlock, cell, deadline))
+    && (rwlock->flags & PRWLOCK_FLAG_READER_BIAS)
+    && atomic_load_explicit(&rwlock->bias.enabled[partition],
+      memory_order_relaxed)
+    && 0 != (rc = prwlock_bias_revoke(rwlock, partition, deadline))) {
+    (void) prwlock_cell_downgrade(rwlock, cell);
+  }
+  if (0 == rc && (rwlock->flags & PRWLOCK_FLAG_READ_LEASE)
+    && 0 != (rc = prwlock_lease_revoke(rwlock, partition, deadline))) {
+    (void) prwlock_cell_downgrade(rwlock, cell);
+  }
+
+  if (rwlock->flags & PRWLOCK_FLAG_GLOBAL) {
+    prwlock_global_exit(rwlock, (0 == rc) ? PRWLOCK_MODE_READ
+      : PRWLOCK_MODE_WRITE);
+  }
+  if (0 == rc) {
+    atomic_store_explicit(&cell->write_held, 1, memory_order_relaxed);
+    if (rwlock->flags & PRWLOCK_FLAG_OPTIMISTIC) {
+      prwlock_sequence_begin(&cell->sequence);
+    }
+  }
+  return rc;
+} /* prwlock_partition_upgrade() */
+
+/* ------------------------------------------------------------------------- */
+
+static int
+prwlock_combine_init (
+  partitioned_rwlock_t         *rwlock
+) {
+  if (posix_memalign((void **) &rwlock->combine, CACHE_LINE_SIZE,
+    (rwlock->partition_count * sizeof(*rwlock->combine)))) {
+    printf("Failed to allocate combining state!\n");
+    return -1;
+  }
+  memset(rwlock->combine, 0,
+    (rwlock->partition_count * sizeof(*rwlock->combine)));
+  return 0;
+} /* prwlock_combine_init() */
+
+/* ------------------------------------------------------------------------- */
+
+static void
+prwlock_combine_destroy (
+  partitioned_rwlock_t         *rwlock
+) {
+  free(rwlock->combine);
+  rwlock->combine = NULL;
+} /* prwlock_combine_destroy() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Called holding the partition for write: runs the combiner's own
+ * operation, if it has one, then takes the whole list at a time and runs
+ * it oldest first, until the list is empty or the limit is reached. An
+ * operation is done once its state says so, after which its caller may
+ * return and take the operation with it, so next is read first. active is
+ * cleared before the list is looked at for the last time: a caller that
+ * publishes after that look sees no combiner and takes the partition
+ * itself, and the oldest operation published before it has its caller
+ * elected to combine next. The list only changes at its head while the
+ * partition is held, so walking it to its tail is safe here.
+ */
+static void
+prwlock_combine_run (
+  partitioned_rwlock_t         *rwlock,
+  size_t                        partition,
+  partitioned_rwlock_combine_fn fn,
+  void                         *arg
+) {
+  prwlock_combine_t *combine = &rwlock->combine[partition];
+  size_t count = 0;
+
+  atomic_store(&combine->active, 1);
+  if (NULL != fn) {
+    fn(rwlock, partition, arg);
+    ++count;
+  }
+
+  while (PRWLOCK_COMBINE_LIMIT > count) {
+    prwlock_combine_op_t *batch = atomic_exchange(&combine->pending, NULL);
+    prwlock_combine_op_t *ordered = NULL;
+
+    if (NULL == batch) {
+      break;
+    }
+    while (NULL != batch) {
+      prwlock_combine_op_t *next = batch->next;
+
+      batch->next = ordered;
+      ordered = batch;
+      batch = next;
+    }
+    while (NULL != ordered) {
+      prwlock_combine_op_t *op = ordered;
+
+      ordered = op->next;
+      op->fn(rwlock, partition, op->arg);
+      if (PRWLOCK_COMBINE_PARKED & atomic_exchange_explicit(&op->state,
+        PRWLOCK_COMBINE_DONE, memory_order_release)) {
+        (void) prwlock_futex_wake(rwlock, &op->state, 1);
+      }
+      ++count;
+    }
+  }
+
+  atomic_store(&combine->active, 0);
+  prwlock_combine_op_t *next = atomic_load(&combine->pending);
+  if (NULL == next) {
+    return;
+  }
+  while (NULL != next->next) {
+    next = next->next;
+  }
+  if (PRWLOCK_COMBINE_PARKED & atomic_exchange(&next->state,
+    PRWLOCK_COMBINE_ELECTED)) {
+    (void) prwlock_futex_wake(rwlock, &next->state, 1);
+  }
+} /* prwlock_combine_run() */
+
+/* ------------------------------------------------------------------------- */
+
+/* The many-partition calls take either bare indices plus a mode, or requests */
+static partitioned_rwlock_request_t
+prwlock_many_request (
+  const size_t                 *partitions,
+  const partitioned_rwlock_request_t *requests,
+  partitioned_rwlock_mode_t     mode,
+  size_t                        index
+) {
+  partitioned_rwlock_request_t request;
+
+  if (NULL != requests) {
+    return requests[index];
+  }
+  request.partition = partitions[index];
+  request.mode = mode;
+  return request;
+} /* prwlock_many_request() */
+
+/* ------------------------------------------------------------------------- */
+
+/* Write beats upgradable, which beats read */
+static partitioned_rwlock_mode_t
+prwlock_many_mode (
+  partitioned_rwlock_mode_t     lhs,
+  partitioned_rwlock_mode_t     rhs
+) {
+  if (PRWLOCK_MODE_WRITE == lhs || PRWLOCK_MODE_WRITE == rhs) {
+    return PRWLOCK_MODE_WRITE;
+  }
+  return (PRWLOCK_MODE_UPGRADABLE == rhs) ? rhs : lhs;
+} /* prwlock_many_mode() */
+
+/* ------------------------------------------------------------------------- */
+
+static int
+prwlock_many_compare (
+  const void                   *lhs,
+  const void                   *rhs
+) {
+  size_t left = ((const partitioned_rwlock_request_t *) lhs)->partition;
+  size_t right = ((const partitioned_rwlock_request_t *) rhs)->partition;
+
+  return (left > right) - (left < right);
+} /* prwlock_many_compare() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Sorts a partition set into ascending (canonical) order and folds duplicate
+ * partitions into one entry, in the strongest mode asked for. Every caller
+ * acquiring more than one partition goes through this order, so no two of
+ * them can each hold a partition the other is waiting for. Returns the
+ * distinct count.
+ */
+static size_t
+prwlock_many_normalize (
+  partitioned_rwlock_request_t *set,
+  size_t                        count
+) {
+  size_t unique = 0;
+
+  if (PRWLOCK_MANY_STACK_COUNT >= count) {
+    for (size_t ii = 1; ii < count; ++ii) {
+      partitioned_rwlock_request_t entry = set[ii];
+      size_t jj = ii;
+
+      while (0 < jj && set[jj - 1].partition > entry.partition) {
+        set[jj] = set[jj - 1];
+        --jj;
+      }
+      set[jj] = entry;
+    }
+  } else {
+    qsort(set, count, sizeof(*set), prwlock_many_compare);
+  }
+
+  for (size_t ii = 0; ii < count; ++ii) {
+    if (0 < unique && set[unique - 1].partition == set[ii].partition) {
+      set[unique - 1].mode = prwlock_many_mode(set[unique - 1].mode,
+        set[ii].mode);
+    } else {
+      set[unique++] = set[ii];
+    }
+  }
+
+  return unique;
+} /* prwlock_many_normalize() */
+
+/* ------------------------------------------------------------------------- */
+
+static int
+prwlock_many_acquire (
+  partitioned_rwlock_t         *rwlock,
+  const partitioned_rwlock_request_t *request,
+  uint64_t                      deadline
+) {
+  assert(request->partition < rwlock->partition_count);
+
+  if (PRWLOCK_MODE_UPGRADABLE == request->mode
+    && !(rwlock->flags & PRWLOCK_FLAG_UPGRADABLE)) {
+    return EINVAL;
+  }
+  return prwlock_partition_lock(rwlock, request->partition, request->mode,
+    deadline);
+} /* prwlock_many_acquire() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Locks a set of partitions in canonical order. If any acquisition fails
+ * (a busy partition for the try variants, an error otherwise) everything
+ * taken so far is released, so the caller never holds a partial set. Pairs,
+ * the common cross-partition case, skip the copy and sort entirely.
+ */
+static int
+prwlock_many_lock (
+  partitioned_rwlock_t         *rwlock,
+  const size_t                 *partitions,
+  const partitioned_rwlock_request_t *requests,
+  partitioned_rwlock_mode_t     mode,
+  size_t                        count,
+  uint64_t                      deadline
+) {
+  partitioned_rwlock_request_t local[PRWLOCK_MANY_STACK_COUNT];
+  partitioned_rwlock_request_t *set = local;
+  int rc = 0;
+
+  assert(NULL != rwlock);
+  assert(0 == count || NULL != partitions || NULL != requests);
+
+  if (2 >= count) {
+    partitioned_rwlock_request_t first, second;
+
+    if (0 == count) {
+      return 0;
+    }
+    first = prwlock_many_request(partitions, requests, mode, 0);
+    if (1 == count) {
+      return prwlock_many_acquire(rwlock, &first, deadline);
+    }
+    second = prwlock_many_request(partitions, requests, mode, 1);
+    if (first.partition == second.partition) {
+      first.mode = prwlock_many_mode(first.mode, second.mode);
+      return prwlock_many_acquire(rwlock, &first, deadline);
+    }
+    if (first.partition > second.partition) {
+      partitioned_rwlock_request_t swap = first;
+      first = second;
+      second = swap;
+    }
+    if (0 != (rc = prwlock_many_acquire(rwlock, &first, deadline))) {
+      return rc;
+    }
+    if (0 != (rc = prwlock_many_acquire(rwlock, &second, deadline))) {
+      (void) prwlock_partition_unlock(rwlock, first.partition,
+        (PRWLOCK_MODE_WRITE == first.mode));
+    }
+    return rc;
+  }
+
+  if (PRWLOCK_MANY_STACK_COUNT < count
+    && NULL == (set = malloc(count * sizeof(*set)))) {
+    return ENOMEM;
+  }
+  for (size_t ii = 0; ii < count; ++ii) {
+    set[ii] = prwlock_many_request(partitions, requests, mode, ii);
+  }
+  count = prwlock_many_normalize(set, count);
+
+  for (size_t ii = 0; ii < count; ++ii) {
+    if (0 != (rc = prwlock_many_acquire(rwlock, &set[ii], deadline))) {
+      while (0 < ii--) {
+        (void) prwlock_partition_unlock(rwlock, set[ii].partition,
+          (PRWLOCK_MODE_WRITE == set[ii].mode));
+      }
+      break;
+    }
+  }
+
+  if (local != set) {
+    free(set);
+  }
+  return rc;
+} /* prwlock_many_lock() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Lets loops with asynchronous requests queued know that the partition (or
+ * with PRWLOCK_PARTITION_ANY, perhaps every partition) may be free. Each
+ * loop is sent its async handle at most once until it drains, however many
+ * releases come in between. Nothing happens for locks never used
+ * asynchronously, and on backends other than libuv.
+ */
+static void
+prwlock_async_notify (
+  partitioned_rwlock_t         *rwlock,
+  size_t                        partition
+) {
+#if defined(USE_LIBUV_RWLOCK)
+  _Atomic uint32_t *waiting = atomic_load_explicit(&rwlock->async.waiting,
+    memory_order_acquire);
+  if (NULL == waiting) {
+    return;
+  }
+
+  /* Orders the release before the check, against a queuer's retry */
+  atomic_thread_fence(memory_order_seq_cst);
+  if (PRWLOCK_PARTITION_ANY != partition
+    && 0 == atomic_load_explicit(&waiting[partition], memory_order_relaxed)) {
+    return;
+  }
+
+  pthread_mutex_lock(&rwlock->async.mutex);
+  for (prwlock_async_loop_t *context = rwlock->async.loops; NULL != context;
+    context = context->next) {
+    if (0 < atomic_load(&context->queued)
+      && 0 == atomic_exchange(&context->signalled, 1)) {
+      (void) uv_async_send(&context->async);
+    }
+  }
+  pthread_mutex_unlock(&rwlock->async.mutex);
+#else
+  (void) rwlock;
+  (void) partition;
+#endif /* USE_LIBUV_RWLOCK */
+} /* prwlock_async_notify() */
+
+/* ------------------------------------------------------------------------- */
+
+#if defined(USE_LIBUV_RWLOCK)
+
+/*
+ * The loop's queue on the lock, set up on first use; must run on the loop's
+ * thread, which uv_async_init() requires. The handle is unreferenced while
+ * nothing is queued, so it never keeps uv_run() from returning.
+ */
+static prwlock_async_loop_t *
+prwlock_async_loop (
+  uv_loop_t                    *loop,
+  partitioned_rwlock_t         *rwlock
+) {
+  prwlock_async_loop_t *context;
+
+  pthread_mutex_lock(&rwlock->async.mutex);
+  for (context = rwlock->async.loops; NULL != context;
+    context = context->next) {
+    if (loop == context->loop) {
+      pthread_mutex_unlock(&rwlock->async.mutex);
+      return context;
+    }
+  }
+
+  if (NULL == atomic_load_explicit(&rwlock->async.waiting,
+    memory_order_relaxed)) {
+    _Atomic uint32_t *waiting = calloc(rwlock->partition_count,
+      sizeof(*waiting));
+    if (NULL == waiting) {
+      pthread_mutex_unlock(&rwlock->async.mutex);
+      return NULL;
+    }
+    atomic_store_explicit(&rwlock->async.waiting, waiting,
+      memory_order_release);
+  }
+
+  context = calloc(1, sizeof(*context));
+  if (NULL != context) {
+    context->busy_pass = calloc(rwlock->partition_count,
+      sizeof(*context->busy_pass));
+  }
+  if (NULL == context || NULL == context->busy_pass
+    || 0 != uv_async_init(loop, &context->async, prwlock_async_drain)) {
+    if (NULL != context) {
+      free(context->busy_pass);
+    }
+    free(context);
+    pthread_mutex_unlock(&rwlock->async.mutex);
+    return NULL;
+  }
+  context->async.data = context;
+  context->loop = loop;
+  context->rwlock = rwlock;
+  uv_unref((uv_handle_t *) &context->async);
+
+  context->next = rwlock->async.loops;
+  rwlock->async.loops = context;
+  pthread_mutex_unlock(&rwlock->async.mutex);
+  return context;
+} /* prwlock_async_loop() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Async callback: one pass over the loop's queue, in order, taking every
+ * partition it can. Once a request finds its partition busy, later ones
+ * for that partition wait too, so readers do not overtake a queued writer.
+ * Callbacks run after the pass, when the queue is consistent again.
+ */
+static void
+prwlock_async_drain (
+  uv_async_t                   *handle
+) {
+  prwlock_async_loop_t *context = (prwlock_async_loop_t *) handle->data;
+  partitioned_rwlock_t *rwlock = context->rwlock;
+  _Atomic uint32_t *waiting = atomic_load_explicit(&rwlock->async.waiting,
+    memory_order_relaxed);
+  prwlock_async_request_t *granted = NULL;
+  prwlock_async_request_t **granted_tail = &granted;
+  prwlock_async_request_t **link = &context->head;
+  prwlock_async_request_t *request;
+
+  /* Lowered first, so a release during the pass sends the handle again */
+  atomic_store(&context->signalled, 0);
+
+  if (0 == ++context->pass) {
+    memset(context->busy_pass, 0,
+      (rwlock->partition_count * sizeof(*context->busy_pass)));
+    context->pass = 1;
+  }
+
+  context->tail = NULL;
+  while (NULL != (request = *link)) {
+    size_t partition = request->partition;
+
+    if (context->pass != context->busy_pass[partition]
+      && 0 == prwlock_partition_lock(rwlock, partition, request->mode,
+        PRWLOCK_DEADLINE_NOW)) {
+      *link = request->next;
+      request->next = NULL;
+      *granted_tail = request;
+      granted_tail = &request->next;
+      atomic_fetch_sub(&waiting[partition], 1);
+      atomic_fetch_sub(&context->queued, 1);
+    } else {
+      context->busy_pass[partition] = context->pass;
+      context->tail = request;
+      link = &request->next;
+    }
+  }
+  if (NULL == context->head) {
+    uv_unref((uv_handle_t *) &context->async);
+  }
+
+  while (NULL != (request = granted)) {
+    granted = request->next;
+    request->cb(rwlock, request->partition, 0, request->arg);
+    free(request);
+  }
+} /* prwlock_async_drain() */
+
+/* ------------------------------------------------------------------------- */
+
+static void
+prwlock_async_closed (
+  uv_handle_t                  *handle
+) {
+  prwlock_async_loop_t *context = (prwlock_async_loop_t *) handle->data;
+
+  free(context->busy_pass);
+  free(context);
+} /* prwlock_async_closed() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Tries the partition at once; if it is busy, queues the request on the
+ * loop and tries once more, as the release may have come before the
+ * request was counted and so signalled nobody.
+ */
+static int
+prwlock_async_lock (
+  uv_loop_t                    *loop,
+  partitioned_rwlock_t         *rwlock,
+  size_t                        partition,
+  partitioned_rwlock_mode_t     mode,
+  partitioned_rwlock_async_cb   cb,
+  void                         *arg
+) {
+  /* Keys move between partitions of a resizable lock underneath a queue */
+  if (rwlock->flags & PRWLOCK_FLAG_RESIZABLE) {
+    return EINVAL;
+  }
+
+  int rc = prwlock_partition_lock(rwlock, partition, mode,
+    PRWLOCK_DEADLINE_NOW);
+  if (EBUSY != rc) {
+    return rc;
+  }
+
+  prwlock_async_loop_t *context = prwlock_async_loop(loop, rwlock);
+  prwlock_async_request_t *request = (NULL != context)
+    ? malloc(sizeof(*request)) : NULL;
+  if (NULL == request) {
+    return ENOMEM;
+  }
+  request->next = NULL;
+  request->partition = partition;
+  request->mode = mode;
+  request->cb = cb;
+  request->arg = arg;
+
+  /* The loop first, so a release that sees the partition's count signals */
+  _Atomic uint32_t *waiting = atomic_load_explicit(&rwlock->async.waiting,
+    memory_order_relaxed);
+  atomic_fetch_add(&context->queued, 1);
+  atomic_fetch_add(&waiting[partition], 1);
+
+  rc = prwlock_partition_lock(rwlock, partition, mode, PRWLOCK_DEADLINE_NOW);
+  if (EBUSY != rc) {
+    atomic_fetch_sub(&waiting[partition], 1);
+    atomic_fetch_sub(&context->queued, 1);
+    free(request);
+    return rc;
+  }
+
+  if (NULL == context->tail) {
+    context->head = request;
+  } else {
+    context->tail->next = request;
+  }
+  context->tail = request;
+  uv_ref((uv_handle_t *) &context->async);
+  return EINPROGRESS;
+} /* prwlock_async_lock() */
+
+#endif /* USE_LIBUV_RWLOCK */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * The *_key calls lock the partition a key maps to, and report it through
+ * partition (if not NULL) so the caller can unlock without hashing again.
+ * On a resizable lock the index is only good until the next resize, and
+ * unlock_key() is the way to let go.
+ */
+static int
+prwlock_key_lock (
+  partitioned_rwlock_t         *rwlock,
+  const void                   *key,
+  size_t                        length,
+  partitioned_rwlock_mode_t     mode,
+  uint64_t                      deadline,
+  size_t                       *partition
+) {
+  if (rwlock->flags & PRWLOCK_FLAG_RESIZABLE) {
+    return prwlock_resize_lock(rwlock,
+      prwlock_hash_bytes(key, length, rwlock->hash_seed), mode, deadline,
+      partition);
+  }
+
+  size_t mapped = partitioned_rwlock_partition(rwlock, key, length);
+
+  if (NULL != partition) {
+    *partition = mapped;
+  }
+  return prwlock_partition_lock(rwlock, mapped, mode, deadline);
+} /* prwlock_key_lock() */
+
+/* ========================================================================= */
+/* -- PUBLIC METHODS ------------------------------------------------------- */
+/* ========================================================================= */
+
+int
+partitioned_rwlock_attr_init (
+  partitioned_rwlock_attr_t    *attr
+) {
+  assert(NULL != attr);
+
+  memset(attr, 0, sizeof(*attr));
+  return 0;
+} /* partitioned_rwlock_attr_init() */
+
+/* ------------------------------------------------------------------------- */
+
+int
+partitioned_rwlock_init (
+  partitioned_rwlock_t        **rwlock,
+  size_t                        partition_count
+) {
+  return partitioned_rwlock_init_ex(rwlock, partition_count, NULL);
+} /* partitioned_rwlock_init() */
+
+/* ------------------------------------------------------------------------- */
+
+int
+partitioned_rwlock_init_ex (
+  partitioned_rwlock_t        **rwlock,
+  size_t                        partition_count,
+  const partitioned_rwlock_attr_t *attr
+) {
+  partitioned_rwlock_t *newlock = NULL;
+  if (posix_memalign((void *) &newlock, CACHE_LINE_SIZE, sizeof(*newlock))) {
+    printf("Failed to allocate new lock structure!\n");
+    return -1;
+  }
+  memset(newlock, 0, sizeof(*newlock));
+
+  prwlock_configure(newlock, partition_count, attr);
+#if defined(USE_LIBUV_RWLOCK)
+  if (PRWLOCK_POLICY_WRITER_PREFERRING == newlock->policy) {
+    printf("libuv read-write locks cannot prefer writers!\n");
+    free(newlock);
+    return -1;
+  }
+#endif /* USE_LIBUV_RWLOCK */
+#if !defined(USE_ATOMICS)
+  /* Handing a write lock to another thread is only defined for atomics */
+  if (newlock->flags & PRWLOCK_FLAG_COHORT) {
+    printf("Cohort handoff requires the atomics backend!\n");
+    free(newlock);
+    return -1;
+  }
+#endif /* !USE_ATOMICS */
+  /* Those keep per-partition state that a resize would have to carry over */
+  if ((newlock->flags & PRWLOCK_FLAG_RESIZABLE)
+    && ((newlock->flags & (PRWLOCK_FLAG_READER_BIAS | PRWLOCK_FLAG_STATS
+      | PRWLOCK_FLAG_COHORT | PRWLOCK_FLAG_UPGRADABLE | PRWLOCK_FLAG_TRACE
+      | PRWLOCK_FLAG_READ_LEASE | PRWLOCK_FLAG_COMBINING))
+      || PRWLOCK_NUMA_NONE != newlock->numa.placement
+      || 0 < newlock->cell_data)) {
+    printf("Resizable locks support no bias, leases, stats, cohorts, "
+      "upgrades, combining, tracing, placement or cell data!\n");
+    free(newlock);
+    return -1;
+  }
+  /* Both take over the read path of a partition */
+  if ((newlock->flags & PRWLOCK_FLAG_READER_BIAS)
+    && (newlock->flags & PRWLOCK_FLAG_READ_LEASE)) {
+    printf("Reader bias and read leases cannot be combined!\n");
+    free(newlock);
+    return -1;
+  }
+  newlock->cohort_batch = (NULL != attr && 0 < attr->cohort_batch)
+    ? attr->cohort_batch : PRWLOCK_COHORT_BATCH;
+
+  /* Placed cells are whole pages, so no page is shared with other data */
+  newlock->cell_stride = prwlock_cell_stride(newlock,
+    (NULL != attr) ? attr->stride : PRWLOCK_STRIDE_CACHE_LINE);
+  size_t cell_alignment = (CACHE_LINE_PAIR_SIZE == newlock->cell_stride)
+    ? CACHE_LINE_PAIR_SIZE : CACHE_LINE_SIZE;
+  size_t cell_bytes = (partition_count * newlock->cell_stride);
+  if (PRWLOCK_NUMA_NONE != newlock->numa.placement) {
+    newlock->numa.page_size = (size_t) sysconf(_SC_PAGESIZE);
+    cell_alignment = newlock->numa.page_size;
+    cell_bytes = ((cell_bytes + newlock->numa.page_size - 1)
+      & ~(newlock->numa.page_size - 1));
+  }
+  if (posix_memalign((void **) &newlock->cells, cell_alignment, cell_bytes)) {
+    printf("Failed to allocate %zd cells!\n", partition_count);
+    free(newlock);
+    return -1;
+  }
+
+  /* Placement comes first so that cell pages are touched on their node */
+  if (PRWLOCK_NUMA_NONE != newlock->numa.placement
+    && 0 != prwlock_numa_init(newlock)) {
+    free(newlock->cells);
+    free(newlock);
+    return -1;
+  }
+
+  prwlock_cells_init(newlock);
+#if defined(USE_LIBUV_RWLOCK)
+  (void) pthread_mutex_init(&newlock->async.mutex, NULL);
+#endif /* USE_LIBUV_RWLOCK */
+
+  if ((newlock->flags & PRWLOCK_FLAG_READER_BIAS)
+    && 0 != prwlock_bias_init(newlock)) {
+    partitioned_rwlock_destroy(newlock);
+    return -1;
+  }
+
+  if ((newlock->flags & PRWLOCK_FLAG_GLOBAL)
+    && 0 != prwlock_global_init(newlock)) {
+    partitioned_rwlock_destroy(newlock);
+    return -1;
+  }
+
+  if ((newlock->flags & PRWLOCK_FLAG_STATS)
+    && 0 != prwlock_stats_init(newlock)) {
+    partitioned_rwlock_destroy(newlock);
+    return -1;
+  }
+
+  if ((newlock->flags & PRWLOCK_FLAG_COHORT)
+    && 0 != prwlock_cohort_init(newlock)) {
+    partitioned_rwlock_destroy(newlock);
+    return -1;
+  }
+
+  if ((newlock->flags & PRWLOCK_FLAG_READ_LEASE)
+    && 0 != prwlock_lease_init(newlock)) {
+    partitioned_rwlock_destroy(newlock);
+    return -1;
+  }
+
+  if ((newlock->flags & PRWLOCK_FLAG_COMBINING)
+    && 0 != prwlock_combine_init(newlock)) {
+    partitioned_rwlock_destroy(newlock);
+    return -1;
+  }
+
+  if ((newlock->flags & PRWLOCK_FLAG_RESIZABLE)
+    && 0 != prwlock_resize_init(newlock)) {
+    partitioned_rwlock_destroy(newlock);
+    return -1;
+  }
+
+  if ((newlock->flags & PRWLOCK_FLAG_TRACE)
+    && 0 != prwlock_trace_init(newlock, attr)) {
+    partitioned_rwlock_destroy(newlock);
+    return -1;
+  }
+
+  if ((newlock->flags & PRWLOCK_FLAG_EPOCH)
+    && 0 != prwlock_epoch_init(newlock)) {
+    newlock->flags &= ~PRWLOCK_FLAG_EPOCH;
+    partitioned_rwlock_destroy(newlock);
+    return -1;
+  }
+
+  *rwlock = newlock;
+  return 0;
+} /* partitioned_rwlock_init_ex() */
+
+/* ------------------------------------------------------------------------- */
+
+/* Bytes of shared memory partitioned_rwlock_init_shared() needs */
+size_t
+partitioned_rwlock_shared_size (
+  size_t                        partition_count,
+  const partitioned_rwlock_attr_t *attr
+) {
+  partitioned_rwlock_t layout;
+
+  memset(&layout, 0, sizeof(layout));
+  prwlock_configure(&layout, partition_count, attr);
+  layout.cell_stride = prwlock_cell_stride(&layout,
+    (NULL != attr) ? attr->stride : PRWLOCK_STRIDE_CACHE_LINE);
+  return (prwlock_shared_cells_offset(&layout)
+    + (partition_count * layout.cell_stride));
+} /* partitioned_rwlock_shared_size() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Creates a lock whose header and cells live in region: memory shared
+ * between processes (a MAP_SHARED mapping, say), cache-line aligned and at
+ * least partitioned_rwlock_shared_size() bytes. Other processes reach it
+ * with partitioned_rwlock_attach_shared(). A NULL region maps an anonymous
+ * one, shared with children forked later. pthreads cells are made
+ * PTHREAD_PROCESS_SHARED and futexes are waited on across processes; the
+ * partition calls, inline ones included, run as on a private lock. Any
+ * policy, stride and cell data will do, but of the flags only optimistic
+ * reads, whose state lives wholly in the cells.
+ */
+int
+partitioned_rwlock_init_shared (
+  partitioned_rwlock_t        **rwlock,
+  void                         *region,
+  size_t                        region_size,
+  size_t                        partition_count,
+  const partitioned_rwlock_attr_t *attr
+) {
+#if defined(USE_LIBUV_RWLOCK)
+  /* uv_rwlock_t has no process-shared attribute */
+  (void) rwlock;
+  (void) region;
+  (void) region_size;
+  (void) partition_count;
+  (void) attr;
+  printf("libuv read-write locks cannot be process-shared!\n");
+  return -1;
+#else
+  partitioned_rwlock_t *newlock = NULL;
+  if (posix_memalign((void *) &newlock, CACHE_LINE_SIZE, sizeof(*newlock))) {
+    printf("Failed to allocate new lock structure!\n");
+    return -1;
+  }
+  memset(newlock, 0, sizeof(*newlock));
+
+  prwlock_configure(newlock, partition_count, attr);
+  if ((newlock->flags & ~PRWLOCK_SHARED_FLAGS)
+    || PRWLOCK_NUMA_NONE != newlock->numa.placement) {
+    printf("Process-shared locks support optimistic reads only, and no "
+      "placement!\n");
+    free(newlock);
+    return -1;
+  }
+  newlock->cell_stride = prwlock_cell_stride(newlock,
+    (NULL != attr) ? attr->stride : PRWLOCK_STRIDE_CACHE_LINE);
+  size_t cell_alignment = (CACHE_LINE_PAIR_SIZE == newlock->cell_stride)
+    ? CACHE_LINE_PAIR_SIZE : CACHE_LINE_SIZE;
+  size_t cells_offset = prwlock_shared_cells_offset(newlock);
+  size_t size = (cells_offset + (partition_count * newlock->cell_stride));
+
+  if (NULL == region) {
+    region = mmap(NULL, size, (PROT_READ | PROT_WRITE),
+      (MAP_SHARED | MAP_ANONYMOUS), -1, 0);
+    if (MAP_FAILED == region) {
+      printf("Failed to map %zu bytes of shared memory!\n", size);
+      free(newlock);
+      return -1;
+    }
+    region_size = size;
+    newlock->shared_mapped = 1;
+  } else if (region_size < size
+    || 0 != ((uintptr_t) region % cell_alignment)) {
+    printf("Shared region needs %zu bytes, %zu-byte aligned!\n", size,
+      cell_alignment);
+    free(newlock);
+    return -1;
+  }
+
+  prwlock_shared_t *shared = region;
+  atomic_store_explicit(&shared->magic, 0, memory_order_relaxed);
+  shared->backend = PRWLOCK_SHARED_BACKEND;
+  shared->cell_size = sizeof(partitioned_rwlock_cell_t);
+  shared->region_size = region_size;
+  shared->cells_offset = cells_offset;
+  shared->partition_count = partition_count;
+  shared->cell_stride = newlock->cell_stride;
+  shared->cell_data = newlock->cell_data;
+  shared->hash_seed = newlock->hash_seed;
+  shared->flags = newlock->flags;
+  shared->policy = newlock->policy;
+  shared->creator = getpid();
+
+  newlock->shared = shared;
+  newlock->shared_owner = 1;
+  newlock->cells = (partitioned_rwlock_cell_t *) ((char *) region
+    + cells_offset);
+  prwlock_cells_init(newlock);
+
+  atomic_store_explicit(&shared->magic, PRWLOCK_SHARED_MAGIC,
+    memory_order_release);
+  *rwlock = newlock;
+  return 0;
+#endif /* USE_LIBUV_RWLOCK */
+} /* partitioned_rwlock_init_shared() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * A handle on a lock that partitioned_rwlock_init_shared() made in region,
+ * as mapped into this process, wherever that is. Destroying the handle
+ * leaves the lock to its creator.
+ */
+int
+partitioned_rwlock_attach_shared (
+  partitioned_rwlock_t        **rwlock,
+  void                         *region
+) {
+  prwlock_shared_t *shared = region;
+
+  if (NULL == shared || PRWLOCK_SHARED_MAGIC != atomic_load_explicit(
+      &shared->magic, memory_order_acquire)
+    || PRWLOCK_SHARED_BACKEND != shared->backend
+    || sizeof(partitioned_rwlock_cell_t) != shared->cell_size) {
+    printf("Region holds no process-shared lock of this build!\n");
+    return -1;
+  }
+
+  partitioned_rwlock_t *newlock = NULL;
+  if (posix_memalign((void *) &newlock, CACHE_LINE_SIZE, sizeof(*newlock))) {
+    printf("Failed to allocate new lock structure!\n");
+    return -1;
+  }
+  memset(newlock, 0, sizeof(*newlock));
+
+  partitioned_rwlock_attr_t attr;
+  (void) partitioned_rwlock_attr_init(&attr);
+  attr.flags = shared->flags;
+  attr.policy = shared->policy;
+  attr.hash_seed = shared->hash_seed;
+  attr.cell_data = shared->cell_data;
+  prwlock_configure(newlock, shared->partition_count, &attr);
+  newlock->cell_stride = shared->cell_stride;
+  newlock->cells = (partitioned_rwlock_cell_t *) ((char *) region
+    + shared->cells_offset);
+  newlock->shared = shared;
+
+  *rwlock = newlock;
+  return 0;
+} /* partitioned_rwlock_attach_shared() */
+
+/* ------------------------------------------------------------------------- */
+
+int
+partitioned_rwlock_destroy (
+  partitioned_rwlock_t         *rwlock
+) {
+  if (NULL != rwlock->shared) {
+    prwlock_shared_detach(rwlock);
+    free(rwlock);
+    return 0;
+  }
+#if defined(USE_LIBUV_RWLOCK)
+  /* Loops still queued on the lock have to close their queues first */
+  if (NULL != rwlock->async.loops) {
+    return EBUSY;
+  }
+  free((void *) atomic_load(&rwlock->async.waiting));
+  (void) pthread_mutex_destroy(&rwlock->async.mutex);
+#endif /* USE_LIBUV_RWLOCK */
+  for (size_t ii = 0; ii < rwlock->partition_count; ++ii) {
+    prwlock_cell_destroy(rwlock, PRWLOCK_CELL(rwlock, ii));
+  }
+  prwlock_bias_destroy(rwlock);
+  prwlock_global_destroy(rwlock);
+  prwlock_stats_destroy(rwlock);
+  prwlock_cohort_destroy(rwlock);
+  prwlock_lease_destroy(rwlock);
+  prwlock_combine_destroy(rwlock);
+  prwlock_numa_destroy(rwlock);
+  prwlock_resize_destroy(rwlock);
+  prwlock_epoch_destroy(rwlock);
+  prwlock_trace_destroy(rwlock);
+  free(rwlock->cells);
+  free(rwlock);
+  return 0;
+} /* partitioned_rwlock_destroy() */
+
+/* ------------------------------------------------------------------------- */
+
+size_t
+partitioned_rwlock_get_partition_count (
+  partitioned_rwlock_t         *rwlock
+) {
+  return rwlock->partition_count;
+} /* partitioned_rwlock_get_partition_count() */
+
+/* ------------------------------------------------------------------------- */
+
+/* Bytes between neighbouring cells, as chosen by the stride attribute */
+size_t
+partitioned_rwlock_get_cell_stride (
+  partitioned_rwlock_t         *rwlock
+) {
+  return rwlock->cell_stride;
+} /* partitioned_rwlock_get_cell_stride() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * The partition's attr.cell_data bytes, 16-byte aligned, or NULL if none
+ * were asked for. What is kept there is the caller's to guard with the
+ * partition's lock.
+ */
+void *
+partitioned_rwlock_cell_data (
+  partitioned_rwlock_t         *rwlock,
+  const size_t                  partition
+) {
+  assert(NULL != rwlock);
+  assert(partition < rwlock->partition_count);
+
+  if (0 == rwlock->cell_data) {
+    return NULL;
+  }
+  return ((char *) PRWLOCK_CELL(rwlock, partition)
+    + PRWLOCK_CELL_DATA_OFFSET);
+} /* partitioned_rwlock_cell_data() */
+
+/* ------------------------------------------------------------------------- */
+
+int
+partitioned_rwlock_rdlock (
+  partitioned_rwlock_t         *rwlock,
+  const size_t                  partition
+) {
+  assert(NULL != rwlock);
+  assert(partition < rwlock->partition_count);
+
+  PRWLOCK_TRACE_SITE(rwlock);
+  return prwlock_partition_lock(rwlock, partition, PRWLOCK_MODE_READ,
+    PRWLOCK_DEADLINE_NONE);
+} /* partitioned_rwlock_rdlock() */
+
+/* ------------------------------------------------------------------------- */
+
+int
+partitioned_rwlock_tryrdlock (
+  partitioned_rwlock_t         *rwlock,
+  const size_t                  partition
+) {
+  assert(NULL != rwlock);
+  assert(partition < rwlock->partition_count);
+
+  PRWLOCK_TRACE_SITE(rwlock);
+  return prwlock_partition_lock(rwlock, partition, PRWLOCK_MODE_READ,
+    PRWLOCK_DEADLINE_NOW);
+} /* partitioned_rwlock_tryrdlock() */
+
+/* ------------------------------------------------------------------------- */
+
+int
+partitioned_rwlock_trywrlock (
+  partitioned_rwlock_t         *rwlock,
+  const size_t                  partition
+) {
+  assert(NULL != rwlock);
+  assert(partition < rwlock->partition_count);
+
+  PRWLOCK_TRACE_SITE(rwlock);
+  return prwlock_partition_lock(rwlock, partition, PRWLOCK_MODE_WRITE,
+    PRWLOCK_DEADLINE_NOW);
+} /* partitioned_rwlock_trywrlock() */
+
+/* ------------------------------------------------------------------------- */
+
+int
+partitioned_rwlock_wrlock (
+  partitioned_rwlock_t         *rwlock,
+  const size_t                  partition
+) {
+  assert(NULL != rwlock);
+  assert(partition < rwlock->partition_count);
+
+  PRWLOCK_TRACE_SITE(rwlock);
+  return prwlock_partition_lock(rwlock, partition, PRWLOCK_MODE_WRITE,
+    PRWLOCK_DEADLINE_NONE);
+} /* partitioned_rwlock_wrlock() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Timed locks give up with ETIMEDOUT once abstime, on CLOCK_MONOTONIC, has
+ * passed without the partition being taken, leaving nothing behind on it;
+ * a deadline already past still gets one attempt. The atomics backend
+ * parks with a timeout; libuv and phase-fair cells are polled instead.
+ */
+int
+partitioned_rwlock_timedrdlock (
+  partitioned_rwlock_t         *rwlock,
+  const size_t                  partition,
+  const struct timespec        *abstime
+) {
+  assert(NULL != rwlock);
+  assert(partition < rwlock->partition_count);
+
+  PRWLOCK_TRACE_SITE(rwlock);
+  if (!prwlock_timespec_valid(abstime)) {
+    return EINVAL;
+  }
+  return prwlock_partition_lock(rwlock, partition, PRWLOCK_MODE_READ,
+    prwlock_deadline(abstime));
+} /* partitioned_rwlock_timedrdlock() */
+
+/* ------------------------------------------------------------------------- */
+
+int
+partitioned_rwlock_timedwrlock (
+  partitioned_rwlock_t         *rwlock,
+  const size_t                  partition,
+  const struct timespec        *abstime
+) {
+  assert(NULL != rwlock);
+  assert(partition < rwlock->partition_count);
+
+  PRWLOCK_TRACE_SITE(rwlock);
+  if (!prwlock_timespec_valid(abstime)) {
+    return EINVAL;
+  }
+  return prwlock_partition_lock(rwlock, partition, PRWLOCK_MODE_WRITE,
+    prwlock_deadline(abstime));
+} /* partitioned_rwlock_timedwrlock() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * The deadline timeout_ns from now, for the timed calls. A request with a
+ * latency budget computes it once, so every lock it takes shares the one
+ * budget rather than each getting a fresh timeout.
+ */
+int
+partitioned_rwlock_deadline (
+  struct timespec              *abstime,
+  uint64_t                      timeout_ns
+) {
+  if (NULL == abstime) {
+    return EINVAL;
+  }
+
+  uint64_t now = prwlock_now_ns();
+  prwlock_timespec(((UINT64_MAX - now) < timeout_ns) ? UINT64_MAX
+    : (now + timeout_ns), abstime);
+  return 0;
+} /* partitioned_rwlock_deadline() */
+
+/* ------------------------------------------------------------------------- */
+
+int
+partitioned_rwlock_unlock (
+  partitioned_rwlock_t         *rwlock,
+  const size_t                  partition
+) {
+  assert(NULL != rwlock);
+  assert(partition < rwlock->partition_count);
+
+  return prwlock_partition_unlock(rwlock, partition, PRWLOCK_UNLOCK_INFER);
+} /* partitioned_rwlock_unlock() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Mode-specific releases, which must match how the partition is held. They
+ * skip working the mode out, and so read nothing another holder may have
+ * written; an upgraded hold is a write hold until downgraded.
+ */
+int
+partitioned_rwlock_rdunlock (
+  partitioned_rwlock_t         *rwlock,
+  const size_t                  partition
+) {
+  assert(NULL != rwlock);
+  assert(partition < rwlock->partition_count);
+
+  return prwlock_partition_unlock(rwlock, partition, 0);
+} /* partitioned_rwlock_rdunlock() */
+
+/* ------------------------------------------------------------------------- */
+
+int
+partitioned_rwlock_wrunlock (
+  partitioned_rwlock_t         *rwlock,
+  const size_t                  partition
+) {
+  assert(NULL != rwlock);
+  assert(partition < rwlock->partition_count);
+
+  return prwlock_partition_unlock(rwlock, partition, 1);
+} /* partitioned_rwlock_wrunlock() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Upgradable read lock (PRWLOCK_FLAG_UPGRADABLE): shares the partition with
+ * plain readers, but only one upgradable holder is let in at a time, so an
+ * upgrade never has to wait for another upgrade. Released by unlock(), or
+ * converted by upgrade().
+ */
+int
+partitioned_rwlock_uplock (
+  partitioned_rwlock_t         *rwlock,
+  const size_t                  partition
+) {
+  assert(NULL != rwlock);
+  assert(partition < rwlock->partition_count);
+
+  PRWLOCK_TRACE_SITE(rwlock);
+  if (!(rwlock->flags & PRWLOCK_FLAG_UPGRADABLE)) {
+    return EINVAL;
+  }
+  return prwlock_partition_lock(rwlock, partition, PRWLOCK_MODE_UPGRADABLE,
+    PRWLOCK_DEADLINE_NONE);
+} /* partitioned_rwlock_uplock() */
+
+/* ------------------------------------------------------------------------- */
+
+int
+partitioned_rwlock_tryuplock (
+  partitioned_rwlock_t         *rwlock,
+  const size_t                  partition
+) {
+  assert(NULL != rwlock);
+  assert(partition < rwlock->partition_count);
+
+  PRWLOCK_TRACE_SITE(rwlock);
+  if (!(rwlock->flags & PRWLOCK_FLAG_UPGRADABLE)) {
+    return EINVAL;
+  }
+  return prwlock_partition_lock(rwlock, partition, PRWLOCK_MODE_UPGRADABLE,
+    PRWLOCK_DEADLINE_NOW);
+} /* partitioned_rwlock_tryuplock() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Converts the caller's upgradable hold into a write hold once the other
+ * readers have left; readers arriving meanwhile wait, unless the policy
+ * prefers readers. Nothing the caller read can change in between. Returns
+ * EPERM if the caller holds no upgradable lock on the partition.
+ */
+int
+partitioned_rwlock_upgrade (
+  partitioned_rwlock_t         *rwlock,
+  const size_t                  partition
+) {
+  assert(NULL != rwlock);
+  assert(partition < rwlock->partition_count);
+
+  if (!(rwlock->flags & PRWLOCK_FLAG_UPGRADABLE)) {
+    return EINVAL;
+  }
+  return prwlock_partition_upgrade(rwlock, partition,
+    PRWLOCK_DEADLINE_NONE);
+} /* partitioned_rwlock_upgrade() */
+
+/* ------------------------------------------------------------------------- */
+
+/* As upgrade(), but returns EBUSY, still read-locked, while readers remain */
+int
+partitioned_rwlock_tryupgrade (
+  partitioned_rwlock_t         *rwlock,
+  const size_t                  partition
+) {
+  assert(NULL != rwlock);
+  assert(partition < rwlock->partition_count);
+
+  if (!(rwlock->flags & PRWLOCK_FLAG_UPGRADABLE)) {
+    return EINVAL;
+  }
+  return prwlock_partition_upgrade(rwlock, partition,
+    PRWLOCK_DEADLINE_NOW);
+} /* partitioned_rwlock_tryupgrade() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Turns the caller's write lock, however taken, into a plain read lock
+ * without letting another writer in first. An upgraded holder gives up the
+ * upgrader token as well.
+ */
+int
+partitioned_rwlock_downgrade (
+  partitioned_rwlock_t         *rwlock,
+  const size_t                  partition
+) {
+  assert(NULL != rwlock);
+  assert(partition < rwlock->partition_count);
+
+  if (!(rwlock->flags & PRWLOCK_FLAG_UPGRADABLE)) {
+    return EINVAL;
+  }
+
+  partitioned_rwlock_cell_t *cell = PRWLOCK_CELL(rwlock, partition);
+  int owned = prwlock_upgrader_owned(cell);
+  if (!atomic_load_explicit(&cell->write_held, memory_order_relaxed)
+    || (prwlock_upgrader_emulated(rwlock) && !owned)) {
+    return EPERM;
+  }
+
+  atomic_store_explicit(&cell->write_held, 0, memory_order_relaxed);
+  if (rwlock->flags & PRWLOCK_FLAG_OPTIMISTIC) {
+    prwlock_sequence_end(&cell->sequence);
+  }
+  int rc = prwlock_cell_downgrade(rwlock, cell);
+
+  /* A holder of partitions is never kept out, so this cannot block */
+  if (rwlock->flags & PRWLOCK_FLAG_GLOBAL) {
+    (void) prwlock_global_enter(rwlock, PRWLOCK_MODE_READ,
+      PRWLOCK_DEADLINE_NONE);
+    prwlock_global_exit(rwlock, PRWLOCK_MODE_WRITE);
+  }
+  if (owned) {
+    prwlock_upgrader_release(rwlock, cell);
+  }
+  prwlock_async_notify(rwlock, partition);
+  return rc;
+} /* partitioned_rwlock_downgrade() */
+
+/* ------------------------------------------------------------------------- */
+
+int
+partitioned_rwlock_rdlock_many (
+  partitioned_rwlock_t         *rwlock,
+  const size_t                 *partitions,
+  size_t                        count
+) {
+  PRWLOCK_TRACE_SITE(rwlock);
+  return prwlock_many_lock(rwlock, partitions, NULL, PRWLOCK_MODE_READ, count,
+    PRWLOCK_DEADLINE_NONE);
+} /* partitioned_rwlock_rdlock_many() */
+
+/* ------------------------------------------------------------------------- */
+
+int
+partitioned_rwlock_tryrdlock_many (
+  partitioned_rwlock_t         *rwlock,
+  const size_t                 *partitions,
+  size_t                        count
+) {
+  PRWLOCK_TRACE_SITE(rwlock);
+  return prwlock_many_lock(rwlock, partitions, NULL, PRWLOCK_MODE_READ, count,
+    PRWLOCK_DEADLINE_NOW);
+} /* partitioned_rwlock_tryrdlock_many() */
+
+/* ------------------------------------------------------------------------- */
+
+int
+partitioned_rwlock_wrlock_many (
+  partitioned_rwlock_t         *rwlock,
+  const size_t                 *partitions,
+  size_t                        count
+) {
+  PRWLOCK_TRACE_SITE(rwlock);
+  return prwlock_many_lock(rwlock, partitions, NULL, PRWLOCK_MODE_WRITE,
+    count, PRWLOCK_DEADLINE_NONE);
+} /* partitioned_rwlock_wrlock_many() */
+
+/* ------------------------------------------------------------------------- */
+
+int
+partitioned_rwlock_trywrlock_many (
+  partitioned_rwlock_t         *rwlock,
+  const size_t                 *partitions,
+  size_t                        count
+) {
+  PRWLOCK_TRACE_SITE(rwlock);
+  return prwlock_many_lock(rwlock, partitions, NULL, PRWLOCK_MODE_WRITE,
+    count, PRWLOCK_DEADLINE_NOW);
+} /* partitioned_rwlock_trywrlock_many() */
+
+/* ------------------------------------------------------------------------- */
+
+int
+partitioned_rwlock_lock_many (
+  partitioned_rwlock_t         *rwlock,
+  const partitioned_rwlock_request_t *requests,
+  size_t                        count
+) {
+  PRWLOCK_TRACE_SITE(rwlock);
+  return prwlock_many_lock(rwlock, NULL, requests, PRWLOCK_MODE_READ, count,
+    PRWLOCK_DEADLINE_NONE);
+} /* partitioned_rwlock_lock_many() */
+
+/* ------------------------------------------------------------------------- */
+
+int
+partitioned_rwlock_trylock_many (
+  partitioned_rwlock_t         *rwlock,
+  const partitioned_rwlock_request_t *requests,
+  size_t                        count
+) {
+  PRWLOCK_TRACE_SITE(rwlock);
+  return prwlock_many_lock(rwlock, NULL, requests, PRWLOCK_MODE_READ, count,
+    PRWLOCK_DEADLINE_NOW);
+} /* partitioned_rwlock_trylock_many() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Releases a set taken by any of the *_many calls; the mode each partition
+ * is held in is recovered by the unlock itself, so mixed-mode sets pass the
+ * same partition indices. Duplicates are released once.
+ */
+int
+partitioned_rwlock_unlock_many (
+  partitioned_rwlock_t         *rwlock,
+  const size_t                 *partitions,
+  size_t                        count
+) {
+  partitioned_rwlock_request_t local[PRWLOCK_MANY_STACK_COUNT];
+  partitioned_rwlock_request_t *set = local;
+  int rc = 0;
+
+  assert(NULL != rwlock);
+  assert(0 == count || NULL != partitions);
+
+  if (2 >= count) {
+    if (0 < count) {
+      rc = partitioned_rwlock_unlock(rwlock, partitions[0]);
+    }
+    if (2 == count && partitions[0] != partitions[1]) {
+      int next = partitioned_rwlock_unlock(rwlock, partitions[1]);
+      rc = (0 != rc) ? rc : next;
+    }
+    return rc;
+  }
+
+  /* Releasing must not fail for want of memory; dedupe the slow way instead */
+  if (PRWLOCK_MANY_STACK_COUNT < count
+    && NULL == (set = malloc(count * sizeof(*set)))) {
+    for (size_t ii = 0; ii < count; ++ii) {
+      size_t jj = 0;
+
+      while (jj < ii && partitions[jj] != partitions[ii]) {
+        ++jj;
+      }
+      if (jj == ii) {
+        int next = partitioned_rwlock_unlock(rwlock, partitions[ii]);
+        rc = (0 != rc) ? rc : next;
+      }
+    }
+    return rc;
+  }
+  for (size_t ii = 0; ii < count; ++ii) {
+    set[ii] = prwlock_many_request(partitions, NULL, PRWLOCK_MODE_READ, ii);
+  }
+  count = prwlock_many_normalize(set, count);
+
+  while (0 < count--) {
+    int next = partitioned_rwlock_unlock(rwlock, set[count].partition);
+    rc = (0 != rc) ? rc : next;
+  }
+
+  if (local != set) {
+    free(set);
+  }
+  return rc;
+} /* partitioned_rwlock_unlock_many() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Optimistic reads (PRWLOCK_FLAG_OPTIMISTIC) write no shared memory: take a
+ * stamp with read_begin(), copy what is needed out of the partition, and
+ * keep the copy only if read_validate() then succeeds. Writers may change
+ * the data under the reader in the meantime, so the copy must not be acted
+ * on (pointers followed, sizes trusted) before validation. read_begin()
+ * returns EBUSY while the partition is write-held; the caller can retry or
+ * fall back to rdlock().
+ */
+int
+partitioned_rwlock_read_begin (
+  partitioned_rwlock_t         *rwlock,
+  const size_t                  partition,
+  uint64_t                     *stamp
+) {
+  assert(NULL != rwlock);
+  assert(partition < rwlock->partition_count);
+  assert(NULL != stamp);
+
+  if (!(rwlock->flags & PRWLOCK_FLAG_OPTIMISTIC)) {
+    return EINVAL;
+  }
+
+  *stamp = prwlock_sequence_stamp(rwlock, partition);
+  /* Odd in either half means a writer is in */
+  return (*stamp & ((UINT64_C(1) << 32) | 1)) ? EBUSY : 0;
+} /* partitioned_rwlock_read_begin() */
+
+/* ------------------------------------------------------------------------- */
+
+/* 0 if no writer has held the partition since read_begin(), else EAGAIN */
+int
+partitioned_rwlock_read_validate (
+  partitioned_rwlock_t         *rwlock,
+  const size_t                  partition,
+  uint64_t                      stamp
+) {
+  assert(NULL != rwlock);
+  assert(partition < rwlock->partition_count);
+
+  if (!(rwlock->flags & PRWLOCK_FLAG_OPTIMISTIC)) {
+    return EINVAL;
+  }
+
+  /* Orders the caller's reads of the data before the second look */
+  atomic_thread_fence(memory_order_acquire);
+  return (stamp == prwlock_sequence_stamp(rwlock, partition)) ? 0 : EAGAIN;
+} /* partitioned_rwlock_read_validate() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Epoch read sections (PRWLOCK_FLAG_EPOCH). Entering stores the current
+ * epoch to the thread's own slot and, where membarrier(2) is available,
+ * takes only a compiler barrier, so readers share no cache line with one
+ * another or with writers. Sections nest, and take no partition lock: what
+ * they read must be published atomically by writers, and reclaimed through
+ * synchronize() or defer(). EAGAIN if there are more threads than slots.
+ */
+int
+partitioned_rwlock_epoch_enter (
+  partitioned_rwlock_t         *rwlock
+) {
+  assert(NULL != rwlock);
+
+  if (!(rwlock->flags & PRWLOCK_FLAG_EPOCH)) {
+    return EINVAL;
+  }
+
+  prwlock_epoch_slot_t *slot = prwlock_epoch_slot(rwlock, 1);
+  if (NULL == slot) {
+    return EAGAIN;
+  }
+  if (0 == slot->nesting++) {
+    atomic_store_explicit(&slot->value, atomic_load_explicit(
+      &rwlock->epoch.epoch, memory_order_acquire), memory_order_relaxed);
+    if (rwlock->epoch.membarrier) {
+      atomic_signal_fence(memory_order_seq_cst);
+    } else {
+      atomic_thread_fence(memory_order_seq_cst);
+    }
+  }
+  return 0;
+} /* partitioned_rwlock_epoch_enter() */
+
+/* ------------------------------------------------------------------------- */
+
+int
+partitioned_rwlock_epoch_exit (
+  partitioned_rwlock_t         *rwlock
+) {
+  assert(NULL != rwlock);
+
+  if (!(rwlock->flags & PRWLOCK_FLAG_EPOCH)) {
+    return EINVAL;
+  }
+
+  prwlock_epoch_slot_t *slot = prwlock_epoch_slot(rwlock, 0);
+  if (NULL == slot || 0 == slot->nesting) {
+    return EPERM;
+  }
+  if (0 == --slot->nesting) {
+    atomic_store_explicit(&slot->value, 0, memory_order_release);
+  }
+  return 0;
+} /* partitioned_rwlock_epoch_exit() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Waits for a grace period: every epoch section under way when it was
+ * called has ended, so what was unpublished before can be freed. EDEADLK
+ * from inside a section of the caller's own.
+ */
+int
+partitioned_rwlock_synchronize (
+  partitioned_rwlock_t         *rwlock
+) {
+  assert(NULL != rwlock);
+
+  if (!(rwlock->flags & PRWLOCK_FLAG_EPOCH)) {
+    return EINVAL;
+  }
+
+  prwlock_epoch_slot_t *slot = prwlock_epoch_slot(rwlock, 0);
+  if (NULL != slot && 0 < slot->nesting) {
+    return EDEADLK;
+  }
+  prwlock_epoch_synchronize(rwlock);
+  return 0;
+} /* partitioned_rwlock_synchronize() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Leaves reclaim(arg) to run once the sections under way have ended, so a
+ * writer need not wait. Every PRWLOCK_EPOCH_DEFER_BATCH deferrals, the
+ * deferring thread (unless inside a section) waits out one grace period
+ * for the lot and runs them. Without memory for the request, it waits and
+ * reclaims there and then, or fails with ENOMEM inside a section.
+ */
+int
+partitioned_rwlock_defer (
+  partitioned_rwlock_t         *rwlock,
+  void                        (*reclaim) (void *),
+  void                         *arg
+) {
+  assert(NULL != rwlock);
+  assert(NULL != reclaim);
+
+  if (!(rwlock->flags & PRWLOCK_FLAG_EPOCH)) {
+    return EINVAL;
+  }
+
+  prwlock_epoch_slot_t *slot = prwlock_epoch_slot(rwlock, 0);
+  int reading = (NULL != slot && 0 < slot->nesting);
+  prwlock_epoch_deferred_t *deferred = malloc(sizeof(*deferred));
+
+  if (NULL == deferred) {
+    if (reading) {
+      return ENOMEM;
+    }
+    prwlock_epoch_synchronize(rwlock);
+    reclaim(arg);
+    return 0;
+  }
+  deferred->reclaim = reclaim;
+  deferred->arg = arg;
+
+  pthread_mutex_lock(&rwlock->epoch.mutex);
+  deferred->next = rwlock->epoch.deferred;
+  rwlock->epoch.deferred = deferred;
+  if (reading || PRWLOCK_EPOCH_DEFER_BATCH > ++rwlock->epoch.deferred_count) {
+    pthread_mutex_unlock(&rwlock->epoch.mutex);
+    return 0;
+  }
+  rwlock->epoch.deferred = NULL;
+  rwlock->epoch.deferred_count = 0;
+  pthread_mutex_unlock(&rwlock->epoch.mutex);
+
+  prwlock_epoch_synchronize(rwlock);
+  prwlock_epoch_run(deferred);
+  return 0;
+} /* partitioned_rwlock_defer() */
+
+/* ------------------------------------------------------------------------- */
+
+/* Waits out a grace period and runs every reclamation deferred before */
+int
+partitioned_rwlock_reclaim (
+  partitioned_rwlock_t         *rwlock
+) {
+  assert(NULL != rwlock);
+
+  if (!(rwlock->flags & PRWLOCK_FLAG_EPOCH)) {
+    return EINVAL;
+  }
+
+  prwlock_epoch_slot_t *slot = prwlock_epoch_slot(rwlock, 0);
+  if (NULL != slot && 0 < slot->nesting) {
+    return EDEADLK;
+  }
+
+  pthread_mutex_lock(&rwlock->epoch.mutex);
+  prwlock_epoch_deferred_t *deferred = rwlock->epoch.deferred;
+  rwlock->epoch.deferred = NULL;
+  rwlock->epoch.deferred_count = 0;
+  pthread_mutex_unlock(&rwlock->epoch.mutex);
+
+  prwlock_epoch_synchronize(rwlock);
+  prwlock_epoch_run(deferred);
+  return 0;
+} /* partitioned_rwlock_reclaim() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Combining write (PRWLOCK_FLAG_COMBINING): fn(rwlock, partition, arg) is
+ * run once with the partition write-locked, by this thread or by another
+ * combining writer, and the call returns once it has been. A caller that
+ * gets the partition at once, or finds it held by anything but a
+ * combiner, takes it as wrlock() would and combines; otherwise it publishes
+ * the operation and waits, either for it to be run or to be elected to
+ * combine next. The operation must not lock the partition itself, nor
+ * rely on the thread it runs on. The caller must not hold the partition.
+ */
+int
+partitioned_rwlock_combine (
+  partitioned_rwlock_t         *rwlock,
+  const size_t                  partition,
+  partitioned_rwlock_combine_fn fn,
+  void                         *arg
+) {
+  assert(NULL != rwlock);
+  assert(partition < rwlock->partition_count);
+
+  if (!(rwlock->flags & PRWLOCK_FLAG_COMBINING) || NULL == fn) {
+    return EINVAL;
+  }
+
+  PRWLOCK_TRACE_SITE(rwlock);
+  prwlock_combine_t *combine = &rwlock->combine[partition];
+  int rc = prwlock_partition_lock(rwlock, partition, PRWLOCK_MODE_WRITE,
+    PRWLOCK_DEADLINE_NOW);
+
+  if (EBUSY == rc && !atomic_load(&combine->active)) {
+    rc = prwlock_partition_lock(rwlock, partition, PRWLOCK_MODE_WRITE,
+      PRWLOCK_DEADLINE_NONE);
+  } else if (EBUSY == rc) {
+    prwlock_combine_op_t op;
+
+    op.fn = fn;
+    op.arg = arg;
+    atomic_init(&op.state, PRWLOCK_COMBINE_WAITING);
+    op.next = atomic_load_explicit(&combine->pending, memory_order_relaxed);
+    while (!atomic_compare_exchange_weak(&combine->pending, &op.next, &op));
+
+    /* Either the combiner's last look at the list sees op, or this sees 0 */
+    if (atomic_load(&combine->active)
+      && PRWLOCK_COMBINE_DONE == (~PRWLOCK_COMBINE_PARKED
+        & prwlock_pft_await(rwlock, &op.state, ~PRWLOCK_COMBINE_PARKED,
+          PRWLOCK_COMBINE_WAITING, 0, PRWLOCK_COMBINE_PARKED))) {
+      return 0;
+    }
+
+    /*
+     * op is published, so this must not fail; nor can it, as whoever
+     * published or combined before held the partition and this thread
+     * does not.
+     */
+    rc = prwlock_partition_lock(rwlock, partition, PRWLOCK_MODE_WRITE,
+      PRWLOCK_DEADLINE_NONE);
+    if (0 == rc) {
+      prwlock_combine_run(rwlock, partition, NULL, NULL);
+      return prwlock_partition_unlock(rwlock, partition, 1);
+    }
+    return rc;
+  }
+
+  if (0 != rc) {
+    return rc;
+  }
+  prwlock_combine_run(rwlock, partition, fn, arg);
+  return prwlock_partition_unlock(rwlock, partition, 1);
+} /* partitioned_rwlock_combine() */
+
+/* ------------------------------------------------------------------------- */
+
+size_t
+partitioned_rwlock_partition (
+  partitioned_rwlock_t         *rwlock,
+  const void                   *key,
+  size_t                        length
+) {
+  assert(NULL != rwlock);
+  assert(NULL != key || 0 == length);
+
+  return prwlock_hash_reduce(rwlock,
+    prwlock_hash_bytes(key, length, rwlock->hash_seed));
+} /* partitioned_rwlock_partition() */
+
+/* ------------------------------------------------------------------------- */
+
+void
+partitioned_rwlock_partition_many (
+  partitioned_rwlock_t         *rwlock,
+  const void *const            *keys,
+  const size_t                 *lengths,
+  size_t                        count,
+  size_t                       *partitions
+) {
+  assert(NULL != rwlock);
+  assert(0 == count || (NULL != keys && NULL != lengths
+    && NULL != partitions));
+
+  for (size_t ii = 0; ii < count; ++ii) {
+    partitions[ii] = prwlock_hash_reduce(rwlock,
+      prwlock_hash_bytes(keys[ii], lengths[ii], rwlock->hash_seed));
+  }
+} /* partitioned_rwlock_partition_many() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Maps integer keys (which hash differently from their bytes). The loop is
+ * unrolled four wide so the independent multiplies overlap; x86-64 has no
+ * 64x64->128 vector multiply to do better with.
+ */
+void
+partitioned_rwlock_partition_u64 (
+  partitioned_rwlock_t         *rwlock,
+  const uint64_t               *keys,
+  size_t                        count,
+  size_t                       *partitions
+) {
+  size_t ii = 0;
+
+  assert(NULL != rwlock);
+  assert(0 == count || (NULL != keys && NULL != partitions));
+
+  uint64_t seed = rwlock->hash_seed;
+
+  for (; (ii + 4) <= count; ii += 4) {
+    uint64_t hash0 = prwlock_hash_u64(keys[ii], seed);
+    uint64_t hash1 = prwlock_hash_u64(keys[ii + 1], seed);
+    uint64_t hash2 = prwlock_hash_u64(keys[ii + 2], seed);
+    uint64_t hash3 = prwlock_hash_u64(keys[ii + 3], seed);
+
+    partitions[ii] = prwlock_hash_reduce(rwlock, hash0);
+    partitions[ii + 1] = prwlock_hash_reduce(rwlock, hash1);
+    partitions[ii + 2] = prwlock_hash_reduce(rwlock, hash2);
+    partitions[ii + 3] = prwlock_hash_reduce(rwlock, hash3);
+  }
+  for (; ii < count; ++ii) {
+    partitions[ii] = prwlock_hash_reduce(rwlock,
+      prwlock_hash_u64(keys[ii], seed));
+  }
+} /* partitioned_rwlock_partition_u64() */
+
+/* ------------------------------------------------------------------------- */
+
+int
+partitioned_rwlock_rdlock_key (
+  partitioned_rwlock_t         *rwlock,
+  const void                   *key,
+  size_t                        length,
+  size_t                       *partition
+) {
+  PRWLOCK_TRACE_SITE(rwlock);
+  return prwlock_key_lock(rwlock, key, length, PRWLOCK_MODE_READ,
+    PRWLOCK_DEADLINE_NONE, partition);
+} /* partitioned_rwlock_rdlock_key() */
+
+/* ------------------------------------------------------------------------- */
+
+int
+partitioned_rwlock_tryrdlock_key (
+  partitioned_rwlock_t         *rwlock,
+  const void                   *key,
+  size_t                        length,
+  size_t                       *partition
+) {
+  PRWLOCK_TRACE_SITE(rwlock);
+  return prwlock_key_lock(rwlock, key, length, PRWLOCK_MODE_READ,
+    PRWLOCK_DEADLINE_NOW, partition);
+} /* partitioned_rwlock_tryrdlock_key() */
+
+/* ------------------------------------------------------------------------- */
+
+int
+partitioned_rwlock_wrlock_key (
+  partitioned_rwlock_t         *rwlock,
+  const void                   *key,
+  size_t                        length,
+  size_t                       *partition
+) {
+  PRWLOCK_TRACE_SITE(rwlock);
+  return prwlock_key_lock(rwlock, key, length, PRWLOCK_MODE_WRITE,
+    PRWLOCK_DEADLINE_NONE, partition);
+} /* partitioned_rwlock_wrlock_key() */
+
+/* ------------------------------------------------------------------------- */
+
+int
+partitioned_rwlock_trywrlock_key (
+  partitioned_rwlock_t         *rwlock,
+  const void                   *key,
+  size_t                        length,
+  size_t                       *partition
+) {
+  PRWLOCK_TRACE_SITE(rwlock);
+  return prwlock_key_lock(rwlock, key, length, PRWLOCK_MODE_WRITE,
+    PRWLOCK_DEADLINE_NOW, partition);
+} /* partitioned_rwlock_trywrlock_key() */
+
+/* ------------------------------------------------------------------------- */
+
+int
+partitioned_rwlock_unlock_key (
+  partitioned_rwlock_t         *rwlock,
+  const void                   *key,
+  size_t                        length
+) {
+  if (rwlock->flags & PRWLOCK_FLAG_RESIZABLE) {
+    return prwlock_resize_unlock(rwlock,
+      prwlock_hash_bytes(key, length, rwlock->hash_seed));
+  }
+  return prwlock_partition_unlock(rwlock,
+    partitioned_rwlock_partition(rwlock, key, length), PRWLOCK_UNLOCK_INFER);
+} /* partitioned_rwlock_unlock_key() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Changes the number of partitions of a PRWLOCK_FLAG_RESIZABLE lock while
+ * it stays in use. The new table is published first; then each old
+ * partition in turn is write-locked, which waits out its holders, marked
+ * as moved, and released, after which its keys lock in the new table. Only
+ * one old partition is ever blocked at a time. The old table is freed once
+ * no key operation can still be looking at it. With power-of-two counts,
+ * doubling splits each partition p into p and p + count. The caller must
+ * not hold any partition of the lock. Returns EINVAL if the lock is not
+ * resizable or partition_count is 0, or ENOMEM.
+ */
+int
+partitioned_rwlock_resize (
+  partitioned_rwlock_t         *rwlock,
+  size_t                        partition_count
+) {
+  assert(NULL != rwlock);
+
+  if (!(rwlock->flags & PRWLOCK_FLAG_RESIZABLE) || 0 == partition_count) {
+    return EINVAL;
+  }
+
+  int rc = pthread_rwlock_wrlock(&rwlock->resize.gate);
+  if (0 != rc) {
+    return rc;
+  }
+
+  prwlock_table_t *previous = atomic_load(&rwlock->resize.table);
+  if (partition_count == previous->partition_count) {
+    (void) pthread_rwlock_unlock(&rwlock->resize.gate);
+    return 0;
+  }
+  prwlock_table_t *table = prwlock_table_create(rwlock, partition_count,
+    previous);
+  if (NULL == table) {
+    (void) pthread_rwlock_unlock(&rwlock->resize.gate);
+    return ENOMEM;
+  }
+  atomic_store(&rwlock->resize.table, table);
+
+  for (size_t ii = 0; ii < previous->partition_count; ++ii) {
+    partitioned_rwlock_cell_t *cell = PRWLOCK_TABLE_CELL(rwlock, previous, ii);
+
+    (void) prwlock_cell_wrlock(rwlock, cell);
+    atomic_store(&table->migrated[ii], 1);
+    (void) prwlock_cell_unlock(rwlock, cell);
+  }
+  atomic_store(&table->previous, NULL);
+
+  /* Only the index-based calls read these, and they may not race a resize */
+  rwlock->partition_count = table->partition_count;
+  rwlock->partition_mask = table->partition_mask;
+  rwlock->cells = table->cells;
+
+  prwlock_resize_synchronize(rwlock);
+  prwlock_table_free(rwlock, previous);
+  free(table->migrated);
+  table->migrated = NULL;
+  (void) pthread_rwlock_unlock(&rwlock->resize.gate);
+  return 0;
+} /* partitioned_rwlock_resize() */
+
+/* ------------------------------------------------------------------------- */
+
+int
+partitioned_rwlock_numa_node_count (
+  void
+) {
+  return prwlock_numa_node_count();
+} /* partitioned_rwlock_numa_node_count() */
+
+/* ------------------------------------------------------------------------- */
+
+int
+partitioned_rwlock_numa_current_node (
+  void
+) {
+  return prwlock_numa_current_node();
+} /* partitioned_rwlock_numa_current_node() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Returns the node a partition's cell was placed on, or -1 if the lock was
+ * created without placement or the kernel chooses (interleaving).
+ */
+int
+partitioned_rwlock_partition_node (
+  partitioned_rwlock_t         *rwlock,
+  size_t                        partition
+) {
+  assert(NULL != rwlock);
+  assert(partition < rwlock->partition_count);
+
+  if (NULL == rwlock->numa.page_nodes) {
+    return -1;
+  }
+  return rwlock->numa.page_nodes[(partition * rwlock->cell_stride)
+    / rwlock->numa.page_size];
+} /* partitioned_rwlock_partition_node() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Moves the cells of partitions [first, first + count) to a node, for
+ * partitions mostly used by threads running there. Whole pages move, so
+ * neighbouring partitions on the same pages move with them. Returns 0 or
+ * an errno value; EINVAL if the lock was created without placement.
+ */
+int
+partitioned_rwlock_numa_bind (
+  partitioned_rwlock_t         *rwlock,
+  size_t                        first,
+  size_t                        count,
+  int                           node
+) {
+  assert(NULL != rwlock);
+
+  prwlock_numa_t *numa = &rwlock->numa;
+  if (NULL == numa->page_nodes || 0 == count
+    || first >= rwlock->partition_count
+    || count > (rwlock->partition_count - first)
+    || 0 > node || node >= prwlock_numa_node_count()) {
+    return EINVAL;
+  }
+
+  size_t first_page = ((first * rwlock->cell_stride) / numa->page_size);
+  size_t last_page = ((((first + count) * rwlock->cell_stride) - 1)
+    / numa->page_size);
+  if (1 < prwlock_numa_node_count()) {
+    int rc = prwlock_numa_mbind(
+      ((char *) rwlock->cells + (first_page * numa->page_size)),
+      (((last_page - first_page) + 1) * numa->page_size),
+      PRWLOCK_MPOL_PREFERRED, node);
+    if (0 != rc) {
+      return rc;
+    }
+  }
+  for (size_t ii = first_page; ii <= last_page; ++ii) {
+    numa->page_nodes[ii] = node;
+  }
+  return 0;
+} /* partitioned_rwlock_numa_bind() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Sums the shards into one entry per partition, for up to count partitions.
+ * Counters are read without stopping anyone, so a snapshot taken under load
+ * is approximate. Returns the number of entries filled, or -1 if the lock
+ * was created without PRWLOCK_FLAG_STATS.
+ */
+int
+partitioned_rwlock_stats_snapshot (
+  partitioned_rwlock_t         *rwlock,
+  partitioned_rwlock_stats_t   *stats,
+  size_t                        count
+) {
+  assert(NULL != rwlock);
+  assert(0 == count || NULL != stats);
+
+  if (NULL == rwlock->stats) {
+    return -1;
+  }
+  if (count > rwlock->partition_count) {
+    count = rwlock->partition_count;
+  }
+
+  memset(stats, 0, (count * sizeof(*stats)));
+  for (size_t ii = 0; ii < count; ++ii) {
+    partitioned_rwlock_stats_t *entry = &stats[ii];
+
+    entry->partition = ii;
+    for (size_t shard = 0; shard < PRWLOCK_STATS_SHARDS; ++shard) {
+      prwlock_stats_cell_t *cell =
+        &rwlock->stats[(shard * rwlock->partition_count) + ii];
+
+      entry->read_acquires += atomic_load_explicit(&cell->read_acquires,
+        memory_order_relaxed);
+      entry->write_acquires += atomic_load_explicit(&cell->write_acquires,
+        memory_order_relaxed);
+      entry->try_failures += atomic_load_explicit(&cell->try_failures,
+        memory_order_relaxed);
+      entry->timeouts += atomic_load_explicit(&cell->timeouts,
+        memory_order_relaxed);
+      entry->contended += atomic_load_explicit(&cell->contended,
+        memory_order_relaxed);
+      entry->wait_ns += atomic_load_explicit(&cell->wait_ns,
+        memory_order_relaxed);
+      entry->hold_ns += atomic_load_explicit(&cell->hold_ns,
+        memory_order_relaxed);
+      for (size_t bucket = 0; bucket < PRWLOCK_STATS_BUCKETS; ++bucket) {
+        entry->wait_histogram[bucket] += atomic_load_explicit(
+          &cell->wait_histogram[bucket], memory_order_relaxed);
+        entry->hold_histogram[bucket] += atomic_load_explicit(
+          &cell->hold_histogram[bucket], memory_order_relaxed);
+      }
+    }
+  }
+  return (int) count;
+} /* partitioned_rwlock_stats_snapshot() */
+
+/* ------------------------------------------------------------------------- */
+
+int
+partitioned_rwlock_stats_reset (
+  partitioned_rwlock_t         *rwlock
+) {
+  assert(NULL != rwlock);
+
+  if (NULL == rwlock->stats) {
+    return -1;
+  }
+  for (size_t ii = 0; ii < (PRWLOCK_STATS_SHARDS * rwlock->partition_count);
+    ++ii) {
+    prwlock_stats_cell_t *cell = &rwlock->stats[ii];
+
+    atomic_store_explicit(&cell->read_acquires, 0, memory_order_relaxed);
+    atomic_store_explicit(&cell->write_acquires, 0, memory_order_relaxed);
+    atomic_store_explicit(&cell->try_failures, 0, memory_order_relaxed);
+    atomic_store_explicit(&cell->timeouts, 0, memory_order_relaxed);
+    atomic_store_explicit(&cell->contended, 0, memory_order_relaxed);
+    atomic_store_explicit(&cell->wait_ns, 0, memory_order_relaxed);
+    atomic_store_explicit(&cell->hold_ns, 0, memory_order_relaxed);
+    for (size_t bucket = 0; bucket < PRWLOCK_STATS_BUCKETS; ++bucket) {
+      atomic_store_explicit(&cell->wait_histogram[bucket], 0,
+        memory_order_relaxed);
+      atomic_store_explicit(&cell->hold_histogram[bucket], 0,
+        memory_order_relaxed);
+    }
+  }
+  return 0;
+} /* partitioned_rwlock_stats_reset() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Writes a snapshot of every partition that has seen any traffic, either
+ * as one line per partition or as a JSON document whose histograms are
+ * labelled by the exclusive upper bound of each bucket in ns (0 for the
+ * unbounded last bucket).
+ */
+int
+partitioned_rwlock_stats_print (
+  partitioned_rwlock_t         *rwlock,
+  FILE                         *out,
+  partitioned_rwlock_stats_format_t format
+) {
+  assert(NULL != rwlock);
+  assert(NULL != out);
+
+  if (NULL == rwlock->stats) {
+    return -1;
+  }
+
+  partitioned_rwlock_stats_t *stats = malloc(rwlock->partition_count
+    * sizeof(*stats));
+  if (NULL == stats) {
+    return -1;
+  }
+  int count = partitioned_rwlock_stats_snapshot(rwlock, stats,
+    rwlock->partition_count);
+  int first = 1;
+
+  if (PRWLOCK_STATS_FORMAT_JSON == format) {
+    fprintf(out, "{\"bucket_limits_ns\":[");
+    for (size_t bucket = 0; bucket < PRWLOCK_STATS_BUCKETS; ++bucket) {
+      fprintf(out, "%s%" PRIu64, (0 == bucket) ? "" : ",",
+        ((PRWLOCK_STATS_BUCKETS - 1) == bucket) ? UINT64_C(0)
+          : (UINT64_C(1) << (bucket + PRWLOCK_STATS_BUCKET_SHIFT)));
+    }
+    fprintf(out, "],\"partitions\":[");
+  } else {
+    fprintf(out, "%-10s %12s %12s %10s %10s %10s %14s %14s\n", "partition",
+      "reads", "writes", "try_fails", "timeouts", "contended", "wait_ns",
+      "hold_ns");
+  }
+
+  for (int ii = 0; ii < count; ++ii) {
+    partitioned_rwlock_stats_t *entry = &stats[ii];
+
+    if (0 == (entry->read_acquires | entry->write_acquires
+      | entry->try_failures | entry->timeouts)) {
+      continue;
+    }
+    if (PRWLOCK_STATS_FORMAT_JSON == format) {
+      fprintf(out, "%s{\"partition\":%zu,\"read_acquires\":%" PRIu64
+        ",\"write_acquires\":%" PRIu64 ",\"try_failures\":%" PRIu64
+        ",\"timeouts\":%" PRIu64 ",\"contended\":%" PRIu64
+        ",\"wait_ns\":%" PRIu64 ",\"hold_ns\":%" PRIu64
+        ",\"wait_histogram\":[", (first) ? "" : ",", entry->partition,
+        entry->read_acquires, entry->write_acquires, entry->try_failures,
+        entry->timeouts, entry->contended, entry->wait_ns, entry->hold_ns);
+      for (size_t bucket = 0; bucket < PRWLOCK_STATS_BUCKETS; ++bucket) {
+        fprintf(out, "%s%" PRIu64, (0 == bucket) ? "" : ",",
+          entry->wait_histogram[bucket]);
+      }
+      fprintf(out, "],\"hold_histogram\":[");
+      for (size_t bucket = 0; bucket < PRWLOCK_STATS_BUCKETS; ++bucket) {
+        fprintf(out, "%s%" PRIu64, (0 == bucket) ? "" : ",",
+          entry->hold_histogram[bucket]);
+      }
+      fprintf(out, "]}");
+    } else {
+      fprintf(out, "%-10zu %12" PRIu64 " %12" PRIu64 " %10" PRIu64
+        " %10" PRIu64 " %10" PRIu64 " %14" PRIu64 " %14" PRIu64 "\n",
+        entry->partition, entry->read_acquires, entry->write_acquires,
+        entry->try_failures, entry->timeouts, entry->contended,
+        entry->wait_ns, entry->hold_ns);
+    }
+    first = 0;
+  }
+
+  if (PRWLOCK_STATS_FORMAT_JSON == format) {
+    fprintf(out, "]}\n");
+  }
+  free(stats);
+  return 0;
+} /* partitioned_rwlock_stats_print() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Moves up to count trace records into records, thread by thread, oldest
+ * first within a thread. Returns the number moved, or -1 if the lock was
+ * created without PRWLOCK_FLAG_TRACE.
+ */
+int
+partitioned_rwlock_trace_drain (
+  partitioned_rwlock_t         *rwlock,
+  partitioned_rwlock_trace_record_t *records,
+  size_t                        count
+) {
+  assert(NULL != rwlock);
+  assert(0 == count || NULL != records);
+
+  if (NULL == rwlock->trace) {
+    return -1;
+  }
+  if (count > INT_MAX) {
+    count = INT_MAX;
+  }
+
+  size_t drained = 0;
+  pthread_mutex_lock(&rwlock->trace->mutex);
+  for (size_t ii = 0; ii < PRWLOCK_TRACE_RINGS && drained < count; ++ii) {
+    prwlock_trace_ring_t *ring = atomic_load_explicit(
+      &rwlock->trace->rings[ii], memory_order_acquire);
+    if (NULL == ring) {
+      continue;
+    }
+
+    uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    uint32_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    while (tail != head && drained < count) {
+      records[drained++] =
+        ring->records[tail++ & (PRWLOCK_TRACE_RING_RECORDS - 1)];
+    }
+    atomic_store_explicit(&ring->tail, tail, memory_order_release);
+  }
+  pthread_mutex_unlock(&rwlock->trace->mutex);
+  return (int) drained;
+} /* partitioned_rwlock_trace_drain() */
+
+/* ------------------------------------------------------------------------- */
+
+/* Records lost so far to full rings, or to threads past the last ring */
+uint64_t
+partitioned_rwlock_trace_dropped (
+  partitioned_rwlock_t         *rwlock
+) {
+  assert(NULL != rwlock);
+
+  if (NULL == rwlock->trace) {
+    return 0;
+  }
+
+  uint64_t dropped = atomic_load_explicit(&rwlock->trace->dropped,
+    memory_order_relaxed);
+  for (size_t ii = 0; ii < PRWLOCK_TRACE_RINGS; ++ii) {
+    prwlock_trace_ring_t *ring = atomic_load_explicit(
+      &rwlock->trace->rings[ii], memory_order_acquire);
+    if (NULL != ring) {
+      dropped += atomic_load_explicit(&ring->dropped, memory_order_relaxed);
+    }
+  }
+  return dropped;
+} /* partitioned_rwlock_trace_dropped() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Drains every trace record and writes it out, as text or as one JSON
+ * object per line (what tools/prwlock-trace-top reads), followed by the
+ * count of dropped records. Addresses are symbolized where the C library
+ * can, as "module(symbol+offset) [address]".
+ */
+int
+partitioned_rwlock_trace_print (
+  partitioned_rwlock_t         *rwlock,
+  FILE                         *out,
+  partitioned_rwlock_stats_format_t format
+) {
+  assert(NULL != rwlock);
+  assert(NULL != out);
+
+  if (NULL == rwlock->trace) {
+    return -1;
+  }
+
+  partitioned_rwlock_trace_record_t *records = malloc(
+    PRWLOCK_TRACE_RING_RECORDS * sizeof(*records));
+  if (NULL == records) {
+    return -1;
+  }
+
+  int count;
+  while (0 < (count = partitioned_rwlock_trace_drain(rwlock, records,
+    PRWLOCK_TRACE_RING_RECORDS))) {
+    for (int ii = 0; ii < count; ++ii) {
+      partitioned_rwlock_trace_record_t *record = &records[ii];
+      const void *addresses[PRWLOCK_TRACE_FRAMES + 1];
+      char **symbols = NULL;
+      const char *kind = (PRWLOCK_TRACE_WAIT == record->kind)
+        ? "wait" : "hold";
+      const char *mode = (PRWLOCK_MODE_WRITE == record->mode) ? "write"
+        : (PRWLOCK_MODE_UPGRADABLE == record->mode) ? "upgradable" : "read";
+
+      /* The caller first, then the frames */
+      addresses[0] = record->caller;
+      memcpy(&addresses[1], record->frames,
+        (record->frame_count * sizeof(addresses[0])));
+#if defined(__GLIBC__)
+      symbols = backtrace_symbols((void *const *) addresses,
+        (int) (record->frame_count + 1));
+#endif /* __GLIBC__ */
+
+      if (PRWLOCK_STATS_FORMAT_JSON == format) {
+        fprintf(out, "{\"kind\":\"%s\",\"mode\":\"%s\",\"partition\":%zu,"
+          "\"thread\":%" PRIu32 ",\"duration_ns\":%" PRIu64
+          ",\"timestamp_ns\":%" PRIu64 ",\"caller\":", kind, mode,
+          record->partition, record->thread_id, record->duration_ns,
+          record->timestamp_ns);
+      } else {
+        fprintf(out, "%s %s partition %zu: %.3f ms, thread %" PRIu32
+          ", from ", kind, mode, record->partition,
+          ((double) record->duration_ns / 1E6), record->thread_id);
+      }
+
+      for (unsigned int jj = 0; jj <= record->frame_count; ++jj) {
+        char address[2 + (2 * sizeof(void *)) + 1];
+        const char *name = address;
+
+        snprintf(address, sizeof(address), "%p", addresses[jj]);
+        if (NULL != symbols) {
+          name = symbols[jj];
+        }
+        if (PRWLOCK_STATS_FORMAT_JSON == format) {
+          fputs((1 == jj) ? ",\"frames\":[\"" : (1 < jj) ? ",\"" : "\"",
+            out);
+          for (const char *at = name; '\0' != *at; ++at) {
+            if ('"' == *at || '\\' == *at) {
+              fputc('\\', out);
+            }
+            fputc(((unsigned char) *at < 0x20) ? ' ' : *at, out);
+          }
+          fputc('"', out);
+        } else {
+          fprintf(out, (0 == jj) ? "%s\n" : "    %s\n", name);
+        }
+      }
+      if (PRWLOCK_STATS_FORMAT_JSON == format) {
+        fputs((0 < record->frame_count) ? "]}\n" : ",\"frames\":[]}\n", out);
+      }
+      free(symbols);
+    }
+  }
+  free(records);
+
+  if (PRWLOCK_STATS_FORMAT_JSON == format) {
+    fprintf(out, "{\"dropped\":%" PRIu64 "}\n",
+      partitioned_rwlock_trace_dropped(rwlock));
+  } else {
+    fprintf(out, "dropped: %" PRIu64 "\n",
+      partitioned_rwlock_trace_dropped(rwlock));
+  }
+  return 0;
+} /* partitioned_rwlock_trace_print() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Shared hold on every partition. Partition holders are drained as for
+ * wrlock_all(), after which readers are let back in and writers are held
+ * off until the last shared holder calls unlock_all(). Without
+ * PRWLOCK_FLAG_GLOBAL this read-locks each partition in turn. A global
+ * holder works on the protected data directly; it must not also lock
+ * individual partitions of the same lock.
+ */
+int
+partitioned_rwlock_rdlock_all (
+  partitioned_rwlock_t         *rwlock
+) {
+  assert(NULL != rwlock);
+
+  PRWLOCK_TRACE_SITE(rwlock);
+  int rc = prwlock_resize_hold(rwlock);
+  if (0 != rc) {
+    return rc;
+  }
+
+  if (!(rwlock->flags & PRWLOCK_FLAG_GLOBAL)) {
+    for (size_t ii = 0; ii < rwlock->partition_count; ++ii) {
+      rc = prwlock_partition_lock(rwlock, ii, PRWLOCK_MODE_READ,
+        PRWLOCK_DEADLINE_NONE);
+      if (0 != rc) {
+        while (0 < ii--) {
+          (void) prwlock_partition_unlock(rwlock, ii, 0);
+        }
+        prwlock_resize_unhold(rwlock);
+        return rc;
+      }
+    }
+    return 0;
+  }
+
+  rc = prwlock_cell_rdlock(rwlock, &rwlock->global.cell);
+  if (0 != rc) {
+    prwlock_resize_unhold(rwlock);
+    return rc;
+  }
+
+  /* The first shared holder drains; later ones wait for it to finish */
+  uint32_t intent = atomic_load_explicit(&rwlock->global.intent,
+    memory_order_relaxed);
+  uint32_t next;
+  do {
+    next = (0 == intent) ? (PRWLOCK_GLOBAL_SHARED | PRWLOCK_GLOBAL_PENDING)
+      : (intent + PRWLOCK_GLOBAL_SHARED);
+  } while (!atomic_compare_exchange_weak(&rwlock->global.intent, &intent,
+    next));
+
+  if (0 == intent) {
+    prwlock_global_drain(rwlock);
+    atomic_fetch_and(&rwlock->global.intent, ~PRWLOCK_GLOBAL_PENDING);
+    (void) prwlock_futex_wake(rwlock, &rwlock->global.intent, INT_MAX);
+  } else {
+    while (PRWLOCK_GLOBAL_PENDING & (intent = atomic_load(
+      &rwlock->global.intent))) {
+      prwlock_futex_wait(rwlock, &rwlock->global.intent, intent);
+    }
+  }
+  return 0;
+} /* partitioned_rwlock_rdlock_all() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Exclusive hold on every partition. With PRWLOCK_FLAG_GLOBAL this costs a
+ * store to the intention word plus a drain of the ingress counters, however
+ * many partitions the lock has.
+ */
+int
+partitioned_rwlock_wrlock_all (
+  partitioned_rwlock_t         *rwlock
+) {
+  assert(NULL != rwlock);
+
+  PRWLOCK_TRACE_SITE(rwlock);
+  int rc = prwlock_resize_hold(rwlock);
+  if (0 != rc) {
+    return rc;
+  }
+
+  if (!(rwlock->flags & PRWLOCK_FLAG_GLOBAL)) {
+    for (size_t ii = 0; ii < rwlock->partition_count; ++ii) {
+      rc = prwlock_partition_lock(rwlock, ii, PRWLOCK_MODE_WRITE,
+        PRWLOCK_DEADLINE_NONE);
+      if (0 != rc) {
+        while (0 < ii--) {
+          (void) prwlock_partition_unlock(rwlock, ii, 1);
+        }
+        prwlock_resize_unhold(rwlock);
+        return rc;
+      }
+    }
+    return 0;
+  }
+
+  rc = prwlock_cell_wrlock(rwlock, &rwlock->global.cell);
+  if (0 != rc) {
+    prwlock_resize_unhold(rwlock);
+    return rc;
+  }
+  atomic_store(&rwlock->global.intent, PRWLOCK_GLOBAL_EXCLUSIVE);
+  /* Threads already holding partitions may now pass (see blocks()) */
+  (void) prwlock_futex_wake(rwlock, &rwlock->global.intent, INT_MAX);
+  prwlock_global_drain(rwlock);
+  if (rwlock->flags & PRWLOCK_FLAG_OPTIMISTIC) {
+    prwlock_sequence_begin(&rwlock->global.cell.sequence);
+  }
+  return 0;
+} /* partitioned_rwlock_wrlock_all() */
+
+/* ------------------------------------------------------------------------- */
+
+int
+partitioned_rwlock_unlock_all (
+  partitioned_rwlock_t         *rwlock
+) {
+  assert(NULL != rwlock);
+
+  if (!(rwlock->flags & PRWLOCK_FLAG_GLOBAL)) {
+    int rc = 0;
+    for (size_t ii = rwlock->partition_count; 0 < ii--; ) {
+      int next = prwlock_partition_unlock(rwlock, ii,
+        PRWLOCK_UNLOCK_INFER);
+      rc = (0 != rc) ? rc : next;
+    }
+    prwlock_resize_unhold(rwlock);
+    return rc;
+  }
+
+  if (PRWLOCK_GLOBAL_EXCLUSIVE & atomic_load_explicit(&rwlock->global.intent,
+    memory_order_relaxed)) {
+    if (rwlock->flags & PRWLOCK_FLAG_OPTIMISTIC) {
+      prwlock_sequence_end(&rwlock->global.cell.sequence);
+    }
+    atomic_store_explicit(&rwlock->global.intent, 0, memory_order_release);
+  } else {
+    atomic_fetch_sub_explicit(&rwlock->global.intent, PRWLOCK_GLOBAL_SHARED,
+      memory_order_release);
+  }
+  int rc = prwlock_cell_unlock(rwlock, &rwlock->global.cell);
+  (void) prwlock_futex_wake(rwlock, &rwlock->global.intent, INT_MAX);
+  prwlock_async_notify(rwlock, PRWLOCK_PARTITION_ANY);
+  prwlock_resize_unhold(rwlock);
+  return rc;
+} /* partitioned_rwlock_unlock_all() */
+
+/* ------------------------------------------------------------------------- */
+
+#if defined(USE_LIBUV_RWLOCK)
+
+/*
+ * Acquisition for event-loop threads, which must not block: called on the
+ * loop's thread, it returns 0 if the partition was taken there and then,
+ * and cb is not called. If the partition is busy it returns EINPROGRESS
+ * and the request waits in the loop's queue; once a release lets it in,
+ * the partition is taken on the loop's thread, which then owns it, and cb
+ * runs there. Other errors are the lock's own, or ENOMEM. Not available on
+ * resizable locks.
+ */
+int
+partitioned_rwlock_rdlock_async (
+  uv_loop_t                    *loop,
+  partitioned_rwlock_t         *rwlock,
+  const size_t                  partition,
+  partitioned_rwlock_async_cb   cb,
+  void                         *arg
+) {
+  assert(NULL != loop);
+  assert(NULL != rwlock);
+  assert(partition < rwlock->partition_count);
+  assert(NULL != cb);
+
+  return prwlock_async_lock(loop, rwlock, partition, PRWLOCK_MODE_READ, cb,
+    arg);
+} /* partitioned_rwlock_rdlock_async() */
+
+/* ------------------------------------------------------------------------- */
+
+int
+partitioned_rwlock_wrlock_async (
+  uv_loop_t                    *loop,
+  partitioned_rwlock_t         *rwlock,
+  const size_t                  partition,
+  partitioned_rwlock_async_cb   cb,
+  void                         *arg
+) {
+  assert(NULL != loop);
+  assert(NULL != rwlock);
+  assert(partition < rwlock->partition_count);
+  assert(NULL != cb);
+
+  return prwlock_async_lock(loop, rwlock, partition, PRWLOCK_MODE_WRITE, cb,
+    arg);
+} /* partitioned_rwlock_wrlock_async() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Drops the loop's queue on the lock, on the loop's thread: requests still
+ * waiting get their callbacks with ECANCELED, and the async handle is
+ * closed. Every loop that queued on the lock must do this before the lock
+ * is destroyed, and before the loop itself is closed.
+ */
+int
+partitioned_rwlock_async_close (
+  uv_loop_t                    *loop,
+  partitioned_rwlock_t         *rwlock
+) {
+  assert(NULL != loop);
+  assert(NULL != rwlock);
+
+  prwlock_async_loop_t *context = NULL;
+  pthread_mutex_lock(&rwlock->async.mutex);
+  for (prwlock_async_loop_t **link = &rwlock->async.loops; NULL != *link;
+    link = &(*link)->next) {
+    if (loop == (*link)->loop) {
+      context = *link;
+      *link = context->next;
+      break;
+    }
+  }
+  pthread_mutex_unlock(&rwlock->async.mutex);
+  if (NULL == context) {
+    return 0;
+  }
+
+  _Atomic uint32_t *waiting = atomic_load_explicit(&rwlock->async.waiting,
+    memory_order_relaxed);
+  prwlock_async_request_t *request;
+  while (NULL != (request = context->head)) {
+    context->head = request->next;
+    atomic_fetch_sub(&waiting[request->partition], 1);
+    request->cb(rwlock, request->partition, ECANCELED, request->arg);
+    free(request);
+  }
+  context->tail = NULL;
+  atomic_store(&context->queued, 0);
+  uv_close((uv_handle_t *) &context->async, prwlock_async_closed);
+  return 0;
+} /* partitioned_rwlock_async_close() */
+
+#endif /* USE_LIBUV_RWLOCK */
+
+/* :vi set ts=2 et sw=2: */
@@ -32,7 +32,18 @@
 /* -- INCLUSIONS ----------------------------------------------------------- */
 /* ========================================================================= */
 
+#include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#if defined(USE_FUTEX)
+# if !defined(__linux__)
+#  error "USE_FUTEX requires Linux"
+# endif /* !__linux__ */
+# if !defined(USE_ATOMICS)
+#  define USE_ATOMICS
+# endif /* !USE_ATOMICS */
+#endif /* USE_FUTEX */
 #if defined(USE_LIBUV_RWLOCK)
 # include <uv.h>
 #elif defined(USE_ATOMICS) 
@@ -45,6 +56,119 @@
 /* -- DEFINITIONS ---------------------------------------------------------- */
 /* ========================================================================= */
 
+/*
+ * Reader-biased (BRAVO-style) partitions: readers announce themselves in a
+ * per-lock table of visible-reader slots rather than updating the shared
+ * cell, and writers revoke the bias and drain those slots before entering.
+ */
+#define PRWLOCK_FLAG_READER_BIAS        0x00000001u
+
+/*
+ * Whole-lock operations (the *_all calls) by intention word and drain rather
+ * than one acquisition per partition. Partition operations pay a per-thread
+ * counter update and a check of the intention word while the flag is set.
+ */
+#define PRWLOCK_FLAG_GLOBAL             0x00000002u
+
+/*
+ * Per-partition contention statistics, kept in per-thread shards and read
+ * with partitioned_rwlock_stats_snapshot(). Each acquisition costs a clock
+ * read and a few uncontended counter updates.
+ */
+#define PRWLOCK_FLAG_STATS              0x00000004u
+
+/*
+ * Cohort handoff (USE_ATOMICS only): a writer releasing a partition that
+ * another writer on its NUMA node is waiting for passes the lock straight
+ * on, up to cohort_batch times in a row, before the partition is released
+ * to other nodes and to readers. Readers hold back while writers queue,
+ * unless the policy prefers readers.
+ */
+#define PRWLOCK_FLAG_COHORT             0x00000008u
+
+/*
+ * Online resizing with partitioned_rwlock_resize(). Keys are locked through
+ * a table pointer that a resize replaces while the lock stays in use, which
+ * costs the *_key calls an extra counter update. Partition indices name
+ * cells of the current table only, so the index-based calls must not race
+ * a resize; the *_key calls and the *_all calls may. Not available with
+ * reader bias, statistics, cohorts or NUMA placement.
+ */
+#define PRWLOCK_FLAG_RESIZABLE          0x00000010u
+
+/*
+ * Optimistic reads with partitioned_rwlock_read_begin() and read_validate():
+ * every write acquisition moves a per-partition sequence number (or with
+ * PRWLOCK_FLAG_GLOBAL, wrlock_all() a lock-wide one), which readers check
+ * instead of announcing themselves.
+ */
+#define PRWLOCK_FLAG_OPTIMISTIC         0x00000020u
+
+/*
+ * Upgradable read locks (partitioned_rwlock_uplock()): at most one per
+ * partition, alongside plain readers, convertible to a write lock in place
+ * with partitioned_rwlock_upgrade(); any write lock can be turned back into
+ * a read lock with partitioned_rwlock_downgrade(). The atomics backend
+ * converts the cell directly. pthreads, libuv and phase-fair cells cannot,
+ * so there writers take the partition's upgrader token too, and a
+ * conversion briefly lets go of the cell with no writer able to get in.
+ * Not available on resizable locks.
+ */
+#define PRWLOCK_FLAG_UPGRADABLE         0x00000040u
+
+/*
+ * Epoch-based reads with partitioned_rwlock_epoch_enter() and epoch_exit():
+ * a reader stores to a slot of its own and locks nothing, so it never
+ * waits and never keeps a writer out. Writers still lock partitions
+ * against one another, publish new versions of what they guard, and leave
+ * the old ones to be freed after a grace period, waited for with
+ * partitioned_rwlock_synchronize() or handed to partitioned_rwlock_defer().
+ * Epochs are lock-wide: a grace period waits for sections on any partition.
+ */
+#define PRWLOCK_FLAG_EPOCH              0x00000080u
+
+/*
+ * Slow-holder tracing: every partition acquisition and release through the
+ * lock functions is timestamped with the CPU's cycle counter, and a wait or
+ * hold longer than attr.trace_threshold_ns is recorded, with the call site
+ * of the acquisition and a backtrace, in a ring of the thread's own. Read
+ * the records with partitioned_rwlock_trace_drain() or trace_print().
+ */
+#define PRWLOCK_FLAG_TRACE              0x00000100u
+
+/*
+ * Biased read leases: a partition one thread keeps read-locking is leased
+ * to that thread, whose read locks and unlocks then only check the lease
+ * and count in a line no other thread touches. A writer, or a reader from
+ * another thread, revokes the lease and waits for the holder's reads to
+ * end, with membarrier(2) where the kernel has it. Partitions whose leases
+ * keep being revoked early wait longer for the next, and are eventually
+ * no longer leased. Not available with reader bias or on resizable locks.
+ */
+#define PRWLOCK_FLAG_READ_LEASE         0x00000200u
+
+/*
+ * Combining writes with partitioned_rwlock_combine(): a writer that finds
+ * the partition busy publishes its operation on a per-partition list, and
+ * whichever combining writer holds the partition runs every operation
+ * published before letting it go. A burst of small writes to a hot
+ * partition then costs one acquisition rather than one handoff each, and
+ * what they write stays in one core's cache. Not available on resizable
+ * locks.
+ */
+#define PRWLOCK_FLAG_COMBINING          0x00000400u
+
+/*
+ * Statistics histograms are power-of-two: bucket 0 counts durations under
+ * 2^PRWLOCK_STATS_BUCKET_SHIFT ns, bucket b those under 2^(b + shift) ns,
+ * and the last bucket everything longer.
+ */
+#define PRWLOCK_STATS_BUCKETS           24
+#define PRWLOCK_STATS_BUCKET_SHIFT      6
+
+/* Return addresses kept per trace record, innermost first */
+#define PRWLOCK_TRACE_FRAMES            12
+
 /* ========================================================================= */
 /* -- MACROS --------------------------------------------------------------- */
 /* ========================================================================= */
@@ -55,6 +179,144 @@
 
 typedef struct partitioned_rwlock_t partitioned_rwlock_t;
 
+/*
+ * Fairness between readers and writers of a partition. The default is the
+ * backend's own: writer-preferring for USE_ATOMICS, reader-preferring for
+ * pthreads and libuv. Phase-fair partitions alternate between a batch of
+ * readers and a single writer, with writers admitted in FIFO ticket order,
+ * and are available on every backend. libuv cannot prefer writers.
+ */
+typedef enum {
+  PRWLOCK_POLICY_DEFAULT = 0,
+  PRWLOCK_POLICY_READER_PREFERRING,
+  PRWLOCK_POLICY_WRITER_PREFERRING,
+  PRWLOCK_POLICY_PHASE_FAIR
+} partitioned_rwlock_policy_t;
+
+/*
+ * Where partition cells live on a NUMA machine. Interleaved cells are
+ * spread page by page over the nodes; blocked cells give each node one
+ * contiguous run of partitions, reported by partitioned_rwlock_partition_node()
+ * and movable with partitioned_rwlock_numa_bind(). Either way cells are
+ * page-aligned, and placement is granted a page of cells at a time.
+ */
+typedef enum {
+  PRWLOCK_NUMA_NONE = 0,
+  PRWLOCK_NUMA_INTERLEAVE,
+  PRWLOCK_NUMA_BLOCKED
+} partitioned_rwlock_numa_t;
+
+/*
+ * Spacing of partition cells. One cell per cache line, the default, keeps
+ * neighbouring partitions from false sharing. Packed cells sit back to back
+ * at the backend's own size (8 bytes for the default atomics cell; the
+ * phase-fair policy and the global, cohort, optimistic and upgradable flags
+ * need more), so very large tables stay in cache and TLB reach at the cost
+ * of false sharing. A two-line stride also keeps the adjacent-line
+ * prefetcher from pulling in a neighbour's cell.
+ */
+typedef enum {
+  PRWLOCK_STRIDE_CACHE_LINE = 0,
+  PRWLOCK_STRIDE_PACKED,
+  PRWLOCK_STRIDE_DOUBLE_LINE
+} partitioned_rwlock_stride_t;
+
+/*
+ * hash_seed keys the mapping from keys to partitions; locks created with
+ * the same seed and partition count map every key alike. cohort_batch caps
+ * consecutive same-node handoffs under PRWLOCK_FLAG_COHORT (0 for the
+ * default). cell_data reserves that many bytes of caller data in every
+ * cell, just after the lock words, for state guarded by the partition to
+ * share its cache line; it is zeroed at init and found with
+ * partitioned_rwlock_cell_data(). Not available on resizable locks.
+ * trace_threshold_ns is the shortest wait or hold PRWLOCK_FLAG_TRACE
+ * records (0 for the default of 1 ms).
+ */
+typedef struct {
+  unsigned int                  flags;
+  partitioned_rwlock_policy_t   policy;
+  uint64_t                      hash_seed;
+  partitioned_rwlock_numa_t     numa;
+  unsigned int                  cohort_batch;
+  partitioned_rwlock_stride_t   stride;
+  size_t                        cell_data;
+  uint64_t                      trace_threshold_ns;
+} partitioned_rwlock_attr_t;
+
+typedef struct {
+  size_t                        partition;
+  uint64_t                      read_acquires;
+  uint64_t                      write_acquires;
+  uint64_t                      try_failures;
+  uint64_t                      timeouts;       /* timed acquisitions */
+  uint64_t                      contended;      /* had to wait */
+  uint64_t                      wait_ns;
+  uint64_t                      hold_ns;
+  uint64_t                      wait_histogram[PRWLOCK_STATS_BUCKETS];
+  uint64_t                      hold_histogram[PRWLOCK_STATS_BUCKETS];
+} partitioned_rwlock_stats_t;
+
+typedef enum {
+  PRWLOCK_STATS_FORMAT_TEXT = 0,
+  PRWLOCK_STATS_FORMAT_JSON
+} partitioned_rwlock_stats_format_t;
+
+/* Upgradable requests need PRWLOCK_FLAG_UPGRADABLE */
+typedef enum {
+  PRWLOCK_MODE_READ = 0,
+  PRWLOCK_MODE_WRITE,
+  PRWLOCK_MODE_UPGRADABLE
+} partitioned_rwlock_mode_t;
+
+/*
+ * One entry of a multi-partition acquisition. A partition may appear more
+ * than once; it is locked once, in the strongest mode any entry asks for.
+ */
+typedef struct {
+  size_t                        partition;
+  partitioned_rwlock_mode_t     mode;
+} partitioned_rwlock_request_t;
+
+typedef enum {
+  PRWLOCK_TRACE_HOLD = 0,
+  PRWLOCK_TRACE_WAIT
+} partitioned_rwlock_trace_kind_t;
+
+/*
+ * A wait or hold past the threshold. caller is the return address of the
+ * lock call that acquired the partition, and mode the mode it asked for;
+ * frames is the stack where the record was made, at the end of the wait
+ * or at the release. timestamp_ns is then, on CLOCK_MONOTONIC.
+ */
+typedef struct {
+  partitioned_rwlock_trace_kind_t kind;
+  partitioned_rwlock_mode_t     mode;
+  size_t                        partition;
+  uint32_t                      thread_id;
+  uint64_t                      duration_ns;
+  uint64_t                      timestamp_ns;
+  const void                   *caller;
+  unsigned int                  frame_count;
+  const void                   *frames[PRWLOCK_TRACE_FRAMES];
+} partitioned_rwlock_trace_record_t;
+
+#if defined(USE_LIBUV_RWLOCK)
+/*
+ * Completion of a queued asynchronous acquisition, run on the requesting
+ * loop's thread: status is 0 once the partition is held by that thread,
+ * or ECANCELED if partitioned_rwlock_async_close() dropped the request.
+ */
+typedef void (*partitioned_rwlock_async_cb) (partitioned_rwlock_t *rwlock,
+  size_t partition, int status, void *arg);
+#endif /* USE_LIBUV_RWLOCK */
+
+/*
+ * An operation for partitioned_rwlock_combine(), run once with the
+ * partition write-locked, on whichever thread is combining at the time.
+ */
+typedef void (*partitioned_rwlock_combine_fn) (partitioned_rwlock_t *rwlock,
+  size_t partition, void *arg);
+
 /* ========================================================================= */
 /* -- PRIVATE METHOD PROTOTYPES -------------------------------------------- */
 /* ========================================================================= */
@@ -87,10 +349,27 @@ typedef struct partitioned_rwlock_t partitioned_rwlock_t;
 /* -- PUBLIC METHODS ------------------------------------------------------- */
 /* ========================================================================= */
 
+#if defined(__cplusplus)
+extern "C" {
+#endif /* __cplusplus */
+
+int partitioned_rwlock_attr_init (partitioned_rwlock_attr_t *attr);
 int partitioned_rwlock_init (partitioned_rwlock_t **rwlock,
   size_t partition_count);
+int partitioned_rwlock_init_ex (partitioned_rwlock_t **rwlock,
+  size_t partition_count, const partitioned_rwlock_attr_t *attr);
+size_t partitioned_rwlock_shared_size (size_t partition_count,
+  const partitioned_rwlock_attr_t *attr);
+int partitioned_rwlock_init_shared (partitioned_rwlock_t **rwlock,
+  void *region, size_t region_size, size_t partition_count,
+  const partitioned_rwlock_attr_t *attr);
+int partitioned_rwlock_attach_shared (partitioned_rwlock_t **rwlock,
+  void *region);
 int partitioned_rwlock_destroy (partitioned_rwlock_t *rwlock);
 size_t partitioned_rwlock_get_partition_count (partitioned_rwlock_t *rwlock);
+size_t partitioned_rwlock_get_cell_stride (partitioned_rwlock_t *rwlock);
+void *partitioned_rwlock_cell_data (partitioned_rwlock_t *rwlock,
+  const size_t partition);
 int partitioned_rwlock_rdlock (partitioned_rwlock_t *rwlock,
   const size_t partition);
 int partitioned_rwlock_tryrdlock (partitioned_rwlock_t *rwlock,
@@ -99,8 +378,106 @@ int partitioned_rwlock_wrlock (partitioned_rwlock_t *rwlock,
   const size_t partition);
 int partitioned_rwlock_trywrlock (partitioned_rwlock_t *rwlock,
   const size_t partition);
+int partitioned_rwlock_timedrdlock (partitioned_rwlock_t *rwlock,
+  const size_t partition, const struct timespec *abstime);
+int partitioned_rwlock_timedwrlock (partitioned_rwlock_t *rwlock,
+  const size_t partition, const struct timespec *abstime);
+int partitioned_rwlock_deadline (struct timespec *abstime,
+  uint64_t timeout_ns);
 int partitioned_rwlock_unlock (partitioned_rwlock_t *rwlock,
   const size_t partition);
+int partitioned_rwlock_rdunlock (partitioned_rwlock_t *rwlock,
+  const size_t partition);
+int partitioned_rwlock_wrunlock (partitioned_rwlock_t *rwlock,
+  const size_t partition);
+int partitioned_rwlock_uplock (partitioned_rwlock_t *rwlock,
+  const size_t partition);
+int partitioned_rwlock_tryuplock (partitioned_rwlock_t *rwlock,
+  const size_t partition);
+int partitioned_rwlock_upgrade (partitioned_rwlock_t *rwlock,
+  const size_t partition);
+int partitioned_rwlock_tryupgrade (partitioned_rwlock_t *rwlock,
+  const size_t partition);
+int partitioned_rwlock_downgrade (partitioned_rwlock_t *rwlock,
+  const size_t partition);
+int partitioned_rwlock_rdlock_many (partitioned_rwlock_t *rwlock,
+  const size_t *partitions, size_t count);
+int partitioned_rwlock_tryrdlock_many (partitioned_rwlock_t *rwlock,
+  const size_t *partitions, size_t count);
+int partitioned_rwlock_wrlock_many (partitioned_rwlock_t *rwlock,
+  const size_t *partitions, size_t count);
+int partitioned_rwlock_trywrlock_many (partitioned_rwlock_t *rwlock,
+  const size_t *partitions, size_t count);
+int partitioned_rwlock_lock_many (partitioned_rwlock_t *rwlock,
+  const partitioned_rwlock_request_t *requests, size_t count);
+int partitioned_rwlock_trylock_many (partitioned_rwlock_t *rwlock,
+  const partitioned_rwlock_request_t *requests, size_t count);
+int partitioned_rwlock_unlock_many (partitioned_rwlock_t *rwlock,
+  const size_t *partitions, size_t count);
+int partitioned_rwlock_read_begin (partitioned_rwlock_t *rwlock,
+  const size_t partition, uint64_t *stamp);
+int partitioned_rwlock_read_validate (partitioned_rwlock_t *rwlock,
+  const size_t partition, uint64_t stamp);
+int partitioned_rwlock_epoch_enter (partitioned_rwlock_t *rwlock);
+int partitioned_rwlock_epoch_exit (partitioned_rwlock_t *rwlock);
+int partitioned_rwlock_synchronize (partitioned_rwlock_t *rwlock);
+int partitioned_rwlock_defer (partitioned_rwlock_t *rwlock,
+  void (*reclaim) (void *), void *arg);
+int partitioned_rwlock_reclaim (partitioned_rwlock_t *rwlock);
+int partitioned_rwlock_combine (partitioned_rwlock_t *rwlock,
+  const size_t partition, partitioned_rwlock_combine_fn fn, void *arg);
+size_t partitioned_rwlock_partition (partitioned_rwlock_t *rwlock,
+  const void *key, size_t length);
+void partitioned_rwlock_partition_many (partitioned_rwlock_t *rwlock,
+  const void *const *keys, const size_t *lengths, size_t count,
+  size_t *partitions);
+void partitioned_rwlock_partition_u64 (partitioned_rwlock_t *rwlock,
+  const uint64_t *keys, size_t count, size_t *partitions);
+int partitioned_rwlock_rdlock_key (partitioned_rwlock_t *rwlock,
+  const void *key, size_t length, size_t *partition);
+int partitioned_rwlock_tryrdlock_key (partitioned_rwlock_t *rwlock,
+  const void *key, size_t length, size_t *partition);
+int partitioned_rwlock_wrlock_key (partitioned_rwlock_t *rwlock,
+  const void *key, size_t length, size_t *partition);
+int partitioned_rwlock_trywrlock_key (partitioned_rwlock_t *rwlock,
+  const void *key, size_t length, size_t *partition);
+int partitioned_rwlock_unlock_key (partitioned_rwlock_t *rwlock,
+  const void *key, size_t length);
+int partitioned_rwlock_resize (partitioned_rwlock_t *rwlock,
+  size_t partition_count);
+int partitioned_rwlock_numa_node_count (void);
+int partitioned_rwlock_numa_current_node (void);
+int partitioned_rwlock_partition_node (partitioned_rwlock_t *rwlock,
+  size_t partition);
+int partitioned_rwlock_numa_bind (partitioned_rwlock_t *rwlock,
+  size_t first, size_t count, int node);
+int partitioned_rwlock_stats_snapshot (partitioned_rwlock_t *rwlock,
+  partitioned_rwlock_stats_t *stats, size_t count);
+int partitioned_rwlock_stats_reset (partitioned_rwlock_t *rwlock);
+int partitioned_rwlock_stats_print (partitioned_rwlock_t *rwlock, FILE *out,
+  partitioned_rwlock_stats_format_t format);
+int partitioned_rwlock_trace_drain (partitioned_rwlock_t *rwlock,
+  partitioned_rwlock_trace_record_t *records, size_t count);
+uint64_t partitioned_rwlock_trace_dropped (partitioned_rwlock_t *rwlock);
+int partitioned_rwlock_trace_print (partitioned_rwlock_t *rwlock, FILE *out,
+  partitioned_rwlock_stats_format_t format);
+int partitioned_rwlock_rdlock_all (partitioned_rwlock_t *rwlock);
+int partitioned_rwlock_wrlock_all (partitioned_rwlock_t *rwlock);
+int partitioned_rwlock_unlock_all (partitioned_rwlock_t *rwlock);
+#if defined(USE_LIBUV_RWLOCK)
+int partitioned_rwlock_rdlock_async (uv_loop_t *loop,
+  partitioned_rwlock_t *rwlock, const size_t partition,
+  partitioned_rwlock_async_cb cb, void *arg);
+int partitioned_rwlock_wrlock_async (uv_loop_t *loop,
+  partitioned_rwlock_t *rwlock, const size_t partition,
+  partitioned_rwlock_async_cb cb, void *arg);
+int partitioned_rwlock_async_close (uv_loop_t *loop,
+  partitioned_rwlock_t *rwlock);
+#endif /* USE_LIBUV_RWLOCK */
+
+#if defined(__cplusplus)
+}
+#endif /* __cplusplus */
 
 #endif /* PRWLOCK_H */
 
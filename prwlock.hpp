@@ -0,0 +1,495 @@
+#ifndef PRWLOCK_HPP
+#define PRWLOCK_HPP
+/* ========================================================================= **
+**                                      __           __                      **
+**                       ______      __/ /___  _____/ /__                    **
+**                      / ___/ | /| / / / __ \/ ___/ //_/                    **
+**                     / /   | |/ |/ / / /_/ / /__/ ,<                       **
+**                    /_/    |__/|__/_/\____/\___/_/|_|                      **
+**                                                                           **
+** ========================================================================= **
+**                      PARTITIONED READER-WRITER LOCK                       **
+** ========================================================================= **
+**                                                                           **
+** Copyright (c) 2002-2018 Jonah H. Harris.                                  **
+**                                                                           **
+** This library is free software; you can redistribute it and/or modify it   **
+** under the terms of the GNU Lesser General Public License as published by  **
+** the Free Software Foundation; either version 3 of the License, or (at     **
+** your option) any later version.                                           **
+**                                                                           **
+** This library is distributed in the hope it will be useful, but WITHOUT    **
+** ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or     **
+** FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public       **
+** License for more details.                                                 **
+**                                                                           **
+** You should have received a copy of the GNU Lesser General Public License  **
+** along with this library; if not, write to the Free Software Foundation,   **
+** Inc., 675 Mass Ave, Cambridge, MA 02139, USA.                             **
+** ========================================================================= */
+
+/*
+ * C++17 front-end. partitioned_shared_mutex<N, Backend, Hash> owns a lock
+ * of N partitions, N a power of two, so a key's partition is its hash under
+ * a constant mask. Each partition is a SharedMutex for std::unique_lock and
+ * std::shared_lock, and scoped_partition_lock holds several at once. The
+ * Backend is a class of static calls, chosen at compile time:
+ * inline_backend (the default) does what prwlock_inline.h does for C, and
+ * library_backend always calls into prwlock.c. The cell implementation is
+ * still the one prwlock.c was built with.
+ */
+
+/* ========================================================================= */
+/* -- INCLUSIONS ----------------------------------------------------------- */
+/* ========================================================================= */
+
+#include <cstddef>
+#include <cstdint>
+#include <cassert>
+#include <functional>
+#include <initializer_list>
+#include <stdexcept>
+#include <system_error>
+#include <vector>
+
+#include "prwlock.h"
+#include "prwlock_inline.h"
+
+namespace prwlock {
+
+/* ========================================================================= */
+/* -- BACKENDS ------------------------------------------------------------- */
+/* ========================================================================= */
+
+/* Every call goes through prwlock.c */
+struct library_backend {
+  static int rdlock (
+    partitioned_rwlock_t       *rwlock,
+    std::size_t                 partition
+  ) noexcept {
+    return partitioned_rwlock_rdlock(rwlock, partition);
+  } /* rdlock() */
+
+  static int tryrdlock (
+    partitioned_rwlock_t       *rwlock,
+    std::size_t                 partition
+  ) noexcept {
+    return partitioned_rwlock_tryrdlock(rwlock, partition);
+  } /* tryrdlock() */
+
+  static int wrlock (
+    partitioned_rwlock_t       *rwlock,
+    std::size_t                 partition
+  ) noexcept {
+    return partitioned_rwlock_wrlock(rwlock, partition);
+  } /* wrlock() */
+
+  static int trywrlock (
+    partitioned_rwlock_t       *rwlock,
+    std::size_t                 partition
+  ) noexcept {
+    return partitioned_rwlock_trywrlock(rwlock, partition);
+  } /* trywrlock() */
+
+  static int rdunlock (
+    partitioned_rwlock_t       *rwlock,
+    std::size_t                 partition
+  ) noexcept {
+    return partitioned_rwlock_rdunlock(rwlock, partition);
+  } /* rdunlock() */
+
+  static int wrunlock (
+    partitioned_rwlock_t       *rwlock,
+    std::size_t                 partition
+  ) noexcept {
+    return partitioned_rwlock_wrunlock(rwlock, partition);
+  } /* wrunlock() */
+}; /* library_backend */
+
+/* ------------------------------------------------------------------------- */
+
+#if defined(USE_ATOMICS)
+/*
+ * One compare-and-swap on an uncontended plain cell, as in prwlock_inline.h,
+ * else the library call. The state word is reached with the compiler's
+ * __atomic builtins, the same operations stdatomic.h makes of it in C.
+ */
+struct inline_backend {
+  static std::uint32_t *state (
+    partitioned_rwlock_t       *rwlock,
+    std::size_t                 partition
+  ) noexcept {
+    const partitioned_rwlock_head_t *head =
+      reinterpret_cast<const partitioned_rwlock_head_t *>(rwlock);
+
+    assert(nullptr != rwlock);
+    assert(partition < head->partition_count);
+
+    if ((head->flags & PRWLOCK_INLINE_SLOW_FLAGS)
+      || PRWLOCK_POLICY_PHASE_FAIR == head->policy) {
+      return nullptr;
+    }
+    return reinterpret_cast<std::uint32_t *>(
+      static_cast<char *>(head->cells) + (partition * head->cell_stride));
+  } /* state() */
+
+  static bool fast_rdlock (
+    partitioned_rwlock_t       *rwlock,
+    std::size_t                 partition
+  ) noexcept {
+    std::uint32_t *word = state(rwlock, partition);
+    if (nullptr == word) {
+      return false;
+    }
+
+    std::uint32_t value = __atomic_load_n(word, __ATOMIC_RELAXED);
+    return PRWLOCK_STATE_IS_READ_LOCKABLE(value,
+        reinterpret_cast<const partitioned_rwlock_head_t *>(rwlock)->policy)
+      && __atomic_compare_exchange_n(word, &value,
+        (value + PRWLOCK_STATE_READ_LOCKED), true, __ATOMIC_ACQUIRE,
+        __ATOMIC_RELAXED);
+  } /* fast_rdlock() */
+
+  static bool fast_wrlock (
+    partitioned_rwlock_t       *rwlock,
+    std::size_t                 partition
+  ) noexcept {
+    std::uint32_t *word = state(rwlock, partition);
+    std::uint32_t value = 0;
+
+    return (nullptr != word)
+      && __atomic_compare_exchange_n(word, &value,
+        PRWLOCK_STATE_WRITE_LOCKED, false, __ATOMIC_ACQUIRE,
+        __ATOMIC_RELAXED);
+  } /* fast_wrlock() */
+
+  static int rdlock (
+    partitioned_rwlock_t       *rwlock,
+    std::size_t                 partition
+  ) noexcept {
+    return (fast_rdlock(rwlock, partition)) ? 0
+      : partitioned_rwlock_rdlock(rwlock, partition);
+  } /* rdlock() */
+
+  static int tryrdlock (
+    partitioned_rwlock_t       *rwlock,
+    std::size_t                 partition
+  ) noexcept {
+    return (fast_rdlock(rwlock, partition)) ? 0
+      : partitioned_rwlock_tryrdlock(rwlock, partition);
+  } /* tryrdlock() */
+
+  static int wrlock (
+    partitioned_rwlock_t       *rwlock,
+    std::size_t                 partition
+  ) noexcept {
+    return (fast_wrlock(rwlock, partition)) ? 0
+      : partitioned_rwlock_wrlock(rwlock, partition);
+  } /* wrlock() */
+
+  static int trywrlock (
+    partitioned_rwlock_t       *rwlock,
+    std::size_t                 partition
+  ) noexcept {
+    return (fast_wrlock(rwlock, partition)) ? 0
+      : partitioned_rwlock_trywrlock(rwlock, partition);
+  } /* trywrlock() */
+
+  /* Only the last reader out ahead of a parked writer has anyone to wake */
+  static int rdunlock (
+    partitioned_rwlock_t       *rwlock,
+    std::size_t                 partition
+  ) noexcept {
+    std::uint32_t *word = state(rwlock, partition);
+    if (nullptr != word) {
+      std::uint32_t value = __atomic_load_n(word, __ATOMIC_RELAXED);
+      if ((PRWLOCK_STATE_READ_LOCKED != (value & PRWLOCK_STATE_MASK)
+          || 0 == (value & PRWLOCK_STATE_WRITERS_WAITING))
+        && __atomic_compare_exchange_n(word, &value,
+          (value - PRWLOCK_STATE_READ_LOCKED), true, __ATOMIC_RELEASE,
+          __ATOMIC_RELAXED)) {
+        return 0;
+      }
+    }
+    return partitioned_rwlock_rdunlock(rwlock, partition);
+  } /* rdunlock() */
+
+  static int wrunlock (
+    partitioned_rwlock_t       *rwlock,
+    std::size_t                 partition
+  ) noexcept {
+    std::uint32_t *word = state(rwlock, partition);
+    std::uint32_t value = PRWLOCK_STATE_WRITE_LOCKED;
+
+    if (nullptr != word && __atomic_compare_exchange_n(word, &value, 0,
+      false, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+      return 0;
+    }
+    return partitioned_rwlock_wrunlock(rwlock, partition);
+  } /* wrunlock() */
+}; /* inline_backend */
+#else
+/* Only the atomics cell can be taken inline */
+struct inline_backend : library_backend {
+}; /* inline_backend */
+#endif /* USE_ATOMICS */
+
+/* ========================================================================= */
+/* -- HASHING -------------------------------------------------------------- */
+/* ========================================================================= */
+
+/*
+ * std::hash, finalised so that a mask of the low bits is a fair partition
+ * even where std::hash is the identity (as it is for integers).
+ */
+struct default_hash {
+  template <typename Key>
+  std::uint64_t operator() (
+    const Key                  &key
+  ) const noexcept {
+    std::uint64_t hash = static_cast<std::uint64_t>(std::hash<Key>{}(key));
+
+    hash ^= (hash >> 33);
+    hash *= UINT64_C(0xff51afd7ed558ccd);
+    hash ^= (hash >> 33);
+    hash *= UINT64_C(0xc4ceb9fe1a85ec53);
+    hash ^= (hash >> 33);
+    return hash;
+  } /* operator()() */
+}; /* default_hash */
+
+/* ========================================================================= */
+/* -- PARTITIONED SHARED MUTEX --------------------------------------------- */
+/* ========================================================================= */
+
+/*
+ * Acquisitions throw std::system_error where the C call fails, as
+ * std::shared_mutex does; releases do not fail. Construction throws
+ * std::runtime_error if the lock cannot be made with the given attributes,
+ * and std::invalid_argument for PRWLOCK_FLAG_RESIZABLE.
+ */
+template <std::size_t N, typename Backend = inline_backend,
+  typename Hash = default_hash>
+class partitioned_shared_mutex {
+  static_assert(0 < N && 0 == (N & (N - 1)),
+    "partition count must be a power of two");
+
+public:
+  using backend_type = Backend;
+  using hasher = Hash;
+
+  static constexpr std::size_t partition_count = N;
+  static constexpr std::size_t partition_mask = (N - 1);
+
+  /*
+   * One partition as a SharedMutex. A handle names the partition and does
+   * not own it, so it must outlive any std::unique_lock or std::shared_lock
+   * made over it.
+   */
+  class partition_mutex {
+  public:
+    partition_mutex (
+      partitioned_shared_mutex &owner,
+      std::size_t               partition
+    ) noexcept : owner_(&owner), partition_(partition) {
+    } /* partition_mutex() */
+
+    void lock () {
+      owner_->lock(partition_);
+    } /* lock() */
+
+    bool try_lock () noexcept {
+      return owner_->try_lock(partition_);
+    } /* try_lock() */
+
+    void unlock () noexcept {
+      owner_->unlock(partition_);
+    } /* unlock() */
+
+    void lock_shared () {
+      owner_->lock_shared(partition_);
+    } /* lock_shared() */
+
+    bool try_lock_shared () noexcept {
+      return owner_->try_lock_shared(partition_);
+    } /* try_lock_shared() */
+
+    void unlock_shared () noexcept {
+      owner_->unlock_shared(partition_);
+    } /* unlock_shared() */
+
+    std::size_t index () const noexcept {
+      return partition_;
+    } /* index() */
+
+  private:
+    partitioned_shared_mutex   *owner_;
+    std::size_t                 partition_;
+  }; /* partition_mutex */
+
+  partitioned_shared_mutex () : partitioned_shared_mutex(nullptr) {
+  } /* partitioned_shared_mutex() */
+
+  explicit partitioned_shared_mutex (
+    const partitioned_rwlock_attr_t &attr,
+    const Hash                 &hash = Hash()
+  ) : partitioned_shared_mutex(&attr, hash) {
+  } /* partitioned_shared_mutex() */
+
+  ~partitioned_shared_mutex () {
+    (void) partitioned_rwlock_destroy(rwlock_);
+  } /* ~partitioned_shared_mutex() */
+
+  partitioned_shared_mutex (const partitioned_shared_mutex &) = delete;
+  partitioned_shared_mutex &operator= (
+    const partitioned_shared_mutex &) = delete;
+
+  static constexpr std::size_t partition_of_hash (
+    std::uint64_t               hash
+  ) noexcept {
+    return (static_cast<std::size_t>(hash) & partition_mask);
+  } /* partition_of_hash() */
+
+  template <typename Key>
+  std::size_t partition_of (
+    const Key                  &key
+  ) const noexcept {
+    return partition_of_hash(hash_(key));
+  } /* partition_of() */
+
+  partition_mutex partition (
+    std::size_t                 partition
+  ) noexcept {
+    assert(partition < N);
+    return partition_mutex(*this, partition);
+  } /* partition() */
+
+  template <typename Key>
+  partition_mutex partition_for (
+    const Key                  &key
+  ) noexcept {
+    return partition_mutex(*this, partition_of(key));
+  } /* partition_for() */
+
+  void lock (
+    std::size_t                 partition
+  ) {
+    check(Backend::wrlock(rwlock_, partition), "partitioned_rwlock_wrlock");
+  } /* lock() */
+
+  bool try_lock (
+    std::size_t                 partition
+  ) noexcept {
+    return (0 == Backend::trywrlock(rwlock_, partition));
+  } /* try_lock() */
+
+  void unlock (
+    std::size_t                 partition
+  ) noexcept {
+    (void) Backend::wrunlock(rwlock_, partition);
+  } /* unlock() */
+
+  void lock_shared (
+    std::size_t                 partition
+  ) {
+    check(Backend::rdlock(rwlock_, partition), "partitioned_rwlock_rdlock");
+  } /* lock_shared() */
+
+  bool try_lock_shared (
+    std::size_t                 partition
+  ) noexcept {
+    return (0 == Backend::tryrdlock(rwlock_, partition));
+  } /* try_lock_shared() */
+
+  void unlock_shared (
+    std::size_t                 partition
+  ) noexcept {
+    (void) Backend::rdunlock(rwlock_, partition);
+  } /* unlock_shared() */
+
+  /* For the C calls this front-end does not wrap */
+  partitioned_rwlock_t *native_handle () noexcept {
+    return rwlock_;
+  } /* native_handle() */
+
+private:
+  partitioned_shared_mutex (
+    const partitioned_rwlock_attr_t *attr,
+    const Hash                 &hash = Hash()
+  ) : rwlock_(nullptr), hash_(hash) {
+    /* The mask is fixed at compile time, so the count must be too */
+    if (nullptr != attr && (attr->flags & PRWLOCK_FLAG_RESIZABLE)) {
+      throw std::invalid_argument("partitioned_shared_mutex cannot resize");
+    }
+    if (0 != partitioned_rwlock_init_ex(&rwlock_, N, attr)) {
+      throw std::runtime_error("partitioned_rwlock_init_ex failed");
+    }
+  } /* partitioned_shared_mutex() */
+
+  static void check (
+    int                         rc,
+    const char                 *what
+  ) {
+    if (0 != rc) {
+      throw std::system_error(rc, std::generic_category(), what);
+    }
+  } /* check() */
+
+  partitioned_rwlock_t         *rwlock_;
+  Hash                          hash_;
+}; /* partitioned_shared_mutex */
+
+/* ========================================================================= */
+/* -- SCOPED MULTI-PARTITION GUARD ----------------------------------------- */
+/* ========================================================================= */
+
+/*
+ * Holds a set of partitions, each in the mode its request asks for, from
+ * construction to destruction. The set is taken with
+ * partitioned_rwlock_lock_many(), in partition order and with duplicates
+ * merged, so guards over overlapping sets cannot deadlock one another.
+ */
+template <typename Mutex>
+class scoped_partition_lock {
+public:
+  scoped_partition_lock (
+    Mutex                      &mutex,
+    std::initializer_list<partitioned_rwlock_request_t> requests
+  ) : scoped_partition_lock(mutex, requests.begin(), requests.size()) {
+  } /* scoped_partition_lock() */
+
+  scoped_partition_lock (
+    Mutex                      &mutex,
+    const partitioned_rwlock_request_t *requests,
+    std::size_t                 count
+  ) : rwlock_(mutex.native_handle()) {
+    partitions_.reserve(count);
+    for (std::size_t ii = 0; ii < count; ++ii) {
+      partitions_.push_back(requests[ii].partition);
+    }
+
+    int rc = partitioned_rwlock_lock_many(rwlock_, requests, count);
+    if (0 != rc) {
+      throw std::system_error(rc, std::generic_category(),
+        "partitioned_rwlock_lock_many");
+    }
+  } /* scoped_partition_lock() */
+
+  ~scoped_partition_lock () {
+    (void) partitioned_rwlock_unlock_many(rwlock_, partitions_.data(),
+      partitions_.size());
+  } /* ~scoped_partition_lock() */
+
+  scoped_partition_lock (const scoped_partition_lock &) = delete;
+  scoped_partition_lock &operator= (const scoped_partition_lock &) = delete;
+
+private:
+  partitioned_rwlock_t         *rwlock_;
+  std::vector<std::size_t>      partitions_;
+}; /* scoped_partition_lock */
+
+} /* namespace prwlock */
+
+#endif /* PRWLOCK_HPP */
+
+/* :vi set ts=2 et sw=2: */
@@ -0,0 +1,314 @@
+#ifndef PRWLOCK_INLINE_H
+#define PRWLOCK_INLINE_H
+/* ========================================================================= **
+**                                      __           __                      **
+**                       ______      __/ /___  _____/ /__                    **
+**                      / ___/ | /| / / / __ \/ ___/ //_/                    **
+**                     / /   | |/ |/ / / /_/ / /__/ ,<                       **
+**                    /_/    |__/|__/_/\____/\___/_/|_|                      **
+**                                                                           **
+** ========================================================================= **
+**                      PARTITIONED READER-WRITER LOCK                       **
+** ========================================================================= **
+**                                                                           **
+** Copyright (c) 2002-2018 Jonah H. Harris.                                  **
+**                                                                           **
+** This library is free software; you can redistribute it and/or modify it   **
+** under the terms of the GNU Lesser General Public License as published by  **
+** the Free Software Foundation; either version 3 of the License, or (at     **
+** your option) any later version.                                           **
+**                                                                           **
+** This library is distributed in the hope it will be useful, but WITHOUT    **
+** ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or     **
+** FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public       **
+** License for more details.                                                 **
+**                                                                           **
+** You should have received a copy of the GNU Lesser General Public License  **
+** along with this library; if not, write to the Free Software Foundation,   **
+** Inc., 675 Mass Ave, Cambridge, MA 02139, USA.                             **
+** ========================================================================= */
+
+/*
+ * Inline fast paths for the partition calls. With USE_ATOMICS, an
+ * uncontended acquire or release of a plain cell is one compare-and-swap on
+ * the cell's state word, done in the caller; anything else (a contended
+ * cell, a release with waiters to wake, a flag or policy that does more
+ * than touch the cell) falls through to the library call of the same name.
+ * Other backends, and C++ (see prwlock.hpp), always call through. The
+ * calls mix freely with the library ones: a partition taken inline may be
+ * released by the library and the other way round.
+ */
+
+/* ========================================================================= */
+/* -- INCLUSIONS ----------------------------------------------------------- */
+/* ========================================================================= */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <errno.h>
+#include <assert.h>
+
+#include "prwlock.h"
+
+/* ========================================================================= */
+/* -- DEFINITIONS ---------------------------------------------------------- */
+/* ========================================================================= */
+
+#if defined(USE_ATOMICS)
+/*
+ * Atomic cell state word. The low bits count readers, with the all-ones
+ * value reserved for "write-locked"; the top two bits record that readers
+ * or writers are parked and must be woken on release.
+ */
+# define PRWLOCK_STATE_READ_LOCKED      0x00000001u
+# define PRWLOCK_STATE_MASK             0x3fffffffu
+# define PRWLOCK_STATE_WRITE_LOCKED     PRWLOCK_STATE_MASK
+# define PRWLOCK_STATE_MAX_READERS      (PRWLOCK_STATE_MASK - 1)
+# define PRWLOCK_STATE_READERS_WAITING  0x40000000u
+# define PRWLOCK_STATE_WRITERS_WAITING  0x80000000u
+
+/*
+ * Flags under which a partition call does more than acquire or release its
+ * cell, and so never takes the inline path. A new flag that hooks the
+ * partition calls belongs here.
+ */
+# define PRWLOCK_INLINE_SLOW_FLAGS                                            \
+  (PRWLOCK_FLAG_READER_BIAS | PRWLOCK_FLAG_GLOBAL | PRWLOCK_FLAG_STATS        \
+    | PRWLOCK_FLAG_COHORT | PRWLOCK_FLAG_OPTIMISTIC                           \
+    | PRWLOCK_FLAG_UPGRADABLE | PRWLOCK_FLAG_TRACE | PRWLOCK_FLAG_READ_LEASE)
+
+/* C++ has no _Atomic qualifier; prwlock.hpp carries its own fast paths */
+# if !defined(__cplusplus)
+#  define PRWLOCK_INLINE_FAST_PATHS
+# endif /* !__cplusplus */
+#endif /* USE_ATOMICS */
+
+/* ========================================================================= */
+/* -- MACROS --------------------------------------------------------------- */
+/* ========================================================================= */
+
+#if defined(USE_ATOMICS)
+# define PRWLOCK_STATE_IS_UNLOCKED(state)                                     \
+  (0 == ((state) & PRWLOCK_STATE_MASK))
+# define PRWLOCK_STATE_IS_WRITE_LOCKED(state)                                 \
+  (PRWLOCK_STATE_WRITE_LOCKED == ((state) & PRWLOCK_STATE_MASK))
+# define PRWLOCK_STATE_IS_READ_LOCKABLE(state, policy)                        \
+  ((((state) & PRWLOCK_STATE_MASK) < PRWLOCK_STATE_MAX_READERS)               \
+    && ((PRWLOCK_POLICY_READER_PREFERRING == (policy))                        \
+      || (0 == ((state) & (PRWLOCK_STATE_READERS_WAITING                      \
+        | PRWLOCK_STATE_WRITERS_WAITING)))))
+#endif /* USE_ATOMICS */
+
+/* ========================================================================= */
+/* -- PRIVATE TYPES -------------------------------------------------------- */
+/* ========================================================================= */
+
+#if defined(USE_ATOMICS)
+/*
+ * The leading fields of partitioned_rwlock_t, which prwlock.c asserts stay
+ * where this says. Each cell begins with its state word, cell_stride bytes
+ * after the one before.
+ */
+typedef struct {
+  size_t                        partition_count;
+  size_t                        partition_mask;
+  uint64_t                      hash_seed;
+  void                         *cells;
+  size_t                        cell_stride;
+  unsigned int                  flags;
+  partitioned_rwlock_policy_t   policy;
+} __attribute__((may_alias)) partitioned_rwlock_head_t;
+#endif /* USE_ATOMICS */
+
+/* ========================================================================= */
+/* -- PRIVATE METHODS ------------------------------------------------------ */
+/* ========================================================================= */
+
+#if defined(PRWLOCK_INLINE_FAST_PATHS)
+/* The partition's state word, or NULL where the library has to be called */
+static inline _Atomic uint32_t *
+prwlock_inline_state (
+  partitioned_rwlock_t         *rwlock,
+  size_t                        partition
+) {
+  const partitioned_rwlock_head_t *head =
+    (const partitioned_rwlock_head_t *) rwlock;
+
+  assert(NULL != rwlock);
+  assert(partition < head->partition_count);
+
+  if ((head->flags & PRWLOCK_INLINE_SLOW_FLAGS)
+    || PRWLOCK_POLICY_PHASE_FAIR == head->policy) {
+    return NULL;
+  }
+  return (_Atomic uint32_t *) ((char *) head->cells
+    + (partition * head->cell_stride));
+} /* prwlock_inline_state() */
+
+/* ------------------------------------------------------------------------- */
+
+static inline int
+prwlock_inline_rdlock (
+  partitioned_rwlock_t         *rwlock,
+  size_t                        partition
+) {
+  _Atomic uint32_t *word = prwlock_inline_state(rwlock, partition);
+  if (NULL == word) {
+    return 0;
+  }
+
+  uint32_t state = atomic_load_explicit(word, memory_order_relaxed);
+  return PRWLOCK_STATE_IS_READ_LOCKABLE(state,
+      ((const partitioned_rwlock_head_t *) rwlock)->policy)
+    && atomic_compare_exchange_weak_explicit(word, &state,
+      (state + PRWLOCK_STATE_READ_LOCKED), memory_order_acquire,
+      memory_order_relaxed);
+} /* prwlock_inline_rdlock() */
+
+/* ------------------------------------------------------------------------- */
+
+static inline int
+prwlock_inline_wrlock (
+  partitioned_rwlock_t         *rwlock,
+  size_t                        partition
+) {
+  _Atomic uint32_t *word = prwlock_inline_state(rwlock, partition);
+  uint32_t state = 0;
+
+  return (NULL != word)
+    && atomic_compare_exchange_strong_explicit(word, &state,
+      PRWLOCK_STATE_WRITE_LOCKED, memory_order_acquire, memory_order_relaxed);
+} /* prwlock_inline_wrlock() */
+
+/* ------------------------------------------------------------------------- */
+
+/* Only the last reader out ahead of a parked writer has anyone to wake */
+static inline int
+prwlock_inline_rdunlock (
+  partitioned_rwlock_t         *rwlock,
+  size_t                        partition
+) {
+  _Atomic uint32_t *word = prwlock_inline_state(rwlock, partition);
+  if (NULL == word) {
+    return 0;
+  }
+
+  uint32_t state = atomic_load_explicit(word, memory_order_relaxed);
+  return (PRWLOCK_STATE_READ_LOCKED != (state & PRWLOCK_STATE_MASK)
+      || 0 == (state & PRWLOCK_STATE_WRITERS_WAITING))
+    && atomic_compare_exchange_weak_explicit(word, &state,
+      (state - PRWLOCK_STATE_READ_LOCKED), memory_order_release,
+      memory_order_relaxed);
+} /* prwlock_inline_rdunlock() */
+
+/* ------------------------------------------------------------------------- */
+
+static inline int
+prwlock_inline_wrunlock (
+  partitioned_rwlock_t         *rwlock,
+  size_t                        partition
+) {
+  _Atomic uint32_t *word = prwlock_inline_state(rwlock, partition);
+  uint32_t state = PRWLOCK_STATE_WRITE_LOCKED;
+
+  return (NULL != word)
+    && atomic_compare_exchange_strong_explicit(word, &state, 0,
+      memory_order_release, memory_order_relaxed);
+} /* prwlock_inline_wrunlock() */
+#endif /* PRWLOCK_INLINE_FAST_PATHS */
+
+/* ========================================================================= */
+/* -- PUBLIC METHODS ------------------------------------------------------- */
+/* ========================================================================= */
+
+static inline int
+partitioned_rwlock_inline_rdlock (
+  partitioned_rwlock_t         *rwlock,
+  const size_t                  partition
+) {
+#if defined(PRWLOCK_INLINE_FAST_PATHS)
+  if (prwlock_inline_rdlock(rwlock, partition)) {
+    return 0;
+  }
+#endif /* PRWLOCK_INLINE_FAST_PATHS */
+  return partitioned_rwlock_rdlock(rwlock, partition);
+} /* partitioned_rwlock_inline_rdlock() */
+
+/* ------------------------------------------------------------------------- */
+
+static inline int
+partitioned_rwlock_inline_tryrdlock (
+  partitioned_rwlock_t         *rwlock,
+  const size_t                  partition
+) {
+#if defined(PRWLOCK_INLINE_FAST_PATHS)
+  if (prwlock_inline_rdlock(rwlock, partition)) {
+    return 0;
+  }
+#endif /* PRWLOCK_INLINE_FAST_PATHS */
+  return partitioned_rwlock_tryrdlock(rwlock, partition);
+} /* partitioned_rwlock_inline_tryrdlock() */
+
+/* ------------------------------------------------------------------------- */
+
+static inline int
+partitioned_rwlock_inline_wrlock (
+  partitioned_rwlock_t         *rwlock,
+  const size_t                  partition
+) {
+#if defined(PRWLOCK_INLINE_FAST_PATHS)
+  if (prwlock_inline_wrlock(rwlock, partition)) {
+    return 0;
+  }
+#endif /* PRWLOCK_INLINE_FAST_PATHS */
+  return partitioned_rwlock_wrlock(rwlock, partition);
+} /* partitioned_rwlock_inline_wrlock() */
+
+/* ------------------------------------------------------------------------- */
+
+static inline int
+partitioned_rwlock_inline_trywrlock (
+  partitioned_rwlock_t         *rwlock,
+  const size_t                  partition
+) {
+#if defined(PRWLOCK_INLINE_FAST_PATHS)
+  if (prwlock_inline_wrlock(rwlock, partition)) {
+    return 0;
+  }
+#endif /* PRWLOCK_INLINE_FAST_PATHS */
+  return partitioned_rwlock_trywrlock(rwlock, partition);
+} /* partitioned_rwlock_inline_trywrlock() */
+
+/* ------------------------------------------------------------------------- */
+
+static inline int
+partitioned_rwlock_inline_rdunlock (
+  partitioned_rwlock_t         *rwlock,
+  const size_t                  partition
+) {
+#if defined(PRWLOCK_INLINE_FAST_PATHS)
+  if (prwlock_inline_rdunlock(rwlock, partition)) {
+    return 0;
+  }
+#endif /* PRWLOCK_INLINE_FAST_PATHS */
+  return partitioned_rwlock_rdunlock(rwlock, partition);
+} /* partitioned_rwlock_inline_rdunlock() */
+
+/* ------------------------------------------------------------------------- */
+
+static inline int
+partitioned_rwlock_inline_wrunlock (
+  partitioned_rwlock_t         *rwlock,
+  const size_t                  partition
+) {
+#if defined(PRWLOCK_INLINE_FAST_PATHS)
+  if (prwlock_inline_wrunlock(rwlock, partition)) {
+    return 0;
+  }
+#endif /* PRWLOCK_INLINE_FAST_PATHS */
+  return partitioned_rwlock_wrunlock(rwlock, partition);
+} /* partitioned_rwlock_inline_wrunlock() */
+
+#endif /* PRWLOCK_INLINE_H */
+
+/* :vi set ts=2 et sw=2: */
@@ -0,0 +1,531 @@
+/* ========================================================================= **
+**                                      __           __                      **
+**                       ______      __/ /___  _____/ /__                    **
+**                      / ___/ | /| / / / __ \/ ___/ //_/                    **
+**                     / /   | |/ |/ / / /_/ / /__/ ,<                       **
+**                    /_/    |__/|__/_/\____/\___/_/|_|                      **
+**                                                                           **
+** ========================================================================= **
+**                      PARTITIONED READER-WRITER LOCK                       **
+** ========================================================================= **
+**                                                                           **
+** Copyright (c) 2002-2018 Jonah H. Harris.                                  **
+**                                                                           **
+** This library is free software; you can redistribute it and/or modify it   **
+** under the terms of the GNU Lesser General Public License as published by  **
+** the Free Software Foundation; either version 3 of the License, or (at     **
+** your option) any later version.                                           **
+**                                                                           **
+** This library is distributed in the hope it will be useful, but WITHOUT    **
+** ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or     **
+** FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public       **
+** License for more details.                                                 **
+**                                                                           **
+** You should have received a copy of the GNU Lesser General Public License  **
+** along with this library; if not, write to the Free Software Foundation,   **
+** Inc., 675 Mass Ave, Cambridge, MA 02139, USA.                             **
+** ========================================================================= */
+
+/* ========================================================================= */
+/* -- INCLUSIONS ----------------------------------------------------------- */
+/* ========================================================================= */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+
+#include "prwlock.h"
+#include "prwlock_inline.h"
+#include "prwlock_map.h"
+
+/* ========================================================================= */
+/* -- DEFINITIONS ---------------------------------------------------------- */
+/* ========================================================================= */
+
+/* Smallest table a partition allocates on its first insert */
+#define PRWLOCK_MAP_MIN_CAPACITY        8
+
+/* Largest table, so slot indices and counts fit 32 bits */
+#define PRWLOCK_MAP_MAX_CAPACITY        (UINT32_C(1) << 31)
+
+/* Tables grow past this many entries in four slots */
+#define PRWLOCK_MAP_LOAD_QUARTERS       3
+
+/* Lookups up to this many keys are grouped on the stack */
+#define PRWLOCK_MAP_STACK_COUNT         16
+
+/* Key of the slot hash, which is unrelated to the partition hash */
+#define PRWLOCK_MAP_HASH_SECRET         UINT64_C(0x9e3779b97f4a7c15)
+
+/* ========================================================================= */
+/* -- MACROS --------------------------------------------------------------- */
+/* ========================================================================= */
+
+#define PRWLOCK_MAP_TABLE(map, partition)                                     \
+  ((prwlock_map_table_t *) partitioned_rwlock_cell_data((map)->rwlock,      \
+    (partition)))
+
+/* ========================================================================= */
+/* -- PRIVATE TYPES -------------------------------------------------------- */
+/* ========================================================================= */
+
+typedef struct {
+  uint64_t                      key;
+  uint64_t                      value;
+} prwlock_map_slot_t;
+
+/* One partition's table, kept in its cell; 16 bytes */
+typedef struct {
+  prwlock_map_slot_t           *slots;
+  uint32_t                      capacity;       /* 0 until the first put */
+  uint32_t                      count;
+} prwlock_map_table_t;
+
+/* A key of a bulk lookup, by partition */
+typedef struct {
+  size_t                        partition;
+  size_t                        index;
+} prwlock_map_lookup_t;
+
+struct partitioned_map_t {
+  partitioned_rwlock_t         *rwlock;
+  size_t                        partition_count;
+  uint32_t                      initial_capacity;
+};
+
+/* ========================================================================= */
+/* -- PRIVATE METHOD PROTOTYPES -------------------------------------------- */
+/* ========================================================================= */
+
+static uint64_t prwlock_map_hash (uint64_t key);
+static uint32_t prwlock_map_capacity (size_t entries);
+static size_t prwlock_map_partition (const partitioned_map_t *map,
+  uint64_t key);
+static int prwlock_map_find (const prwlock_map_table_t *table, uint64_t key,
+  uint32_t *slot);
+static int prwlock_map_grow (prwlock_map_table_t *table, uint32_t capacity);
+static int prwlock_map_lookup_compare (const void *lhs, const void *rhs);
+static void prwlock_map_lookup_sort (prwlock_map_lookup_t *lookups,
+  size_t count);
+
+/* ========================================================================= */
+/* -- STATIC ASSERTIONS ---------------------------------------------------- */
+/* ========================================================================= */
+
+_Static_assert(16 == sizeof(prwlock_map_table_t),
+  "prwlock_map_table_t should fit the cell's spare bytes");
+
+/* ========================================================================= */
+/* -- PRIVATE METHODS ------------------------------------------------------ */
+/* ========================================================================= */
+
+/* Murmur3's finaliser; the slot is taken from the top half */
+static uint64_t
+prwlock_map_hash (
+  uint64_t                      key
+) {
+  uint64_t hash = (key ^ PRWLOCK_MAP_HASH_SECRET);
+
+  hash ^= (hash >> 33);
+  hash *= UINT64_C(0xff51afd7ed558ccd);
+  hash ^= (hash >> 33);
+  hash *= UINT64_C(0xc4ceb9fe1a85ec53);
+  hash ^= (hash >> 33);
+  return hash;
+} /* prwlock_map_hash() */
+
+/* ------------------------------------------------------------------------- */
+
+/* Smallest power of two holding entries within the load factor */
+static uint32_t
+prwlock_map_capacity (
+  size_t                        entries
+) {
+  uint64_t capacity = PRWLOCK_MAP_MIN_CAPACITY;
+
+  while (capacity < PRWLOCK_MAP_MAX_CAPACITY
+    && (capacity * PRWLOCK_MAP_LOAD_QUARTERS) < ((uint64_t) entries * 4)) {
+    capacity <<= 1;
+  }
+  return (uint32_t) capacity;
+} /* prwlock_map_capacity() */
+
+/* ------------------------------------------------------------------------- */
+
+static size_t
+prwlock_map_partition (
+  const partitioned_map_t      *map,
+  uint64_t                      key
+) {
+  size_t partition;
+
+  partitioned_rwlock_partition_u64(map->rwlock, &key, 1, &partition);
+  return partition;
+} /* prwlock_map_partition() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Finds key's slot, or where it would go, returning whether it is there.
+ * The table must have room: linear probing ends at the first empty slot.
+ */
+static int
+prwlock_map_find (
+  const prwlock_map_table_t    *table,
+  uint64_t                      key,
+  uint32_t                     *slot
+) {
+  uint32_t mask = (table->capacity - 1);
+  uint32_t index = ((uint32_t) (prwlock_map_hash(key) >> 32) & mask);
+
+  while (PARTITIONED_MAP_EMPTY_KEY != table->slots[index].key) {
+    if (key == table->slots[index].key) {
+      *slot = index;
+      return 1;
+    }
+    index = ((index + 1) & mask);
+  }
+  *slot = index;
+  return 0;
+} /* prwlock_map_find() */
+
+/* ------------------------------------------------------------------------- */
+
+static int
+prwlock_map_grow (
+  prwlock_map_table_t          *table,
+  uint32_t                      capacity
+) {
+  prwlock_map_table_t grown;
+
+  grown.slots = malloc((size_t) capacity * sizeof(*grown.slots));
+  if (NULL == grown.slots) {
+    return ENOMEM;
+  }
+  grown.capacity = capacity;
+  grown.count = table->count;
+  for (uint32_t ii = 0; ii < capacity; ++ii) {
+    grown.slots[ii].key = PARTITIONED_MAP_EMPTY_KEY;
+  }
+
+  for (uint32_t ii = 0; ii < table->capacity; ++ii) {
+    if (PARTITIONED_MAP_EMPTY_KEY != table->slots[ii].key) {
+      uint32_t slot;
+
+      (void) prwlock_map_find(&grown, table->slots[ii].key, &slot);
+      grown.slots[slot] = table->slots[ii];
+    }
+  }
+
+  free(table->slots);
+  *table = grown;
+  return 0;
+} /* prwlock_map_grow() */
+
+/* ------------------------------------------------------------------------- */
+
+static int
+prwlock_map_lookup_compare (
+  const void                   *lhs,
+  const void                   *rhs
+) {
+  size_t left = ((const prwlock_map_lookup_t *) lhs)->partition;
+  size_t right = ((const prwlock_map_lookup_t *) rhs)->partition;
+
+  return (left > right) - (left < right);
+} /* prwlock_map_lookup_compare() */
+
+/* ------------------------------------------------------------------------- */
+
+static void
+prwlock_map_lookup_sort (
+  prwlock_map_lookup_t         *lookups,
+  size_t                        count
+) {
+  if (PRWLOCK_MAP_STACK_COUNT < count) {
+    qsort(lookups, count, sizeof(*lookups), prwlock_map_lookup_compare);
+    return;
+  }
+
+  for (size_t ii = 1; ii < count; ++ii) {
+    prwlock_map_lookup_t entry = lookups[ii];
+    size_t jj = ii;
+
+    while (0 < jj && lookups[jj - 1].partition > entry.partition) {
+      lookups[jj] = lookups[jj - 1];
+      --jj;
+    }
+    lookups[jj] = entry;
+  }
+} /* prwlock_map_lookup_sort() */
+
+/* ========================================================================= */
+/* -- PUBLIC METHODS ------------------------------------------------------- */
+/* ========================================================================= */
+
+/*
+ * expected_entries, across the whole map, sizes each partition's first
+ * table (0 to start small). attr is as for partitioned_rwlock_init_ex(),
+ * apart from cell_data, which the map sets; it cannot be resizable.
+ */
+int
+partitioned_map_init (
+  partitioned_map_t           **map,
+  size_t                        partition_count,
+  size_t                        expected_entries,
+  const partitioned_rwlock_attr_t *attr
+) {
+  partitioned_rwlock_attr_t lock_attr;
+  partitioned_map_t *newmap;
+
+  if (NULL != attr) {
+    lock_attr = *attr;
+  } else {
+    partitioned_rwlock_attr_init(&lock_attr);
+  }
+  lock_attr.cell_data = sizeof(prwlock_map_table_t);
+
+  newmap = calloc(1, sizeof(*newmap));
+  if (NULL == newmap) {
+    printf("Failed to allocate new map structure!\n");
+    return -1;
+  }
+  if (0 != partitioned_rwlock_init_ex(&newmap->rwlock, partition_count,
+    &lock_attr)) {
+    free(newmap);
+    return -1;
+  }
+  newmap->partition_count = partition_count;
+  newmap->initial_capacity = prwlock_map_capacity((0 < partition_count)
+    ? ((expected_entries + partition_count - 1) / partition_count) : 0);
+
+  *map = newmap;
+  return 0;
+} /* partitioned_map_init() */
+
+/* ------------------------------------------------------------------------- */
+
+int
+partitioned_map_destroy (
+  partitioned_map_t            *map
+) {
+  for (size_t ii = 0; ii < map->partition_count; ++ii) {
+    free(PRWLOCK_MAP_TABLE(map, ii)->slots);
+  }
+  partitioned_rwlock_destroy(map->rwlock);
+  free(map);
+  return 0;
+} /* partitioned_map_destroy() */
+
+/* ------------------------------------------------------------------------- */
+
+/* For statistics, or for holding partitions across several map calls */
+partitioned_rwlock_t *
+partitioned_map_get_lock (
+  partitioned_map_t            *map
+) {
+  return map->rwlock;
+} /* partitioned_map_get_lock() */
+
+/* ------------------------------------------------------------------------- */
+
+/* Each partition is counted under its read lock, but not all at once */
+size_t
+partitioned_map_size (
+  partitioned_map_t            *map
+) {
+  size_t size = 0;
+
+  assert(NULL != map);
+
+  for (size_t ii = 0; ii < map->partition_count; ++ii) {
+    (void) partitioned_rwlock_inline_rdlock(map->rwlock, ii);
+    size += PRWLOCK_MAP_TABLE(map, ii)->count;
+    (void) partitioned_rwlock_inline_rdunlock(map->rwlock, ii);
+  }
+  return size;
+} /* partitioned_map_size() */
+
+/* ------------------------------------------------------------------------- */
+
+/* Returns ENOENT, leaving value alone, when key is not there */
+int
+partitioned_map_get (
+  partitioned_map_t            *map,
+  uint64_t                      key,
+  uint64_t                     *value
+) {
+  size_t partition = prwlock_map_partition(map, key);
+  const prwlock_map_table_t *table = PRWLOCK_MAP_TABLE(map, partition);
+  uint32_t slot;
+  int rc;
+
+  assert(NULL != value);
+
+  if (0 != (rc = partitioned_rwlock_inline_rdlock(map->rwlock, partition))) {
+    return rc;
+  }
+  rc = ENOENT;
+  if (0 < table->capacity && prwlock_map_find(table, key, &slot)) {
+    *value = table->slots[slot].value;
+    rc = 0;
+  }
+  (void) partitioned_rwlock_inline_rdunlock(map->rwlock, partition);
+  return rc;
+} /* partitioned_map_get() */
+
+/* ------------------------------------------------------------------------- */
+
+/* Inserts or replaces: EINVAL for the empty key, ENOMEM if it can't grow */
+int
+partitioned_map_put (
+  partitioned_map_t            *map,
+  uint64_t                      key,
+  uint64_t                      value
+) {
+  size_t partition = prwlock_map_partition(map, key);
+  prwlock_map_table_t *table = PRWLOCK_MAP_TABLE(map, partition);
+  uint32_t slot;
+  int rc;
+
+  if (PARTITIONED_MAP_EMPTY_KEY == key) {
+    return EINVAL;
+  }
+
+  if (0 != (rc = partitioned_rwlock_inline_wrlock(map->rwlock, partition))) {
+    return rc;
+  }
+  if (0 < table->capacity && prwlock_map_find(table, key, &slot)) {
+    table->slots[slot].value = value;
+  } else {
+    if (((uint64_t) (table->count + 1) * 4)
+      > ((uint64_t) table->capacity * PRWLOCK_MAP_LOAD_QUARTERS)) {
+      if (PRWLOCK_MAP_MAX_CAPACITY == table->capacity) {
+        rc = ENOMEM;
+      } else {
+        rc = prwlock_map_grow(table, (0 == table->capacity)
+          ? map->initial_capacity : (table->capacity << 1));
+      }
+    }
+    if (0 == rc) {
+      (void) prwlock_map_find(table, key, &slot);
+      table->slots[slot].key = key;
+      table->slots[slot].value = value;
+      ++table->count;
+    }
+  }
+  (void) partitioned_rwlock_inline_wrunlock(map->rwlock, partition);
+  return rc;
+} /* partitioned_map_put() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Backward-shift deletion: entries after the hole that probed past it move
+ * up, so lookups never need tombstones.
+ */
+int
+partitioned_map_erase (
+  partitioned_map_t            *map,
+  uint64_t                      key
+) {
+  size_t partition = prwlock_map_partition(map, key);
+  prwlock_map_table_t *table = PRWLOCK_MAP_TABLE(map, partition);
+  uint32_t hole;
+  int rc;
+
+  if (0 != (rc = partitioned_rwlock_inline_wrlock(map->rwlock, partition))) {
+    return rc;
+  }
+  if (0 == table->capacity || !prwlock_map_find(table, key, &hole)) {
+    (void) partitioned_rwlock_inline_wrunlock(map->rwlock, partition);
+    return ENOENT;
+  }
+
+  uint32_t mask = (table->capacity - 1);
+  uint32_t index = ((hole + 1) & mask);
+  while (PARTITIONED_MAP_EMPTY_KEY != table->slots[index].key) {
+    uint32_t home = ((uint32_t) (prwlock_map_hash(table->slots[index].key)
+      >> 32) & mask);
+
+    /* Move it up unless its home lies cyclically in (hole, index] */
+    if (((index - home) & mask) >= ((index - hole) & mask)) {
+      table->slots[hole] = table->slots[index];
+      hole = index;
+    }
+    index = ((index + 1) & mask);
+  }
+  table->slots[hole].key = PARTITIONED_MAP_EMPTY_KEY;
+  --table->count;
+
+  (void) partitioned_rwlock_inline_wrunlock(map->rwlock, partition);
+  return 0;
+} /* partitioned_map_erase() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Looks up count keys, taking each partition's read lock once for all of
+ * its keys, in partition order. found[ii] says whether values[ii] was set.
+ * Returns how many were found. Without memory to group a large batch, the
+ * keys are looked up one by one instead.
+ */
+size_t
+partitioned_map_get_many (
+  partitioned_map_t            *map,
+  const uint64_t               *keys,
+  size_t                        count,
+  uint64_t                     *values,
+  uint8_t                      *found
+) {
+  prwlock_map_lookup_t local[PRWLOCK_MAP_STACK_COUNT];
+  prwlock_map_lookup_t *lookups = local;
+  size_t hits = 0;
+
+  assert(NULL != map);
+  assert(0 == count || (NULL != keys && NULL != values && NULL != found));
+
+  if (PRWLOCK_MAP_STACK_COUNT < count
+    && NULL == (lookups = malloc(count * sizeof(*lookups)))) {
+    for (size_t ii = 0; ii < count; ++ii) {
+      found[ii] = (0 == partitioned_map_get(map, keys[ii], &values[ii]));
+      hits += found[ii];
+    }
+    return hits;
+  }
+
+  for (size_t ii = 0; ii < count; ++ii) {
+    lookups[ii].partition = prwlock_map_partition(map, keys[ii]);
+    lookups[ii].index = ii;
+  }
+  prwlock_map_lookup_sort(lookups, count);
+
+  for (size_t ii = 0; ii < count; ) {
+    size_t partition = lookups[ii].partition;
+    const prwlock_map_table_t *table = PRWLOCK_MAP_TABLE(map, partition);
+
+    (void) partitioned_rwlock_inline_rdlock(map->rwlock, partition);
+    for (; ii < count && partition == lookups[ii].partition; ++ii) {
+      size_t index = lookups[ii].index;
+      uint32_t slot;
+
+      found[index] = (0 < table->capacity
+        && prwlock_map_find(table, keys[index], &slot));
+      if (found[index]) {
+        values[index] = table->slots[slot].value;
+        ++hits;
+      }
+    }
+    (void) partitioned_rwlock_inline_rdunlock(map->rwlock, partition);
+  }
+
+  if (local != lookups) {
+    free(lookups);
+  }
+  return hits;
+} /* partitioned_map_get_many() */
+
+/* :vi set ts=2 et sw=2: */
@@ -0,0 +1,90 @@
+#ifndef PRWLOCK_MAP_H
+#define PRWLOCK_MAP_H
+/* ========================================================================= **
+**                                      __           __                      **
+**                       ______      __/ /___  _____/ /__                    **
+**                      / ___/ | /| / / / __ \/ ___/ //_/                    **
+**                     / /   | |/ |/ / / /_/ / /__/ ,<                       **
+**                    /_/    |__/|__/_/\____/\___/_/|_|                      **
+**                                                                           **
+** ========================================================================= **
+**                      PARTITIONED READER-WRITER LOCK                       **
+** ========================================================================= **
+**                                                                           **
+** Copyright (c) 2002-2018 Jonah H. Harris.                                  **
+**                                                                           **
+** This library is free software; you can redistribute it and/or modify it   **
+** under the terms of the GNU Lesser General Public License as published by  **
+** the Free Software Foundation; either version 3 of the License, or (at     **
+** your option) any later version.                                           **
+**                                                                           **
+** This library is distributed in the hope it will be useful, but WITHOUT    **
+** ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or     **
+** FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public       **
+** License for more details.                                                 **
+**                                                                           **
+** You should have received a copy of the GNU Lesser General Public License  **
+** along with this library; if not, write to the Free Software Foundation,   **
+** Inc., 675 Mass Ave, Cambridge, MA 02139, USA.                             **
+** ========================================================================= */
+
+/*
+ * Reference partitioned hash map over the lock: 64-bit keys to 64-bit
+ * values (a value may as well be a pointer). Each partition has its own
+ * open-addressing table, linear probing with backward-shift erase, whose
+ * header lives in the partition's cell (attr.cell_data) so the lock and the
+ * table it guards share a cache line. A key picks its partition through
+ * partitioned_rwlock_partition_u64(), so a map and a plain lock made with
+ * the same seed and partition count agree on where every key lives.
+ */
+
+/* ========================================================================= */
+/* -- INCLUSIONS ----------------------------------------------------------- */
+/* ========================================================================= */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "prwlock.h"
+
+/* ========================================================================= */
+/* -- DEFINITIONS ---------------------------------------------------------- */
+/* ========================================================================= */
+
+/* Marks empty slots, so it cannot be stored */
+#define PARTITIONED_MAP_EMPTY_KEY       UINT64_MAX
+
+/* ========================================================================= */
+/* -- PRIVATE TYPES -------------------------------------------------------- */
+/* ========================================================================= */
+
+typedef struct partitioned_map_t partitioned_map_t;
+
+/* ========================================================================= */
+/* -- PUBLIC METHODS ------------------------------------------------------- */
+/* ========================================================================= */
+
+#if defined(__cplusplus)
+extern "C" {
+#endif /* __cplusplus */
+
+int partitioned_map_init (partitioned_map_t **map, size_t partition_count,
+  size_t expected_entries, const partitioned_rwlock_attr_t *attr);
+int partitioned_map_destroy (partitioned_map_t *map);
+partitioned_rwlock_t *partitioned_map_get_lock (partitioned_map_t *map);
+size_t partitioned_map_size (partitioned_map_t *map);
+int partitioned_map_get (partitioned_map_t *map, uint64_t key,
+  uint64_t *value);
+int partitioned_map_put (partitioned_map_t *map, uint64_t key,
+  uint64_t value);
+int partitioned_map_erase (partitioned_map_t *map, uint64_t key);
+size_t partitioned_map_get_many (partitioned_map_t *map,
+  const uint64_t *keys, size_t count, uint64_t *values, uint8_t *found);
+
+#if defined(__cplusplus)
+}
+#endif /* __cplusplus */
+
+#endif /* PRWLOCK_MAP_H */
+
+/* :vi set ts=2 et sw=2: */